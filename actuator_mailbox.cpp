@@ -0,0 +1,64 @@
+/**
+ * @file actuator_mailbox.cpp
+ *
+ * @brief Latest actuator command received from the board
+ *
+ */
+
+#include "actuator_mailbox.h"
+
+#include <string.h>
+
+
+// ------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------
+Actuator_Mailbox::Actuator_Mailbox()
+{
+    seq = 0;
+    count = 0;
+    memset(&value, 0, sizeof(value));
+}
+
+// ------------------------------------------------------------------------
+//  FUNCTIONS
+// ------------------------------------------------------------------------
+
+//
+// publish
+//
+void Actuator_Mailbox::publish(const Actuator_Sample &sample)
+{
+    uint32_t s = seq;
+
+    // Odd sequence: update in progress
+    __atomic_store_n(&seq, s + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    count++;
+    value = sample;
+    value.count = count;
+
+    __atomic_store_n(&seq, s + 2, __ATOMIC_RELEASE);
+}
+
+//
+// read
+//
+bool Actuator_Mailbox::read(Actuator_Sample* sample, uint32_t &last_count)
+{
+    uint32_t s1, s2;
+
+    do
+    {
+        s1 = __atomic_load_n(&seq, __ATOMIC_ACQUIRE);
+        *sample = value;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        s2 = __atomic_load_n(&seq, __ATOMIC_RELAXED);
+    } while ((s1 & 1) || s1 != s2);
+
+    bool fresh = (sample->count != last_count);
+    last_count = sample->count;
+
+    return fresh;
+}
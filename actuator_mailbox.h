@@ -0,0 +1,67 @@
+/**
+ * @file actuator_mailbox.h
+ *
+ * @brief Latest actuator command received from the board
+ *
+ * Single writer (inflow task) / any number of readers mailbox. The
+ * value is protected by a sequence counter: the writer never blocks
+ * and the readers retry if they overlap with an update.
+ *
+ */
+
+#ifndef ACTUATOR_MAILBOX_H_
+#define ACTUATOR_MAILBOX_H_
+
+// ------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------
+
+#include <stdint.h>
+
+
+// ------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------
+// Actuator command as received in the HIL_CONTROLS message
+struct Actuator_Sample {
+
+    float roll_ailerons;
+    float pitch_elevator;
+    float yaw_rudder;
+    float throttle;
+
+    uint64_t board_time_usec;   // time_usec of the HIL_CONTROLS (board clock)
+    uint64_t rx_time_ns;        // Host reception time (CLOCK_MONOTONIC)
+
+    uint32_t count;             // Number of the sample (1 = first one)
+};
+
+
+// ---------------------------------------------------------------------
+//   Actuator Mailbox Class
+// ---------------------------------------------------------------------
+class Actuator_Mailbox
+{
+
+    public:
+
+        Actuator_Mailbox();
+
+        // Writer side: store a new sample
+        void publish(const Actuator_Sample &sample);
+
+        // Reader side: copy the latest sample. Returns true if the
+        // sample is newer than the one identified by last_count, which
+        // is updated. Each reader keeps its own last_count.
+        bool read(Actuator_Sample* sample, uint32_t &last_count);
+
+    private:
+
+        uint32_t seq;
+        uint32_t count;
+        Actuator_Sample value;
+
+};
+
+
+#endif // ACTUATOR_MAILBOX_H_
@@ -16,6 +16,8 @@
 
 #include "autopilot_interface.h"
 
+#include <string.h>
+
 #define AUT_INTERFACE_DBG 1 
 
 
@@ -28,7 +30,7 @@
 //   Con/De structors
 // ---------------------------------------------------------------------
 Autopilot_Interface::Autopilot_Interface(char *&uart_name_, int &baudrate):
-   uart_port(uart_name_,baudrate) 
+   port(uart_name_,baudrate) 
 {
 
     // Initialize attributes (State of the Vehicle)
@@ -53,14 +55,20 @@ Autopilot_Interface::Autopilot_Interface(char *&uart_name_, int &baudrate):
 
     // Initialization of mutexes
     
-    pthread_mutex_init(&mut_sendMessage,0);
-    pthread_cond_init(&cond_empty,0);
-
-    pthread_mutex_init(&mut_Messages,0);
-    pthread_mutex_init(&mut_queueIndex,0);
+    rt_mutex_init(&mut_sendMessage);
+    // The TX engine waits on the budget window with CLOCK_MONOTONIC
+    pthread_condattr_t cattr;
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&cond_empty, &cattr);
+    pthread_condattr_destroy(&cattr);
+    pthread_cond_init(&cond_idle, 0);
+
+    rt_mutex_init(&mut_Messages);
+    rt_mutex_init(&mut_queueIndex);
     
     // Conditional Mutex
-    pthread_mutex_init(&mut_heartbeat,0);
+    rt_mutex_init(&mut_heartbeat);
     pthread_cond_init(&cond_heartbeat,0);
 
     f_aut_THilCtr = fopen("./T_aut_HilCtr.txt","w");
@@ -69,13 +77,58 @@ Autopilot_Interface::Autopilot_Interface(char *&uart_name_, int &baudrate):
     // Initialize the serial port giving device name and 
     // baudrate.
     // Initialize the structure for the poll() 
-    fdsR[0].fd = uart_port.fd;
+    fdsR[0].fd = port.fd;
     fdsR[0].events = POLLIN;
 
-    fdsW[0].fd = uart_port.fd;
-    fdsW[0].fd = POLLOUT;
+    fdsW[0].fd = port.fd;
+    fdsW[0].events = POLLOUT;
 
     read_heartbeat_old = 0;
+    last_read_ns = 0;
+    rx_stage_len = 0;
+
+    raw_sink = NULL;
+
+    metrics_link = -1;
+    metrics_rx_queue = -1;
+    for (int i = 0; i < TX_NUM_CLASSES; i++)
+        metrics_tx_queue[i] = -1;
+    raw_sink_arg = NULL;
+    raw_forwarded = 0;
+
+    // TX engine: bytes that the serial line can carry in a window (8N1).
+    // UDP/TCP links are not paced.
+    tx_stop = false;
+    tx_writing = false;
+    if (port.baudrate > 0)
+        tx_window_bytes = (uint32_t)((uint64_t)port.baudrate / 10 * TX_WINDOW_US / 1000000);
+    else
+        tx_window_bytes = TX_UNLIMITED_BYTES;
+    tx_budget = tx_window_bytes;
+    tx_window_start = 0;
+    tx_errors = 0;
+    tx_budget_waits = 0;
+    tx_flushes = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        tx_direct[i].len = 0;
+        tx_direct[i].nframes = 0;
+    }
+    tx_direct_fill = 0;
+    tx_direct_ready = 1;
+    tx_direct_busy = 2;
+    tx_direct_pending = false;
+    for (int i = 0; i < TX_NUM_CLASSES; i++)
+    {
+        tx_frames[i] = 0;
+        tx_bytes[i] = 0;
+        tx_drops[i] = 0;
+    }
+    loop_latency = NULL;
+    recorder = NULL;
+    link_usage.set_baudrate(port.baudrate);
+    mav_link_init(&mav_link, port.kind_name(), MAV_VERSION_AUTO);
+    link_quality.init("autopilot", &parser);
 
 }
 
@@ -100,12 +153,11 @@ int Autopilot_Interface::fetch_data()
     int i = 0;
 
     // Allocate Space for the Reading Buffer
-    uint8_t NBytes = 128;
-    char rbuff[NBytes];
+    // A datagram must be read whole
+    unsigned NBytes = (port.kind == LINK_KIND_UDP) ? LINK_READ_BYTES : 128;
     
-    // Allocate Mavlink message variables
-    mavlink_status_t status;
-    mavlink_message_t recMessage;
+    // Message parsed by the parser of the link
+    mavlink_message_t &recMessage = parser.msg;
 
     // Flag for the Message reception
     int msgReceived = 0; 
@@ -120,8 +172,10 @@ int Autopilot_Interface::fetch_data()
     // Until I don't receive a message...
     while (!msgReceived)
     {
-        // Lock the device and try to read at most NBytes 
-        int nread = uart_port.readBytes(rbuff, NBytes); 
+        // Lock the device and try to read at most NBytes after the
+        // tail of the previous read
+        uint8_t* rbuff = rx_stage + rx_stage_len;
+        int nread = port.readBytes((char*)rbuff, NBytes); 
 
         //printf("Autopilot_Interface::fetch_message() [Inside the while_loop()] 
 		//		line %d \n read %d bytes from serial\n", __LINE__, nread);
@@ -139,29 +193,71 @@ int Autopilot_Interface::fetch_data()
             return 0;
         }
 
+        // Reception time of the data
+        last_read_ns = time_monotonic_ns();
+        link_usage.add_bytes(LINK_DIR_RX, nread, last_read_ns);
+
         // Seek for mavlink messages in the received data stream
         for (i = 0; i < nread; i++)
         {
             // Parse 1 byte at time
-            if (mavlink_parse_char(MAVLINK_COMM_1, rbuff[i], &recMessage, &status))
+            if (parser.parse(rbuff[i]))
             {
+                // The frame ends with this byte
+                uint16_t len = mav_frame_len(&recMessage);
+                const uint8_t* frame = rbuff + i + 1 - len;
+
+                link_quality.add_frame(&recMessage);
+                if (recorder != NULL)
+                    recorder->record(FREC_LINK_AUTOPILOT, FREC_DIR_RX, frame, len, last_read_ns);
+
                 pthread_mutex_lock(&mut_Messages);
 
+                mav_link_rx(&mav_link, &recMessage, last_read_ns);
+                link_usage.add_frame(LINK_DIR_RX, recMessage.msgid,
+                        len, mav_v1_frame_len(&recMessage));
+                metrics_frame(metrics_link, METRICS_DIR_RX, recMessage.msgid, len);
+
                 // Handle the message and save in the Stock Structure 
                 message_Id = handle_message(&recMessage);
+
+                // Frames not inspected by the router leave as they are,
+                // the others are queued for the inflow task
+                if (raw_sink != NULL && raw_sink(raw_sink_arg, &recMessage, frame, len))
+                {
+                    raw_forwarded++;
+                }
+                else
+                {
+                    current_messages.messages.push(recMessage);
+                    NMessages++;
+                    metrics_gauge(metrics_rx_queue, current_messages.messages.size());
+                }
                 // Take trace of the received messages
                 // queueIndexFetched.push(message_Id);
 
                 pthread_mutex_unlock(&mut_Messages);
                 
-                NMessages++;
                 // Set the flag to 1 to signal that a full message has been retrieved 
                 msgReceived = 1;
             }
+            else if (parser.bad_frame)
+            {
+                link_quality.add_bad_crc(&recMessage);
+            }
         }
+
+        // Keep the bytes of the frame in progress, if any
+        unsigned total = rx_stage_len + nread;
+        unsigned keep = 0;
+        if (parser.in_progress())
+            keep = (total < MAVLINK_MAX_PACKET_LEN) ? total : MAVLINK_MAX_PACKET_LEN;
+        if (keep > 0 && keep < total)
+            memmove(rx_stage, rx_stage + total - keep, keep);
+        rx_stage_len = keep;
     }
 
-    /* Return the number of read messages */
+    /* Return the number of queued messages */
     return NMessages;
 }
 
@@ -169,33 +265,33 @@ int Autopilot_Interface::fetch_data()
 //
 //  handle_message 
 //
-// In the Autopilot interface the handling consists in stocking the data into 
-// queues for a future retrieval. 
+// In the Autopilot interface the handling consists in recording the 
+// reception time and the state of the vehicle. fetch_data() then queues 
+// the message for a future retrieval, or forwards it raw. 
 //
 int Autopilot_Interface::handle_message(mavlink_message_t* message)
 {
     int message_id = message->msgid;
-    // Push the message in the queue
-    current_messages.messages.push(*message);
     // Record the time
-    current_messages.time_stamps[message_id] = ptask_gettime(MICRO);
+    if (message_id < MAV_TRACKED_MSGIDS)
+    {
+        current_messages.time_stamps[message_id] = ptask_gettime(MICRO);
+        current_messages.rx_time_ns[message_id] = last_read_ns;
+    }
     
     // Handle Message ID
     switch (message_id)
     {
         case MAVLINK_MSG_ID_HEARTBEAT:
             {
-                mavlink_heartbeat_t heartbeat;
-                mavlink_msg_heartbeat_decode(message, &heartbeat);
                 // Look the mutex for accessing the vehicle state information.
                 // This information could be shared by other threads.
                 // Wakeup eventually blocked thread waiting for new state information
                 pthread_mutex_lock(&mut_heartbeat);
-                base_mode = heartbeat.base_mode;
-                custom_mode = heartbeat.custom_mode;
-                mav_type = heartbeat.type;
-                system_status = heartbeat.system_status;
-                custom_mode = heartbeat.custom_mode;
+                base_mode = MAV_GET(message, HEARTBEAT, base_mode);
+                custom_mode = MAV_GET(message, HEARTBEAT, custom_mode);
+                mav_type = MAV_GET(message, HEARTBEAT, type);
+                system_status = MAV_GET(message, HEARTBEAT, system_status);
 
                 //printf("base_mode = %u\n",base_mode);
                 pthread_cond_signal(&cond_heartbeat);
@@ -208,9 +304,6 @@ int Autopilot_Interface::handle_message(mavlink_message_t* message)
                 fprintf(f_aut_THilCtr,"%lu \n",current_messages.time_stamps[message_id]);
                 //printf("MAVLINK_MSG_ID_HIL_CONTROLS\n");
 
-                mavlink_hil_controls_t hil_controls;
-                mavlink_msg_hil_controls_decode(message, &hil_controls);
-
                 hil_controls_count++;
                 if ( AUT_INTERFACE_DBG ) 
                 {
@@ -221,10 +314,10 @@ int Autopilot_Interface::handle_message(mavlink_message_t* message)
                         printf("HIL_CONTROLS frequency :   %lu Hz\n",hil_controls_count/10);
                         hil_controls_count = 0;
                         read_hil_controls_old = curr;
-                        printf("%1.2f | ",hil_controls.roll_ailerons); 
-                        printf("%1.2f | ",hil_controls.pitch_elevator);
-                        printf("%1.2f | ",hil_controls.yaw_rudder);
-                        printf("%1.2f | \n",hil_controls.throttle);
+                        printf("%1.2f | ",MAV_GET(message, HIL_CONTROLS, roll_ailerons)); 
+                        printf("%1.2f | ",MAV_GET(message, HIL_CONTROLS, pitch_elevator));
+                        printf("%1.2f | ",MAV_GET(message, HIL_CONTROLS, yaw_rudder));
+                        printf("%1.2f | \n",MAV_GET(message, HIL_CONTROLS, throttle));
                     }
                 } 
             }
@@ -247,32 +340,504 @@ int Autopilot_Interface::get_message(mavlink_message_t* rqmsg)
     // Extract the message from the front of the queue
     mavlink_message_t message = current_messages.messages.front();
     current_messages.messages.pop();
+    metrics_gauge(metrics_rx_queue, current_messages.messages.size());
     
     *rqmsg = message;
     return message.msgid;
 }
 
 
+//
+// metrics_register
+//
+// The depth of a queue is sampled when messages are queued and when
+// they are taken from it
+//
+void Autopilot_Interface::metrics_register(const char* name)
+{
+    static const char* cls_name[TX_NUM_CLASSES] = { "sensor", "command", "bulk" };
+    char gauge[METRICS_NAME_LEN];
+
+    metrics_link = metrics_register_link(name);
+    snprintf(gauge, sizeof(gauge), "%s_rx_queue", name);
+    metrics_rx_queue = metrics_register_gauge(gauge);
+    for (int i = 0; i < TX_NUM_CLASSES; i++)
+    {
+        snprintf(gauge, sizeof(gauge), "%s_tx_%s", name, cls_name[i]);
+        metrics_tx_queue[i] = metrics_register_gauge(gauge);
+    }
+}
+
+
+//
+// tx_class
+//
+// Priority class of a message sent to the board. The requests and
+// answers of the GS protocols (parameters, mission, logs, FTP) go with
+// the commands: a GS waits for each of them, shedding one stalls the
+// transfer until its timeout. Only streaming traffic is left to the bulk
+// class
+//
+int Autopilot_Interface::tx_class(uint32_t msgid)
+{
+    switch (msgid)
+    {
+        case MAVLINK_MSG_ID_HIL_SENSOR:
+        case MAVLINK_MSG_ID_HIL_GPS:
+        case MAVLINK_MSG_ID_HIL_STATE_QUATERNION:
+        case MAVLINK_MSG_ID_HIL_OPTICAL_FLOW:
+            return TX_CLASS_SENSOR;
+
+        case MAVLINK_MSG_ID_HEARTBEAT:
+        case MAVLINK_MSG_ID_SET_MODE:
+        case MAVLINK_MSG_ID_COMMAND_LONG:
+        case MAVLINK_MSG_ID_COMMAND_INT:
+        case MAVLINK_MSG_ID_MANUAL_CONTROL:
+        case MAVLINK_MSG_ID_RC_CHANNELS_OVERRIDE:
+        case MAVLINK_MSG_ID_SET_POSITION_TARGET_LOCAL_NED:
+        case MAVLINK_MSG_ID_SET_ATTITUDE_TARGET:
+        case MAVLINK_MSG_ID_COMMAND_ACK:
+        case MAVLINK_MSG_ID_REQUEST_DATA_STREAM:
+        case MAVLINK_MSG_ID_PARAM_REQUEST_LIST:
+        case MAVLINK_MSG_ID_PARAM_REQUEST_READ:
+        case MAVLINK_MSG_ID_PARAM_SET:
+        case MAVLINK_MSG_ID_MISSION_REQUEST_LIST:
+        case MAVLINK_MSG_ID_MISSION_REQUEST_PARTIAL_LIST:
+        case MAVLINK_MSG_ID_MISSION_WRITE_PARTIAL_LIST:
+        case MAVLINK_MSG_ID_MISSION_REQUEST:
+        case MAVLINK_MSG_ID_MISSION_REQUEST_INT:
+        case MAVLINK_MSG_ID_MISSION_CLEAR_ALL:
+        case MAVLINK_MSG_ID_MISSION_ITEM:
+        case MAVLINK_MSG_ID_MISSION_ITEM_INT:
+        case MAVLINK_MSG_ID_MISSION_COUNT:
+        case MAVLINK_MSG_ID_MISSION_ACK:
+        case MAVLINK_MSG_ID_MISSION_SET_CURRENT:
+        case MAVLINK_MSG_ID_LOG_REQUEST_LIST:
+        case MAVLINK_MSG_ID_LOG_REQUEST_DATA:
+        case MAVLINK_MSG_ID_LOG_REQUEST_END:
+        case MAVLINK_MSG_ID_LOG_ERASE:
+        case MAVLINK_MSG_ID_FILE_TRANSFER_PROTOCOL:
+            return TX_CLASS_COMMAND;
+
+        default:
+            return TX_CLASS_BULK;
+    }
+}
+
+std::queue<mavlink_message_t>* Autopilot_Interface::tx_queue(int cls)
+{
+    switch (cls)
+    {
+        case TX_CLASS_SENSOR:
+            return &HPsendQueue;
+        case TX_CLASS_COMMAND:
+            return &CMDsendQueue;
+        default:
+            return &LPsendQueue;
+    }
+}
+
+//
+// tx_push
+//
+// Queue the message in its priority class (mut_sendMessage held).
+// Returns the length of the frame or -1 if the message was dropped.
+//
+int Autopilot_Interface::tx_push(mavlink_message_t* message)
+{
+    int cls = tx_class(message->msgid);
+
+    // Backpressure: the line is close to saturation, shed the bulk
+    // traffic (sensor data and commands always pass)
+    if (cls == TX_CLASS_BULK)
+    {
+        int level = link_usage.level(LINK_DIR_TX, time_monotonic_ns());
+        if (level == LINK_BP_DROP ||
+                (level == LINK_BP_DECIMATE && !link_usage.decimate(message->msgid)))
+        {
+            tx_drops[cls]++;
+            link_usage.add_drop(LINK_DIR_TX, message->msgid);
+            return -1;
+        }
+    }
+
+    std::queue<mavlink_message_t>* q = tx_queue(cls);
+    if (q->size() >= TX_QUEUE_LIMIT)
+    {
+        tx_drops[cls]++;
+        link_usage.add_drop(LINK_DIR_TX, message->msgid);
+        if (cls != TX_CLASS_SENSOR)
+            return -1;
+
+        // Old sensor data is useless: make room for the new sample
+        q->pop();
+    }
+    q->push(*message);
+    metrics_gauge(metrics_tx_queue[cls], q->size());
+
+    return mav_frame_len(message);
+}
+
 //
 // send_message
 //
+// Queue the message and wake up the TX engine.
+// Returns the length of the frame or -1 if the message was dropped.
+//
 int Autopilot_Interface::send_message(mavlink_message_t* message)
 {
-    uint16_t len = 0;   
-    
-    char buf[300];
-    len = mavlink_msg_to_send_buffer((uint8_t *)buf, message);
+    pthread_mutex_lock(&mut_sendMessage);
+    int len = tx_push(message);
+    pthread_cond_signal(&cond_empty);
+    pthread_mutex_unlock(&mut_sendMessage);
 
-    // Write buffer to serial port, locks port while writing
-    int writtenB = uart_port.write_bytes(buf,len);
-    
-    if (len != writtenB)
+    return len;
+}
+
+//
+// send_messages
+//
+// Queue a group of messages at once: the TX engine is woken up a single
+// time and writes them with the same flush.
+// Returns the bytes queued or -1 if any message was dropped.
+//
+int Autopilot_Interface::send_messages(mavlink_message_t* msgs, int n)
+{
+    int total = 0;
+
+    pthread_mutex_lock(&mut_sendMessage);
+    for (int i = 0; i < n; i++)
     {
-        printf("Autopilot_Interface::write_message: ERROR WHILE WRITING"); 
-        return -1;
+        int len = tx_push(&msgs[i]);
+        if (len < 0)
+            total = -1;
+        else if (total >= 0)
+            total += len;
     }
-    // Done!
-    return writtenB;
+    pthread_cond_signal(&cond_empty);
+    pthread_mutex_unlock(&mut_sendMessage);
+
+    return total;
+}
+
+//
+// tx_direct_begin
+//
+// The buffer being filled belongs to the producer: no lock needed
+//
+Tx_Direct* Autopilot_Interface::tx_direct_begin()
+{
+    Tx_Direct* d = &tx_direct[tx_direct_fill];
+    d->len = 0;
+    d->nframes = 0;
+    return d;
+}
+
+//
+// tx_direct_add
+//
+void Autopilot_Interface::tx_direct_add(Tx_Direct* d, uint32_t msgid, uint16_t len,
+        uint16_t v1_len, uint64_t sensor_time_usec)
+{
+    int i = d->nframes++;
+    d->frame_len[i] = len;
+    d->msgid[i] = msgid;
+    d->v1_len[i] = v1_len;
+    d->sensor[i] = sensor_time_usec;
+    d->len += len;
+}
+
+//
+// tx_direct_commit
+//
+// Hand the frames to the TX engine, ahead of the queued messages. Frames
+// committed before and not yet taken are old sensor data: they are
+// replaced. Returns the bytes committed or -1 if frames were replaced.
+//
+int Autopilot_Interface::tx_direct_commit()
+{
+    int ret;
+
+    pthread_mutex_lock(&mut_sendMessage);
+    ret = tx_direct[tx_direct_fill].len;
+    if (tx_direct_pending)
+    {
+        Tx_Direct* old = &tx_direct[tx_direct_ready];
+        for (int i = 0; i < old->nframes; i++)
+        {
+            tx_drops[TX_CLASS_SENSOR]++;
+            link_usage.add_drop(LINK_DIR_TX, old->msgid[i]);
+        }
+        ret = -1;
+    }
+
+    int tmp = tx_direct_ready;
+    tx_direct_ready = tx_direct_fill;
+    tx_direct_fill = tmp;
+    tx_direct_pending = true;
+
+    pthread_cond_signal(&cond_empty);
+    pthread_mutex_unlock(&mut_sendMessage);
+
+    return ret;
+}
+
+//
+// tx_engine
+//
+// Single writer of the serial port. The queued messages are taken in
+// strict priority order (sensor, command, bulk) within a byte budget
+// per window derived from the baudrate: data never piles up in the
+// kernel and USB buffers, where it would delay the next sensor frame.
+//
+// All the frames that fit in the budget are encoded straight into
+// tx_buf and written with a single write(), so a period costs one
+// syscall and one USB transfer instead of one per message. The sensor
+// frames encoded in place by the simulator go first, gathered with
+// tx_buf by the same write.
+//
+void Autopilot_Interface::tx_engine()
+{
+    const uint64_t window_ns = (uint64_t)TX_WINDOW_US * 1000;
+
+    pthread_mutex_lock(&mut_sendMessage);
+    while (!tx_stop)
+    {
+        if (!tx_direct_pending && HPsendQueue.empty() && CMDsendQueue.empty() &&
+                LPsendQueue.empty())
+        {
+            pthread_cond_broadcast(&cond_idle);
+            pthread_cond_wait(&cond_empty, &mut_sendMessage);
+            continue;
+        }
+
+        // Refill the budget at each new window
+        uint64_t now = time_monotonic_ns();
+        if (now - tx_window_start >= window_ns)
+        {
+            tx_window_start = now;
+            tx_budget = tx_window_bytes;
+        }
+
+        // Frames encoded in place first: they are sensor data
+        Tx_Direct* direct = NULL;
+        if (tx_direct_pending)
+        {
+            uint32_t len = tx_direct[tx_direct_ready].len;
+            if (len <= tx_budget || tx_budget >= tx_window_bytes)
+            {
+                int tmp = tx_direct_busy;
+                tx_direct_busy = tx_direct_ready;
+                tx_direct_ready = tmp;
+                tx_direct_pending = false;
+                direct = &tx_direct[tx_direct_busy];
+                tx_budget = (len < tx_budget) ? tx_budget - len : 0;
+            }
+        }
+
+        // Gather the frames, highest priority class first (nothing
+        // passes the direct frames waiting for the budget)
+        uint32_t used = 0;
+        int nframes = 0;
+        unsigned drained = 0;
+        int cls = tx_direct_pending ? TX_NUM_CLASSES : 0;
+        while (cls < TX_NUM_CLASSES && nframes < TX_BATCH_FRAMES)
+        {
+            std::queue<mavlink_message_t>* q = tx_queue(cls);
+            if (q->empty())
+            {
+                cls++;
+                continue;
+            }
+
+            // In the MAVLink version spoken by the board
+            const mavlink_message_t &msg = *mav_link_tx(&mav_link, &q->front(), &tx_conv);
+            uint32_t len = mav_frame_len(&msg);
+
+            // Out of budget (a frame larger than the whole window is
+            // written alone) or out of buffer
+            if (len > tx_budget && (nframes > 0 || tx_budget < tx_window_bytes))
+                break;
+            if (used + len > TX_BATCH_BYTES)
+                break;
+
+            mavlink_msg_to_send_buffer(tx_buf + used, &msg);
+            tx_batch_len[nframes] = len;
+            tx_batch_msgid[nframes] = msg.msgid;
+            tx_batch_v1_len[nframes] = mav_v1_frame_len(&msg);
+            tx_batch_class[nframes] = cls;
+            tx_batch_sensor[nframes] = (msg.msgid == MAVLINK_MSG_ID_HIL_SENSOR) ?
+                    MAV_GET(&msg, HIL_SENSOR, time_usec) : 0;
+            nframes++;
+            used += len;
+            tx_budget = (len < tx_budget) ? tx_budget - len : 0;
+            q->pop();
+            drained |= 1 << cls;
+        }
+
+        // Depth of the queues taken from, once per batch
+        for (int c = 0; c < TX_NUM_CLASSES; c++)
+            if (drained & (1 << c))
+                metrics_gauge(metrics_tx_queue[c], tx_queue(c)->size());
+
+        // Budget exhausted: wait for the next window
+        if (nframes == 0 && direct == NULL)
+        {
+            struct timespec deadline;
+            uint64_t next = tx_window_start + window_ns;
+            deadline.tv_sec = next / 1000000000ULL;
+            deadline.tv_nsec = next % 1000000000ULL;
+            tx_budget_waits++;
+            pthread_cond_timedwait(&cond_empty, &mut_sendMessage, &deadline);
+            continue;
+        }
+        tx_writing = true;
+        pthread_mutex_unlock(&mut_sendMessage);
+
+        // Write outside the lock: producers are never blocked by the port
+        struct iovec iov[2];
+        int iovcnt = 0;
+        uint32_t total = used;
+        if (direct != NULL)
+        {
+            iov[iovcnt].iov_base = direct->buf;
+            iov[iovcnt].iov_len = direct->len;
+            iovcnt++;
+            total += direct->len;
+        }
+        if (used > 0)
+        {
+            iov[iovcnt].iov_base = tx_buf;
+            iov[iovcnt].iov_len = used;
+            iovcnt++;
+        }
+
+        uint64_t tx_start = time_monotonic_ns();
+        int writtenB = port.write_iov(iov, iovcnt);
+        uint64_t tx_end = time_monotonic_ns();
+
+        if (loop_latency != NULL)
+        {
+            if (direct != NULL)
+            {
+                for (int i = 0; i < direct->nframes; i++)
+                {
+                    if (direct->sensor[i] != 0)
+                        loop_latency->sensor_sent(direct->sensor[i], tx_start, tx_end,
+                                direct->frame_len[i]);
+                }
+            }
+            for (int i = 0; i < nframes; i++)
+            {
+                if (tx_batch_sensor[i] != 0)
+                    loop_latency->sensor_sent(tx_batch_sensor[i], tx_start, tx_end,
+                            tx_batch_len[i]);
+            }
+        }
+
+        // Frames written, in the order of the write
+        if (recorder != NULL && writtenB == (int)total)
+        {
+            const uint8_t* frame;
+            if (direct != NULL)
+            {
+                frame = direct->buf;
+                for (int i = 0; i < direct->nframes; i++)
+                {
+                    recorder->record(FREC_LINK_AUTOPILOT, FREC_DIR_TX, frame,
+                            direct->frame_len[i], tx_start);
+                    frame += direct->frame_len[i];
+                }
+            }
+            frame = tx_buf;
+            for (int i = 0; i < nframes; i++)
+            {
+                recorder->record(FREC_LINK_AUTOPILOT, FREC_DIR_TX, frame, tx_batch_len[i],
+                        tx_start);
+                frame += tx_batch_len[i];
+            }
+        }
+
+        pthread_mutex_lock(&mut_sendMessage);
+        tx_writing = false;
+        tx_flushes++;
+        link_usage.add_bytes(LINK_DIR_TX, (writtenB > 0) ? writtenB : 0, tx_end);
+        if (writtenB != (int)total)
+        {
+            tx_errors++;
+            printf("Autopilot_Interface::tx_engine : ERROR WHILE WRITING\n");
+        }
+        else
+        {
+            if (direct != NULL)
+            {
+                for (int i = 0; i < direct->nframes; i++)
+                {
+                    tx_frames[TX_CLASS_SENSOR]++;
+                    tx_bytes[TX_CLASS_SENSOR] += direct->frame_len[i];
+                    link_usage.add_frame(LINK_DIR_TX, direct->msgid[i], direct->frame_len[i],
+                            direct->v1_len[i]);
+                    metrics_frame(metrics_link, METRICS_DIR_TX, direct->msgid[i],
+                            direct->frame_len[i]);
+                }
+            }
+            for (int i = 0; i < nframes; i++)
+            {
+                tx_frames[tx_batch_class[i]]++;
+                tx_bytes[tx_batch_class[i]] += tx_batch_len[i];
+                link_usage.add_frame(LINK_DIR_TX, tx_batch_msgid[i], tx_batch_len[i],
+                        tx_batch_v1_len[i]);
+                metrics_frame(metrics_link, METRICS_DIR_TX, tx_batch_msgid[i], tx_batch_len[i]);
+            }
+        }
+    }
+    pthread_mutex_unlock(&mut_sendMessage);
+}
+
+//
+// tx_engine_stop
+//
+void Autopilot_Interface::tx_engine_stop()
+{
+    pthread_mutex_lock(&mut_sendMessage);
+    tx_stop = true;
+    pthread_cond_signal(&cond_empty);
+    pthread_cond_broadcast(&cond_idle);
+    pthread_mutex_unlock(&mut_sendMessage);
+}
+
+//
+// tx_wait_idle
+//
+void Autopilot_Interface::tx_wait_idle()
+{
+    pthread_mutex_lock(&mut_sendMessage);
+    while (!tx_stop && (tx_writing || tx_direct_pending || !HPsendQueue.empty() ||
+                !CMDsendQueue.empty() || !LPsendQueue.empty()))
+        pthread_cond_wait(&cond_idle, &mut_sendMessage);
+    pthread_mutex_unlock(&mut_sendMessage);
+}
+
+//
+// tx_report
+//
+void Autopilot_Interface::tx_report(FILE* f)
+{
+    const char* names[TX_NUM_CLASSES] = {"sensor", "command", "bulk"};
+
+    uint64_t frames = 0;
+    for (int i = 0; i < TX_NUM_CLASSES; i++)
+        frames += tx_frames[i];
+
+    fprintf(f, "Serial TX (budget %u bytes / %d us, waits %lu, errors %lu)\n",
+            tx_window_bytes, TX_WINDOW_US, (unsigned long)tx_budget_waits,
+            (unsigned long)tx_errors);
+    fprintf(f, "  writes %lu, %.2f frames per write\n", (unsigned long)tx_flushes,
+            tx_flushes ? (double)frames / tx_flushes : 0.0);
+    for (int i = 0; i < TX_NUM_CLASSES; i++)
+        fprintf(f, "  %-8s frames %10lu bytes %12lu drops %8lu\n", names[i],
+                (unsigned long)tx_frames[i], (unsigned long)tx_bytes[i],
+                (unsigned long)tx_drops[i]);
 }
 
 
@@ -323,10 +888,7 @@ void Autopilot_Interface::write_hilsensors()
     //   WRITE
     // -------------------------------------------------------------------
 
-    char buf[300]; 
-    uint16_t len = mavlink_msg_to_send_buffer((uint8_t*)buf, &msg);
-
-    int writtenB = uart_port.write_bytes(buf,len);
+    int writtenB = send_message(&msg);
 
     // check the write
     if ( writtenB < 0 )
@@ -365,7 +927,7 @@ write_raw()
         send_buff[i] = i+1;
     }
 
-    int len = uart_port.write_bytes(send_buff,sizeof(send_buff));
+    int len = port.write_bytes(send_buff,sizeof(send_buff));
     printf("Written  %d bytes \n",len);
     printf("%d %d %d %d %d \n", send_buff[0], send_buff[1], send_buff[2], send_buff[3], send_buff[4]);
     return ;
@@ -377,7 +939,6 @@ write_raw()
 // -----------------------------------------------------------------------
 void Autopilot_Interface::start_hil()
 {
-    char buf[300];
     uint8_t newBaseMode;
     uint32_t newCustomMode;
 
@@ -394,7 +955,6 @@ void Autopilot_Interface::start_hil()
     mavlink_message_t msg;
     mavlink_msg_set_mode_pack(system_id, 0, &msg, (uint8_t)1, newBaseMode, newCustomMode);
     //mavlink_msg_set_mode_pack(255, 0, &msg, (uint8_t)1, newBaseMode, 65536); 
-    uint16_t len = mavlink_msg_to_send_buffer((uint8_t*)buf, &msg);
     printf("Setting HIL mode \n");
     int attempts = 0;
     bool condition = 1;
@@ -404,7 +964,7 @@ void Autopilot_Interface::start_hil()
         
         // Write the request message to serial
         printf("Sending Request #%d \n",attempts);
-        int writtenB = uart_port.write_bytes(buf,len);
+        int writtenB = send_message(&msg);
       
 
         // We must wait for an acknowledgment for the new state, that is
@@ -446,8 +1006,6 @@ void Autopilot_Interface::start_hil()
 void Autopilot_Interface::stop_hil()
 {
     
-    char buf[300];
-
     uint8_t newBaseMode;
     uint32_t newCustomMode = 0;
     
@@ -462,7 +1020,6 @@ void Autopilot_Interface::stop_hil()
     // Create the message and put into the buffer
     mavlink_message_t msg;
     mavlink_msg_set_mode_pack(system_id, 0, &msg, (uint8_t)1, newBaseMode, newCustomMode);
-    uint16_t len = mavlink_msg_to_send_buffer((uint8_t*)buf, &msg);
 
     printf("Unsetting HIL mode \n");
     int attempts = 0;
@@ -473,7 +1030,7 @@ void Autopilot_Interface::stop_hil()
 
        // Write the request message to serial
         printf("Sending Request #%d \n",attempts);
-        int writtenB = uart_port.write_bytes(buf,len);
+        int writtenB = send_message(&msg);
       
         // We must wait for an acknowledgment for the new state, that is
         // a new heartbeat message where the state of the AUV is 
@@ -515,6 +1072,11 @@ bool Autopilot_Interface::is_hil()
     return hil_mode;    
 }
 
+void Autopilot_Interface::set_hil(bool on)
+{
+    hil_mode = on;
+}
+
 
 // -----------------------------------------------------------------------
 //   Start Off-Board Mode
@@ -605,11 +1167,7 @@ int Autopilot_Interface::toggle_offboard_control( bool flag )
     mavlink_msg_command_long_encode(system_id, companion_id, &message, &com);
 
     // Send the message
-    char buf[300];
-    
-    uint16_t len = mavlink_msg_to_send_buffer((uint8_t*)buf, &message);
-    // Write buffer to serial port, locks port while writing
-    int writtenB = uart_port.write_bytes(buf,len);
+    int writtenB = send_message(&message);
 
     // Done!
     return writtenB;
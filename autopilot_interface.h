@@ -18,11 +18,22 @@
 //   Includes
 // -----------------------------------------------------------------------
 
-#include "serial_port.h"
+#include "link_port.h"
+#include "rt_setup.h"
+#include "time_utils.h"
+#include "loop_latency.h"
+#include "link_usage.h"
+#include "link_quality.h"
+#include "flight_recorder.h"
+#include "metrics.h"
+#include "mav_version.h"
+#include "mav_parser.h"
+#include "mav_msgset.h"
 
 #include <signal.h>
 #include <sys/time.h>
 #include <stdint.h>
+#include "mav_crc.h"
 #include <common/mavlink.h>
 #include <queue>
 extern "C" {
@@ -32,6 +43,35 @@ extern "C" {
 //   Defines
 // ------------------------------------------------------------------------
 
+// Priority classes of the messages sent to the board
+#define TX_CLASS_SENSOR   0   // HIL sensor data (highest priority)
+#define TX_CLASS_COMMAND  1   // Commands, mode changes, GS protocol requests
+#define TX_CLASS_BULK     2   // Streaming traffic (shed under backpressure)
+#define TX_NUM_CLASSES    3
+
+// Maximum number of messages waiting in each class
+#define TX_QUEUE_LIMIT    256
+
+// Window of the TX byte budget (us)
+#define TX_WINDOW_US      4000
+
+// Budget of a window on a link without baudrate (UDP/TCP)
+#define TX_UNLIMITED_BYTES 0x7fffffff
+
+// Messages whose reception time is recorded (ids 0..255)
+#define MAV_TRACKED_MSGIDS 256
+
+// Frames written together by a single flush of the TX engine
+#define TX_BATCH_BYTES    2048
+#define TX_BATCH_FRAMES   32
+
+// Sensor frames encoded in place by the simulator, per period
+#define TX_DIRECT_BYTES   512
+#define TX_DIRECT_FRAMES  4
+
+// Staging of the received bytes: a read plus the tail of a frame in progress
+#define RX_STAGE_BYTES    (LINK_READ_BYTES + MAVLINK_MAX_PACKET_LEN)
+
 
 // ------------------------------------------------------------------------
 //   Data Structures
@@ -44,10 +84,33 @@ struct Mavlink_Messages {
 
 	std::queue<mavlink_message_t> messages;
 
-	// Time Stamps
-	long unsigned int time_stamps[256];
+	// Time Stamps (MAVLink 1 ids only, MAVLink 2 ids can be larger)
+	long unsigned int time_stamps[MAV_TRACKED_MSGIDS];
+
+	// Host reception time (CLOCK_MONOTONIC ns)
+	uint64_t rx_time_ns[MAV_TRACKED_MSGIDS];
 };
 
+// Frames encoded in place (see hil_encode.h), written before the queued
+// messages of the same flush
+struct Tx_Direct {
+
+	uint8_t buf[TX_DIRECT_BYTES];
+	uint16_t len;
+	int nframes;
+
+	uint16_t frame_len[TX_DIRECT_FRAMES];
+	uint32_t msgid[TX_DIRECT_FRAMES];
+	uint16_t v1_len[TX_DIRECT_FRAMES];
+	uint64_t sensor[TX_DIRECT_FRAMES];      // HIL_SENSOR time_usec (0 = other)
+};
+
+// Raw passthrough: receives the parsed header and the original bytes of
+// each frame. Returns 1 if the frame has been forwarded (it is not
+// queued), 0 otherwise.
+typedef int (*Raw_Frame_Sink)(void* arg, const mavlink_message_t* msg,
+		const uint8_t* frame, unsigned len);
+
 
 // ---------------------------------------------------------------------
 //   Autopilot Interface Class
@@ -97,8 +160,63 @@ class Autopilot_Interface
 		int fetch_data();
 		int get_message(mavlink_message_t* req_mess);
 
-		// Write mavlink message on the serial interface
+		// Queue a mavlink message for the serial interface
 		int send_message(mavlink_message_t* msg);
+		// Queue a group of messages due in the same period
+		int send_messages(mavlink_message_t* msgs, int n);
+
+		// Sensor frames encoded by the caller (single producer): encode 
+		// at buf + len of the buffer returned by tx_direct_begin(), 
+		// record each frame with tx_direct_add() and hand the buffer to 
+		// the TX engine with tx_direct_commit()
+		Tx_Direct* tx_direct_begin();
+		void tx_direct_add(Tx_Direct* d, uint32_t msgid, uint16_t len, uint16_t v1_len,
+				uint64_t sensor_time_usec);
+		int tx_direct_commit();
+
+		// TX engine: writes the queued messages on the serial port
+		void tx_engine();
+		void tx_engine_stop();
+		// Wait until the engine has written everything queued so far
+		void tx_wait_idle();
+		void tx_report(FILE* f);
+
+		// Closed-loop latency measurement (optional)
+		Loop_Latency* loop_latency;
+
+		// Recorder of the frames read and written (optional)
+		Flight_Recorder* recorder;
+
+		// Bandwidth accounting and backpressure of the serial link
+		Link_Usage link_usage;
+
+		// Live metrics of the link and of its queues (-1 = not published)
+		void metrics_register(const char* name);
+		int metrics_link;
+		int metrics_rx_queue;
+		int metrics_tx_queue[TX_NUM_CLASSES];
+
+		// MAVLink version spoken on the serial link
+		Mav_Link_Version mav_link;
+
+		// Parser of the frames received from the board
+		Mavlink_Parser parser;
+
+		// Loss, duplicates and errors of the frames from the board
+		Link_Quality link_quality;
+
+		// Raw passthrough of the received frames (optional)
+		Raw_Frame_Sink raw_sink;
+		void* raw_sink_arg;
+		uint64_t raw_forwarded;
+
+		// TX statistics, per class
+		uint64_t tx_frames[TX_NUM_CLASSES];
+		uint64_t tx_bytes[TX_NUM_CLASSES];
+		uint64_t tx_drops[TX_NUM_CLASSES];
+		uint64_t tx_errors;
+		uint64_t tx_budget_waits;
+		uint64_t tx_flushes;
 
 		//        int write_messages();
 		void write_hilsensors();
@@ -107,13 +225,23 @@ class Autopilot_Interface
 		void start_hil();
 		void stop_hil();
 		bool is_hil();
+		// Replay: HIL mode as acknowledged by the recorded heartbeats
+		void set_hil(bool on);
 
 		void enable_offboard_control();
 		void disable_offboard_control();
 
-		Serial_Port uart_port; 
+		Link_Port port;
 
 	private:
+		// Time of the last read from the serial port
+		uint64_t last_read_ns;
+
+		// Received bytes, kept linear so that each parsed frame can be
+		// forwarded from here as it was received
+		uint8_t rx_stage[RX_STAGE_BYTES];
+		unsigned rx_stage_len;
+
 		FILE* f_aut_THilCtr;
 		FILE* f_aut_TSens;
 		FILE* f_aut_TSens_before;
@@ -134,6 +262,35 @@ class Autopilot_Interface
 		// Mutex and condition variable for the sending queues
 		pthread_mutex_t mut_sendMessage;
 		pthread_cond_t cond_empty;
+		pthread_cond_t cond_idle;
+
+		// TX engine state (protected by mut_sendMessage)
+		bool tx_stop;
+		bool tx_writing;
+		uint32_t tx_window_bytes;
+		uint32_t tx_budget;
+		uint64_t tx_window_start;
+
+		int tx_class(uint32_t msgid);
+		std::queue<mavlink_message_t>* tx_queue(int cls);
+		int tx_push(mavlink_message_t* msg);
+
+		// Triple buffer of the direct frames: filled by the producer, 
+		// ready to be sent, being written by the TX engine
+		Tx_Direct tx_direct[3];
+		int tx_direct_fill;
+		int tx_direct_ready;
+		int tx_direct_busy;
+		bool tx_direct_pending;
+
+		// Frames of the current flush, encoded back to back
+		uint8_t tx_buf[TX_BATCH_BYTES];
+		uint16_t tx_batch_len[TX_BATCH_FRAMES];
+		uint8_t tx_batch_class[TX_BATCH_FRAMES];
+		uint32_t tx_batch_msgid[TX_BATCH_FRAMES];
+		uint16_t tx_batch_v1_len[TX_BATCH_FRAMES];
+		uint64_t tx_batch_sensor[TX_BATCH_FRAMES];   // HIL_SENSOR time_usec (0 = other)
+		mavlink_message_t tx_conv;                   // Message converted to the link version
 
 		//mutex for the access to the base_mode variable 
 		bool new_heartbeat;
@@ -142,8 +299,10 @@ class Autopilot_Interface
 
 		bool hil_mode;
 
-		std::queue<mavlink_message_t> LPsendQueue;
+		// Sending queues: sensor data, commands, bulk
 		std::queue<mavlink_message_t> HPsendQueue;
+		std::queue<mavlink_message_t> CMDsendQueue;
+		std::queue<mavlink_message_t> LPsendQueue;
 
 		struct pollfd fdsR[1];
 		struct pollfd fdsW[1];
@@ -0,0 +1,312 @@
+/*
+ * file: crc_bench.cpp
+ *
+ * Validation and microbenchmark of the table driven X.25 checksum
+ * (mav_crc.h) against the reference implementation of checksum.h.
+ *
+ *  - the tables are recomputed from the polynomial
+ *  - random buffers of every length up to a MAVLink 2 frame, split at
+ *    random points, give the reference CRC
+ *  - every message of the dialect, with a random payload, is packed in
+ *    MAVLink 1 and 2: the frame carries the reference CRC and is
+ *    accepted by the parser
+ *  - the entries of the router message set (mav_msgset.h) are those of
+ *    the table of the dialect
+ *  - speed of the three implementations on frames of typical lengths
+ *
+ * usage: crc_bench [-n <iterations>]
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "time_utils.h"
+#include "mav_crc.h"
+#include <common/mavlink.h>
+#include "mav_parser.h"
+#include "mav_msgset.h"
+
+
+// ------------------------------------------------------------------------
+//   Reference
+// ------------------------------------------------------------------------
+
+// crc_accumulate() of checksum.h
+static inline void crc_reference(uint8_t data, uint16_t* crcAccum)
+{
+    uint8_t tmp;
+
+    tmp = data ^ (uint8_t)(*crcAccum & 0xff);
+    tmp ^= (tmp << 4);
+    *crcAccum = (*crcAccum >> 8) ^ (tmp << 8) ^ (tmp << 3) ^ (tmp >> 4);
+}
+
+static uint16_t crc_reference_buffer(const uint8_t* p, unsigned len)
+{
+    uint16_t crc = X25_INIT_CRC;
+    while (len--)
+        crc_reference(*p++, &crc);
+    return crc;
+}
+
+
+// ------------------------------------------------------------------------
+//   Validation
+// ------------------------------------------------------------------------
+
+static int check_tables()
+{
+    int errors = 0;
+    uint16_t t[MAV_CRC_SLICES][256];
+
+    for (int i = 0; i < 256; i++)
+    {
+        uint16_t c = i;
+        for (int b = 0; b < 8; b++)
+            c = (c & 1) ? (c >> 1) ^ MAV_CRC_POLY : c >> 1;
+        t[0][i] = c;
+    }
+    for (int k = 1; k < MAV_CRC_SLICES; k++)
+        for (int i = 0; i < 256; i++)
+            t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+
+    for (int k = 0; k < MAV_CRC_SLICES; k++)
+        for (int i = 0; i < 256; i++)
+            if (t[k][i] != mav_crc_table[k][i])
+            {
+                printf("table %d[%d]: 0x%04x instead of 0x%04x\n", k, i,
+                        mav_crc_table[k][i], t[k][i]);
+                errors++;
+            }
+
+    printf("Tables:          %s\n", errors ? "FAILED" : "ok");
+    return errors;
+}
+
+static int check_buffers()
+{
+    int errors = 0;
+    int cases = 0;
+    uint8_t buf[MAVLINK_MAX_PACKET_LEN];
+
+    for (int len = 0; len <= MAVLINK_MAX_PACKET_LEN; len++)
+    {
+        for (int rep = 0; rep < 64; rep++)
+        {
+            for (int i = 0; i < len; i++)
+                buf[i] = rand();
+
+            uint16_t ref = crc_reference_buffer(buf, len);
+
+            // In two parts, as the packers do (header, then payload)
+            int split = len ? rand() % (len + 1) : 0;
+            uint16_t crc = mav_crc_calculate(buf, split);
+            mav_crc_accumulate_buffer(&crc, (const char*)buf + split, len - split);
+
+            // One byte at a time, as the parser does
+            uint16_t crc_byte = X25_INIT_CRC;
+            for (int i = 0; i < len; i++)
+                crc_accumulate(buf[i], &crc_byte);
+
+            if (crc != ref || crc_byte != ref)
+            {
+                if (errors < 10)
+                    printf("length %d split %d: 0x%04x 0x%04x instead of 0x%04x\n",
+                            len, split, crc, crc_byte, ref);
+                errors++;
+            }
+            cases++;
+        }
+    }
+
+    printf("Buffers:         %s (%d cases)\n", errors ? "FAILED" : "ok", cases);
+    return errors;
+}
+
+//
+// check_message
+//
+// Pack the message in the given version, check the CRC of the frame
+// against the reference and parse it back
+//
+static int check_message(const mavlink_msg_entry_t* e, bool mavlink1)
+{
+    mavlink_message_t msg;
+    Mavlink_Parser parser;
+    uint8_t frame[MAVLINK_MAX_PACKET_LEN];
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msgid = e->msgid;
+    for (int i = 0; i < e->msg_len; i++)
+        _MAV_PAYLOAD_NON_CONST(&msg)[i] = rand();
+    // Trailing zeros, truncated by MAVLink 2
+    if (e->msg_len > 4)
+        memset(_MAV_PAYLOAD_NON_CONST(&msg) + e->msg_len - 3, 0, 3);
+
+    mavlink_status_t* chan = mavlink_get_channel_status(MAVLINK_COMM_0);
+    if (mavlink1)
+        chan->flags |= MAVLINK_STATUS_FLAG_OUT_MAVLINK1;
+    else
+        chan->flags &= ~MAVLINK_STATUS_FLAG_OUT_MAVLINK1;
+
+    mavlink_finalize_message_chan(&msg, 1, 1, MAVLINK_COMM_0, e->msg_len, e->msg_len,
+            e->crc_extra);
+    unsigned len = mavlink_msg_to_send_buffer(frame, &msg);
+
+    // Header (without the magic) and payload, then the crc extra
+    uint16_t ref = crc_reference_buffer(frame + 1, len - 3);
+    crc_reference(e->crc_extra, &ref);
+    uint16_t wire = frame[len - 2] | (frame[len - 1] << 8);
+
+    int parsed = 0;
+    for (unsigned i = 0; i < len; i++)
+        parsed += parser.parse(frame[i]);
+
+    if (wire != ref || parsed != 1 || parser.msg.msgid != e->msgid)
+    {
+        printf("msgid %u (v%d): crc 0x%04x instead of 0x%04x, parsed %d\n",
+                e->msgid, mavlink1 ? 1 : 2, wire, ref, parsed);
+        return 1;
+    }
+    return 0;
+}
+
+static int check_messages()
+{
+    static const mavlink_msg_entry_t table[] = MAVLINK_MESSAGE_CRCS;
+    const int n = sizeof(table) / sizeof(table[0]);
+    int errors = 0;
+    int frames = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        for (int rep = 0; rep < 16; rep++)
+        {
+            if (table[i].msgid < 256)
+            {
+                errors += check_message(&table[i], true);
+                frames++;
+            }
+            errors += check_message(&table[i], false);
+            frames++;
+        }
+    }
+
+    mavlink_get_channel_status(MAVLINK_COMM_0)->flags &= ~MAVLINK_STATUS_FLAG_OUT_MAVLINK1;
+
+    printf("Messages:        %s (%d types, %d frames)\n", errors ? "FAILED" : "ok", n, frames);
+    return errors;
+}
+
+static int check_msgset()
+{
+    static const mavlink_msg_entry_t table[] = MAVLINK_MESSAGE_CRCS;
+    const int n = sizeof(table) / sizeof(table[0]);
+    int errors = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        const mavlink_msg_entry_t* e = mav_msg_entry(table[i].msgid);
+        if (e == NULL || e->msgid != table[i].msgid || e->crc_extra != table[i].crc_extra ||
+                e->msg_len != table[i].msg_len || e->flags != table[i].flags ||
+                e->target_system_ofs != table[i].target_system_ofs ||
+                e->target_component_ofs != table[i].target_component_ofs)
+        {
+            printf("msgid %u: entry differs from the dialect\n", table[i].msgid);
+            errors++;
+        }
+    }
+    if (mav_msg_entry(table[n - 1].msgid + 1) != NULL)
+    {
+        printf("msgid %u: unknown id found\n", table[n - 1].msgid + 1);
+        errors++;
+    }
+
+    printf("Message set:     %s\n", errors ? "FAILED" : "ok");
+    return errors;
+}
+
+
+// ------------------------------------------------------------------------
+//   Benchmark
+// ------------------------------------------------------------------------
+
+static volatile uint16_t sink;
+
+static void bench(unsigned len, long iterations)
+{
+    uint8_t buf[MAVLINK_MAX_PACKET_LEN];
+    for (unsigned i = 0; i < len; i++)
+        buf[i] = rand();
+
+    uint64_t t0 = time_monotonic_ns();
+    for (long it = 0; it < iterations; it++)
+    {
+        buf[0] = it;
+        sink = crc_reference_buffer(buf, len);
+    }
+
+    uint64_t t1 = time_monotonic_ns();
+    for (long it = 0; it < iterations; it++)
+    {
+        buf[0] = it;
+        uint16_t crc = X25_INIT_CRC;
+        for (unsigned i = 0; i < len; i++)
+            crc_accumulate(buf[i], &crc);
+        sink = crc;
+    }
+
+    uint64_t t2 = time_monotonic_ns();
+    for (long it = 0; it < iterations; it++)
+    {
+        buf[0] = it;
+        sink = mav_crc_calculate(buf, len);
+    }
+    uint64_t t3 = time_monotonic_ns();
+
+    double ref = (double)(t1 - t0) / iterations;
+    double byte = (double)(t2 - t1) / iterations;
+    double slice = (double)(t3 - t2) / iterations;
+
+    printf("  %5u %12.1f %12.1f %12.1f %9.2fx %9.2fx\n", len, ref, byte, slice,
+            ref / byte, ref / slice);
+}
+
+
+int main(int argc, char **argv)
+{
+    long iterations = 1000000;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-n") == 0 && argc > i + 1)
+            iterations = atol(argv[++i]);
+        else
+        {
+            printf("usage: crc_bench [-n <iterations>]\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    srand(1);
+
+    int errors = check_tables();
+    errors += check_buffers();
+    errors += check_messages();
+    errors += check_msgset();
+    if (errors)
+        return EXIT_FAILURE;
+
+    // Header + payload of HEARTBEAT, HIL_CONTROLS, HIL_SENSOR and of
+    // the largest MAVLink 2 frame
+    printf("\nns per CRC, %ld iterations\n", iterations);
+    printf("  %5s %12s %12s %12s %10s %10s\n", "BYTES", "REFERENCE", "TABLE",
+            "SLICING-8", "TABLE", "SLICING-8");
+    unsigned lengths[] = {18, 51, 73, MAVLINK_MAX_PACKET_LEN - 3};
+    for (unsigned i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++)
+        bench(lengths[i], iterations);
+
+    return EXIT_SUCCESS;
+}
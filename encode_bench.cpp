@@ -0,0 +1,272 @@
+/*
+ * file: encode_bench.cpp
+ *
+ * Check and microbenchmark of the direct encoding of the HIL frames
+ * (hil_encode.h) against the path it replaces:
+ *
+ *   mavlink_msg_hil_*_pack() -> queue of mavlink_message_t -> conversion
+ *   to the version of the link -> mavlink_msg_to_send_buffer()
+ *
+ * Random outputs of the model are encoded both ways in MAVLink 1 and 2:
+ * the frames must be byte for byte identical. Then both paths are timed
+ * for the frames of a simulation step. The makefile builds hil_encode.o
+ * with the -O2 of this file, so that both paths are compiled alike.
+ *
+ * usage: encode_bench [-n <iterations>]
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <queue>
+
+#include "time_utils.h"
+#include "hil_encode.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+
+// ------------------------------------------------------------------------
+//   Reference path
+// ------------------------------------------------------------------------
+
+static std::queue<mavlink_message_t> queue;
+static mavlink_message_t conv;
+
+//
+// pack_frames
+//
+// Frames of a step as written by the TX engine before the direct
+// encoding. Returns the bytes written in buf.
+//
+static unsigned pack_frames(uint8_t* buf, const ExtY_DynModel_T* y, uint64_t time_usec,
+        bool gps, Mav_Link_Version* link)
+{
+    mavlink_message_t sensor_msg;
+    mavlink_message_t gps_msg;
+    mavlink_message_t hil_msgs[2];
+
+    mavlink_msg_hil_sensor_pack(1, 1, &sensor_msg, time_usec,
+            (float)y->Accelerometer[0], (float)y->Accelerometer[1], (float)y->Accelerometer[2],
+            (float)y->Gyro[0], (float)y->Gyro[1], (float)y->Gyro[2],
+            (float)y->Magn[0], (float)y->Magn[1], (float)y->Magn[2],
+            (float)y->Press, (float)y->diff_Pres, (float)y->Baro_Alt, (float)y->Temp,
+            (uint32_t)0xFF);
+    hil_msgs[0] = sensor_msg;
+    int n = 1;
+
+    if (gps)
+    {
+        int16_t cog = (int16_t)(y->COG * 100);
+        mavlink_msg_hil_gps_pack(1, 1, &gps_msg, time_usec, 3,
+                (int32_t)(y->Gps_Lat * 1e7), (int32_t)(y->Gps_Lon * 1e7),
+                (int32_t)(y->Gps_Alt * 1e3), 1, 1, (uint16_t)(y->Gps_V_Mod * 100),
+                (int16_t)(y->Gps_V[0] * 100), (int16_t)(y->Gps_V[1] * 100),
+                (int16_t)(y->Gps_V[2] * 100), cog, 8);
+        hil_msgs[n++] = gps_msg;
+    }
+
+    // send_messages() and tx_engine()
+    for (int i = 0; i < n; i++)
+        queue.push(hil_msgs[i]);
+
+    unsigned used = 0;
+    while (!queue.empty())
+    {
+        const mavlink_message_t &msg = *mav_link_tx(link, &queue.front(), &conv);
+        used += mavlink_msg_to_send_buffer(buf + used, &msg);
+        queue.pop();
+    }
+    return used;
+}
+
+
+// ------------------------------------------------------------------------
+//   Direct path
+// ------------------------------------------------------------------------
+
+static unsigned encode_frames(uint8_t* buf, const ExtY_DynModel_T* y, uint64_t time_usec,
+        bool gps, int version)
+{
+    mavlink_status_t* chan = mavlink_get_channel_status(MAVLINK_COMM_0);
+    Mav_Frame_Hdr hdr;
+    hdr.version = version;
+    hdr.sysid = 1;
+    hdr.compid = 1;
+
+    hdr.seq = chan->current_tx_seq++;
+    unsigned used = hil_sensor_encode(buf, &hdr, time_usec, y);
+    if (gps)
+    {
+        hdr.seq = chan->current_tx_seq++;
+        used += hil_gps_encode(buf + used, &hdr, time_usec, y);
+    }
+    return used;
+}
+
+
+// ------------------------------------------------------------------------
+//   Check and benchmark
+// ------------------------------------------------------------------------
+
+static float rnd(float range)
+{
+    // Some exact zeros, as in the first steps of the model
+    if (rand() % 8 == 0)
+        return 0.0f;
+    return range * (2.0f * rand() / RAND_MAX - 1.0f);
+}
+
+static void random_outputs(ExtY_DynModel_T* y)
+{
+    memset(y, 0, sizeof(*y));
+    for (int i = 0; i < 3; i++)
+    {
+        y->Accelerometer[i] = rnd(20);
+        y->Gyro[i] = rnd(5);
+        y->Magn[i] = rnd(1);
+        y->Gps_V[i] = rnd(30);
+    }
+    y->Press = 1013 + rnd(20);
+    y->diff_Pres = rnd(1);
+    y->Baro_Alt = rnd(500);
+    y->Temp = rnd(40);
+    y->Gps_Lat = 43.7 + rnd(0.01f);
+    y->Gps_Lon = 10.4 + rnd(0.01f);
+    y->Gps_Alt = rnd(500);
+    y->Gps_V_Mod = 30 + rnd(30);
+    y->COG = rnd(180);
+}
+
+static int check(int version, int samples)
+{
+    Mav_Link_Version link;
+    mav_link_init(&link, "bench", version);
+    mavlink_status_t* chan = mavlink_get_channel_status(MAVLINK_COMM_0);
+
+    uint8_t ref[2 * MAVLINK_MAX_PACKET_LEN];
+    uint8_t out[2 * MAVLINK_MAX_PACKET_LEN];
+    ExtY_DynModel_T y;
+    int errors = 0;
+
+    for (int i = 0; i < samples; i++)
+    {
+        random_outputs(&y);
+        uint64_t time_usec = 1000000ULL * rand() + rand();
+        bool gps = (i % 2) == 1;
+
+        uint8_t seq = chan->current_tx_seq;
+        unsigned ref_len = pack_frames(ref, &y, time_usec, gps, &link);
+        chan->current_tx_seq = seq;
+        unsigned len = encode_frames(out, &y, time_usec, gps, version);
+
+        if (len != ref_len || memcmp(ref, out, len) != 0)
+        {
+            if (errors < 5)
+            {
+                printf("v%d sample %d: %u bytes instead of %u\n", version, i, len, ref_len);
+                for (unsigned b = 0; b < ref_len; b++)
+                    printf("%02x%c", ref[b], (b + 1) % 32 ? ' ' : '\n');
+                printf("\n");
+                for (unsigned b = 0; b < len; b++)
+                    printf("%02x%c", out[b], (b + 1) % 32 ? ' ' : '\n');
+                printf("\n");
+            }
+            errors++;
+        }
+    }
+
+    printf("MAVLink %d:  %s (%d steps, GPS every other step)\n", version,
+            errors ? "FAILED" : "identical frames", samples);
+    return errors;
+}
+
+static inline uint64_t cycles()
+{
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static volatile uint8_t sink;
+
+static void bench(int version, bool gps, long iterations)
+{
+    Mav_Link_Version link;
+    mav_link_init(&link, "bench", version);
+
+    uint8_t buf[2 * MAVLINK_MAX_PACKET_LEN];
+    ExtY_DynModel_T y;
+    random_outputs(&y);
+
+    uint64_t t0 = time_monotonic_ns();
+    uint64_t c0 = cycles();
+    for (long it = 0; it < iterations; it++)
+    {
+        y.Temp = it;
+        pack_frames(buf, &y, it, gps, &link);
+        sink = buf[20];
+    }
+    uint64_t c1 = cycles();
+    uint64_t t1 = time_monotonic_ns();
+    for (long it = 0; it < iterations; it++)
+    {
+        y.Temp = it;
+        encode_frames(buf, &y, it, gps, version);
+        sink = buf[20];
+    }
+    uint64_t c2 = cycles();
+    uint64_t t2 = time_monotonic_ns();
+
+    printf("  v%d %-12s %10.1f %10.1f %12.0f %12.0f %10.0f\n", version,
+            gps ? "sensor+gps" : "sensor",
+            (double)(t1 - t0) / iterations, (double)(t2 - t1) / iterations,
+            (double)(c1 - c0) / iterations, (double)(c2 - c1) / iterations,
+            ((double)(c1 - c0) - (double)(c2 - c1)) / iterations);
+}
+
+
+int main(int argc, char **argv)
+{
+    long iterations = 1000000;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-n") == 0 && argc > i + 1)
+            iterations = atol(argv[++i]);
+        else
+        {
+            printf("usage: encode_bench [-n <iterations>]\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    srand(1);
+
+    int errors = check(MAV_VERSION_1, 10000);
+    errors += check(MAV_VERSION_2, 10000);
+    if (errors)
+        return EXIT_FAILURE;
+
+    printf("\nPer step, %ld iterations%s\n", iterations,
+#ifdef HAVE_TSC
+            ""
+#else
+            " (no cycle counter)"
+#endif
+            );
+    printf("  %-15s %10s %10s %12s %12s %10s\n", "FRAMES", "PACK ns", "DIRECT ns",
+            "PACK cyc", "DIRECT cyc", "SAVED cyc");
+    bench(MAV_VERSION_2, false, iterations);
+    bench(MAV_VERSION_2, true, iterations);
+    bench(MAV_VERSION_1, false, iterations);
+    bench(MAV_VERSION_1, true, iterations);
+
+    return EXIT_SUCCESS;
+}
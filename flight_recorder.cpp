@@ -0,0 +1,409 @@
+/**
+ * @file flight_recorder.cpp
+ *
+ * @brief Binary recorder of the MAVLink frames crossing the router
+ *
+ */
+
+#include "flight_recorder.h"
+#include "frec_index.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "time_utils.h"
+
+
+// ------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------
+Flight_Recorder::Flight_Recorder()
+{
+    for (int i = 0; i < FREC_LINKS * 2; i++)
+    {
+        ring[i].head = 0;
+        ring[i].tail = 0;
+        ring[i].frames = 0;
+        ring[i].bytes = 0;
+        ring[i].drops = 0;
+    }
+
+    active = false;
+    frames = 0;
+    bytes = 0;
+    segments = 0;
+    write_errors = 0;
+    late = 0;
+
+    prefix[0] = '\0';
+    stop_writer = false;
+    tlog_fd = -1;
+    meta_fd = -1;
+    tlog = NULL;
+    meta = NULL;
+    tlog_used = 0;
+    meta_used = 0;
+    header = NULL;
+    written_ns = 0;
+}
+
+Flight_Recorder::~Flight_Recorder()
+{
+    stop();
+}
+
+// ------------------------------------------------------------------------
+//  FUNCTIONS
+// ------------------------------------------------------------------------
+
+//
+// start
+//
+int Flight_Recorder::start(const char* prefix_)
+{
+    snprintf(prefix, sizeof(prefix), "%s", prefix_);
+
+    if (open_segment() < 0)
+        return -1;
+
+    stop_writer = false;
+    if (pthread_create(&writer, NULL, writer_thread, this) != 0)
+    {
+        printf("Flight recorder: could not start the writer thread\n");
+        close_segment();
+        return -1;
+    }
+
+    active = true;
+    printf("Recording the MAVLink traffic to %s_*.tlog\n", prefix);
+    return 0;
+}
+
+//
+// stop
+//
+void Flight_Recorder::stop()
+{
+    if (!active)
+        return;
+
+    active = false;
+    stop_writer = true;
+    pthread_join(writer, NULL);
+
+    // Frames recorded after the last drain of the thread, and those
+    // held back
+    while (drain(true) > 0)
+        ;
+    close_segment();
+}
+
+//
+// record
+//
+void Flight_Recorder::record(int link, int dir, const uint8_t* frame, unsigned len,
+        uint64_t now_ns)
+{
+    if (!active)
+        return;
+
+    Frec_Ring* r = &ring[link * 2 + dir];
+    uint32_t h = r->head;
+    uint32_t t = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+
+    if (h - t >= FREC_RING_SLOTS || len > FREC_MAX_FRAME)
+    {
+        r->drops++;
+        return;
+    }
+
+    Frec_Slot* s = &r->slot[h & (FREC_RING_SLOTS - 1)];
+    s->mono_ns = now_ns;
+    s->len = len;
+    memcpy(s->frame, frame, len);
+    r->frames++;
+    r->bytes += len;
+
+    __atomic_store_n(&r->head, h + 1, __ATOMIC_RELEASE);
+}
+
+
+// ------------------------------------------------------------------------
+//   Segments
+// ------------------------------------------------------------------------
+
+//
+// map_file
+//
+// Pre-allocated file of the given size, mapped for writing
+//
+static uint8_t* map_file(const char* path, uint64_t size, int* fd)
+{
+    *fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (*fd < 0)
+    {
+        printf("Flight recorder: could not create %s (%s)\n", path, strerror(errno));
+        return NULL;
+    }
+
+    int err = posix_fallocate(*fd, 0, size);
+    if (err != 0)
+    {
+        printf("Flight recorder: could not allocate %s (%s)\n", path, strerror(err));
+        close(*fd);
+        *fd = -1;
+        return NULL;
+    }
+
+    void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, *fd, 0);
+    if (p == MAP_FAILED)
+    {
+        printf("Flight recorder: could not map %s (%s)\n", path, strerror(errno));
+        close(*fd);
+        *fd = -1;
+        return NULL;
+    }
+    return (uint8_t*)p;
+}
+
+//
+// open_segment
+//
+int Flight_Recorder::open_segment()
+{
+    char path[256];
+
+    snprintf(path, sizeof(path), "%s_%03u.tlog", prefix, segments);
+    tlog = map_file(path, FREC_SEGMENT_BYTES, &tlog_fd);
+    if (tlog == NULL)
+        return -1;
+
+    snprintf(path, sizeof(path), "%s_%03u.meta", prefix, segments);
+    meta = map_file(path, FREC_SEGMENT_BYTES / 2, &meta_fd);
+    if (meta == NULL)
+    {
+        munmap(tlog, FREC_SEGMENT_BYTES);
+        close(tlog_fd);
+        tlog = NULL;
+        tlog_fd = -1;
+        return -1;
+    }
+
+    struct timespec rt;
+    clock_gettime(CLOCK_REALTIME, &rt);
+    uint64_t mono = time_monotonic_ns();
+
+    header = (Frec_Meta_Header*)meta;
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, FREC_META_MAGIC, sizeof(header->magic));
+    header->version = FREC_META_VERSION;
+    header->record_size = sizeof(Frec_Meta_Record);
+    header->segment = segments;
+    header->wall_offset_ns = (int64_t)(rt.tv_sec * 1000000000ULL + rt.tv_nsec) - (int64_t)mono;
+
+    tlog_used = 0;
+    meta_used = sizeof(Frec_Meta_Header);
+    segments++;
+    return 0;
+}
+
+//
+// write_index
+//
+int Flight_Recorder::write_index()
+{
+    char path[256];
+    Frec_Index idx;
+
+    snprintf(path, sizeof(path), "%s_%03u.idx", prefix, header->segment);
+    idx.build((const Frec_Meta_Record*)(meta + sizeof(Frec_Meta_Header)), header->records, tlog);
+    return idx.write(path, header->segment);
+}
+
+//
+// close_segment
+//
+// The segment is indexed, then its files are truncated to their content
+//
+void Flight_Recorder::close_segment()
+{
+    if (tlog != NULL && meta != NULL && write_index() < 0)
+        write_errors++;
+
+    if (tlog != NULL)
+    {
+        munmap(tlog, FREC_SEGMENT_BYTES);
+        if (ftruncate(tlog_fd, tlog_used) < 0)
+            write_errors++;
+        close(tlog_fd);
+    }
+    if (meta != NULL)
+    {
+        munmap(meta, FREC_SEGMENT_BYTES / 2);
+        if (ftruncate(meta_fd, meta_used) < 0)
+            write_errors++;
+        close(meta_fd);
+    }
+
+    tlog = NULL;
+    meta = NULL;
+    header = NULL;
+    tlog_fd = -1;
+    meta_fd = -1;
+}
+
+//
+// append
+//
+// The .meta stays sorted by time: a late frame is inserted among the
+// records of the segment (usually a few records back)
+//
+void Flight_Recorder::append(int link, int dir, const Frec_Slot* s)
+{
+    unsigned rec_len = 8 + s->len;
+
+    if (tlog_used + rec_len > FREC_SEGMENT_BYTES ||
+            meta_used + sizeof(Frec_Meta_Record) > FREC_SEGMENT_BYTES / 2)
+    {
+        close_segment();
+        if (open_segment() < 0)
+        {
+            write_errors++;
+            return;
+        }
+    }
+
+    // .tlog: big endian wall clock time in us, then the frame
+    uint64_t us = (uint64_t)((int64_t)s->mono_ns + header->wall_offset_ns) / 1000;
+    uint8_t* p = tlog + tlog_used;
+    for (int i = 0; i < 8; i++)
+        p[i] = (uint8_t)(us >> (56 - 8 * i));
+    memcpy(p + 8, s->frame, s->len);
+
+    Frec_Meta_Record* first = (Frec_Meta_Record*)(meta + sizeof(Frec_Meta_Header));
+    Frec_Meta_Record* m = (Frec_Meta_Record*)(meta + meta_used);
+    if (s->mono_ns < written_ns)
+    {
+        late++;
+        while (m > first && m[-1].mono_ns > s->mono_ns)
+        {
+            m[0] = m[-1];
+            m--;
+        }
+    }
+    else
+        written_ns = s->mono_ns;
+
+    m->mono_ns = s->mono_ns;
+    m->tlog_offset = (uint32_t)tlog_used;
+    m->len = s->len;
+    m->link = link;
+    m->dir = dir;
+
+    tlog_used += rec_len;
+    meta_used += sizeof(Frec_Meta_Record);
+
+    header->records++;
+    header->first_ns = first->mono_ns;
+    header->last_ns = first[header->records - 1].mono_ns;
+    header->tlog_bytes = tlog_used;
+
+    frames++;
+    bytes += s->len;
+}
+
+//
+// drain
+//
+// Move the frames in the rings to the segment, merged in time order.
+// The frames younger than FREC_REORDER_NS stay in the rings, unless
+// all is set (stop). Returns the number of frames written.
+//
+int Flight_Recorder::drain(bool all)
+{
+    uint32_t head[FREC_LINKS * 2];
+    uint32_t tail[FREC_LINKS * 2];
+    uint64_t limit_ns = all ? (uint64_t)-1 : time_monotonic_ns() - FREC_REORDER_NS;
+    int n = 0;
+
+    for (int i = 0; i < FREC_LINKS * 2; i++)
+    {
+        head[i] = __atomic_load_n(&ring[i].head, __ATOMIC_ACQUIRE);
+        tail[i] = ring[i].tail;
+    }
+
+    for (;;)
+    {
+        // Oldest frame at the tail of the rings
+        int oldest = -1;
+        uint64_t oldest_ns = 0;
+        for (int i = 0; i < FREC_LINKS * 2; i++)
+        {
+            if (tail[i] == head[i])
+                continue;
+            uint64_t t = ring[i].slot[tail[i] & (FREC_RING_SLOTS - 1)].mono_ns;
+            if (oldest < 0 || t < oldest_ns)
+            {
+                oldest = i;
+                oldest_ns = t;
+            }
+        }
+        if (oldest < 0 || oldest_ns > limit_ns)
+            break;
+
+        Frec_Ring* r = &ring[oldest];
+        if (meta != NULL)
+            append(oldest / 2, oldest % 2, &r->slot[tail[oldest] & (FREC_RING_SLOTS - 1)]);
+        tail[oldest]++;
+        __atomic_store_n(&r->tail, tail[oldest], __ATOMIC_RELEASE);
+        n++;
+    }
+
+    return n;
+}
+
+//
+// writer_thread
+//
+void* Flight_Recorder::writer_thread(void* arg)
+{
+    Flight_Recorder* rec = (Flight_Recorder*)arg;
+    struct timespec period;
+    period.tv_sec = 0;
+    period.tv_nsec = FREC_PERIOD_NS;
+
+    while (!rec->stop_writer)
+    {
+        if (rec->drain(false) == 0)
+            nanosleep(&period, NULL);
+    }
+    return NULL;
+}
+
+//
+// report
+//
+void Flight_Recorder::report(FILE* f)
+{
+    const char* links[FREC_LINKS] = {"autopilot", "gs"};
+    const char* dirs[2] = {"TX", "RX"};
+
+    if (segments == 0)
+        return;
+
+    fprintf(f, "Flight recorder %s: %lu frames, %lu bytes in %u segments, %lu late, "
+            "%lu write errors\n", prefix, (unsigned long)frames, (unsigned long)bytes,
+            segments, (unsigned long)late, (unsigned long)write_errors);
+    for (int i = 0; i < FREC_LINKS * 2; i++)
+    {
+        const Frec_Ring* r = &ring[i];
+        fprintf(f, "  %-9s %s: %10lu frames %12lu bytes %8lu dropped\n", links[i / 2],
+                dirs[i % 2], (unsigned long)r->frames, (unsigned long)r->bytes,
+                (unsigned long)r->drops);
+    }
+}
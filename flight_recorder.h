@@ -0,0 +1,259 @@
+/**
+ * @file flight_recorder.h
+ *
+ * @brief Binary recorder of the MAVLink frames crossing the router
+ *
+ * Every frame received or sent on the autopilot and GS links is stored
+ * with its wire bytes, the link, the direction and the monotonic time
+ * of the read/write.
+ *
+ * The routing tasks never block: each (link, direction) has a single
+ * producer and its own lock-free ring of slots. A frame that does not
+ * fit in its ring is dropped and counted. A background thread merges
+ * the rings in time order and appends the frames to segment files,
+ * pre-allocated and memory mapped.
+ *
+ * Ordering: a frame can be published after frames stamped later than
+ * it (a TX frame is stamped at the start of the write and recorded when
+ * it completes, a producer may be preempted in between). The writer
+ * holds the frames back until they are FREC_REORDER_NS old before
+ * merging them, and inserts a frame still later than that in time
+ * order among the records of the current segment. So:
+ *
+ *   - the records of a .meta are always sorted by mono_ns (the .tlog
+ *     keeps the order of arrival, the records point into it);
+ *   - a frame published more than FREC_REORDER_NS after its stamp is
+ *     counted as late; if the segment was switched in the meantime it
+ *     may be older than the last record of the previous segment.
+ *
+ *
+ *   <prefix>_<NNN>.tlog   standard .tlog layout: for each frame the
+ *                         wall clock time (us since the epoch, 64 bit
+ *                         big endian) followed by the frame
+ *   <prefix>_<NNN>.meta   Frec_Meta_Header, then one Frec_Meta_Record
+ *                         per frame of the .tlog (monotonic time, link,
+ *                         direction, offset of the record in the .tlog)
+ *
+ * A segment is closed (truncated to its content) when one of its two
+ * files is full, and at stop. The header of the .meta is updated after
+ * each drain: after a crash the segment is read up to header.records.
+ *
+ * When a segment is closed the writer thread adds its index:
+ *
+ *   <prefix>_<NNN>.idx    Frec_Index_Header, then a sparse time index
+ *                         (one Frec_Index_Time every FREC_INDEX_STRIDE
+ *                         records), the directory of the msgids present
+ *                         (Frec_Index_Msgid, sorted by msgid) and, for
+ *                         each msgid, the list of its records (uint32)
+ *
+ * A segment without index (crash) is indexed by the reader in memory.
+ *
+ */
+
+#ifndef FLIGHT_RECORDER_H_
+#define FLIGHT_RECORDER_H_
+
+// ------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+// ------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------
+
+#define FREC_LINK_AUTOPILOT     0
+#define FREC_LINK_GS            1
+#define FREC_LINKS              2
+
+#define FREC_DIR_TX             0   // Written by the router
+#define FREC_DIR_RX             1   // Read by the router
+
+// Largest MAVLink frame (MAVLINK_MAX_PACKET_LEN of the v2 library)
+#define FREC_MAX_FRAME          280
+
+// Slots of the ring of each link and direction (power of two)
+#define FREC_RING_SLOTS         2048
+
+// Size of the .tlog of a segment, the .meta is half of it
+#define FREC_SEGMENT_BYTES      (64UL << 20)
+
+// Period of the writer thread when the rings are empty (ns)
+#define FREC_PERIOD_NS          5000000L
+
+// Age of the frames merged by the writer thread: delay allowed between
+// the stamp of a frame and its publication in the ring (ns)
+#define FREC_REORDER_NS         100000000ULL
+
+#define FREC_META_MAGIC         "FRECMETA"
+#define FREC_META_VERSION       1
+
+#define FREC_INDEX_MAGIC        "FRECIDX"
+#define FREC_INDEX_VERSION      1
+
+// Records between two entries of the time index
+#define FREC_INDEX_STRIDE       256
+
+#define FREC_CACHE_LINE         64
+
+
+// ------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------
+// Header of a .meta file
+struct Frec_Meta_Header {
+
+    char magic[8];              // FREC_META_MAGIC
+    uint32_t version;           // FREC_META_VERSION
+    uint32_t record_size;       // sizeof(Frec_Meta_Record)
+    uint32_t segment;           // Number of the segment
+    uint32_t reserved;
+
+    uint64_t records;           // Frames in the segment
+    uint64_t tlog_bytes;        // Bytes of the .tlog
+
+    int64_t wall_offset_ns;     // CLOCK_REALTIME - CLOCK_MONOTONIC at the opening
+    uint64_t first_ns;          // Monotonic time of the first and last frames
+    uint64_t last_ns;
+};
+
+// Frame of the .tlog
+struct Frec_Meta_Record {
+
+    uint64_t mono_ns;           // CLOCK_MONOTONIC
+    uint32_t tlog_offset;       // Offset of the timestamp of the frame in the .tlog
+    uint16_t len;               // Bytes of the frame
+    uint8_t link;               // FREC_LINK_*
+    uint8_t dir;                // FREC_DIR_*
+};
+
+// Header of a .idx file
+struct Frec_Index_Header {
+
+    char magic[8];              // FREC_INDEX_MAGIC
+    uint32_t version;           // FREC_INDEX_VERSION
+    uint32_t segment;
+    uint64_t records;           // Records of the segment indexed
+
+    uint32_t time_stride;       // FREC_INDEX_STRIDE
+    uint32_t time_entries;
+    uint32_t msgids;            // Entries of the directory
+    uint32_t reserved;
+
+    uint64_t time_offset;       // File offsets of the three tables
+    uint64_t dir_offset;
+    uint64_t list_offset;
+};
+
+// Sparse time index: time of every time_stride-th record
+struct Frec_Index_Time {
+
+    uint64_t mono_ns;
+    uint64_t record;
+};
+
+// Directory: records of a msgid are list[first] .. list[first + count - 1]
+struct Frec_Index_Msgid {
+
+    uint32_t msgid;
+    uint32_t count;
+    uint64_t first;
+};
+
+// Frame waiting in a ring
+struct Frec_Slot {
+
+    uint64_t mono_ns;
+    uint16_t len;
+    uint8_t frame[FREC_MAX_FRAME];
+};
+
+// Single producer / single consumer ring of a link and direction
+struct Frec_Ring {
+
+    uint32_t head __attribute__((aligned(FREC_CACHE_LINE)));    // Producer
+    uint64_t frames;
+    uint64_t bytes;
+    uint64_t drops;
+
+    uint32_t tail __attribute__((aligned(FREC_CACHE_LINE)));    // Writer thread
+
+    Frec_Slot slot[FREC_RING_SLOTS];
+};
+
+
+// Message id of a frame
+static inline uint32_t frec_frame_msgid(const uint8_t* frame, unsigned len)
+{
+    if (len >= 6 && frame[0] == 0xFE)
+        return frame[5];
+    if (len >= 10)
+        return frame[7] | (frame[8] << 8) | ((uint32_t)frame[9] << 16);
+    return 0;
+}
+
+
+// ---------------------------------------------------------------------
+//   Flight Recorder Class
+// ---------------------------------------------------------------------
+class Flight_Recorder
+{
+
+    public:
+
+        Flight_Recorder();
+        ~Flight_Recorder();
+
+        // Open the first segment and start the writer thread (0 = ok)
+        int start(const char* prefix_);
+
+        // Write what is left and close the segment
+        void stop();
+
+        // Producer side: one thread per link and direction. Never blocks.
+        void record(int link, int dir, const uint8_t* frame, unsigned len, uint64_t now_ns);
+
+        void report(FILE* f);
+
+        bool active;
+
+        // Writer side statistics
+        uint64_t frames;
+        uint64_t bytes;
+        uint32_t segments;
+        uint64_t write_errors;
+        uint64_t late;              // Published after FREC_REORDER_NS
+
+    private:
+
+        Frec_Ring ring[FREC_LINKS * 2];
+
+        char prefix[200];
+        pthread_t writer;
+        volatile bool stop_writer;
+
+        // Current segment
+        int tlog_fd;
+        int meta_fd;
+        uint8_t* tlog;
+        uint8_t* meta;
+        uint64_t tlog_used;
+        uint64_t meta_used;
+        Frec_Meta_Header* header;
+        uint64_t written_ns;        // Newest frame written
+
+        int open_segment();
+        void close_segment();
+        void append(int link, int dir, const Frec_Slot* s);
+        int write_index();
+        int drain(bool all);
+
+        static void* writer_thread(void* arg);
+
+};
+
+
+#endif // FLIGHT_RECORDER_H_
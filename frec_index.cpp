@@ -0,0 +1,101 @@
+/**
+ * @file frec_index.cpp
+ *
+ * @brief Index of a segment of the flight recorder
+ *
+ */
+
+#include "frec_index.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+
+// ------------------------------------------------------------------------
+//  FUNCTIONS
+// ------------------------------------------------------------------------
+
+//
+// build
+//
+// The (msgid, record) pairs are sorted once: the records of each msgid
+// come out in time order
+//
+void Frec_Index::build(const Frec_Meta_Record* rec, uint64_t n, const uint8_t* tlog)
+{
+    records = n;
+    time.clear();
+    dir.clear();
+    list.clear();
+
+    std::vector<uint64_t> keys(n);
+    for (uint64_t i = 0; i < n; i++)
+    {
+        if (i % FREC_INDEX_STRIDE == 0)
+        {
+            Frec_Index_Time t;
+            t.mono_ns = rec[i].mono_ns;
+            t.record = i;
+            time.push_back(t);
+        }
+
+        uint32_t msgid = frec_frame_msgid(tlog + rec[i].tlog_offset + 8, rec[i].len);
+        keys[i] = ((uint64_t)msgid << 32) | i;
+    }
+    std::sort(keys.begin(), keys.end());
+
+    list.resize(n);
+    for (uint64_t i = 0; i < n; i++)
+    {
+        uint32_t msgid = keys[i] >> 32;
+        if (dir.empty() || dir.back().msgid != msgid)
+        {
+            Frec_Index_Msgid d;
+            d.msgid = msgid;
+            d.count = 0;
+            d.first = i;
+            dir.push_back(d);
+        }
+        dir.back().count++;
+        list[i] = (uint32_t)keys[i];
+    }
+}
+
+//
+// write
+//
+int Frec_Index::write(const char* path, uint32_t segment)
+{
+    Frec_Index_Header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, FREC_INDEX_MAGIC, sizeof(FREC_INDEX_MAGIC));
+    h.version = FREC_INDEX_VERSION;
+    h.segment = segment;
+    h.records = records;
+    h.time_stride = FREC_INDEX_STRIDE;
+    h.time_entries = time.size();
+    h.msgids = dir.size();
+    h.time_offset = sizeof(h);
+    h.dir_offset = h.time_offset + time.size() * sizeof(Frec_Index_Time);
+    h.list_offset = h.dir_offset + dir.size() * sizeof(Frec_Index_Msgid);
+
+    FILE* f = fopen(path, "wb");
+    if (f == NULL)
+    {
+        printf("Flight recorder: could not create %s\n", path);
+        return -1;
+    }
+
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+    if (!time.empty())
+        ok = ok && fwrite(&time[0], sizeof(Frec_Index_Time), time.size(), f) == time.size();
+    if (!dir.empty())
+        ok = ok && fwrite(&dir[0], sizeof(Frec_Index_Msgid), dir.size(), f) == dir.size();
+    if (!list.empty())
+        ok = ok && fwrite(&list[0], sizeof(uint32_t), list.size(), f) == list.size();
+    if (fclose(f) != 0)
+        ok = false;
+
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,48 @@
+/**
+ * @file frec_index.h
+ *
+ * @brief Index of a segment of the flight recorder
+ *
+ * Built from the .meta records and the .tlog of a segment: by the writer
+ * thread when the segment is closed (saved as <prefix>_NNN.idx), or by
+ * the reader for a segment left without index. See flight_recorder.h for
+ * the layout of the file.
+ *
+ */
+
+#ifndef FREC_INDEX_H_
+#define FREC_INDEX_H_
+
+// ------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <vector>
+
+#include "flight_recorder.h"
+
+
+// ---------------------------------------------------------------------
+//   Flight Recorder Index Class
+// ---------------------------------------------------------------------
+class Frec_Index
+{
+
+    public:
+
+        // Index the first n records of a segment
+        void build(const Frec_Meta_Record* rec, uint64_t n, const uint8_t* tlog);
+
+        // Save as a .idx file (0 = ok)
+        int write(const char* path, uint32_t segment);
+
+        uint64_t records;
+
+        std::vector<Frec_Index_Time> time;
+        std::vector<Frec_Index_Msgid> dir;
+        std::vector<uint32_t> list;
+};
+
+
+#endif // FREC_INDEX_H_
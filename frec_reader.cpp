@@ -0,0 +1,427 @@
+/**
+ * @file frec_reader.cpp
+ *
+ * @brief Reader of the segments written by the flight recorder
+ *
+ */
+
+#include "frec_reader.h"
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+
+// ------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------
+Frec_Reader::Frec_Reader()
+{
+    frames = 0;
+    bad_records = 0;
+    first_ns = 0;
+    last_ns = 0;
+    built_indexes = 0;
+    cur_segment = 0;
+    cur_record = 0;
+    filter = -1;
+    from_ns = 0;
+    to_ns = (uint64_t)-1;
+    past_end = 0;
+}
+
+Frec_Reader::~Frec_Reader()
+{
+    close();
+}
+
+// ------------------------------------------------------------------------
+//  FUNCTIONS
+// ------------------------------------------------------------------------
+
+//
+// map_file
+//
+// Whole file mapped read only, NULL if missing or empty
+//
+static const uint8_t* map_file(const char* path, size_t* size)
+{
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0)
+    {
+        ::close(fd);
+        return NULL;
+    }
+
+    void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+    {
+        printf("Flight recorder reader: could not map %s (%s)\n", path, strerror(errno));
+        return NULL;
+    }
+
+    *size = st.st_size;
+    return (const uint8_t*)p;
+}
+
+//
+// open_segment
+//
+// Returns 0 if the segment has been added, -1 if it does not exist or it
+// is not a recording
+//
+int Frec_Reader::open_segment(const char* prefix, uint32_t n)
+{
+    char path[256];
+    Frec_Segment s;
+
+    snprintf(path, sizeof(path), "%s_%03u.meta", prefix, n);
+    s.meta = map_file(path, &s.meta_size);
+    if (s.meta == NULL)
+        return -1;
+
+    s.header = (const Frec_Meta_Header*)s.meta;
+    if (s.meta_size < sizeof(Frec_Meta_Header) ||
+            memcmp(s.header->magic, FREC_META_MAGIC, sizeof(s.header->magic)) != 0 ||
+            s.header->version != FREC_META_VERSION ||
+            s.header->record_size != sizeof(Frec_Meta_Record))
+    {
+        printf("Flight recorder reader: %s is not a recording\n", path);
+        munmap((void*)s.meta, s.meta_size);
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), "%s_%03u.tlog", prefix, n);
+    s.tlog = map_file(path, &s.tlog_size);
+    if (s.tlog == NULL)
+    {
+        s.tlog_size = 0;
+        if (s.header->records > 0)
+            printf("Flight recorder reader: %s is missing\n", path);
+    }
+
+    // Records in the file, at most those of the header
+    uint64_t in_file = (s.meta_size - sizeof(Frec_Meta_Header)) / sizeof(Frec_Meta_Record);
+    s.records = (s.header->records < in_file) ? s.header->records : in_file;
+
+    const Frec_Meta_Record* rec = (const Frec_Meta_Record*)(s.meta + sizeof(Frec_Meta_Header));
+    s.rec = rec;
+    for (uint64_t i = 0; i < s.records; i++)
+    {
+        if ((uint64_t)rec[i].tlog_offset + 8 + rec[i].len > s.tlog_size)
+        {
+            bad_records += s.records - i;
+            s.records = i;
+            break;
+        }
+    }
+
+    for (uint64_t i = 0; i < s.records; i++)
+    {
+        if (frames + i == 0 || rec[i].mono_ns < first_ns)
+            first_ns = rec[i].mono_ns;
+        if (rec[i].mono_ns > last_ns)
+            last_ns = rec[i].mono_ns;
+    }
+    s.first_index = frames;
+    frames += s.records;
+    open_index(prefix, n, &s);
+    segments.push_back(s);
+    return 0;
+}
+
+//
+// open_index
+//
+// The .idx is used only if it covers exactly the records read
+//
+void Frec_Reader::open_index(const char* prefix, uint32_t n, Frec_Segment* s)
+{
+    char path[256];
+
+    snprintf(path, sizeof(path), "%s_%03u.idx", prefix, n);
+    s->built = NULL;
+    s->idx = map_file(path, &s->idx_size);
+    if (s->idx != NULL)
+    {
+        const Frec_Index_Header* h = (const Frec_Index_Header*)s->idx;
+        if (s->idx_size >= sizeof(*h) &&
+                memcmp(h->magic, FREC_INDEX_MAGIC, sizeof(FREC_INDEX_MAGIC)) == 0 &&
+                h->version == FREC_INDEX_VERSION && h->records == s->records &&
+                h->time_stride == FREC_INDEX_STRIDE &&
+                h->list_offset + s->records * sizeof(uint32_t) <= s->idx_size &&
+                h->dir_offset + (uint64_t)h->msgids * sizeof(Frec_Index_Msgid) <= h->list_offset &&
+                h->time_offset + (uint64_t)h->time_entries * sizeof(Frec_Index_Time) <= h->dir_offset)
+        {
+            s->time = (const Frec_Index_Time*)(s->idx + h->time_offset);
+            s->time_entries = h->time_entries;
+            s->dir = (const Frec_Index_Msgid*)(s->idx + h->dir_offset);
+            s->msgids = h->msgids;
+            s->list = (const uint32_t*)(s->idx + h->list_offset);
+            return;
+        }
+        munmap((void*)s->idx, s->idx_size);
+        s->idx = NULL;
+    }
+
+    // Missing (crash) or stale
+    s->built = new Frec_Index;
+    s->built->build(s->rec, s->records, s->tlog);
+    s->time = s->built->time.empty() ? NULL : &s->built->time[0];
+    s->time_entries = s->built->time.size();
+    s->dir = s->built->dir.empty() ? NULL : &s->built->dir[0];
+    s->msgids = s->built->dir.size();
+    s->list = s->built->list.empty() ? NULL : &s->built->list[0];
+    built_indexes++;
+}
+
+//
+// open
+//
+int Frec_Reader::open(const char* prefix)
+{
+    close();
+
+    for (uint32_t n = 0; open_segment(prefix, n) == 0; n++)
+        ;
+
+    if (segments.empty())
+    {
+        printf("Flight recorder reader: no segment %s_000.meta\n", prefix);
+        return -1;
+    }
+    rewind();
+    return 0;
+}
+
+//
+// close
+//
+void Frec_Reader::close()
+{
+    for (size_t i = 0; i < segments.size(); i++)
+    {
+        if (segments[i].tlog != NULL)
+            munmap((void*)segments[i].tlog, segments[i].tlog_size);
+        munmap((void*)segments[i].meta, segments[i].meta_size);
+        if (segments[i].idx != NULL)
+            munmap((void*)segments[i].idx, segments[i].idx_size);
+        delete segments[i].built;
+    }
+    segments.clear();
+
+    frames = 0;
+    bad_records = 0;
+    first_ns = 0;
+    last_ns = 0;
+    built_indexes = 0;
+    rewind();
+}
+
+//
+// rewind
+//
+void Frec_Reader::rewind()
+{
+    cur_segment = 0;
+    cur_record = 0;
+    filter = -1;
+    from_ns = 0;
+    to_ns = (uint64_t)-1;
+    past_end = 0;
+}
+
+//
+// seek_time
+//
+// First segment with a frame at or after the time, last entry of its
+// time index not after the time, then one entry back: the records out
+// of order within a stride are not skipped. The position is then moved
+// forward through the records up to the first one at or after the time.
+//
+void Frec_Reader::seek_time(uint64_t mono_ns)
+{
+    cur_segment = 0;
+    cur_record = 0;
+
+    while (cur_segment < segments.size())
+    {
+        const Frec_Segment* s = &segments[cur_segment];
+        uint64_t i = s->records;
+        while (i > 0 && s->rec[i - 1].mono_ns < mono_ns && s->records - i < FREC_INDEX_STRIDE)
+            i--;
+        if (i > 0 && s->rec[i - 1].mono_ns >= mono_ns)
+            break;
+        cur_segment++;
+    }
+    if (cur_segment == segments.size())
+        return;
+
+    const Frec_Segment* s = &segments[cur_segment];
+    uint32_t low = 0;
+    uint32_t high = s->time_entries;
+    while (high - low > 1)
+    {
+        uint32_t mid = (low + high) / 2;
+        if (s->time[mid].mono_ns <= mono_ns)
+            low = mid;
+        else
+            high = mid;
+    }
+
+    if (low > 0)
+        low--;
+
+    cur_record = (s->time_entries > 0) ? s->time[low].record : 0;
+    while (cur_record < s->records && s->rec[cur_record].mono_ns < mono_ns)
+        cur_record++;
+}
+
+//
+// set_window
+//
+void Frec_Reader::set_window(uint64_t from, uint64_t to)
+{
+    from_ns = from;
+    to_ns = to;
+    past_end = 0;
+}
+
+//
+// select_msgid
+//
+void Frec_Reader::select_msgid(int64_t msgid)
+{
+    filter = msgid;
+}
+
+//
+// find_msgid
+//
+const Frec_Index_Msgid* Frec_Reader::find_msgid(const Frec_Segment* s, uint32_t msgid)
+{
+    uint32_t low = 0;
+    uint32_t high = s->msgids;
+    while (low < high)
+    {
+        uint32_t mid = (low + high) / 2;
+        if (s->dir[mid].msgid < msgid)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    if (low < s->msgids && s->dir[low].msgid == msgid)
+        return &s->dir[low];
+    return NULL;
+}
+
+//
+// count_msgid
+//
+uint64_t Frec_Reader::count_msgid(uint32_t msgid)
+{
+    uint64_t n = 0;
+    for (size_t i = 0; i < segments.size(); i++)
+    {
+        const Frec_Index_Msgid* d = find_msgid(&segments[i], msgid);
+        if (d != NULL)
+            n += d->count;
+    }
+    return n;
+}
+
+//
+// next_record
+//
+// Moves to the next record of the selected msgid, if any, from the
+// current one (false at the end)
+//
+bool Frec_Reader::next_record()
+{
+    for (;;)
+    {
+        while (cur_segment < segments.size() && cur_record >= segments[cur_segment].records)
+        {
+            cur_segment++;
+            cur_record = 0;
+        }
+        if (cur_segment == segments.size())
+            return false;
+
+        if (filter < 0)
+            return true;
+
+        // First record of the msgid from the current one
+        const Frec_Segment* s = &segments[cur_segment];
+        const Frec_Index_Msgid* d = find_msgid(s, (uint32_t)filter);
+        if (d != NULL)
+        {
+            const uint32_t* begin = s->list + d->first;
+            const uint32_t* end = begin + d->count;
+            const uint32_t* r = std::lower_bound(begin, end, (uint32_t)cur_record);
+            if (r != end)
+            {
+                cur_record = *r;
+                return true;
+            }
+        }
+        cur_record = s->records;
+    }
+}
+
+//
+// next
+//
+// The records out of the window are skipped, not taken as its end
+//
+bool Frec_Reader::next(Frec_Frame* f)
+{
+    for (;;)
+    {
+        if (!next_record())
+            return false;
+
+        uint64_t t = segments[cur_segment].rec[cur_record].mono_ns;
+        if (t > to_ns)
+        {
+            if (++past_end >= FREC_INDEX_STRIDE)
+                return false;
+        }
+        else
+            past_end = 0;
+        if (t >= from_ns && t <= to_ns)
+            break;
+        cur_record++;
+    }
+
+    const Frec_Segment* s = &segments[cur_segment];
+    const Frec_Meta_Record* m = &s->rec[cur_record];
+    const uint8_t* p = s->tlog + m->tlog_offset;
+
+    // .tlog timestamp: big endian
+    uint64_t us = 0;
+    for (int i = 0; i < 8; i++)
+        us = (us << 8) | p[i];
+
+    f->mono_ns = m->mono_ns;
+    f->wall_us = us;
+    f->data = p + 8;
+    f->len = m->len;
+    f->link = m->link;
+    f->dir = m->dir;
+    f->msgid = frec_frame_msgid(f->data, f->len);
+    f->segment = s->header->segment;
+    f->index = s->first_index + cur_record;
+
+    cur_record++;
+    return true;
+}
@@ -0,0 +1,151 @@
+/**
+ * @file frec_reader.h
+ *
+ * @brief Reader of the segments written by the flight recorder
+ *
+ * The .tlog and .meta files of all the segments of a recording
+ * (<prefix>_000, <prefix>_001, ...) are mapped read only and walked in
+ * the order of the .meta records, that is in monotonic time order
+ * within a segment. A frame published late by a producer may be older
+ * than the end of the previous segment, and older recordings are not
+ * sorted at all (see flight_recorder.h): the time window of
+ * set_window() tolerates records out of order within
+ * FREC_INDEX_STRIDE records. The frames point into the mapping: they
+ * are valid until close().
+ *
+ * A segment is read up to the records counted in its header (the files
+ * of a crashed session are not truncated). A record pointing outside the
+ * .tlog ends the segment and is counted as bad.
+ *
+ * The .idx of each segment is mapped as well (it is built in memory when
+ * missing or stale): seek_time() jumps to a time through the sparse time
+ * index, select_msgid() restricts next() to the records of one msgid
+ * through its list, without reading the other frames.
+ *
+ * first_ns and last_ns are the oldest and newest frames of the whole
+ * recording.
+ *
+ */
+
+#ifndef FREC_READER_H_
+#define FREC_READER_H_
+
+// ------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#include "flight_recorder.h"
+#include "frec_index.h"
+
+
+// ------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------
+// Frame of a recording
+struct Frec_Frame {
+
+    uint64_t mono_ns;           // CLOCK_MONOTONIC of the read/write
+    uint64_t wall_us;           // Timestamp of the .tlog record
+    const uint8_t* data;        // Wire bytes
+    uint16_t len;
+    uint8_t link;               // FREC_LINK_*
+    uint8_t dir;                // FREC_DIR_*
+    uint32_t msgid;
+    uint32_t segment;
+    uint64_t index;             // Position in the whole recording
+};
+
+// Mapped segment
+struct Frec_Segment {
+
+    const uint8_t* tlog;
+    size_t tlog_size;
+    const uint8_t* meta;
+    size_t meta_size;
+    const Frec_Meta_Header* header;
+    const Frec_Meta_Record* rec;
+    uint64_t records;           // Usable records
+    uint64_t first_index;       // Index of the first record in the recording
+
+    // Index: mapped from the .idx, or built in memory
+    const uint8_t* idx;
+    size_t idx_size;
+    Frec_Index* built;
+    const Frec_Index_Time* time;
+    uint32_t time_entries;
+    const Frec_Index_Msgid* dir;
+    uint32_t msgids;
+    const uint32_t* list;
+};
+
+
+// ---------------------------------------------------------------------
+//   Flight Recorder Reader Class
+// ---------------------------------------------------------------------
+class Frec_Reader
+{
+
+    public:
+
+        Frec_Reader();
+        ~Frec_Reader();
+
+        // Map the segments of a recording (0 = ok, -1 = no readable segment)
+        int open(const char* prefix);
+        void close();
+
+        // Next frame in time order (false at the end)
+        bool next(Frec_Frame* f);
+
+        // Back to the first frame
+        void rewind();
+
+        // Go to the first frame at or after a monotonic time (a stride
+        // of the time index before it, see set_window())
+        void seek_time(uint64_t mono_ns);
+
+        // Only the frames in [from_ns, to_ns] from the current position.
+        // The walk ends after FREC_INDEX_STRIDE records in a row past
+        // to_ns.
+        void set_window(uint64_t from_ns, uint64_t to_ns);
+
+        // Only the frames of a msgid from the current position
+        // (-1 = all the frames)
+        void select_msgid(int64_t msgid);
+
+        // Frames of a msgid in the recording (from the indexes)
+        uint64_t count_msgid(uint32_t msgid);
+
+        std::vector<Frec_Segment> segments;
+
+        // Whole recording
+        uint64_t frames;
+        uint64_t bad_records;
+        uint64_t first_ns;
+        uint64_t last_ns;
+
+        // Segments whose .idx was missing or stale
+        uint32_t built_indexes;
+
+    private:
+
+        size_t cur_segment;
+        uint64_t cur_record;
+        int64_t filter;
+        uint64_t from_ns;
+        uint64_t to_ns;
+        uint32_t past_end;          // Records in a row after to_ns
+
+        bool next_record();
+        int open_segment(const char* prefix, uint32_t n);
+        void open_index(const char* prefix, uint32_t n, Frec_Segment* s);
+        const Frec_Index_Msgid* find_msgid(const Frec_Segment* s, uint32_t msgid);
+};
+
+
+#endif // FREC_READER_H_
@@ -0,0 +1,355 @@
+/**
+ * @file ground_truth.cpp
+ *
+ * @brief Recorder of the state of the model at each simulation step
+ *
+ */
+
+#include "ground_truth.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include <zlib.h>
+
+
+// ------------------------------------------------------------------------
+//   Fields
+// ------------------------------------------------------------------------
+struct Gt_Field {
+
+    const char* name;
+    size_t offset;
+    unsigned count;
+    unsigned size;
+    uint8_t type;
+};
+
+#define GT_FIELD(member, ctype, type) \
+    { #member, offsetof(Gt_Sample, member), \
+      sizeof(((Gt_Sample*)0)->member) / sizeof(ctype), sizeof(ctype), type }
+
+static const Gt_Field gt_fields[] = {
+    GT_FIELD(time_ns, uint64_t, GT_TYPE_U64),
+    GT_FIELD(u.PWM1, real_T, GT_TYPE_F64),
+    GT_FIELD(u.PWM2, real_T, GT_TYPE_F64),
+    GT_FIELD(u.PWM3, real_T, GT_TYPE_F64),
+    GT_FIELD(u.PWM4, real_T, GT_TYPE_F64),
+    GT_FIELD(y.Temp, real32_T, GT_TYPE_F32),
+    GT_FIELD(y.Press, real32_T, GT_TYPE_F32),
+    GT_FIELD(y.diff_Pres, real32_T, GT_TYPE_F32),
+    GT_FIELD(y.Baro_Alt, real32_T, GT_TYPE_F32),
+    GT_FIELD(y.Gps_Lat, real32_T, GT_TYPE_F32),
+    GT_FIELD(y.Gps_Lon, real32_T, GT_TYPE_F32),
+    GT_FIELD(y.Gps_Alt, real32_T, GT_TYPE_F32),
+    GT_FIELD(y.Gps_V, real32_T, GT_TYPE_F32),
+    GT_FIELD(y.Gps_V_Mod, real32_T, GT_TYPE_F32),
+    GT_FIELD(y.COG, real32_T, GT_TYPE_F32),
+    GT_FIELD(y.Lat_Lon_Alt, real32_T, GT_TYPE_F32),
+    GT_FIELD(y.Magn, real32_T, GT_TYPE_F32),
+    GT_FIELD(y.RPY, real32_T, GT_TYPE_F32),
+    GT_FIELD(y.Accelerometer, real32_T, GT_TYPE_F32),
+    GT_FIELD(y.Gyro, real32_T, GT_TYPE_F32),
+    GT_FIELD(y.Quaternion, real32_T, GT_TYPE_F32),
+    GT_FIELD(y.Sonar, real32_T, GT_TYPE_F32),
+    GT_FIELD(y.Forces, real_T, GT_TYPE_F64),
+    GT_FIELD(y.Torques, real_T, GT_TYPE_F64),
+    GT_FIELD(y.Thursts, real_T, GT_TYPE_F64),
+    GT_FIELD(y.Rotor_Speed, real_T, GT_TYPE_F64),
+    GT_FIELD(pos, real_T, GT_TYPE_F64),
+    GT_FIELD(vel, real_T, GT_TYPE_F64),
+    GT_FIELD(quat, real_T, GT_TYPE_F64),
+    GT_FIELD(pqr, real_T, GT_TYPE_F64),
+};
+
+#define GT_FIELDS   (sizeof(gt_fields) / sizeof(gt_fields[0]))
+
+
+// ------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------
+Ground_Truth::Ground_Truth()
+{
+    active = false;
+    steps = 0;
+    drops = 0;
+    chunks = 0;
+    raw_bytes = 0;
+    stored_bytes = 0;
+    write_errors = 0;
+
+    chunk[0].steps = 0;
+    chunk[1].steps = 0;
+    fill = 0;
+    full[0] = full[1] = false;
+
+    path[0] = '\0';
+    file = NULL;
+    compress = false;
+    stop_writer = false;
+    recording = false;
+    columns = NULL;
+    packed = NULL;
+    packed_size = 0;
+}
+
+Ground_Truth::~Ground_Truth()
+{
+    stop();
+}
+
+// ------------------------------------------------------------------------
+//  FUNCTIONS
+// ------------------------------------------------------------------------
+
+//
+// start
+//
+int Ground_Truth::start(const char* path_, bool compress_)
+{
+    snprintf(path, sizeof(path), "%s", path_);
+    compress = compress_;
+
+    columns = (uint8_t*)malloc(sizeof(Gt_Sample) * GT_CHUNK_STEPS);
+    packed_size = compressBound(sizeof(Gt_Sample) * GT_CHUNK_STEPS);
+    packed = compress ? (uint8_t*)malloc(packed_size) : NULL;
+    file = fopen(path, "wb");
+    if (columns == NULL || (compress && packed == NULL) || file == NULL)
+    {
+        printf("Ground truth: could not create %s\n", path);
+        stop();
+        return -1;
+    }
+
+    Gt_File_Header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, GT_MAGIC, sizeof(GT_MAGIC));
+    h.version = GT_VERSION;
+    h.fields = GT_FIELDS;
+    h.chunk_steps = GT_CHUNK_STEPS;
+    h.flags = compress ? GT_FLAG_ZLIB : 0;
+    fwrite(&h, sizeof(h), 1, file);
+
+    for (unsigned i = 0; i < GT_FIELDS; i++)
+    {
+        Gt_Field_Desc d;
+        memset(&d, 0, sizeof(d));
+        snprintf(d.name, sizeof(d.name), "%s", gt_fields[i].name);
+        d.type = gt_fields[i].type;
+        d.size = gt_fields[i].size;
+        d.count = gt_fields[i].count;
+        fwrite(&d, sizeof(d), 1, file);
+    }
+
+    stop_writer = false;
+    if (pthread_create(&writer, NULL, writer_thread, this) != 0)
+    {
+        printf("Ground truth: could not start the writer thread\n");
+        stop();
+        return -1;
+    }
+
+    __atomic_store_n(&active, true, __ATOMIC_RELEASE);
+    printf("Recording the ground truth to %s%s\n", path, compress ? " (zlib)" : "");
+    return 0;
+}
+
+//
+// stop
+//
+// Called by the main thread while the simulator task may still be in
+// record(): once active is clear and no record() is in progress, no
+// record() can touch the chunks any more
+//
+void Ground_Truth::stop()
+{
+    if (__atomic_exchange_n(&active, false, __ATOMIC_RELEASE))
+    {
+        struct timespec poll;
+        poll.tv_sec = 0;
+        poll.tv_nsec = GT_STOP_POLL_NS;
+
+        // Pairs with the fence of record(): either record() sees active
+        // clear or stop() sees it in progress
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&recording, __ATOMIC_ACQUIRE))
+            nanosleep(&poll, NULL);
+
+        __atomic_store_n(&stop_writer, true, __ATOMIC_RELEASE);
+        pthread_join(writer, NULL);
+
+        // The full chunk, if any, was filled before the current one
+        int other = 1 - fill;
+        if (full[other])
+            write_chunk(&chunk[other]);
+        if (full[fill] || chunk[fill].steps > 0)
+            write_chunk(&chunk[fill]);
+        full[0] = full[1] = false;
+    }
+
+    if (file != NULL && fclose(file) != 0)
+        write_errors++;
+    file = NULL;
+    free(columns);
+    free(packed);
+    columns = NULL;
+    packed = NULL;
+}
+
+//
+// hand_off
+//
+// The chunk being filled goes to the writer if it has done with the
+// other one
+//
+bool Ground_Truth::hand_off()
+{
+    int other = 1 - fill;
+    if (__atomic_load_n(&full[other], __ATOMIC_ACQUIRE))
+        return false;
+
+    __atomic_store_n(&full[fill], true, __ATOMIC_RELEASE);
+    fill = other;
+    chunk[fill].steps = 0;
+    return true;
+}
+
+//
+// record
+//
+void Ground_Truth::record(uint64_t now_ns, const ExtU_DynModel_T* u, const ExtY_DynModel_T* y,
+        const X_DynModel_T* x)
+{
+    __atomic_store_n(&recording, true, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&active, __ATOMIC_ACQUIRE))
+    {
+        __atomic_store_n(&recording, false, __ATOMIC_RELEASE);
+        return;
+    }
+
+    Gt_Chunk* c = &chunk[fill];
+    if (c->steps == GT_CHUNK_STEPS)
+    {
+        if (!hand_off())
+        {
+            drops++;
+            __atomic_store_n(&recording, false, __ATOMIC_RELEASE);
+            return;
+        }
+        c = &chunk[fill];
+    }
+
+    Gt_Sample* s = &c->sample[c->steps];
+    s->time_ns = now_ns;
+    s->u = *u;
+    s->y = *y;
+    memcpy(s->pos, x->xeyeze_CSTATE, sizeof(s->pos));
+    memcpy(s->vel, x->ubvbwb_CSTATE, sizeof(s->vel));
+    memcpy(s->quat, x->q0q1q2q3_CSTATE, sizeof(s->quat));
+    memcpy(s->pqr, x->pqr_CSTATE, sizeof(s->pqr));
+    c->steps++;
+    steps++;
+
+    if (c->steps == GT_CHUNK_STEPS)
+        hand_off();
+
+    __atomic_store_n(&recording, false, __ATOMIC_RELEASE);
+}
+
+//
+// write_chunk
+//
+// By column: the values of a field for all the steps are contiguous
+//
+void Ground_Truth::write_chunk(const Gt_Chunk* c)
+{
+    uint8_t* p = columns;
+    for (unsigned f = 0; f < GT_FIELDS; f++)
+    {
+        unsigned len = gt_fields[f].count * gt_fields[f].size;
+        for (uint32_t i = 0; i < c->steps; i++)
+        {
+            memcpy(p, (const uint8_t*)&c->sample[i] + gt_fields[f].offset, len);
+            p += len;
+        }
+    }
+
+    Gt_Chunk_Header h;
+    memcpy(h.magic, GT_CHUNK_MAGIC, sizeof(h.magic));
+    h.steps = c->steps;
+    h.raw_bytes = p - columns;
+
+    const uint8_t* data = columns;
+    h.stored_bytes = h.raw_bytes;
+    if (compress)
+    {
+        uLongf len = packed_size;
+        if (compress2(packed, &len, columns, h.raw_bytes, Z_BEST_SPEED) == Z_OK)
+        {
+            data = packed;
+            h.stored_bytes = len;
+        }
+        else
+        {
+            write_errors++;
+            return;
+        }
+    }
+
+    if (fwrite(&h, sizeof(h), 1, file) != 1 ||
+            fwrite(data, 1, h.stored_bytes, file) != h.stored_bytes)
+    {
+        write_errors++;
+        return;
+    }
+
+    chunks++;
+    raw_bytes += h.raw_bytes;
+    stored_bytes += h.stored_bytes;
+}
+
+//
+// writer_thread
+//
+void* Ground_Truth::writer_thread(void* arg)
+{
+    Ground_Truth* gt = (Ground_Truth*)arg;
+    struct timespec period;
+    period.tv_sec = 0;
+    period.tv_nsec = GT_PERIOD_NS;
+
+    while (!__atomic_load_n(&gt->stop_writer, __ATOMIC_ACQUIRE))
+    {
+        bool written = false;
+        for (int i = 0; i < 2; i++)
+        {
+            if (__atomic_load_n(&gt->full[i], __ATOMIC_ACQUIRE))
+            {
+                gt->write_chunk(&gt->chunk[i]);
+                __atomic_store_n(&gt->full[i], false, __ATOMIC_RELEASE);
+                written = true;
+            }
+        }
+        if (!written)
+            nanosleep(&period, NULL);
+    }
+    return NULL;
+}
+
+//
+// report
+//
+void Ground_Truth::report(FILE* f)
+{
+    if (path[0] == '\0')
+        return;
+
+    fprintf(f, "Ground truth %s: %lu steps, %lu dropped, %lu chunks, %lu bytes", path,
+            (unsigned long)steps, (unsigned long)drops, (unsigned long)chunks,
+            (unsigned long)stored_bytes);
+    if (compress && stored_bytes > 0)
+        fprintf(f, " (%.1f:1)", (double)raw_bytes / stored_bytes);
+    fprintf(f, ", %lu write errors\n", (unsigned long)write_errors);
+}
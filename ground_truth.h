@@ -0,0 +1,183 @@
+/**
+ * @file ground_truth.h
+ *
+ * @brief Recorder of the state of the model at each simulation step
+ *
+ * The simulator task copies, after each DynModel_step(), the inputs,
+ * the outputs (ExtY_DynModel_T: sensors, forces, torques, thrusts, rotor
+ * speeds, attitude) and the main continuous states (position, body
+ * velocity, quaternion, body rates) into a pre-allocated chunk of
+ * GT_CHUNK_STEPS steps. The copy is all the task does: when a chunk is
+ * full it is handed to a background thread and the task goes on with
+ * the other one (double buffering). If the thread has not written the
+ * other chunk yet the steps are dropped and counted.
+ *
+ * The thread writes the chunks by column (each field of all the steps
+ * of the chunk together), compressed with zlib if requested:
+ *
+ *   Gt_File_Header
+ *   Gt_Field_Desc x fields          name, type and elements of a field
+ *   Gt_Chunk_Header + data          for each chunk, for each field:
+ *                                   steps x count values
+ *
+ * gt_export converts a file to CSV.
+ *
+ */
+
+#ifndef GROUND_TRUTH_H_
+#define GROUND_TRUTH_H_
+
+// ------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+extern "C"
+{
+    #include "DynModel.h"
+}
+
+// ------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------
+
+// Steps of a chunk (4 s at 250 Hz)
+#define GT_CHUNK_STEPS      1000
+
+// Period of the writer thread when there is nothing to write (ns)
+#define GT_PERIOD_NS        50000000L
+
+// Poll of stop() waiting for a record() in progress (ns)
+#define GT_STOP_POLL_NS     100000L
+
+#define GT_MAGIC            "GTRUTH"
+#define GT_CHUNK_MAGIC      "GTCK"
+#define GT_VERSION          1
+
+// Gt_File_Header.flags
+#define GT_FLAG_ZLIB        1
+
+// Gt_Field_Desc.type
+#define GT_TYPE_U64         'u'
+#define GT_TYPE_F32         'f'
+#define GT_TYPE_F64         'd'
+
+
+// ------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------
+// State of the model after a step
+struct Gt_Sample {
+
+    uint64_t time_ns;           // CLOCK_MONOTONIC at the end of the step
+    ExtU_DynModel_T u;
+    ExtY_DynModel_T y;
+    real_T pos[3];              // xe, ye, ze
+    real_T vel[3];              // ub, vb, wb
+    real_T quat[4];             // q0 q1 q2 q3
+    real_T pqr[3];              // p, q, r
+};
+
+struct Gt_Chunk {
+
+    uint32_t steps;
+    Gt_Sample sample[GT_CHUNK_STEPS];
+};
+
+// Header of a file
+struct Gt_File_Header {
+
+    char magic[8];              // GT_MAGIC
+    uint32_t version;           // GT_VERSION
+    uint32_t fields;
+    uint32_t chunk_steps;       // GT_CHUNK_STEPS
+    uint32_t flags;             // GT_FLAG_*
+};
+
+// Field (column) of the file
+struct Gt_Field_Desc {
+
+    char name[32];
+    uint8_t type;               // GT_TYPE_*
+    uint8_t size;               // Bytes of an element
+    uint16_t count;             // Elements per step
+    uint32_t reserved;
+};
+
+// Header of a chunk
+struct Gt_Chunk_Header {
+
+    char magic[4];              // GT_CHUNK_MAGIC
+    uint32_t steps;
+    uint32_t raw_bytes;         // Columns of the chunk
+    uint32_t stored_bytes;      // Bytes that follow (compressed or not)
+};
+
+
+// ---------------------------------------------------------------------
+//   Ground Truth Recorder Class
+// ---------------------------------------------------------------------
+class Ground_Truth
+{
+
+    public:
+
+        Ground_Truth();
+        ~Ground_Truth();
+
+        // Create the file and start the writer thread (0 = ok)
+        int start(const char* path, bool compress);
+
+        // Write the chunks left and close the file
+        void stop();
+
+        // Simulator task, after each step. Never blocks.
+        void record(uint64_t now_ns, const ExtU_DynModel_T* u, const ExtY_DynModel_T* y,
+                const X_DynModel_T* x);
+
+        void report(FILE* f);
+
+        // Written by start() and stop(), read by record() with acquire
+        bool active;
+
+        uint64_t steps;
+        uint64_t drops;
+
+        // Writer side statistics
+        uint64_t chunks;
+        uint64_t raw_bytes;
+        uint64_t stored_bytes;
+        uint64_t write_errors;
+
+    private:
+
+        Gt_Chunk chunk[2];
+        int fill;                   // Chunk filled by the simulator task
+        bool full[2];               // Handed to the writer thread
+
+        char path[256];
+        FILE* file;
+        bool compress;
+        pthread_t writer;
+        volatile bool stop_writer;
+
+        // record() in progress: stop() waits for it before writing the
+        // chunk being filled
+        bool recording;
+
+        // Buffers of the writer, allocated at start
+        uint8_t* columns;
+        uint8_t* packed;
+        unsigned long packed_size;
+
+        bool hand_off();
+        void write_chunk(const Gt_Chunk* c);
+
+        static void* writer_thread(void* arg);
+};
+
+
+#endif // GROUND_TRUTH_H_
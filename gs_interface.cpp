@@ -5,6 +5,8 @@
 
 #include "gs_interface.h"
 
+#include <string.h>
+
 
 // ------------------------------------------------------------------
 // Ground Station Interface
@@ -37,10 +39,24 @@ GS_Interface::GS_Interface():
 	//init_mess_queue(&recQueue);
 
 	// Initialize Mutexes
-	pthread_mutex_init(&mut_sendQueue, 0);
-	pthread_mutex_init(&mut_recQueue, 0);
+	rt_mutex_init(&mut_sendQueue);
+	rt_mutex_init(&mut_recQueue);
 	started = 1;
 
+	mav_link_init(&mav_link, "gs", MAV_VERSION_AUTO);
+	link_quality.init("gs", &parser);
+	recorder = NULL;
+
+	raw_len[0] = raw_len[1] = 0;
+	raw_fill = 0;
+	raw_frames = 0;
+	raw_drops = 0;
+	queued = 0;
+	replay = false;
+	metrics_link = -1;
+	metrics_send_queue = -1;
+	metrics_rec_queue = -1;
+
 	for (i = 0; i < 512; i++)
 		rbuff[i] = 0;
 }
@@ -66,10 +82,24 @@ GS_Interface::GS_Interface(char *ip, uint32_t r_port, uint32_t w_port):
 	//init_mess_queue(&recQueue);
 
 	// Initilize Mutexes
-	pthread_mutex_init(&mut_sendQueue, 0);
-	pthread_mutex_init(&mut_recQueue, 0);
+	rt_mutex_init(&mut_sendQueue);
+	rt_mutex_init(&mut_recQueue);
 	started = 1;
 
+	mav_link_init(&mav_link, "gs", MAV_VERSION_AUTO);
+	link_quality.init("gs", &parser);
+	recorder = NULL;
+
+	raw_len[0] = raw_len[1] = 0;
+	raw_fill = 0;
+	raw_frames = 0;
+	raw_drops = 0;
+	queued = 0;
+	replay = false;
+	metrics_link = -1;
+	metrics_send_queue = -1;
+	metrics_rec_queue = -1;
+
 	for (i = 0; i < 512; i++)
 		rbuff[i] = 0;
 }
@@ -106,8 +136,10 @@ int GS_Interface::sendMessage()
 {
 	int bytes_sent;
 	mavlink_message_t sendMessage;
-	char buf[254];
+	mavlink_message_t convMessage;
+	uint8_t buf[MAVLINK_MAX_PACKET_LEN];
 	int len;
+	bool drained = false;
 
 	// Take the message from the queue
 
@@ -118,10 +150,100 @@ int GS_Interface::sendMessage()
 		sendMessage = sendQueue.front();
 		sendQueue.pop();
 		pthread_mutex_unlock(&mut_sendQueue);
+		drained = true;
 
 		//printf("sendQueue # = %d\n", sendQueue.size());
-		bytes_sent = udp_port.send_mav_mess(&sendMessage);
+		// In the MAVLink version spoken by the Ground Station
+		const mavlink_message_t* msg = mav_link_tx(&mav_link, &sendMessage, &convMessage);
+		len = mavlink_msg_to_send_buffer(buf, msg);
+		bytes_sent = sendDatagram(buf, len);
+		metrics_frame(metrics_link, METRICS_DIR_TX, msg->msgid, len);
+		if (recorder != NULL)
+			recorder->record(FREC_LINK_GS, FREC_DIR_TX, buf, len, time_monotonic_ns());
+	}
+
+	// Depth left once per flush (other tasks may have queued meanwhile)
+	if (drained)
+	{
+		pthread_mutex_lock(&mut_sendQueue);
+		metrics_gauge(metrics_send_queue, sendQueue.size());
+		pthread_mutex_unlock(&mut_sendQueue);
 	}
+
+	sendRaw();
+	return bytes_sent;
+}
+
+//
+// sendDatagram
+//
+int GS_Interface::sendDatagram(const uint8_t* buf, unsigned len)
+{
+	if (replay)
+		return len;
+	return udp_port.send_bytes((char*)buf, len);
+}
+
+//
+// raw_frame_len
+//
+// Length of a validated frame from its header
+//
+static inline unsigned raw_frame_len(const uint8_t* frame)
+{
+	if (frame[0] == MAVLINK_STX_MAVLINK1)
+		return frame[1] + MAVLINK_CORE_HEADER_MAVLINK1_LEN + 1 + MAVLINK_NUM_CHECKSUM_BYTES;
+
+	unsigned len = frame[1] + MAVLINK_NUM_NON_PAYLOAD_BYTES;
+	if (frame[2] & MAVLINK_IFLAG_SIGNED)
+		len += MAVLINK_SIGNATURE_BLOCK_LEN;
+	return len;
+}
+
+//
+// sendRaw
+//
+// Send the raw frames queued so far, packed in datagrams of at most
+// GS_RAW_DATAGRAM bytes (frames are never split)
+//
+int GS_Interface::sendRaw()
+{
+	pthread_mutex_lock(&mut_sendQueue);
+	int idx = raw_fill;
+	unsigned len = raw_len[idx];
+	if (len > 0)
+		raw_fill = 1 - idx;
+	pthread_mutex_unlock(&mut_sendQueue);
+
+	if (len == 0)
+		return 0;
+
+	uint8_t* buf = raw_buf[idx];
+	unsigned start = 0;
+	unsigned end = 0;
+	int bytes_sent = 0;
+	uint64_t now_ns = time_monotonic_ns();
+
+	while (end < len)
+	{
+		unsigned flen = raw_frame_len(buf + end);
+		metrics_frame(metrics_link, METRICS_DIR_TX, frec_frame_msgid(buf + end, flen), flen);
+		if (recorder != NULL)
+			recorder->record(FREC_LINK_GS, FREC_DIR_TX, buf + end, flen, now_ns);
+		if (end > start && end + flen - start > GS_RAW_DATAGRAM)
+		{
+			bytes_sent += sendDatagram(buf + start, end - start);
+			start = end;
+		}
+		end += flen;
+	}
+	bytes_sent += sendDatagram(buf + start, end - start);
+
+	// The buffer can be filled again
+	pthread_mutex_lock(&mut_sendQueue);
+	raw_len[idx] = 0;
+	pthread_mutex_unlock(&mut_sendQueue);
+
 	return bytes_sent;
 }
 
@@ -130,11 +252,8 @@ int GS_Interface::sendMessage()
 //
 int GS_Interface::receiveMessage()
 {
-	int i;
 	uint16_t timeout = 0;  // ms
-	int8_t read_bytes = 0;
-	mavlink_message_t recMessage;
-	mavlink_status_t status;
+	int read_bytes = 0;
 
 
 	int ret = poll(fdsR, 1, timeout);
@@ -152,22 +271,81 @@ int GS_Interface::receiveMessage()
 	}
 	else
 	{
-		// Receive data num bytes over UDP and put them at the sensors address
-		read_bytes = udp_port.receive_bytes(rbuff, sizeof(mavlink_message_t));
-		for (i = 0; i < read_bytes; i++)
+		// Receive data num bytes over UDP and parse them
+		read_bytes = udp_port.receive_bytes(rbuff, sizeof(rbuff));
+		receiveBytes((uint8_t*)rbuff, read_bytes);
+	}
+	return 1;
+}
+
+//
+// receiveBytes
+//
+// The messages parsed are queued for getMessage()
+//
+void GS_Interface::receiveBytes(const uint8_t* buf, int len)
+{
+	mavlink_message_t &recMessage = parser.msg;
+
+	for (int i = 0; i < len; i++)
+	{
+		// Parse 1 byte at time
+		if (parser.parse(buf[i]))
 		{
-			// Parse 1 byte at time
-			if (mavlink_parse_char(MAVLINK_COMM_2, rbuff[i], &recMessage, &status))
+			uint64_t now_ns = time_monotonic_ns();
+			mav_link_rx(&mav_link, &recMessage, now_ns);
+			link_quality.add_frame(&recMessage);
+			metrics_frame(metrics_link, METRICS_DIR_RX, recMessage.msgid,
+					mav_frame_len(&recMessage));
+
+			if (recorder != NULL)
 			{
-				pthread_mutex_lock(&mut_recQueue);
-				recQueue.push(recMessage);
-				//printf("recQueue # = %d\n", recQueue.size());
-				//printf("Message id %d\n", recMessage.msgid);
-				pthread_mutex_unlock(&mut_recQueue);
+				// The frame ends with this byte (serialized again
+				// if it started in a previous datagram)
+				unsigned flen = mav_frame_len(&recMessage);
+				if ((unsigned)i + 1 >= flen)
+				{
+					recorder->record(FREC_LINK_GS, FREC_DIR_RX,
+							buf + i + 1 - flen, flen, now_ns);
+				}
+				else
+				{
+					uint8_t frame[MAVLINK_MAX_PACKET_LEN];
+					flen = mavlink_msg_to_send_buffer(frame, &recMessage);
+					recorder->record(FREC_LINK_GS, FREC_DIR_RX, frame, flen, now_ns);
+				}
 			}
+
+			pthread_mutex_lock(&mut_recQueue);
+			recQueue.push(recMessage);
+			metrics_gauge(metrics_rec_queue, recQueue.size());
+			//printf("recQueue # = %d\n", recQueue.size());
+			//printf("Message id %d\n", recMessage.msgid);
+			pthread_mutex_unlock(&mut_recQueue);
+		}
+		else if (parser.bad_frame)
+		{
+			link_quality.add_bad_crc(&recMessage);
 		}
 	}
-	return 1;
+}
+
+
+//
+// metrics_register
+//
+// The depth of a queue is sampled when messages are queued and when
+// they are taken from it
+//
+void GS_Interface::metrics_register(const char* name)
+{
+	char gauge[METRICS_NAME_LEN];
+
+	metrics_link = metrics_register_link(name);
+	snprintf(gauge, sizeof(gauge), "%s_send_queue", name);
+	metrics_send_queue = metrics_register_gauge(gauge);
+	snprintf(gauge, sizeof(gauge), "%s_rec_queue", name);
+	metrics_rec_queue = metrics_register_gauge(gauge);
 }
 
 
@@ -178,7 +356,39 @@ int GS_Interface::pushMessage(mavlink_message_t* msg)
 {
 	pthread_mutex_lock(&mut_sendQueue);
 	sendQueue.push(*msg);
+	queued++;
+	metrics_gauge(metrics_send_queue, sendQueue.size());
+	pthread_mutex_unlock(&mut_sendQueue);
+	return 1;
+}
+
+
+//
+// pushRaw
+//
+// Frames in the version spoken with the Ground Station are copied once,
+// from the receive buffer of the board link to the UDP buffer
+//
+int GS_Interface::pushRaw(const mavlink_message_t* msg, const uint8_t* frame, unsigned len)
+{
+	int version = (msg->magic == MAVLINK_STX_MAVLINK1) ? MAV_VERSION_1 : MAV_VERSION_2;
+	if (version != mav_link.out)
+		return 0;
+
+	pthread_mutex_lock(&mut_sendQueue);
+	unsigned* fill = &raw_len[raw_fill];
+	if (*fill + len <= GS_RAW_BYTES)
+	{
+		memcpy(raw_buf[raw_fill] + *fill, frame, len);
+		*fill += len;
+		raw_frames++;
+	}
+	else
+	{
+		raw_drops++;
+	}
 	pthread_mutex_unlock(&mut_sendQueue);
+
 	return 1;
 }
 
@@ -186,17 +396,23 @@ int GS_Interface::pushMessage(mavlink_message_t* msg)
 // 
 // getMessage
 //
+// Returns 0 if there are no messages from the GS
+//
 int GS_Interface::getMessage(mavlink_message_t* msg)
 {
+	int ret = 0;
+
 	pthread_mutex_lock(&mut_recQueue);
 	if (!recQueue.empty())
 	{
 		*msg = recQueue.front();
 		recQueue.pop();
+		metrics_gauge(metrics_rec_queue, recQueue.size());
+		ret = 1;
 	}
 
 	//printf("recQueue # = %d\n", recQueue.size());
 	pthread_mutex_unlock(&mut_recQueue);
 
-	return 1;
+	return ret;
 }
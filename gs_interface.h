@@ -8,7 +8,15 @@
  */
 
 #include "udp_port.h"
+#include "rt_setup.h"
+#include "time_utils.h"
+#include "mav_version.h"
+#include "mav_parser.h"
+#include "link_quality.h"
+#include "flight_recorder.h"
+#include "metrics.h"
 #include <time.h>
+#include "mav_crc.h"
 #include "common/mavlink.h"
 #include <poll.h>
 #include <queue>
@@ -19,6 +27,12 @@ extern "C" {
 #include "ptask.h"
 }
 
+// Raw frames waiting to be sent, per buffer
+#define GS_RAW_BYTES      4096
+
+// Largest datagram of raw frames sent to the Ground Station
+#define GS_RAW_DATAGRAM   1400
+
 class GS_Interface {
 
     public:
@@ -38,12 +52,50 @@ class GS_Interface {
         int sendMessage();
         int receiveMessage();
 
+        // Parse the bytes of a datagram (read by receiveMessage, or
+        // recorded)
+        void receiveBytes(const uint8_t* buf, int len);
+
         int pushMessage(mavlink_message_t* message);
         int getMessage(mavlink_message_t* message);
 
+        // Raw passthrough: queue the original bytes of a frame (0 if the
+        // frame has to be converted and goes through pushMessage)
+        int pushRaw(const mavlink_message_t* msg, const uint8_t* frame, unsigned len);
+        int sendRaw();
+
         int started;
 
         Udp_Port udp_port;
+
+        // MAVLink version spoken with the Ground Station
+        Mav_Link_Version mav_link;
+
+        // Parser of the frames received from the Ground Station
+        Mavlink_Parser parser;
+
+        // Loss, duplicates and errors of the frames from the Ground Station
+        Link_Quality link_quality;
+
+        // Recorder of the frames read and written (optional)
+        Flight_Recorder* recorder;
+
+        // Raw passthrough statistics
+        uint64_t raw_frames;
+        uint64_t raw_drops;
+
+        // Messages queued by pushMessage
+        uint64_t queued;
+
+        // Live metrics of the link and of its queues (-1 = not published)
+        void metrics_register(const char* name);
+        int metrics_link;
+        int metrics_send_queue;
+        int metrics_rec_queue;
+
+        // Replay: the datagrams for the Ground Station are built but not
+        // sent
+        bool replay;
         
 
     private:
@@ -64,5 +116,13 @@ class GS_Interface {
 		
 		char rbuff[512];
 
+		int sendDatagram(const uint8_t* buf, unsigned len);
+
+        // Raw frames, double buffered: the inflow task fills one buffer 
+        // while the GS task sends the other (protected by mut_sendQueue)
+        uint8_t raw_buf[2][GS_RAW_BYTES];
+        unsigned raw_len[2];
+        int raw_fill;
+
 };
 
@@ -0,0 +1,237 @@
+/*
+ * file: gt_export.cpp
+ *
+ * Conversion to CSV of the ground truth written by the router
+ * (-ground_truth): one row per simulation step, one column per element
+ * of the fields.
+ *
+ * usage: gt_export <file.gt> [-fields <name,name,...>] [-every <n>] [-info]
+ *
+ *   -fields   only the fields given (e.g. time_ns,pos,quat)
+ *   -every    one step every n
+ *   -info     fields and chunks of the file only
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <zlib.h>
+
+#include "ground_truth.h"
+
+
+static const char* usage = "usage: gt_export <file.gt> [-fields <name,name,...>] [-every <n>] [-info]";
+
+//
+// selected
+//
+// Name in the comma separated list (all if no list)
+//
+static bool selected(const char* list, const char* name)
+{
+    if (list == NULL)
+        return true;
+
+    size_t len = strlen(name);
+    for (const char* p = list; p != NULL; p = strchr(p, ','))
+    {
+        if (*p == ',')
+            p++;
+        if (strncmp(p, name, len) == 0 && (p[len] == ',' || p[len] == '\0'))
+            return true;
+    }
+    return false;
+}
+
+//
+// print_value
+//
+static void print_value(const Gt_Field_Desc* d, const uint8_t* p)
+{
+    if (d->type == GT_TYPE_U64)
+    {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        printf("%lu", (unsigned long)v);
+    }
+    else if (d->type == GT_TYPE_F32)
+    {
+        float v;
+        memcpy(&v, p, sizeof(v));
+        printf("%.9g", v);
+    }
+    else
+    {
+        double v;
+        memcpy(&v, p, sizeof(v));
+        printf("%.17g", v);
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    const char* name = NULL;
+    const char* fields = NULL;
+    unsigned every = 1;
+    bool info = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-fields") == 0 && argc > i + 1)
+            fields = argv[++i];
+        else if (strcmp(argv[i], "-every") == 0 && argc > i + 1 && atoi(argv[i + 1]) > 0)
+            every = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-info") == 0)
+            info = true;
+        else if (argv[i][0] != '-' && name == NULL)
+            name = argv[i];
+        else
+        {
+            printf("%s\n", usage);
+            return EXIT_FAILURE;
+        }
+    }
+    if (name == NULL)
+    {
+        printf("%s\n", usage);
+        return EXIT_FAILURE;
+    }
+
+    FILE* f = fopen(name, "rb");
+    if (f == NULL)
+    {
+        fprintf(stderr, "Could not open %s\n", name);
+        return EXIT_FAILURE;
+    }
+
+    Gt_File_Header h;
+    if (fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, GT_MAGIC, sizeof(GT_MAGIC)) != 0 ||
+            h.version != GT_VERSION)
+    {
+        fprintf(stderr, "%s is not a ground truth file\n", name);
+        return EXIT_FAILURE;
+    }
+
+    std::vector<Gt_Field_Desc> desc(h.fields);
+    if (h.fields == 0 || fread(&desc[0], sizeof(Gt_Field_Desc), h.fields, f) != h.fields)
+    {
+        fprintf(stderr, "%s: truncated field table\n", name);
+        return EXIT_FAILURE;
+    }
+
+    // Row layout: offset of each column in a chunk of n steps is
+    // n * (bytes per step of the fields before)
+    std::vector<uint32_t> step_offset(h.fields);
+    uint32_t step_bytes = 0;
+    for (uint32_t i = 0; i < h.fields; i++)
+    {
+        desc[i].name[sizeof(desc[i].name) - 1] = '\0';
+        step_offset[i] = step_bytes;
+        step_bytes += desc[i].size * desc[i].count;
+    }
+
+    if (info)
+    {
+        printf("%s: %u fields, %u bytes per step, chunks of %u steps%s\n", name, h.fields,
+                step_bytes, h.chunk_steps, (h.flags & GT_FLAG_ZLIB) ? ", zlib" : "");
+        for (uint32_t i = 0; i < h.fields; i++)
+            printf("  %-24s %c x %u\n", desc[i].name, desc[i].type, desc[i].count);
+    }
+    else
+    {
+        // Header of the CSV
+        bool first = true;
+        for (uint32_t i = 0; i < h.fields; i++)
+        {
+            if (!selected(fields, desc[i].name))
+                continue;
+            for (unsigned k = 0; k < desc[i].count; k++)
+            {
+                printf(first ? "%s" : ",%s", desc[i].name);
+                if (desc[i].count > 1)
+                    printf("[%u]", k);
+                first = false;
+            }
+        }
+        printf("\n");
+    }
+
+    std::vector<uint8_t> stored;
+    std::vector<uint8_t> raw;
+    uint64_t steps = 0;
+    uint64_t chunks = 0;
+    uint64_t stored_bytes = 0;
+    Gt_Chunk_Header c;
+
+    while (fread(&c, sizeof(c), 1, f) == 1)
+    {
+        if (memcmp(c.magic, GT_CHUNK_MAGIC, sizeof(c.magic)) != 0 ||
+                c.raw_bytes != c.steps * step_bytes)
+        {
+            fprintf(stderr, "%s: bad chunk %lu\n", name, (unsigned long)chunks);
+            break;
+        }
+
+        stored.resize(c.stored_bytes + 1);
+        if (fread(&stored[0], 1, c.stored_bytes, f) != c.stored_bytes)
+        {
+            fprintf(stderr, "%s: truncated chunk %lu\n", name, (unsigned long)chunks);
+            break;
+        }
+
+        const uint8_t* data = &stored[0];
+        if (h.flags & GT_FLAG_ZLIB)
+        {
+            raw.resize(c.raw_bytes + 1);
+            uLongf len = c.raw_bytes;
+            if (uncompress(&raw[0], &len, &stored[0], c.stored_bytes) != Z_OK ||
+                    len != c.raw_bytes)
+            {
+                fprintf(stderr, "%s: chunk %lu not readable\n", name, (unsigned long)chunks);
+                break;
+            }
+            data = &raw[0];
+        }
+        else if (c.stored_bytes != c.raw_bytes)
+        {
+            fprintf(stderr, "%s: bad chunk %lu\n", name, (unsigned long)chunks);
+            break;
+        }
+
+        chunks++;
+        stored_bytes += c.stored_bytes;
+
+        for (uint32_t s = 0; s < c.steps && !info; s++, steps++)
+        {
+            if (steps % every != 0)
+                continue;
+
+            bool first = true;
+            for (uint32_t i = 0; i < h.fields; i++)
+            {
+                if (!selected(fields, desc[i].name))
+                    continue;
+                unsigned len = desc[i].size * desc[i].count;
+                const uint8_t* p = data + c.steps * step_offset[i] + s * len;
+                for (unsigned k = 0; k < desc[i].count; k++)
+                {
+                    if (!first)
+                        printf(",");
+                    print_value(&desc[i], p + k * desc[i].size);
+                    first = false;
+                }
+            }
+            printf("\n");
+        }
+        if (info)
+            steps += c.steps;
+    }
+    fclose(f);
+
+    fprintf(stderr, "%s: %lu steps in %lu chunks, %lu bytes\n", name, (unsigned long)steps,
+            (unsigned long)chunks, (unsigned long)stored_bytes);
+    return 0;
+}
@@ -0,0 +1,159 @@
+/**
+ * @file hil_encode.cpp
+ *
+ * @brief Direct encoding of the HIL frames from the outputs of the model
+ *
+ */
+
+#include "hil_encode.h"
+
+
+// ------------------------------------------------------------------------
+//  FUNCTIONS
+// ------------------------------------------------------------------------
+
+//
+// mav_frame_payload
+//
+uint8_t* mav_frame_payload(uint8_t* frame, int version)
+{
+    if (version == MAV_VERSION_1)
+        return frame + MAVLINK_CORE_HEADER_MAVLINK1_LEN + 1;
+    return frame + MAVLINK_CORE_HEADER_LEN + 1;
+}
+
+//
+// mav_frame_finish
+//
+// Same frame as mavlink_finalize_message_chan() and
+// mavlink_msg_to_send_buffer() (unsigned): MAVLink 2 truncates the
+// trailing zeros of the payload
+//
+uint16_t mav_frame_finish(uint8_t* frame, const Mav_Frame_Hdr* hdr, uint32_t msgid,
+        uint8_t payload_len, uint8_t crc_extra)
+{
+    uint8_t header_len;
+    uint8_t* payload = mav_frame_payload(frame, hdr->version);
+
+    if (hdr->version == MAV_VERSION_1)
+    {
+        header_len = MAVLINK_CORE_HEADER_MAVLINK1_LEN + 1;
+        frame[0] = MAVLINK_STX_MAVLINK1;
+        frame[1] = payload_len;
+        frame[2] = hdr->seq;
+        frame[3] = hdr->sysid;
+        frame[4] = hdr->compid;
+        frame[5] = msgid & 0xFF;
+    }
+    else
+    {
+        while (payload_len > 0 && payload[payload_len - 1] == 0)
+            payload_len--;
+
+        header_len = MAVLINK_CORE_HEADER_LEN + 1;
+        frame[0] = MAVLINK_STX;
+        frame[1] = payload_len;
+        frame[2] = 0;   // incompat_flags (not signed)
+        frame[3] = 0;   // compat_flags
+        frame[4] = hdr->seq;
+        frame[5] = hdr->sysid;
+        frame[6] = hdr->compid;
+        frame[7] = msgid & 0xFF;
+        frame[8] = (msgid >> 8) & 0xFF;
+        frame[9] = (msgid >> 16) & 0xFF;
+    }
+
+    // Header without the magic, payload and crc extra in one pass
+    uint16_t crc = mav_crc_calculate(frame + 1, header_len - 1 + payload_len);
+    crc_accumulate(crc_extra, &crc);
+
+    uint8_t* ck = payload + payload_len;
+    ck[0] = (uint8_t)(crc & 0xFF);
+    ck[1] = (uint8_t)(crc >> 8);
+
+    return header_len + payload_len + MAVLINK_NUM_CHECKSUM_BYTES;
+}
+
+//
+// hil_sensor_encode
+//
+uint16_t hil_sensor_encode(uint8_t* frame, const Mav_Frame_Hdr* hdr, uint64_t time_usec,
+        const ExtY_DynModel_T* y)
+{
+    char* buf = (char*)mav_frame_payload(frame, hdr->version);
+
+    float xacc = (float)y->Accelerometer[0];
+    float yacc = (float)y->Accelerometer[1];
+    float zacc = (float)y->Accelerometer[2];
+    float xgyro = (float)y->Gyro[0];
+    float ygyro = (float)y->Gyro[1];
+    float zgyro = (float)y->Gyro[2];
+    float xmag = (float)y->Magn[0];
+    float ymag = (float)y->Magn[1];
+    float zmag = (float)y->Magn[2];
+    float abs_pressure = (float)y->Press;
+    float diff_pressure = (float)y->diff_Pres;
+    float pressure_alt = (float)y->Baro_Alt;
+    float temperature = (float)y->Temp;
+    uint32_t fields_updated = (uint32_t)0xFF;
+
+    // Offsets of mavlink_hil_sensor_t
+    MAV_PUT(buf, HIL_SENSOR, time_usec, time_usec);
+    MAV_PUT(buf, HIL_SENSOR, xacc, xacc);
+    MAV_PUT(buf, HIL_SENSOR, yacc, yacc);
+    MAV_PUT(buf, HIL_SENSOR, zacc, zacc);
+    MAV_PUT(buf, HIL_SENSOR, xgyro, xgyro);
+    MAV_PUT(buf, HIL_SENSOR, ygyro, ygyro);
+    MAV_PUT(buf, HIL_SENSOR, zgyro, zgyro);
+    MAV_PUT(buf, HIL_SENSOR, xmag, xmag);
+    MAV_PUT(buf, HIL_SENSOR, ymag, ymag);
+    MAV_PUT(buf, HIL_SENSOR, zmag, zmag);
+    MAV_PUT(buf, HIL_SENSOR, abs_pressure, abs_pressure);
+    MAV_PUT(buf, HIL_SENSOR, diff_pressure, diff_pressure);
+    MAV_PUT(buf, HIL_SENSOR, pressure_alt, pressure_alt);
+    MAV_PUT(buf, HIL_SENSOR, temperature, temperature);
+    MAV_PUT(buf, HIL_SENSOR, fields_updated, fields_updated);
+
+    typedef Mav_Msg<MAVLINK_MSG_ID_HIL_SENSOR> M;
+    return mav_frame_finish(frame, hdr, M::id, M::len, M::crc_extra);
+}
+
+//
+// hil_gps_encode
+//
+uint16_t hil_gps_encode(uint8_t* frame, const Mav_Frame_Hdr* hdr, uint64_t time_usec,
+        const ExtY_DynModel_T* y)
+{
+    char* buf = (char*)mav_frame_payload(frame, hdr->version);
+
+    uint8_t fix_type = 3;
+    int32_t lat = (int32_t)(y->Gps_Lat * 1e7);
+    int32_t lon = (int32_t)(y->Gps_Lon * 1e7);
+    int32_t alt = (int32_t)(y->Gps_Alt * 1e3);
+    uint16_t eph = 1;
+    uint16_t epv = 1;
+    uint16_t vel = (uint16_t)(y->Gps_V_Mod * 100); // cm/s
+    int16_t vn = (int16_t)(y->Gps_V[0] * 100);
+    int16_t ve = (int16_t)(y->Gps_V[1] * 100);
+    int16_t vd = (int16_t)(y->Gps_V[2] * 100);
+    uint16_t cog = (int16_t)(y->COG * 100);
+    uint8_t satellites_visible = 8;
+
+    // Offsets of mavlink_hil_gps_t
+    MAV_PUT(buf, HIL_GPS, time_usec, time_usec);
+    MAV_PUT(buf, HIL_GPS, lat, lat);
+    MAV_PUT(buf, HIL_GPS, lon, lon);
+    MAV_PUT(buf, HIL_GPS, alt, alt);
+    MAV_PUT(buf, HIL_GPS, eph, eph);
+    MAV_PUT(buf, HIL_GPS, epv, epv);
+    MAV_PUT(buf, HIL_GPS, vel, vel);
+    MAV_PUT(buf, HIL_GPS, vn, vn);
+    MAV_PUT(buf, HIL_GPS, ve, ve);
+    MAV_PUT(buf, HIL_GPS, vd, vd);
+    MAV_PUT(buf, HIL_GPS, cog, cog);
+    MAV_PUT(buf, HIL_GPS, fix_type, fix_type);
+    MAV_PUT(buf, HIL_GPS, satellites_visible, satellites_visible);
+
+    typedef Mav_Msg<MAVLINK_MSG_ID_HIL_GPS> M;
+    return mav_frame_finish(frame, hdr, M::id, M::len, M::crc_extra);
+}
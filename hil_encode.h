@@ -0,0 +1,73 @@
+/**
+ * @file hil_encode.h
+ *
+ * @brief Direct encoding of the HIL frames from the outputs of the model
+ *
+ * HIL_SENSOR and HIL_GPS are written as final wire frames (header,
+ * payload, CRC) straight from DynModel_Y into the buffer that the TX
+ * engine writes to the serial port, in the MAVLink version of the link.
+ * No mavlink_message_t is filled and nothing is serialized again: the
+ * frames are byte for byte those of mavlink_msg_hil_*_pack() followed by
+ * mavlink_msg_to_send_buffer() (checked by encode_bench).
+ *
+ */
+
+#ifndef HIL_ENCODE_H_
+#define HIL_ENCODE_H_
+
+// ------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------
+
+#include <stdint.h>
+
+#include "mav_version.h"
+#include "mav_msgset.h"
+
+extern "C"
+{
+    #include "DynModel.h"
+}
+
+// ------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------
+
+// Largest frames written by the encoders (MAVLink 2, full payload)
+#define HIL_SENSOR_FRAME_MAX    (Mav_Msg<MAVLINK_MSG_ID_HIL_SENSOR>::frame_max)
+#define HIL_GPS_FRAME_MAX       (Mav_Msg<MAVLINK_MSG_ID_HIL_GPS>::frame_max)
+
+
+// ------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------
+// Header fields of the frames to encode
+struct Mav_Frame_Hdr {
+
+    int version;        // MAV_VERSION_1 or MAV_VERSION_2
+    uint8_t seq;
+    uint8_t sysid;
+    uint8_t compid;
+};
+
+
+// ------------------------------------------------------------------------
+//   Prototypes
+// ------------------------------------------------------------------------
+
+// Start of the payload in a frame of the given version
+uint8_t* mav_frame_payload(uint8_t* frame, int version);
+
+// Write header and CRC around a payload written at mav_frame_payload().
+// Returns the length of the frame.
+uint16_t mav_frame_finish(uint8_t* frame, const Mav_Frame_Hdr* hdr, uint32_t msgid,
+        uint8_t payload_len, uint8_t crc_extra);
+
+// HIL frames from the outputs of the model. Return the length of the frame.
+uint16_t hil_sensor_encode(uint8_t* frame, const Mav_Frame_Hdr* hdr, uint64_t time_usec,
+        const ExtY_DynModel_T* y);
+uint16_t hil_gps_encode(uint8_t* frame, const Mav_Frame_Hdr* hdr, uint64_t time_usec,
+        const ExtY_DynModel_T* y);
+
+
+#endif // HIL_ENCODE_H_
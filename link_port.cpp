@@ -0,0 +1,442 @@
+/**
+ * @file link_port.cpp
+ *
+ * @brief Transport of the link with the autopilot
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "link_port.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Link_Port::Link_Port(char *&device, int &baudrate_)
+{
+    serial = NULL;
+    fd = -1;
+    baudrate = 0;
+    no_peer_drops = 0;
+    replay_discarded = 0;
+    replay_buf = NULL;
+    replay_len = 0;
+    remote_known = false;
+    remote_fixed = false;
+    memset(&remAddr, 0, sizeof(remAddr));
+    memset(&last_from, 0, sizeof(last_from));
+    pthread_mutex_init(&mut_remote, NULL);
+
+    if (strncmp(device, "udp:", 4) == 0)
+    {
+        kind = LINK_KIND_UDP;
+        open_udp(device + 4);
+    }
+    else if (strncmp(device, "tcp:", 4) == 0)
+    {
+        kind = LINK_KIND_TCP;
+        open_tcp(device + 4);
+    }
+    else if (strcmp(device, "replay") == 0)
+    {
+        kind = LINK_KIND_REPLAY;
+    }
+    else
+    {
+        kind = LINK_KIND_SERIAL;
+        serial = new Serial_Port(device, baudrate_);
+        fd = serial->fd;
+        baudrate = baudrate_;
+    }
+}
+
+Link_Port::~Link_Port()
+{
+    if (serial != NULL)
+        delete serial;
+    else if (fd >= 0)
+        close(fd);
+    pthread_mutex_destroy(&mut_remote);
+}
+
+const char* Link_Port::kind_name()
+{
+    switch (kind)
+    {
+        case LINK_KIND_UDP:
+            return "udp";
+        case LINK_KIND_TCP:
+            return "tcp";
+        case LINK_KIND_REPLAY:
+            return "replay";
+        default:
+            return "serial";
+    }
+}
+
+
+// ------------------------------------------------------------------------------
+//   Open
+// ------------------------------------------------------------------------------
+
+//
+// open_udp
+//
+// "<remote_ip>:<local_port>:<remote_port>"
+//
+void Link_Port::open_udp(const char* spec)
+{
+    char ip[64];
+    unsigned int l_port, r_port;
+
+    if (sscanf(spec, "%63[^:]:%u:%u", ip, &l_port, &r_port) != 3)
+    {
+        printf("Invalid UDP link %s (udp:<remote_ip>:<local_port>:<remote_port>)\n", spec);
+        throw EXIT_FAILURE;
+    }
+
+    fd = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+    struct sockaddr_in locAddr;
+    memset(&locAddr, 0, sizeof(locAddr));
+    locAddr.sin_family = AF_INET;
+    locAddr.sin_port = htons(l_port);
+    locAddr.sin_addr.s_addr = INADDR_ANY;
+
+    if (fd < 0 || bind(fd, (struct sockaddr*)&locAddr, sizeof(locAddr)) < 0)
+    {
+        printf("failure, could not bind UDP port %u (%s)\n", l_port, strerror(errno));
+        throw EXIT_FAILURE;
+    }
+
+    remAddr.sin_family = AF_INET;
+    remAddr.sin_port = htons(r_port);
+    remAddr.sin_addr.s_addr = inet_addr(ip);
+    remote_fixed = (r_port != 0);
+    remote_known = remote_fixed;
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    printf("Connected to udp %s:%u (local port %u)\n", ip, r_port, l_port);
+}
+
+//
+// open_tcp
+//
+// "<host>:<port>", connected as a client
+//
+void Link_Port::open_tcp(const char* spec)
+{
+    char host[64];
+    char port[16];
+
+    if (sscanf(spec, "%63[^:]:%15s", host, port) != 2)
+    {
+        printf("Invalid TCP link %s (tcp:<host>:<port>)\n", spec);
+        throw EXIT_FAILURE;
+    }
+
+    struct addrinfo hints;
+    struct addrinfo* res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(host, port, &hints, &res) != 0)
+    {
+        printf("failure, could not resolve %s\n", host);
+        throw EXIT_FAILURE;
+    }
+
+    fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd < 0 || connect(fd, res->ai_addr, res->ai_addrlen) < 0)
+    {
+        printf("failure, could not connect to %s:%s (%s)\n", host, port, strerror(errno));
+        freeaddrinfo(res);
+        throw EXIT_FAILURE;
+    }
+    freeaddrinfo(res);
+
+    // Frames leave as soon as they are written
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    printf("Connected to tcp %s:%s\n", host, port);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Read / Write
+// ------------------------------------------------------------------------------
+
+//
+// readBytes
+//
+// Returns the bytes read, 0 if no data is available, -1 on error
+//
+int Link_Port::readBytes(char* buff, unsigned len)
+{
+    switch (kind)
+    {
+        case LINK_KIND_SERIAL:
+            return serial->readBytes(buff, len > 255 ? 255 : len);
+
+        case LINK_KIND_REPLAY:
+            {
+                if (len > replay_len)
+                    len = replay_len;
+                memcpy(buff, replay_buf, len);
+                replay_buf += len;
+                replay_len -= len;
+                return len;
+            }
+
+        case LINK_KIND_UDP:
+            {
+                struct sockaddr_in from;
+                socklen_t fromlen = sizeof(from);
+                int ret = recvfrom(fd, buff, len, 0, (struct sockaddr*)&from, &fromlen);
+                if (ret < 0)
+                    return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+
+                // Answer to whoever is talking to us
+                if (!remote_fixed && (from.sin_addr.s_addr != last_from.sin_addr.s_addr ||
+                        from.sin_port != last_from.sin_port))
+                {
+                    last_from = from;
+                    pthread_mutex_lock(&mut_remote);
+                    remAddr = from;
+                    remote_known = true;
+                    pthread_mutex_unlock(&mut_remote);
+                }
+                return ret;
+            }
+
+        default:
+            {
+                int ret = recv(fd, buff, len, 0);
+                if (ret < 0)
+                    return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+
+                // Connection closed by the peer
+                if (ret == 0)
+                    return -1;
+                return ret;
+            }
+    }
+}
+
+//
+// remote
+//
+// Copy of the address of the UDP peer, false if still unknown
+//
+bool Link_Port::remote(struct sockaddr_in* addr)
+{
+    pthread_mutex_lock(&mut_remote);
+    bool known = remote_known;
+    *addr = remAddr;
+    pthread_mutex_unlock(&mut_remote);
+    return known;
+}
+
+//
+// write_bytes
+//
+// Returns the bytes written or -1
+//
+int Link_Port::write_bytes(char* buff, unsigned len)
+{
+    switch (kind)
+    {
+        case LINK_KIND_SERIAL:
+            return serial->write_bytes(buff, len);
+
+        case LINK_KIND_REPLAY:
+            replay_discarded += len;
+            return len;
+
+        case LINK_KIND_UDP:
+            {
+                struct sockaddr_in to;
+                if (!remote(&to))
+                {
+                    no_peer_drops++;
+                    return len;
+                }
+                return sendto(fd, buff, len, 0, (struct sockaddr*)&to, sizeof(to));
+            }
+
+        default:
+            return _write_stream(buff, len);
+    }
+}
+
+//
+// write_iov
+//
+// Returns the bytes written or -1. The iovec array is consumed.
+//
+int Link_Port::write_iov(struct iovec* iov, int iovcnt)
+{
+    unsigned len = 0;
+    for (int i = 0; i < iovcnt; i++)
+        len += iov[i].iov_len;
+
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+
+    if (kind == LINK_KIND_REPLAY)
+    {
+        replay_discarded += len;
+        return len;
+    }
+
+    if (kind == LINK_KIND_UDP)
+    {
+        struct sockaddr_in to;
+        if (!remote(&to))
+        {
+            no_peer_drops++;
+            return len;
+        }
+        mh.msg_name = &to;
+        mh.msg_namelen = sizeof(to);
+        mh.msg_iov = iov;
+        mh.msg_iovlen = iovcnt;
+        return sendmsg(fd, &mh, 0);
+    }
+
+    // Serial and TCP: keep writing the rest after a partial write
+    unsigned writtenB = 0;
+    struct pollfd fdsW[1];
+    fdsW[0].fd = fd;
+    fdsW[0].events = POLLOUT;
+
+    while (writtenB < len)
+    {
+        int ret;
+        if (kind == LINK_KIND_TCP)
+        {
+            mh.msg_iov = iov;
+            mh.msg_iovlen = iovcnt;
+            ret = sendmsg(fd, &mh, MSG_NOSIGNAL);
+        }
+        else
+        {
+            ret = writev(fd, iov, iovcnt);
+        }
+
+        if (ret == -1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            if (errno == EAGAIN && poll(fdsW, 1, SERIAL_WRITE_TIMEOUT_MS) > 0)
+                continue;
+
+            printf("%s, %d : write_iov  : Failed to write on the %s link\n",__FILE__,__LINE__,
+                    kind_name());
+            return -1;
+        }
+        writtenB += ret;
+
+        // Skip what has been written
+        while (iovcnt > 0 && (unsigned)ret >= iov->iov_len)
+        {
+            ret -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0)
+        {
+            iov->iov_base = (char*)iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+
+    return writtenB;
+}
+
+//
+// replay_input
+//
+void Link_Port::replay_input(const uint8_t* buff, unsigned len)
+{
+    replay_buf = buff;
+    replay_len = len;
+}
+
+//
+// _write_stream
+//
+// Same as Serial_Port::_write_port for the TCP socket
+//
+int Link_Port::_write_stream(char* buff, unsigned len)
+{
+    unsigned writtenB = 0;
+    struct pollfd fdsW[1];
+    fdsW[0].fd = fd;
+    fdsW[0].events = POLLOUT;
+
+    while (writtenB < len)
+    {
+        int ret = send(fd, buff + writtenB, len - writtenB, MSG_NOSIGNAL);
+
+        if (ret == -1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            if ((errno == EAGAIN || errno == EWOULDBLOCK) &&
+                    poll(fdsW, 1, SERIAL_WRITE_TIMEOUT_MS) > 0)
+                continue;
+
+            printf("%s, %d : _write_stream  : Failed to write on the socket\n",__FILE__,__LINE__);
+            return -1;
+        }
+        writtenB += ret;
+    }
+
+    return writtenB;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Quit Handler
+// ------------------------------------------------------------------------------
+void Link_Port::handle_quit( int sig )
+{
+    if (serial != NULL)
+    {
+        serial->handle_quit(sig);
+        return;
+    }
+
+    printf("CLOSE %s LINK\n", kind_name());
+    if (kind == LINK_KIND_REPLAY)
+    {
+        printf("%lu bytes written to the replay link\n", (unsigned long)replay_discarded);
+        return;
+    }
+    if (no_peer_drops > 0)
+        printf("%lu datagrams not sent (no UDP peer)\n", (unsigned long)no_peer_drops);
+    close(fd);
+    fd = -1;
+}
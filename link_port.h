@@ -0,0 +1,117 @@
+/**
+ * @file link_port.h
+ *
+ * @brief Transport of the link with the autopilot
+ *
+ * The board is reached through a serial port, or through UDP/TCP when
+ * the autopilot runs in software on the same (or another) machine. The
+ * transport is chosen at startup from the device string:
+ *
+ *   /dev/ttyUSB0                          serial port
+ *   udp:<remote_ip>:<local_port>:<remote_port>
+ *                                         UDP (remote_port 0: answer to
+ *                                         the sender of the last datagram)
+ *   tcp:<host>:<port>                     TCP client
+ *   replay                                recorded traffic (see replay_input):
+ *                                         writes are discarded
+ *
+ * The calls are dispatched on the kind of the link with a switch: no
+ * virtual calls on the read/write path. All the kinds read into the
+ * buffer of the caller (the RX stage of Autopilot_Interface, where the
+ * frames are parsed in place), there is no buffering per kind.
+ *
+ * UDP with remote_port 0: the address of the peer is written by the
+ * reading task and read by the TX engine, under mut_remote. The reader
+ * takes the lock only when the sender changes, the writers copy the
+ * address once per send.
+ *
+ */
+
+#ifndef LINK_PORT_H_
+#define LINK_PORT_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <sys/uio.h>
+
+#include "serial_port.h"
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+#define LINK_KIND_SERIAL    0
+#define LINK_KIND_UDP       1
+#define LINK_KIND_TCP       2
+#define LINK_KIND_REPLAY    3
+
+// Largest datagram read from a UDP link
+#define LINK_READ_BYTES     2048
+
+
+// ----------------------------------------------------------------------------------
+//   Link Port Class
+// ----------------------------------------------------------------------------------
+class Link_Port
+{
+
+    public:
+
+        /**
+         * throws EXIT_FAILURE if the link could not be opened
+         */
+        Link_Port(char *&device, int &baudrate_);
+        ~Link_Port();
+
+        int readBytes(char* buff, unsigned len);
+        int write_bytes(char* buff, unsigned len);
+
+        // Gather write: a single write() (one datagram on UDP)
+        int write_iov(struct iovec* iov, int iovcnt);
+
+        // Replay: bytes returned by the next readBytes() calls
+        void replay_input(const uint8_t* buff, unsigned len);
+
+        void handle_quit( int sig );
+
+        const char* kind_name();
+
+        int kind;           // LINK_KIND_*
+        int fd;             // Descriptor used for poll()
+        int baudrate;       // Bits per second of the line (0 = not a serial line)
+
+        Serial_Port* serial;
+
+        // Datagrams not sent because the UDP peer is still unknown
+        uint64_t no_peer_drops;
+
+        // Bytes written to the replay link
+        uint64_t replay_discarded;
+
+    private:
+
+        pthread_mutex_t mut_remote;
+        struct sockaddr_in remAddr;
+        bool remote_known;
+        bool remote_fixed;
+
+        // Last sender seen by the reading task (not shared)
+        struct sockaddr_in last_from;
+
+        bool remote(struct sockaddr_in* addr);
+
+        const uint8_t* replay_buf;
+        unsigned replay_len;
+
+        void open_udp(const char* spec);
+        void open_tcp(const char* spec);
+        int _write_stream(char* buff, unsigned len);
+};
+
+
+#endif // LINK_PORT_H_
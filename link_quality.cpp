@@ -0,0 +1,187 @@
+/**
+ * @file link_quality.cpp
+ *
+ * @brief Quality of a MAVLink link from sequence numbers and parser errors
+ *
+ */
+
+#include "link_quality.h"
+
+#include <string.h>
+
+
+// ------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------
+Link_Quality::Link_Quality()
+{
+    memset(src, 0, sizeof(src));
+    nsrc = 0;
+    last = 0;
+    other_frames = 0;
+    other_bad_crc = 0;
+    name = "";
+    parser = NULL;
+}
+
+// ------------------------------------------------------------------------
+//  FUNCTIONS
+// ------------------------------------------------------------------------
+
+void Link_Quality::init(const char* name_, const Mavlink_Parser* parser_)
+{
+    name = name_;
+    parser = parser_;
+}
+
+//
+// find
+//
+// Sender already tracked, NULL if unknown
+//
+Link_Source_Quality* Link_Quality::find(uint8_t sysid, uint8_t compid)
+{
+    for (int i = 0; i < nsrc; i++)
+    {
+        if (src[i].sysid == sysid && src[i].compid == compid)
+        {
+            last = i;
+            return &src[i];
+        }
+    }
+    return NULL;
+}
+
+//
+// lookup
+//
+// Sender of a frame, added on its first frame. NULL when the table is
+// full.
+//
+Link_Source_Quality* Link_Quality::lookup(uint8_t sysid, uint8_t compid)
+{
+    Link_Source_Quality* s = find(sysid, compid);
+    if (s != NULL)
+        return s;
+
+    if (nsrc == LINK_QUALITY_SOURCES)
+        return NULL;
+
+    s = &src[nsrc];
+    memset(s, 0, sizeof(*s));
+    s->sysid = sysid;
+    s->compid = compid;
+    last = nsrc++;
+    return s;
+}
+
+//
+// add_seq
+//
+void Link_Quality::add_seq(Link_Source_Quality* s, uint8_t seq)
+{
+    if (s->frames++ == 0)
+    {
+        s->last_seq = seq;
+        return;
+    }
+
+    uint8_t gap = seq - s->last_seq;
+
+    if (gap == 1)
+    {
+        s->last_seq = seq;
+    }
+    else if (gap == 0)
+    {
+        s->duplicates++;
+    }
+    else if (gap <= LINK_QUALITY_MAX_GAP)
+    {
+        s->lost += gap - 1;
+        s->last_seq = seq;
+    }
+    else
+    {
+        // Late: counted as lost when the gap opened
+        s->out_of_order++;
+        if (s->lost > 0)
+            s->lost--;
+    }
+}
+
+//
+// add_bad_crc
+//
+// The header is not trusted: never adds a sender
+//
+void Link_Quality::add_bad_crc(const mavlink_message_t* msg)
+{
+    Link_Source_Quality* s = find(msg->sysid, msg->compid);
+    if (s != NULL)
+        s->bad_crc++;
+    else
+        other_bad_crc++;
+}
+
+uint64_t Link_Quality::frames()
+{
+    uint64_t n = other_frames;
+    for (int i = 0; i < nsrc; i++)
+        n += src[i].frames;
+    return n;
+}
+
+uint64_t Link_Quality::lost()
+{
+    uint64_t n = 0;
+    for (int i = 0; i < nsrc; i++)
+        n += src[i].lost;
+    return n;
+}
+
+//
+// report
+//
+void Link_Quality::report(FILE* f)
+{
+    uint64_t n = frames();
+    uint64_t l = lost();
+    uint64_t dup = 0;
+    uint64_t ooo = 0;
+    for (int i = 0; i < nsrc; i++)
+    {
+        dup += src[i].duplicates;
+        ooo += src[i].out_of_order;
+    }
+
+    fprintf(f, "Link quality %s: %lu frames, %lu lost (%.3f%%), %lu duplicated, "
+            "%lu out of order", name, (unsigned long)n, (unsigned long)l,
+            (n + l) ? 100.0 * l / (n + l) : 0.0, (unsigned long)dup, (unsigned long)ooo);
+    if (parser != NULL)
+        fprintf(f, " | bad CRC %lu, parse errors %lu, resync bytes %lu",
+                (unsigned long)parser->bad_crc, (unsigned long)parser->parse_errors,
+                (unsigned long)parser->resync_bytes);
+    fprintf(f, "\n");
+
+    if (nsrc == 0)
+        return;
+
+    fprintf(f, "  %7s %10s %8s %8s %8s %8s %8s\n", "SYS:COMP", "FRAMES", "LOST", "LOST%",
+            "DUP", "OOO", "BADCRC");
+    for (int i = 0; i < nsrc; i++)
+    {
+        const Link_Source_Quality* s = &src[i];
+        fprintf(f, "  %3u:%-4u %10lu %8lu %8.3f %8lu %8lu %8lu\n", s->sysid, s->compid,
+                (unsigned long)s->frames, (unsigned long)s->lost,
+                (s->frames + s->lost) ? 100.0 * s->lost / (s->frames + s->lost) : 0.0,
+                (unsigned long)s->duplicates, (unsigned long)s->out_of_order,
+                (unsigned long)s->bad_crc);
+    }
+    if (other_frames > 0)
+        fprintf(f, "  %8s %10lu (senders beyond %d, not tracked)\n", "other",
+                (unsigned long)other_frames, LINK_QUALITY_SOURCES);
+    if (other_bad_crc > 0)
+        fprintf(f, "  %8s %10lu (bad CRC, sender not tracked)\n", "other",
+                (unsigned long)other_bad_crc);
+}
@@ -0,0 +1,133 @@
+/**
+ * @file link_quality.h
+ *
+ * @brief Quality of a MAVLink link from sequence numbers and parser errors
+ *
+ * Each sender (sysid, compid) numbers its frames with an 8 bit sequence.
+ * The gap with the last sequence seen from the same sender tells:
+ *
+ *   1                 in order
+ *   0                 duplicate
+ *   2 .. 128          frames lost (gap - 1)
+ *   129 .. 255        late frame (out of order): it had been counted as
+ *                     lost, the loss is taken back
+ *
+ * The bytes discarded by the parser while searching for the start of a
+ * frame and the frames rejected for a bad CRC come from the parser of
+ * the link. A frame with a bad CRC is also charged to the sender named
+ * in its header if that sender is already tracked: the header may be
+ * corrupted as well, so it never adds a sender (a noisy line would fill
+ * the table with senders that do not exist). The others are counted
+ * for the link.
+ *
+ * Single writer (the task reading the link); the counters are read
+ * without locking by the reports.
+ *
+ */
+
+#ifndef LINK_QUALITY_H_
+#define LINK_QUALITY_H_
+
+// ------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "mav_parser.h"
+
+// ------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------
+
+// Senders tracked on a link, the others are accounted together
+#define LINK_QUALITY_SOURCES    16
+
+// Gaps above this are late frames, not losses
+#define LINK_QUALITY_MAX_GAP    128
+
+
+// ------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------
+// Frames of one sender
+struct Link_Source_Quality {
+
+    uint8_t sysid;
+    uint8_t compid;
+    uint8_t last_seq;
+
+    uint64_t frames;
+    uint64_t lost;
+    uint64_t duplicates;
+    uint64_t out_of_order;
+    uint64_t bad_crc;
+};
+
+
+// ---------------------------------------------------------------------
+//   Link Quality Class
+// ---------------------------------------------------------------------
+class Link_Quality
+{
+
+    public:
+
+        Link_Quality();
+
+        // Parser of the link (bad CRC, parse errors, resync bytes)
+        void init(const char* name_, const Mavlink_Parser* parser_);
+
+        // A frame has been parsed
+        void add_frame(const mavlink_message_t* msg)
+        {
+            Link_Source_Quality* s = source(msg->sysid, msg->compid);
+            if (s != NULL)
+                add_seq(s, msg->seq);
+            else
+                other_frames++;
+        }
+
+        // A frame with a bad CRC has been discarded (header in msg)
+        void add_bad_crc(const mavlink_message_t* msg);
+
+        // Totals over the senders
+        uint64_t frames();
+        uint64_t lost();
+
+        void report(FILE* f);
+
+        const char* name;
+
+        Link_Source_Quality src[LINK_QUALITY_SOURCES];
+        int nsrc;
+
+        // Frames of the senders beyond LINK_QUALITY_SOURCES
+        uint64_t other_frames;
+
+        // Bad CRC frames whose header names no tracked sender
+        uint64_t other_bad_crc;
+
+    private:
+
+        const Mavlink_Parser* parser;
+
+        // Last sender seen
+        int last;
+
+        Link_Source_Quality* source(uint8_t sysid, uint8_t compid)
+        {
+            Link_Source_Quality* s = &src[last];
+            if (last < nsrc && s->sysid == sysid && s->compid == compid)
+                return s;
+            return lookup(sysid, compid);
+        }
+
+        Link_Source_Quality* lookup(uint8_t sysid, uint8_t compid);
+        Link_Source_Quality* find(uint8_t sysid, uint8_t compid);
+        void add_seq(Link_Source_Quality* s, uint8_t seq);
+};
+
+
+#endif // LINK_QUALITY_H_
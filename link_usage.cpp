@@ -0,0 +1,195 @@
+/**
+ * @file link_usage.cpp
+ *
+ * @brief Bandwidth accounting of a MAVLink link
+ *
+ */
+
+#include "link_usage.h"
+
+#include <string.h>
+
+
+static inline uint32_t link_bucket(uint32_t msgid)
+{
+    return (msgid < LINK_MSGIDS - 1) ? msgid : LINK_MSGIDS - 1;
+}
+
+
+// ------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------
+Link_Usage::Link_Usage()
+{
+    memset(dir, 0, sizeof(dir));
+    memset(decimation, 0, sizeof(decimation));
+
+    set_baudrate(921600);
+}
+
+// ------------------------------------------------------------------------
+//  FUNCTIONS
+// ------------------------------------------------------------------------
+
+//
+// set_baudrate
+//
+// 8N1: 10 bits on the wire for each byte. A link without baudrate
+// (UDP/TCP) has no capacity: utilisation 0, no backpressure.
+//
+void Link_Usage::set_baudrate(int baudrate)
+{
+    capacity = (baudrate > 0) ? baudrate / 10 : 0;
+}
+
+//
+// roll
+//
+// Close the current window when it is over. A line that has been idle
+// for several windows is measured over the whole idle time.
+//
+void Link_Usage::roll(Link_Direction* d, uint64_t now_ns)
+{
+    uint64_t elapsed = now_ns - d->window_start_ns;
+
+    if (elapsed < LINK_WINDOW_NS)
+        return;
+
+    d->utilisation = capacity ? (float)(d->window_bytes * 1e11 / ((double)capacity * elapsed)) : 0;
+    if (d->utilisation > d->peak)
+        d->peak = d->utilisation;
+
+    d->window_start_ns = now_ns;
+    d->window_bytes = 0;
+}
+
+//
+// add_bytes
+//
+void Link_Usage::add_bytes(int dir_id, uint32_t nbytes, uint64_t now_ns)
+{
+    Link_Direction* d = &dir[dir_id];
+
+    if (d->first_ns == 0)
+    {
+        d->first_ns = now_ns;
+        d->window_start_ns = now_ns;
+    }
+    d->last_ns = now_ns;
+
+    roll(d, now_ns);
+
+    d->bytes += nbytes;
+    d->window_bytes += nbytes;
+}
+
+//
+// add_frame
+//
+// v1_len is the size of the frame in MAVLink 1, for the report of the
+// bytes saved by the payload truncation of MAVLink 2
+//
+void Link_Usage::add_frame(int dir_id, uint32_t msgid, uint32_t len, uint32_t v1_len)
+{
+    Link_Msg_Usage* m = &dir[dir_id].msg[link_bucket(msgid)];
+
+    dir[dir_id].frames++;
+    m->frames++;
+    m->bytes += len;
+    m->v1_bytes += v1_len;
+}
+
+//
+// add_drop
+//
+void Link_Usage::add_drop(int dir_id, uint32_t msgid)
+{
+    dir[dir_id].drops++;
+    dir[dir_id].msg[link_bucket(msgid)].drops++;
+}
+
+//
+// level
+//
+// Backpressure level given by the utilisation of the last window
+//
+int Link_Usage::level(int dir_id, uint64_t now_ns)
+{
+    Link_Direction* d = &dir[dir_id];
+
+    if (d->first_ns == 0)
+        return LINK_BP_NONE;
+
+    roll(d, now_ns);
+
+    if (d->utilisation >= LINK_BP_DROP_PCT)
+        return LINK_BP_DROP;
+    if (d->utilisation >= LINK_BP_DECIMATE_PCT)
+        return LINK_BP_DECIMATE;
+    return LINK_BP_NONE;
+}
+
+//
+// decimate
+//
+// True for 1 message out of LINK_BP_DECIMATION of the same msgid, so
+// that every stream keeps flowing at a lower rate
+//
+bool Link_Usage::decimate(uint32_t msgid)
+{
+    return (decimation[link_bucket(msgid)]++ % LINK_BP_DECIMATION) == 0;
+}
+
+//
+// report
+//
+void Link_Usage::report(FILE* f)
+{
+    const char* names[2] = {"TX", "RX"};
+
+    for (int i = 0; i < 2; i++)
+    {
+        const Link_Direction* d = &dir[i];
+        double secs = (d->last_ns - d->first_ns) / 1e9;
+        double rate = (secs > 0) ? d->bytes / secs : 0;
+
+        if (capacity)
+            fprintf(f, "Link %s: %lu bytes, %lu frames, %lu dropped | %.0f B/s of %lu B/s "
+                    "(avg %.1f%%, last %.1f%%, peak %.1f%%)\n", names[i],
+                    (unsigned long)d->bytes, (unsigned long)d->frames,
+                    (unsigned long)d->drops, rate, (unsigned long)capacity,
+                    100.0 * rate / capacity, d->utilisation, d->peak);
+        else
+            fprintf(f, "Link %s: %lu bytes, %lu frames, %lu dropped | %.0f B/s (unlimited)\n",
+                    names[i], (unsigned long)d->bytes, (unsigned long)d->frames,
+                    (unsigned long)d->drops, rate);
+
+        if (d->frames == 0 && d->drops == 0)
+            continue;
+
+        fprintf(f, "  %6s %10s %12s %8s %8s %12s %7s\n", "MSGID", "FRAMES", "BYTES", "LINK%",
+                "DROPS", "SAVED(v2)", "SAVED%");
+        for (int id = 0; id < LINK_MSGIDS; id++)
+        {
+            const Link_Msg_Usage* m = &d->msg[id];
+            if (m->frames == 0 && m->drops == 0)
+                continue;
+
+            char name[8];
+            if (id == LINK_MSGIDS - 1)
+                snprintf(name, sizeof(name), ">255");
+            else
+                snprintf(name, sizeof(name), "%d", id);
+
+            // Negative when the larger MAVLink 2 header is not repaid
+            // by the truncation of the payload
+            long saved = (long)m->v1_bytes - (long)m->bytes;
+
+            fprintf(f, "  %6s %10lu %12lu %8.2f %8lu %12ld %7.1f\n", name,
+                    (unsigned long)m->frames, (unsigned long)m->bytes,
+                    (secs > 0 && capacity) ? 100.0 * m->bytes / secs / capacity : 0.0,
+                    (unsigned long)m->drops, saved,
+                    m->v1_bytes ? 100.0 * saved / m->v1_bytes : 0.0);
+        }
+    }
+}
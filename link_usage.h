@@ -0,0 +1,122 @@
+/**
+ * @file link_usage.h
+ *
+ * @brief Bandwidth accounting of a MAVLink link
+ *
+ * Bytes and frames are accounted per direction and per msgid. The
+ * utilisation of the line is computed over short windows against the
+ * capacity given by the baudrate (8N1: 10 bits per byte) and drives
+ * the backpressure level used by the sender to shed low priority
+ * traffic before the sensor frames are delayed.
+ *
+ * Each direction has a single writer (TX engine, inflow task).
+ *
+ */
+
+#ifndef LINK_USAGE_H_
+#define LINK_USAGE_H_
+
+// ------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdint.h>
+
+// ------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------
+
+#define LINK_DIR_TX     0
+#define LINK_DIR_RX     1
+
+// One bucket per MAVLink 1 msgid, the last one for the larger ids
+#define LINK_MSGIDS     257
+
+// Window of the utilisation measurement (ns)
+#define LINK_WINDOW_NS  100000000ULL
+
+// Backpressure levels and thresholds (% of the line capacity)
+#define LINK_BP_NONE        0
+#define LINK_BP_DECIMATE    1   // Low priority traffic decimated
+#define LINK_BP_DROP        2   // Low priority traffic dropped
+
+#define LINK_BP_DECIMATE_PCT    70
+#define LINK_BP_DROP_PCT        90
+
+// 1 message out of LINK_BP_DECIMATION passes when decimating
+#define LINK_BP_DECIMATION      4
+
+
+// ------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------
+// Traffic of one msgid
+struct Link_Msg_Usage {
+
+    uint64_t frames;
+    uint64_t bytes;
+    uint64_t v1_bytes;  // Size of the same frames in MAVLink 1
+    uint64_t drops;     // Shed by the backpressure
+};
+
+// Traffic of one direction
+struct Link_Direction {
+
+    uint64_t bytes;             // On the wire (garbage included)
+    uint64_t frames;
+    uint64_t drops;
+
+    uint64_t first_ns;          // First byte accounted
+    uint64_t last_ns;
+
+    // Current window
+    uint64_t window_start_ns;
+    uint64_t window_bytes;
+
+    // Utilisation of the last window and peak (%)
+    float utilisation;
+    float peak;
+
+    Link_Msg_Usage msg[LINK_MSGIDS];
+};
+
+
+// ---------------------------------------------------------------------
+//   Link Usage Class
+// ---------------------------------------------------------------------
+class Link_Usage
+{
+
+    public:
+
+        Link_Usage();
+
+        void set_baudrate(int baudrate);
+
+        // Accounting
+        void add_bytes(int dir, uint32_t nbytes, uint64_t now_ns);
+        void add_frame(int dir, uint32_t msgid, uint32_t len, uint32_t v1_len);
+        void add_drop(int dir, uint32_t msgid);
+
+        // Backpressure
+        int level(int dir, uint64_t now_ns);
+        bool decimate(uint32_t msgid);
+
+        void report(FILE* f);
+
+        Link_Direction dir[2];
+
+        uint64_t capacity;      // Bytes per second of the line (0 = unlimited)
+
+    private:
+
+        // Decimation counters, per msgid
+        uint32_t decimation[LINK_MSGIDS];
+
+        void roll(Link_Direction* d, uint64_t now_ns);
+
+};
+
+
+#endif // LINK_USAGE_H_
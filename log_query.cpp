@@ -0,0 +1,190 @@
+/*
+ * file: log_query.cpp
+ *
+ * Query of the recordings of the flight recorder (-record) through their
+ * indexes: a time window or a single message type is read without going
+ * through the rest of the recording.
+ *
+ * usage: log_query <prefix> [-from <s>] [-to <s>] [-msgid <id>]
+ *                  [-link ap|gs] [-dir rx|tx] [-count] [-summary]
+ *                  [-tlog <file>]
+ *
+ *   -from, -to   window in seconds from the first frame
+ *   -count       number of frames selected only
+ *   -summary     frames per msgid, from the indexes
+ *   -tlog        selected frames saved as a .tlog
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "frec_reader.h"
+#include "time_utils.h"
+
+
+static const char* usage = "usage: log_query <prefix> [-from <s>] [-to <s>] [-msgid <id>] "
+        "[-link ap|gs] [-dir rx|tx] [-count] [-summary] [-tlog <file>]";
+
+//
+// summary
+//
+// Frames per msgid over the segments, from their directories
+//
+static void summary(Frec_Reader* reader)
+{
+    printf("%8s %12s\n", "MSGID", "FRAMES");
+
+    uint32_t msgid = 0;
+    for (;;)
+    {
+        // Smallest msgid not below the current one in the directories
+        bool found = false;
+        uint32_t next = 0;
+        for (size_t i = 0; i < reader->segments.size(); i++)
+        {
+            const Frec_Segment* s = &reader->segments[i];
+            for (uint32_t j = 0; j < s->msgids; j++)
+            {
+                if (s->dir[j].msgid >= msgid)
+                {
+                    if (!found || s->dir[j].msgid < next)
+                        next = s->dir[j].msgid;
+                    found = true;
+                    break;
+                }
+            }
+        }
+        if (!found)
+            break;
+
+        printf("%8u %12lu\n", next, (unsigned long)reader->count_msgid(next));
+        msgid = next + 1;
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    const char* prefix = NULL;
+    double from_s = -1;
+    double to_s = -1;
+    int64_t msgid = -1;
+    int link = -1;
+    int dir = -1;
+    bool count = false;
+    bool show_summary = false;
+    const char* tlog_name = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-from") == 0 && argc > i + 1)
+            from_s = atof(argv[++i]);
+        else if (strcmp(argv[i], "-to") == 0 && argc > i + 1)
+            to_s = atof(argv[++i]);
+        else if (strcmp(argv[i], "-msgid") == 0 && argc > i + 1)
+            msgid = atol(argv[++i]);
+        else if (strcmp(argv[i], "-link") == 0 && argc > i + 1)
+        {
+            i++;
+            link = (strcmp(argv[i], "gs") == 0) ? FREC_LINK_GS : FREC_LINK_AUTOPILOT;
+        }
+        else if (strcmp(argv[i], "-dir") == 0 && argc > i + 1)
+        {
+            i++;
+            dir = (strcmp(argv[i], "tx") == 0) ? FREC_DIR_TX : FREC_DIR_RX;
+        }
+        else if (strcmp(argv[i], "-count") == 0)
+            count = true;
+        else if (strcmp(argv[i], "-summary") == 0)
+            show_summary = true;
+        else if (strcmp(argv[i], "-tlog") == 0 && argc > i + 1)
+            tlog_name = argv[++i];
+        else if (argv[i][0] != '-' && prefix == NULL)
+            prefix = argv[i];
+        else
+        {
+            printf("%s\n", usage);
+            return EXIT_FAILURE;
+        }
+    }
+    if (prefix == NULL)
+    {
+        printf("%s\n", usage);
+        return EXIT_FAILURE;
+    }
+
+    uint64_t t0 = time_monotonic_ns();
+
+    Frec_Reader reader;
+    if (reader.open(prefix) < 0)
+        return EXIT_FAILURE;
+
+    fprintf(stderr, "%s: %lu frames in %lu segments, %.3f s (%u indexes rebuilt)\n", prefix,
+            (unsigned long)reader.frames, (unsigned long)reader.segments.size(),
+            (reader.last_ns - reader.first_ns) / 1e9, reader.built_indexes);
+
+    if (show_summary)
+    {
+        summary(&reader);
+        return 0;
+    }
+
+    FILE* tlog = NULL;
+    if (tlog_name != NULL)
+    {
+        tlog = fopen(tlog_name, "wb");
+        if (tlog == NULL)
+        {
+            fprintf(stderr, "Could not create %s\n", tlog_name);
+            return EXIT_FAILURE;
+        }
+    }
+
+    uint64_t start_ns = 0;
+    uint64_t end_ns = (uint64_t)-1;
+    if (to_s >= 0)
+        end_ns = reader.first_ns + (uint64_t)(to_s * 1e9);
+    if (from_s > 0)
+    {
+        start_ns = reader.first_ns + (uint64_t)(from_s * 1e9);
+        reader.seek_time(start_ns);
+    }
+    reader.select_msgid(msgid);
+    reader.set_window(start_ns, end_ns);
+
+    uint64_t selected = 0;
+    Frec_Frame f;
+    while (reader.next(&f))
+    {
+        if ((link >= 0 && f.link != link) || (dir >= 0 && f.dir != dir))
+            continue;
+        selected++;
+
+        if (tlog != NULL)
+        {
+            uint8_t ts[8];
+            for (int i = 0; i < 8; i++)
+                ts[i] = (uint8_t)(f.wall_us >> (56 - 8 * i));
+            fwrite(ts, 1, 8, tlog);
+            fwrite(f.data, 1, f.len, tlog);
+        }
+        else if (!count)
+        {
+            printf("%lu %.6f %s %s %u %u\n", (unsigned long)f.index,
+                    (f.mono_ns - reader.first_ns) / 1e9,
+                    f.link == FREC_LINK_AUTOPILOT ? "ap" : "gs",
+                    f.dir == FREC_DIR_RX ? "rx" : "tx", f.msgid, f.len);
+        }
+    }
+
+    if (tlog != NULL)
+        fclose(tlog);
+    if (count || tlog != NULL)
+        printf("%lu\n", (unsigned long)selected);
+
+    fprintf(stderr, "%lu frames selected in %.3f ms\n", (unsigned long)selected,
+            (time_monotonic_ns() - t0) / 1e6);
+    return 0;
+}
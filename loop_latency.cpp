@@ -0,0 +1,233 @@
+/**
+ * @file loop_latency.cpp
+ *
+ * @brief Closed-loop latency of the HIL link (HIL_SENSOR -> HIL_CONTROLS)
+ *
+ */
+
+#include "loop_latency.h"
+
+#include <string.h>
+
+
+// ------------------------------------------------------------------------
+//   Histograms
+// ------------------------------------------------------------------------
+//
+// latency_hist_add
+//
+// Single writer (the receiver task); the fields are stored atomically so
+// that report() can read them from another thread
+//
+void latency_hist_add(Latency_Histogram* h, uint64_t ns)
+{
+    if (h->count == 0 || ns < h->min_ns)
+        __atomic_store_n(&h->min_ns, ns, __ATOMIC_RELAXED);
+    if (ns > h->max_ns)
+        __atomic_store_n(&h->max_ns, ns, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&h->count, h->count + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&h->sum_ns, h->sum_ns + ns, __ATOMIC_RELAXED);
+
+    uint64_t bin = ns / LOOP_LATENCY_BIN_NS;
+    if (bin >= LOOP_LATENCY_BINS)
+        bin = LOOP_LATENCY_BINS - 1;
+    __atomic_store_n(&h->bins[bin], h->bins[bin] + 1, __ATOMIC_RELAXED);
+}
+
+//
+// latency_hist_snapshot
+//
+// Copy of a histogram still being written. Each field is read atomically;
+// the copy is not a single instant, so the statistics are clamped to the
+// samples actually found in the bins.
+//
+void latency_hist_snapshot(const Latency_Histogram* h, Latency_Histogram* out)
+{
+    out->count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+    out->sum_ns = __atomic_load_n(&h->sum_ns, __ATOMIC_RELAXED);
+    out->min_ns = __atomic_load_n(&h->min_ns, __ATOMIC_RELAXED);
+    out->max_ns = __atomic_load_n(&h->max_ns, __ATOMIC_RELAXED);
+
+    uint64_t binned = 0;
+    for (int i = 0; i < LOOP_LATENCY_BINS; i++)
+    {
+        out->bins[i] = __atomic_load_n(&h->bins[i], __ATOMIC_RELAXED);
+        binned += out->bins[i];
+    }
+
+    if (out->count > binned)
+        out->count = binned;
+}
+
+//
+// latency_hist_percentile
+//
+// Upper edge of the bin containing the p-th percentile (bounded by
+// the maximum)
+//
+uint64_t latency_hist_percentile(const Latency_Histogram* h, double p)
+{
+    if (h->count == 0)
+        return 0;
+
+    uint64_t target = (uint64_t)(p / 100.0 * h->count);
+    uint64_t acc = 0;
+    for (int i = 0; i < LOOP_LATENCY_BINS - 1; i++)
+    {
+        acc += h->bins[i];
+        if (acc > target)
+        {
+            uint64_t edge = (uint64_t)(i + 1) * LOOP_LATENCY_BIN_NS;
+            return (edge < h->max_ns) ? edge : h->max_ns;
+        }
+    }
+    return h->max_ns;
+}
+
+
+// ------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------
+Loop_Latency::Loop_Latency()
+{
+    memset(&total, 0, sizeof(total));
+    memset(&serial_tx, 0, sizeof(serial_tx));
+    memset(&board, 0, sizeof(board));
+    memset(&serial_rx, 0, sizeof(serial_rx));
+    memset(pending, 0, sizeof(pending));
+
+    echoed = 0;
+    unanswered = 0;
+    overflow = 0;
+
+    head = 0;
+    tail = 0;
+
+    set_baudrate(921600);
+}
+
+// ------------------------------------------------------------------------
+//  FUNCTIONS
+// ------------------------------------------------------------------------
+
+//
+// set_baudrate
+//
+// 8N1: 10 bits on the wire for each byte
+//
+void Loop_Latency::set_baudrate(int baudrate)
+{
+    ns_per_byte = (baudrate > 0) ? 10000000000ULL / baudrate : 0;
+}
+
+//
+// sensor_sent
+//
+void Loop_Latency::sensor_sent(uint64_t time_usec, uint64_t tx_start_ns,
+        uint64_t tx_end_ns, uint16_t frame_len)
+{
+    uint32_t h = head;
+    uint32_t t = __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+
+    // No answers for a while (board not in HIL mode yet)
+    if (h - t >= LOOP_LATENCY_PENDING)
+    {
+        __atomic_store_n(&overflow, overflow + 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    Pending_Sensor* s = &pending[h & (LOOP_LATENCY_PENDING - 1)];
+    s->time_usec = time_usec;
+    s->tx_start_ns = tx_start_ns;
+    s->tx_end_ns = tx_end_ns;
+    s->frame_len = frame_len;
+
+    __atomic_store_n(&head, h + 1, __ATOMIC_RELEASE);
+}
+
+//
+// controls_received
+//
+void Loop_Latency::controls_received(uint64_t board_time_usec, uint64_t rx_ns,
+        uint16_t frame_len)
+{
+    uint32_t h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    uint32_t t = tail;
+    uint32_t i;
+
+    // Firmware echoing the timestamp of the sensor frame
+    for (i = t; i != h; i++)
+    {
+        if (pending[i & (LOOP_LATENCY_PENDING - 1)].time_usec == board_time_usec)
+            break;
+    }
+
+    if (i != h)
+    {
+        __atomic_store_n(&echoed, echoed + 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&unanswered, unanswered + (i - t), __ATOMIC_RELAXED);
+        add_sample(pending[i & (LOOP_LATENCY_PENDING - 1)], rx_ns, frame_len);
+        t = i + 1;
+    }
+    else
+    {
+        // Answer to all the sensor frames written before its reception
+        while (t != h && pending[t & (LOOP_LATENCY_PENDING - 1)].tx_start_ns < rx_ns)
+        {
+            add_sample(pending[t & (LOOP_LATENCY_PENDING - 1)], rx_ns, frame_len);
+            t++;
+        }
+    }
+
+    __atomic_store_n(&tail, t, __ATOMIC_RELEASE);
+}
+
+//
+// add_sample
+//
+void Loop_Latency::add_sample(const Pending_Sensor &s, uint64_t rx_ns, uint16_t rx_len)
+{
+    uint64_t loop = (rx_ns > s.tx_start_ns) ? rx_ns - s.tx_start_ns : 0;
+    uint64_t tx = (s.tx_end_ns - s.tx_start_ns) + s.frame_len * ns_per_byte;
+    uint64_t rx = rx_len * ns_per_byte;
+    uint64_t compute = (loop > tx + rx) ? loop - tx - rx : 0;
+
+    latency_hist_add(&total, loop);
+    latency_hist_add(&serial_tx, tx);
+    latency_hist_add(&board, compute);
+    latency_hist_add(&serial_rx, rx);
+}
+
+//
+// report
+//
+void Loop_Latency::report(FILE* f)
+{
+    Latency_Histogram h[4];
+    const char* names[4] = {"loop", "serial_tx", "board", "serial_rx"};
+
+    latency_hist_snapshot(&total, &h[0]);
+    latency_hist_snapshot(&serial_tx, &h[1]);
+    latency_hist_snapshot(&board, &h[2]);
+    latency_hist_snapshot(&serial_rx, &h[3]);
+
+    fprintf(f, "Loop latency [us] (samples %lu, echoed %lu, unanswered %lu, overflow %lu)\n",
+            (unsigned long)h[0].count,
+            (unsigned long)__atomic_load_n(&echoed, __ATOMIC_RELAXED),
+            (unsigned long)__atomic_load_n(&unanswered, __ATOMIC_RELAXED),
+            (unsigned long)__atomic_load_n(&overflow, __ATOMIC_RELAXED));
+    fprintf(f, "%-10s %9s %9s %9s %9s %9s %9s\n", "", "MIN", "AVG", "P50", "P99",
+            "P99.9", "MAX");
+
+    for (int i = 0; i < 4; i++)
+    {
+        uint64_t n = h[i].count ? h[i].count : 1;
+        fprintf(f, "%-10s %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n", names[i],
+                h[i].min_ns / 1000.0, h[i].sum_ns / 1000.0 / n,
+                latency_hist_percentile(&h[i], 50) / 1000.0,
+                latency_hist_percentile(&h[i], 99) / 1000.0,
+                latency_hist_percentile(&h[i], 99.9) / 1000.0,
+                h[i].max_ns / 1000.0);
+    }
+}
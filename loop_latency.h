@@ -0,0 +1,117 @@
+/**
+ * @file loop_latency.h
+ *
+ * @brief Closed-loop latency of the HIL link (HIL_SENSOR -> HIL_CONTROLS)
+ *
+ * Every HIL_SENSOR sent to the board is tagged with its time_usec and
+ * with the host time of the write. When a HIL_CONTROLS comes back it is
+ * correlated with the sensor frame it answers: the one with the same
+ * timestamp when the firmware echoes it, otherwise every sensor frame
+ * still waiting for an answer (the "next HIL_CONTROLS" rule).
+ *
+ * The loop delay is split in serial TX, board compute and serial RX.
+ * TX and RX are estimated from the write() duration and the time the
+ * frames need on the wire at the configured baudrate; the compute time
+ * is what is left.
+ *
+ * The histograms and counters have a single writer each (the counters
+ * are commented with their task) and are stored with relaxed atomics;
+ * report() may run concurrently and works on a snapshot.
+ *
+ */
+
+#ifndef LOOP_LATENCY_H_
+#define LOOP_LATENCY_H_
+
+// ------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdint.h>
+
+// ------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------
+
+// Sensor frames waiting for an answer (power of two)
+#define LOOP_LATENCY_PENDING    64
+
+// Histograms: 200 us bins, the last bin collects the overflow
+#define LOOP_LATENCY_BINS       50
+#define LOOP_LATENCY_BIN_NS     200000
+
+
+// ------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------
+// Distribution of one latency component
+struct Latency_Histogram {
+
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    uint64_t bins[LOOP_LATENCY_BINS];
+};
+
+// Sensor frame waiting for the HIL_CONTROLS
+struct Pending_Sensor {
+
+    uint64_t time_usec;     // Timestamp carried by the HIL_SENSOR
+    uint64_t tx_start_ns;   // write() called
+    uint64_t tx_end_ns;     // write() returned
+    uint16_t frame_len;     // Bytes on the wire
+};
+
+
+// ---------------------------------------------------------------------
+//   Loop Latency Class
+// ---------------------------------------------------------------------
+class Loop_Latency
+{
+
+    public:
+
+        Loop_Latency();
+
+        void set_baudrate(int baudrate);
+
+        // Sender side (task writing the HIL_SENSOR)
+        void sensor_sent(uint64_t time_usec, uint64_t tx_start_ns,
+                uint64_t tx_end_ns, uint16_t frame_len);
+
+        // Receiver side (task reading the HIL_CONTROLS)
+        void controls_received(uint64_t board_time_usec, uint64_t rx_ns,
+                uint16_t frame_len);
+
+        void report(FILE* f);
+
+        Latency_Histogram total;
+        Latency_Histogram serial_tx;
+        Latency_Histogram board;
+        Latency_Histogram serial_rx;
+
+        uint64_t echoed;        // Matched by timestamp (receiver)
+        uint64_t unanswered;    // Skipped by an echoed answer (receiver)
+        uint64_t overflow;      // Not tracked, too many pending (sender)
+
+    private:
+
+        // Single producer / single consumer ring
+        Pending_Sensor pending[LOOP_LATENCY_PENDING];
+        uint32_t head;          // Written by the sender
+        uint32_t tail;          // Written by the receiver
+
+        uint64_t ns_per_byte;
+
+        void add_sample(const Pending_Sensor &s, uint64_t rx_ns, uint16_t rx_len);
+
+};
+
+void latency_hist_add(Latency_Histogram* h, uint64_t ns);
+void latency_hist_snapshot(const Latency_Histogram* h, Latency_Histogram* out);
+uint64_t latency_hist_percentile(const Latency_Histogram* h, double p);
+
+
+#endif // LOOP_LATENCY_H_
@@ -11,7 +11,8 @@ extern "C"
     #include "DynModel_private.h"
 }
 
-int time_to_exit = 0;
+volatile sig_atomic_t time_to_exit = 0;
+volatile sig_atomic_t quit_signal = 0;
 
 int main(int argc, char *argv[])
 {
@@ -46,6 +47,16 @@ int main(int argc, char *argv[])
 	// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 	char* uart_name = (char*)"/dev/ttyUSB0";
 	int baudrate = 921600;
+	int mav_version = MAV_VERSION_AUTO;
+	char* record_prefix = NULL;
+	char* replay_prefix = NULL;
+	double replay_speed = 1.0;
+	char* replay_log = NULL;
+	char* gt_file = NULL;
+	bool gt_compress = false;
+	char* metrics_socket = NULL;
+	char* mission_file = NULL;
+	bool param_cache_on = false;
 	/*
 	 *                           +---------+
 	 *                           |         |
@@ -69,9 +80,33 @@ int main(int argc, char *argv[])
 
 	UAV_base_mode = 0;
 
+	// --------------------------------------------------------------------
+	//   PARSE THE COMMANDS
+	// --------------------------------------------------------------------
+	// Parse the Command Line 
+	rt_config_defaults(rt_cfg);
+	parse_commandline(argc, argv, uart_name, baudrate, 
+			sim_ip, sim_r_port, sim_w_port, 
+			gs_ip, gs_r_port, gs_w_port, rt_cfg, mav_version, record_prefix,
+			replay_prefix, replay_speed, replay_log, gt_file, gt_compress,
+			metrics_socket, mission_file, param_cache_on);
+	param_cache.enabled = param_cache_on;
+
+	// The recorded frames stand for the board
+	if (replay_prefix != NULL)
+		uart_name = (char*)"replay";
+
+	// --------------------------------------------------------------------
+	//   REAL-TIME SETTINGS
+	// --------------------------------------------------------------------
+	// The mutexes shared by the tasks are created from now on with the
+	// requested protocol. Memory is locked before any task is started.
+	rt_set_pi_mutex(rt_cfg.pi_mutex);
+	rt_lock_memory(rt_cfg);
+
     // Initialize the global Mutex and Condition Variable
     // for the first heartbeat check
-	pthread_mutex_init(&mut_first_heartbeat, 0);
+	rt_mutex_init(&mut_first_heartbeat);
 	pthread_cond_init(&cond_first_heartbeat, 0);
     
 	autopilot_connected = false; // Variable associated with the first heartbeat
@@ -84,16 +119,10 @@ int main(int argc, char *argv[])
 	// --------------------------------------------------------------------
 	//   START PTASK ENVIRONMENT AND RUN THREADS 
 	// --------------------------------------------------------------------
-	ptask_init(SCHED_OTHER, GLOBAL, NO_PROTOCOL);
-
-
-	// --------------------------------------------------------------------
-	//   PARSE THE COMMANDS
-	// --------------------------------------------------------------------
-	// Parse the Command Line 
-	parse_commandline(argc, argv, uart_name, baudrate, 
-			sim_ip, sim_r_port, sim_w_port, 
-			gs_ip, gs_r_port, gs_w_port);
+	// Policy and affinity are applied by each task on itself, 
+	// see rt_apply_task()
+	ptask_init(SCHED_OTHER, GLOBAL, 
+			rt_cfg.pi_mutex ? PRIO_INHERITANCE : NO_PROTOCOL);
 
 
 	// --------------------------------------
@@ -118,6 +147,9 @@ int main(int argc, char *argv[])
 	 * inside the Autopilot_Interface object.
 	 */
 	Autopilot_Interface autopilot_interface(uart_name, baudrate);
+	loop_latency.set_baudrate(autopilot_interface.port.baudrate);
+	autopilot_interface.loop_latency = &loop_latency;
+	mav_link_init(&autopilot_interface.mav_link, autopilot_interface.port.kind_name(), mav_version);
 
 	/*
 	 * Instantiate an ground station interface object
@@ -127,6 +159,7 @@ int main(int argc, char *argv[])
 	 * inside the GS_Interface object.
 	 */
 	GS_Interface gs_interface(gs_ip, gs_r_port, gs_w_port);
+	mav_link_init(&gs_interface.mav_link, "gs", mav_version);
 
 
 
@@ -137,20 +170,64 @@ int main(int argc, char *argv[])
 	/*
 	 * Setup interrupt signal handler
 	 *
-	 * Responds to early exits signaled with Ctrl-C.  The handler will 
-	 * command the UAV to return the standar operative mode, and close 
-	 * threads and the port.
+	 * Responds to early exits signaled with Ctrl-C (or SIGTERM). The
+	 * handler only raises time_to_exit: the signal may be delivered to
+	 * any task, in the middle of anything (a record of the ground
+	 * truth, a lock held). The main thread notices it, commands the UAV
+	 * to return the standard operative mode, and closes threads and the
+	 * port (quit_router).
 	 *
 	 */
 	autopilot_interface_quit    = &autopilot_interface;
 	sim_interface_quit          = &sim_interface;
+	gs_interface_quit           = &gs_interface;
 	signal(SIGINT,quit_handler);
+	signal(SIGTERM,quit_handler);
 
 	struct Interfaces point_to_interfaces;
 	point_to_interfaces.sim = &sim_interface;
 	point_to_interfaces.gs = &gs_interface;
 	point_to_interfaces.aut = &autopilot_interface;
 
+	// Frames for the Ground Station only are forwarded without decoding
+	autopilot_interface.raw_sink = forward_raw;
+	autopilot_interface.raw_sink_arg = &point_to_interfaces;
+
+	// Live counters of the links and of the queues
+	metrics_open();
+	autopilot_interface.metrics_register("ap");
+	gs_interface.metrics_register("gs");
+	simstepM_id = metrics_register_gauge("sim_step_ns");
+	if (metrics_socket != NULL)
+		metrics_serve(metrics_socket);
+
+	// Recording of the traffic on the links
+	if (record_prefix != NULL)
+	{
+		if (flight_recorder.start(record_prefix) < 0)
+			return -1;
+		autopilot_interface.recorder = &flight_recorder;
+		gs_interface.recorder = &flight_recorder;
+	}
+
+	// Export of the state of the model, step by step
+	if (gt_file != NULL && replay_prefix == NULL)
+	{
+		if (ground_truth.start(gt_file, gt_compress) < 0)
+			return -1;
+	}
+
+	// Mission uploaded at the first heartbeat of the board
+	if (mission_file != NULL && replay_prefix == NULL)
+	{
+		if (mission_upload.load(mission_file) < 0)
+			return -1;
+	}
+
+	// Offline replay of a recording, in place of the tasks
+	if (replay_prefix != NULL)
+		return replay_traffic(replay_prefix, replay_speed, replay_log, &point_to_interfaces);
+
 
 
 	//======================================================================
@@ -163,16 +240,46 @@ int main(int argc, char *argv[])
 
 	tspec_init();
 
+	// Timing statistics of the tasks (published in shared memory)
+	task_stats_open();
+	inflowS_id = task_stats_register("inflow", tspec_to(&rd_period, MICRO), 
+			tspec_to(&rd_period, MICRO));
+	simulatorS_id = task_stats_register("simulator", tspec_to(&wr_period, MICRO), 
+			tspec_to(&wr_period, MICRO));
+	gsS_id = task_stats_register("gs", tspec_to(&gs_period, MICRO), 
+			tspec_to(&gs_period, MICRO));
+
+	/************ OUTFLOW THREAD *************/
+
+	// TX engine of the serial port: it is driven by the sending queues
+	// (the period is not used), so it has to be running before anybody
+	// sends messages to the board
+	tpars params_outflow = TASK_SPEC_DFL;
+	params_outflow.period = wr_period;
+	params_outflow.rdline = wr_period;
+	params_outflow.priority = rt_cfg.outflow.priority;
+	params_outflow.act_flag = NOW;
+	params_outflow.measure_flag = 0;
+	params_outflow.processor = (rt_cfg.outflow.processor < 0) ? 0 : rt_cfg.outflow.processor;
+	params_outflow.arg = &point_to_interfaces;
+
+	outflowT_id = ptask_create_param(outflow_thread, &params_outflow);
+	if (outflowT_id == -1)
+	{
+		printf("Outflow Thread not created!");
+		return -1;
+	}
+
 	/************ INFLOW THREAD *************/
 
 	// Defining the Structure containing the thread Properties 
 	tpars params_inflow = TASK_SPEC_DFL;
 	params_inflow.period = rd_period;
 	params_inflow.rdline = rd_period;
-	params_inflow.priority = 90;
+	params_inflow.priority = rt_cfg.inflow.priority;
 	params_inflow.act_flag = NOW;
 	params_inflow.measure_flag = 0;
-	params_inflow.processor = 0;
+	params_inflow.processor = (rt_cfg.inflow.processor < 0) ? 0 : rt_cfg.inflow.processor;
 	params_inflow.arg = &point_to_interfaces;
 
 	// Start to retrieve data from the Autopilot Interface
@@ -189,12 +296,23 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 	if(!autopilot_connected)
-	{
 		printf("Waiting for autopilot connection...\n");
-		pthread_cond_wait(&cond_first_heartbeat, &mut_first_heartbeat);
+	while (!autopilot_connected && !time_to_exit)
+	{
+		struct timespec t;
+		clock_gettime(CLOCK_REALTIME, &t);
+		t.tv_nsec += 100000000L;
+		if (t.tv_nsec >= 1000000000L)
+		{
+			t.tv_sec++;
+			t.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&cond_first_heartbeat, &mut_first_heartbeat, &t);
 	}
-	printf("Connected!\n");
 	pthread_mutex_unlock(&mut_first_heartbeat);
+	if (time_to_exit)
+		quit_router(quit_signal);
+	printf("Connected!\n");
 
 	// Now we are receiving messages from the autopilot board
 
@@ -203,10 +321,10 @@ int main(int argc, char *argv[])
 	tpars params_sim = TASK_SPEC_DFL;
 	params_sim.period = wr_period;
 	params_sim.rdline = wr_period;
-	params_sim.priority = 90;
+	params_sim.priority = rt_cfg.simulator.priority;
 	params_sim.act_flag = NOW;
 	params_sim.measure_flag = 0;
-	params_sim.processor = 0;
+	params_sim.processor = (rt_cfg.simulator.processor < 0) ? 0 : rt_cfg.simulator.processor;
 	params_sim.arg = &point_to_interfaces;
 
 
@@ -223,10 +341,10 @@ int main(int argc, char *argv[])
 	tpars params_gs = TASK_SPEC_DFL;
 	params_gs.period = gs_period;
 	params_gs.rdline = gs_period;
-	params_gs.priority = 80;
+	params_gs.priority = rt_cfg.gs.priority;
 	params_gs.act_flag = NOW;
 	params_gs.measure_flag = 0;
-	params_gs.processor = 0;
+	params_gs.processor = (rt_cfg.gs.processor < 0) ? 0 : rt_cfg.gs.processor;
 	params_gs.arg = &point_to_interfaces;
 	gsT_id = ptask_create_param(gs_thread, &params_gs);
 	if(gsT_id == -1)
@@ -235,8 +353,22 @@ int main(int argc, char *argv[])
 	}
 
 
-	for(;;)
+	// Periodic report of the loop latency, of the link usage and of the
+	// quality of the links
+	int report_count = 0;
+	while (!time_to_exit)
+	{
 		usleep(500000);
+		if (++report_count == 20)
+		{
+			report_count = 0;
+			loop_latency.report(stdout);
+			autopilot_interface.link_usage.report(stdout);
+			autopilot_interface.link_quality.report(stdout);
+			gs_interface.link_quality.report(stdout);
+		}
+	}
+	quit_router(quit_signal);
 
 	return 0;
 
@@ -260,6 +392,10 @@ int main(int argc, char *argv[])
  */
 void inflow_thread()
 {
+	rt_prefault_stack(rt_cfg.prefault_kb);
+	rt_apply_task(rt_cfg.inflow);
+	rt_report_task(rt_cfg.inflow);
+
 	inflow_thread_active = true;
 	struct Interfaces* p = (struct Interfaces*)ptask_get_argument();
 
@@ -282,17 +418,14 @@ void inflow_thread()
 	ptime hil_ctr_rec_time = ptask_gettime(MICRO);
 	ptime hil_ctr_rec_time_old = ptask_gettime(MICRO); 
 
-	// Initialize the control vector
-	for (i = 0; i < 4; i++)
-		hil_ctr[i] = 0;
-
 	inflow_end_time = 0;
 
 	printf("***  Starting Inflow Thread  ***\n");
 	// The autopilot interface has been configured
 	while (!time_to_exit)
 	{
-        //ptask_set_deadline(tid, ptask_get_period(tid, MICRO), MICRO);
+		task_stats_job_start(inflowS_id);
+
 		// Access the Autopilot interface and obtain the 
 		// number of read messages 
 		NMessRead = p->aut->fetch_data();
@@ -309,6 +442,9 @@ void inflow_thread()
 			}
 		}
 
+		// Retransmissions of the mission upload
+		mission_upload.poll(time_monotonic_ns());
+
 		// If not synchonized and we have already received info from the
 		// the autopilot board
 		if (first && autopilot_connected)
@@ -317,32 +453,10 @@ void inflow_thread()
 			first = false;
 		}
 
-		// Send controls
-		// (Don't send messages if you don't have passed the synchronization step)
-		if (!first && p->aut->is_hil() && 
-				simulator_thread_active && 
-				autopilot_connected)
-		{
-            // Update the Input Structure 
-            DynModel_U.PWM1 = hil_ctr[0];
-            DynModel_U.PWM2 = hil_ctr[1];
-            DynModel_U.PWM3 = hil_ctr[2];
-            DynModel_U.PWM4 = hil_ctr[3];
-            
-            printf("HIL_CTR : %1.2f | %1.2f | %1.2f | %1.2f\n", hil_ctr[0], hil_ctr[1], hil_ctr[2], hil_ctr[3]);
-            
-			//p->sim->sendActuatorCommand(hil_ctr, NFloatCont);
-			hil_ctr_time = ptask_gettime(MICRO);
-			fprintf(file_TSndComm,"%lu \n", hil_ctr_time);
-		}
-
-		/*
-        if (ptask_deadline_miss())
-        {
-			printf("Inflow Thread Deadline Miss!  Abs deadline = %lu || Time = %lu\n", 
-                   task_absdl(tid), ptask_gettime(MILLI));
-        }
-        */
+		// The controls are applied to the model by the simulator 
+		// thread, through the hil_ctr_mailbox
+
+		task_stats_job_end(inflowS_id);
 		ptask_wait_for_period();
 
 
@@ -364,22 +478,47 @@ void routing_messages(mavlink_message_t *msg, struct Interfaces* p)
 		case MAVLINK_MSG_ID_HIL_CONTROLS:
 			if (p->aut->is_hil() && simulator_thread_active)
 			{
-				// Extract the timestamp of the control generated by the board
-				uint64_t rec_time = mavlink_msg_hil_controls_get_time_usec(msg);
-				hil_ctr[0] = mavlink_msg_hil_controls_get_roll_ailerons(msg);
-				hil_ctr[1] = mavlink_msg_hil_controls_get_pitch_elevator(msg);
-				hil_ctr[1] = mavlink_msg_hil_controls_get_yaw_rudder(msg);
-				hil_ctr[3] = mavlink_msg_hil_controls_get_throttle(msg);
+				// Store the control together with the timestamp generated
+				// by the board and the time of reception
+				Actuator_Sample ctr;
+				ctr.board_time_usec = MAV_GET(msg, HIL_CONTROLS, time_usec);
+				ctr.rx_time_ns = p->aut->current_messages.rx_time_ns[msg->msgid];
+				ctr.roll_ailerons = MAV_GET(msg, HIL_CONTROLS, roll_ailerons);
+				ctr.pitch_elevator = MAV_GET(msg, HIL_CONTROLS, pitch_elevator);
+				ctr.yaw_rudder = MAV_GET(msg, HIL_CONTROLS, yaw_rudder);
+				ctr.throttle = MAV_GET(msg, HIL_CONTROLS, throttle);
+				hil_ctr_mailbox.publish(ctr);
+
+				// Close the loop opened by the HIL_SENSOR frames
+				loop_latency.controls_received(ctr.board_time_usec, ctr.rx_time_ns,
+						mav_frame_len(msg));
 			}
 			break;
 
 			// TO GROUND STATION
 		case MAVLINK_MSG_ID_HEARTBEAT:
-			UAV_base_mode = mavlink_msg_heartbeat_get_base_mode(msg); 
+			UAV_base_mode = MAV_GET(msg, HEARTBEAT, base_mode); 
 			pthread_mutex_lock(&mut_first_heartbeat);
 			autopilot_connected = true;
 			pthread_cond_signal(&cond_first_heartbeat);
 			pthread_mutex_unlock(&mut_first_heartbeat);
+			mission_upload.start(p->aut, msg->sysid, msg->compid, time_monotonic_ns());
+			param_cache.set_owner(msg);
+			if (gs_thread_active)
+				p->gs->pushMessage(msg);
+			break;
+
+			// Answers to the mission upload of the router, the others go
+			// to the Ground Station
+		case MAVLINK_MSG_ID_MISSION_REQUEST:
+		case MAVLINK_MSG_ID_MISSION_REQUEST_INT:
+		case MAVLINK_MSG_ID_MISSION_ACK:
+			if (!mission_upload.handle(msg, time_monotonic_ns()) && gs_thread_active)
+				p->gs->pushMessage(msg);
+			break;
+
+		case MAVLINK_MSG_ID_PARAM_VALUE:
+			param_cache.update(msg);
 			if (gs_thread_active)
 				p->gs->pushMessage(msg);
 			break;
@@ -391,11 +530,61 @@ void routing_messages(mavlink_message_t *msg, struct Interfaces* p)
 	}
 }
 
+// -------------------------------------------------------
+//  Raw passthrough of the frames from the autopilot
+//
+//  Called by fetch_data() for each frame received: the
+//  frames that routing_messages() would only push to the
+//  GS are forwarded with their original bytes. Returns 0
+//  for the frames that have to be routed.
+//
+// -------------------------------------------------------
+int forward_raw(void* arg, const mavlink_message_t* msg, const uint8_t* frame, unsigned len)
+{
+	struct Interfaces* p = (struct Interfaces*)arg;
+
+	if (mav_router_decodes(msg->msgid) || !gs_thread_active)
+		return 0;
+
+	return p->gs->pushRaw(msg, frame, len);
+}
+
 
 
 
 
 
+// ----------------------------------------------------------------------
+//    OUTFLOW THREAD
+// ----------------------------------------------------------------------
+/*
+ * This thread is the only writer of the serial port. It takes the 
+ * messages queued by the simulator and ground station threads and 
+ * writes them to the PX4, sensor data first.
+ *
+ *
+ *   Simulator      >-----+
+ *                        +----> PX4
+ *   Ground Station >-----+
+ *
+ *
+ */
+void outflow_thread()
+{
+	rt_prefault_stack(rt_cfg.prefault_kb);
+	rt_apply_task(rt_cfg.outflow);
+	rt_report_task(rt_cfg.outflow);
+
+	struct Interfaces* p = (struct Interfaces*)ptask_get_argument();
+
+	printf("***  Starting Outflow Thread  ***\n");
+
+	// Returns when the engine is stopped
+	p->aut->tx_engine();
+}
+
+
+
 // ----------------------------------------------------------------------
 //    TEST THREAD
 // ----------------------------------------------------------------------
@@ -455,49 +644,34 @@ void simulator_thread()
 	struct Interfaces* p = (struct Interfaces*)ptask_get_argument();
 
 	int ret_sens;
-	int ret_gps;
 
 	uint8_t system_id = p->aut->system_id;
 	uint8_t component_id = p->aut->autopilot_id;
 
-	mavlink_message_t sensor_msg;
-	mavlink_message_t gps_msg;
 	mavlink_status_t status;
 
 	bool first = true;
-	const unsigned int NFloatSens = 22;
-
-	float      xacc;
-	float      yacc;
-	float      zacc;
-	float      xgyro;
-	float      ygyro;
-	float      zgyro;
-	float      xmag;
-	float      ymag;
-	float      zmag;
-	float      abs_pressure;
-	float      diff_pressure;
-	float      pressure_alt;
-	float      temperature;
-	uint32_t   fields_updated;
-
-	uint8_t    fix_type;
-	int32_t    lat;
-	int32_t    lon;
-	int32_t    alt;
-	uint16_t   eph;
-	uint16_t   epv;
-	uint16_t   vel;
-	int16_t    vn;
-	int16_t    ve;
-	int16_t    vd;
-	int16_t    cog;
-	uint8_t    satellites_visible;
-    
+
+	// Header of the HIL frames, encoded in place for the TX engine
+	Mav_Frame_Hdr hdr;
+	hdr.sysid = system_id;
+	hdr.compid = component_id;
+	// Own sequence: only the simulator sends as system_id:autopilot_id,
+	// while the packers of the other tasks update MAVLINK_COMM_0
+	uint8_t hil_seq = 0;
+	Tx_Direct* frames;
+	uint16_t len;
+
     uint64_t   time_usec;
 
+	Actuator_Sample hil_ctr;
+	uint32_t hil_ctr_count = 0;
+	bool fresh_ctr;
+
 	printf("***  Starting Simulator Thread  ***\n");
+	rt_prefault_stack(rt_cfg.prefault_kb);
+	rt_apply_task(rt_cfg.simulator);
+	rt_report_task(rt_cfg.simulator);
 	simulator_thread_active = true;
     
     ptime old_sent_time = 0;
@@ -505,76 +679,73 @@ void simulator_thread()
 	// Check the initialization of the necessary classes
 	while (!time_to_exit)
 	{
-        //ptask_set_deadline(tid, ptask_get_period(tid, MICRO), MICRO);
 		if (first)
 		{
 			first = false;
 			pbarrier_wait(&barrier, 0);
 			printf("Simulation Thread STARTED! \n");
 		}
+		task_stats_job_start(simulatorS_id);
+
+		// Update the Input Structure with the latest control from the board
+		fresh_ctr = hil_ctr_mailbox.read(&hil_ctr, hil_ctr_count);
+		if (hil_ctr.count > 0)
+		{
+			ctr_age_ns = time_monotonic_ns() - hil_ctr.rx_time_ns;
+			ctr_age_sum_ns += ctr_age_ns;
+			ctr_steps++;
+			if (ctr_age_ns > ctr_age_max_ns)
+				ctr_age_max_ns = ctr_age_ns;
+
+			if (fresh_ctr)
+			{
+				DynModel_U.PWM1 = hil_ctr.roll_ailerons;
+				DynModel_U.PWM2 = hil_ctr.pitch_elevator;
+				DynModel_U.PWM3 = hil_ctr.yaw_rudder;
+				DynModel_U.PWM4 = hil_ctr.throttle;
+
+				hil_ctr_time = ptask_gettime(MICRO);
+				fprintf(file_TSndComm,"%lu \n", hil_ctr_time);
+			}
+			else
+				ctr_stale_steps++;
+		}
+
+		uint64_t step_start = time_monotonic_ns();
 		DynModel_step();
+		uint64_t step_end = time_monotonic_ns();
+		metrics_gauge(simstepM_id, step_end - step_start);
+		ground_truth.record(step_end, &DynModel_U, &DynModel_Y, &DynModel_X);
 
         time_usec = ptask_gettime(MICRO);
 
-        xacc = (float)DynModel_Y.Accelerometer[0];
-        yacc = (float)DynModel_Y.Accelerometer[1]; 
-        zacc = (float)DynModel_Y.Accelerometer[2];
-        xgyro = (float)DynModel_Y.Gyro[0];
-        ygyro = (float)DynModel_Y.Gyro[1];
-        zgyro = (float)DynModel_Y.Gyro[2];
-        xmag = (float)DynModel_Y.Magn[0];
-        ymag = (float)DynModel_Y.Magn[1];
-        zmag = (float)DynModel_Y.Magn[2];
-        abs_pressure = (float)DynModel_Y.Press;
-        diff_pressure = (float)DynModel_Y.diff_Pres;
-        pressure_alt = (float)DynModel_Y.Baro_Alt;
-        temperature = (float)DynModel_Y.Temp;
-        fields_updated = (uint32_t)0xFF;
-        fix_type = 3;
-        lat = (int32_t)(DynModel_Y.Gps_Lat * 1e7);
-        lon = (int32_t)(DynModel_Y.Gps_Lon * 1e7);
-        alt = (int32_t)(DynModel_Y.Gps_Alt * 1e3);
-        eph = 1;
-        epv = 1;
-        vel = (uint16_t)(DynModel_Y.Gps_V_Mod * 100); // cm/s
-        vn  = (int16_t)(DynModel_Y.Gps_V[0] * 100); 
-        ve  = (int16_t)(DynModel_Y.Gps_V[1] * 100);
-        vd  = (int16_t)(DynModel_Y.Gps_V[2] * 100);
-        cog = (int16_t)(DynModel_Y.COG * 100);  
-        satellites_visible = 8;
-
-        // Composition of the mavlink messages  
-        //  Sensors Message 
-        mavlink_msg_hil_sensor_pack(system_id, component_id, &sensor_msg, time_usec, 
-                xacc, yacc, zacc, xgyro, ygyro, zgyro, xmag, ymag, zmag, abs_pressure, 
-                diff_pressure, pressure_alt, temperature, fields_updated);
-        //  GPS Message
-        mavlink_msg_hil_gps_pack(system_id, component_id, &gps_msg, 
-                time_usec, fix_type, lat, lon, alt, eph, epv, 
-                vel, vn, ve, vd, cog, satellites_visible);
 		if (p->aut->is_hil())
 		{
-            // Send Sensor Data to Board
-			ret_sens = p->aut->send_message(&sensor_msg);
-            
-            // Record Sending Time
-			ptime sendTime = ptask_gettime(MICRO);
-			fprintf(file_TSndSns,"%lu \n", sendTime);
+			// Sensor (and GPS) frames straight from the model outputs to
+			// the buffer of the serial port, in the version of the link
+			hdr.version = p->aut->mav_link.out;
+			frames = p->aut->tx_direct_begin();
+
+			hdr.seq = hil_seq++;
+			len = hil_sensor_encode(frames->buf + frames->len, &hdr, time_usec, &DynModel_Y);
+			p->aut->tx_direct_add(frames, MAVLINK_MSG_ID_HIL_SENSOR, len,
+					Mav_Msg<MAVLINK_MSG_ID_HIL_SENSOR>::v1_frame_len, time_usec);
 
-            // Send GPS data to Board
 			if ( (time_usec - old_sent_time) > 450000)
 			{
-				ret_gps = p->aut->send_message(&gps_msg);
+				hdr.seq = hil_seq++;
+				len = hil_gps_encode(frames->buf + frames->len, &hdr, time_usec, &DynModel_Y);
+				p->aut->tx_direct_add(frames, MAVLINK_MSG_ID_HIL_GPS, len,
+						Mav_Msg<MAVLINK_MSG_ID_HIL_GPS>::v1_frame_len, 0);
 				old_sent_time = time_usec;
 			}
+			ret_sens = p->aut->tx_direct_commit();
+            
+            // Record Sending Time
+			ptime sendTime = ptask_gettime(MICRO);
+			fprintf(file_TSndSns,"%lu \n", sendTime);
 		}
-		/*
-        if (ptask_deadline_miss())
-        {
-			printf("Simulator Thread Deadline Miss!  Abs deadline = %lu || Time = %lu\n", 
-                   task_absdl(tid), ptask_gettime(MILLI));
-        }
-        */
+		task_stats_job_end(simulatorS_id);
         ptask_wait_for_period();
 		
 	}
@@ -600,6 +771,9 @@ void simulator_thread()
 void gs_thread()
 {
 	printf("***  Starting Ground Station Thread  ***\n");
+	rt_prefault_stack(rt_cfg.prefault_kb);
+	rt_apply_task(rt_cfg.gs);
+	rt_report_task(rt_cfg.gs);
 	const unsigned int DIM_BUFF = 256;
 
 	int tid = ptask_get_index();
@@ -625,21 +799,28 @@ void gs_thread()
 			first = false;
 			printf("GS Thread STARTED! \n");
 		}
+		task_stats_job_start(gsS_id);
+
 		// Send all the pending data to the Ground Station
 		p->gs->sendMessage();
 
 		//Wait for data from the Ground Station 
 		p->gs->receiveMessage();
-		// Retrieve message from the Ground Station
-		p->gs->getMessage(&msg_message);
-
-		// Send data to the Autopilot
-		p->aut->send_message(&msg_message);
+		// Retrieve the messages from the Ground Station and 
+		// send them to the Autopilot (parameter requests may be
+		// answered by the cache)
+		while (p->gs->getMessage(&msg_message) > 0)
+		{
+			if (!param_cache.request(&msg_message, p->gs))
+				p->aut->send_message(&msg_message);
+		}
+		param_cache.poll(p->gs);
         
         // Record Sending Time
         gs_time = ptask_gettime(MICRO); 
 		fprintf(file_TGS,"%lu \n",gs_time);
         
+		task_stats_job_end(gsS_id);
         ptask_wait_for_period();
 	}
 
@@ -650,16 +831,253 @@ void gs_thread()
 
 
 
+// ----------------------------------------------------------------------
+//    REPLAY
+// ----------------------------------------------------------------------
+/*
+ * The frames received in a recorded session are fed, in the order they
+ * were read, to the same code paths of the tasks: the autopilot frames
+ * through the replay link to fetch_data() and routing_messages(), the
+ * Ground Station frames to receiveBytes() and send_message(). Everything
+ * runs here, one frame at a time, with the monotonic clock set to the
+ * time of the frame. The TX engine runs in its own thread and each frame
+ * is completely written before the next one.
+ *
+ * For each frame a line with the decision of the router is written to
+ * the log:
+ *
+ *   <index> <ap|gs> <msgid> <sysid>:<compid> <seq> -> <decision>
+ *
+ *   gs_raw, gs_raw_drop    raw passthrough to the Ground Station
+ *   gs                     queued for the Ground Station
+ *   sim                    actuator command for the simulator
+ *   board:<class>          written to the board (sensor, command, bulk)
+ *   board_drop             dropped by the TX engine
+ *   none                   consumed by the router
+ *   bad                    not a valid frame
+ *
+ * The log only depends on the recording: two runs can be compared with
+ * diff.
+ *
+ * speed: 1 = recorded pace, N = N times faster, 0 = as fast as possible
+ */
+static void* replay_tx_engine(void* arg)
+{
+	Autopilot_Interface* aut = (Autopilot_Interface*)arg;
+	aut->tx_engine();
+	return NULL;
+}
+
+static uint64_t replay_clock_ns()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000ULL + (uint64_t)t.tv_nsec;
+}
+
+int replay_traffic(const char* prefix, double speed, const char* log_name,
+		struct Interfaces* p)
+{
+	const char* classes[TX_NUM_CLASSES] = {"sensor", "command", "bulk"};
+
+	Frec_Reader reader;
+	if (reader.open(prefix) < 0)
+		return -1;
+
+	FILE* log = stdout;
+	if (log_name != NULL)
+	{
+		log = fopen(log_name, "w");
+		if (log == NULL)
+		{
+			printf("Replay: could not create %s\n", log_name);
+			return -1;
+		}
+	}
+
+	// Same routing as a HIL session with all the tasks running
+	gs_thread_active = true;
+	simulator_thread_active = true;
+	p->gs->replay = true;
+
+	pthread_t tx_thread;
+	if (pthread_create(&tx_thread, NULL, replay_tx_engine, p->aut) != 0)
+	{
+		printf("Replay: could not start the TX engine\n");
+		return -1;
+	}
+
+	printf("Replaying %s: %lu frames in %lu segments, %.3f s, ", prefix,
+			(unsigned long)reader.frames, (unsigned long)reader.segments.size(),
+			(reader.last_ns - reader.first_ns) / 1e9);
+	if (speed > 0)
+		printf("speed %.2fx\n", speed);
+	else
+		printf("as fast as possible\n");
+
+	mavlink_message_t msg;
+	Actuator_Sample ctr;
+	uint32_t ctr_count = 0;
+	uint64_t replayed = 0;
+	uint64_t routed = 0;
+	char decision[64];
+
+	Frec_Frame f;
+	uint64_t clock_ns = 0;
+	uint64_t start_ns = replay_clock_ns();
+	while (!time_to_exit && reader.next(&f))
+	{
+		// Frames written by the router are the result, not the input
+		if (f.dir != FREC_DIR_RX)
+			continue;
+
+		if (speed > 0)
+		{
+			uint64_t due = start_ns + (uint64_t)((f.mono_ns - reader.first_ns) / speed);
+			struct timespec t;
+			t.tv_sec = due / 1000000000ULL;
+			t.tv_nsec = due % 1000000000ULL;
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL);
+		}
+		// A frame published late may be older than the end of the
+		// previous segment: the clock never goes back
+		if (f.mono_ns > clock_ns)
+			clock_ns = f.mono_ns;
+		time_set_virtual_ns(clock_ns);
+
+		int n = 0;
+		decision[0] = '\0';
+		if (f.link == FREC_LINK_AUTOPILOT)
+		{
+			uint64_t forwarded = p->aut->raw_forwarded;
+			uint64_t raw_drops = p->gs->raw_drops;
+			uint64_t queued = p->gs->queued;
+
+			p->aut->port.replay_input(f.data, f.len);
+			int nread = p->aut->fetch_data();
+			for (int i = 0; i < nread; i++)
+			{
+				p->aut->get_message(&msg);
+				routing_messages(&msg, p);
+				if (msg.msgid == MAVLINK_MSG_ID_HEARTBEAT)
+					p->aut->set_hil((p->aut->base_mode & MAV_MODE_FLAG_HIL_ENABLED) != 0);
+			}
+
+			if (p->aut->raw_forwarded != forwarded)
+			{
+				n = 1;
+				msg = p->aut->parser.msg;
+				strcat(decision, (p->gs->raw_drops != raw_drops) ? " gs_raw_drop" : " gs_raw");
+			}
+			else if (nread > 0)
+			{
+				n = 1;
+				if (p->gs->queued != queued)
+					strcat(decision, " gs");
+				if (hil_ctr_mailbox.read(&ctr, ctr_count))
+					strcat(decision, " sim");
+			}
+		}
+		else
+		{
+			p->gs->receiveBytes(f.data, f.len);
+			while (p->gs->getMessage(&msg) > 0)
+			{
+				uint64_t sent[TX_NUM_CLASSES];
+				for (int c = 0; c < TX_NUM_CLASSES; c++)
+					sent[c] = p->aut->tx_frames[c];
+
+				n++;
+				if (param_cache.request(&msg, p->gs))
+				{
+					strcat(decision, " cache");
+					continue;
+				}
+				if (p->aut->send_message(&msg) < 0)
+				{
+					strcat(decision, " board_drop");
+					continue;
+				}
+				p->aut->tx_wait_idle();
+				for (int c = 0; c < TX_NUM_CLASSES; c++)
+				{
+					if (p->aut->tx_frames[c] != sent[c])
+					{
+						strcat(decision, " board:");
+						strcat(decision, classes[c]);
+					}
+				}
+			}
+		}
+
+		// Messages for the Ground Station leave with the frame
+		param_cache.poll(p->gs);
+		p->gs->sendMessage();
+
+		if (n == 0)
+			fprintf(log, "%lu %s -> bad\n", (unsigned long)f.index,
+					f.link == FREC_LINK_AUTOPILOT ? "ap" : "gs");
+		else
+			fprintf(log, "%lu %s %u %u:%u %u ->%s\n", (unsigned long)f.index,
+					f.link == FREC_LINK_AUTOPILOT ? "ap" : "gs", msg.msgid, msg.sysid,
+					msg.compid, msg.seq, decision[0] ? decision : " none");
+		replayed++;
+		routed += n;
+	}
+	uint64_t elapsed_ns = replay_clock_ns() - start_ns;
+
+	p->aut->tx_wait_idle();
+	p->aut->tx_engine_stop();
+	pthread_join(tx_thread, NULL);
+	time_set_virtual_ns(0);
+
+	if (log != stdout)
+		fclose(log);
+
+	double virtual_s = (reader.last_ns - reader.first_ns) / 1e9;
+	double elapsed_s = elapsed_ns / 1e9;
+	printf("Replayed %lu frames (%lu messages) in %.3f s: %.0f messages/s, "
+			"%.3f s of traffic, %.1fx\n", (unsigned long)replayed, (unsigned long)routed,
+			elapsed_s, elapsed_s > 0 ? routed / elapsed_s : 0.0, virtual_s,
+			elapsed_s > 0 ? virtual_s / elapsed_s : 0.0);
+	if (reader.bad_records > 0)
+		printf("  %lu records of the recording not readable\n",
+				(unsigned long)reader.bad_records);
+
+	p->aut->tx_report(stdout);
+	mav_link_report(&p->aut->mav_link, stdout);
+	mav_link_report(&p->gs->mav_link, stdout);
+	p->aut->link_quality.report(stdout);
+	p->gs->link_quality.report(stdout);
+	printf("Raw passthrough to GS: %lu frames, %lu dropped\n",
+			(unsigned long)p->gs->raw_frames, (unsigned long)p->gs->raw_drops);
+	param_cache.report(stdout);
+	flight_recorder.stop();
+	flight_recorder.report(stdout);
+	p->aut->port.handle_quit(0);
+	metrics_close();
+
+	return 0;
+}
+
+
+
+
+
+
 // ----------------------------------------------------------------------
 //   Parse Command Line
 // ----------------------------------------------------------------------
 // throws EXIT_FAILURE if could not open the port
 void parse_commandline(int argc, char **argv, char *&uart_name, int &baudrate, char *&sim_ip, unsigned int &sim_r_port, unsigned int &sim_w_port, 
-		char *&gs_ip, unsigned int &gs_r_port, unsigned int &gs_w_port)
+		char *&gs_ip, unsigned int &gs_r_port, unsigned int &gs_w_port, RT_Config &rt_cfg,
+		int &mav_version, char *&record_prefix, char *&replay_prefix, double &replay_speed,
+		char *&replay_log, char *&gt_file, bool &gt_compress, char *&metrics_socket,
+		char *&mission_file, bool &param_cache_on)
 {
 
 	// string for command line usage
-	const char *commandline_usage = "usage: routing -d <devicename> -b <baudrate> -sim_ip <Simip> -sim_rp <SimreadPort> -sim_wr <SimwritePort> -gs_ip <GSip> -gs_rd <GSreadPort> - gs_wr <GSwritePort>";
+	const char *commandline_usage = "usage: routing -d <devicename> -b <baudrate> -sim_ip <Simip> -sim_rp <SimreadPort> -sim_wr <SimwritePort> -gs_ip <GSip> -gs_rd <GSreadPort> - gs_wr <GSwritePort> [-rt_in <cpu:policy:prio>] [-rt_sim <cpu:policy:prio>] [-rt_gs <cpu:policy:prio>] [-rt_out <cpu:policy:prio>] [-mlock] [-prefault <KB>] [-pi] [-mavlink <auto|1|2>] [-record <prefix>] [-replay <prefix> [-replay_speed <N|max>] [-replay_log <file>]] [-ground_truth <file> [-gt_compress]] [-metrics_socket <path>] [-mission <file.mission>] [-param_cache]";
 
 	// Read input arguments
 	for (int i = 1; i < argc; i++) { // argv[0] is "mavlink"
@@ -757,6 +1175,144 @@ void parse_commandline(int argc, char **argv, char *&uart_name, int &baudrate, c
 			}
 		}
 
+
+		// Real-time settings of the tasks: "cpu:policy:prio[:runtime_us]"
+		// policy = other | fifo | rr | deadline
+		if (strcmp(argv[i], "-rt_in") == 0 || strcmp(argv[i], "-rt_sim") == 0 ||
+				strcmp(argv[i], "-rt_gs") == 0 || strcmp(argv[i], "-rt_out") == 0) {
+			Task_RT_Config* task = &rt_cfg.inflow;
+			if (strcmp(argv[i], "-rt_sim") == 0)
+				task = &rt_cfg.simulator;
+			if (strcmp(argv[i], "-rt_gs") == 0)
+				task = &rt_cfg.gs;
+			if (strcmp(argv[i], "-rt_out") == 0)
+				task = &rt_cfg.outflow;
+
+			if (argc <= i + 1 || !rt_parse_task(argv[i + 1], *task)) {
+				printf("%s\n",commandline_usage);
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// Lock the process memory
+		if (strcmp(argv[i], "-mlock") == 0) {
+			rt_cfg.mem_lock = true;
+		}
+
+		// Stack prefaulted by each task
+		if (strcmp(argv[i], "-prefault") == 0) {
+			if (argc <= i + 1 || !rt_parse_prefault(argv[i + 1], rt_cfg.prefault_kb)) {
+				printf("%s\n",commandline_usage);
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// Priority inheritance on the shared mutexes
+		if (strcmp(argv[i], "-pi") == 0) {
+			rt_cfg.pi_mutex = true;
+		}
+
+		// MAVLink version on the links (auto = 2, 1 if the peer does not switch)
+		if (strcmp(argv[i], "-mavlink") == 0) {
+			if (argc > i + 1 && mav_parse_version(argv[i + 1]) >= 0) {
+				mav_version = mav_parse_version(argv[i + 1]);
+			}
+			else {
+				printf("%s\n",commandline_usage);
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// Flight recorder: <prefix>_NNN.tlog and <prefix>_NNN.meta
+		if (strcmp(argv[i], "-record") == 0) {
+			if (argc > i + 1) {
+				record_prefix = argv[i + 1];
+			}
+			else {
+				printf("%s\n",commandline_usage);
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// Replay of a recording instead of the board and the GS
+		if (strcmp(argv[i], "-replay") == 0) {
+			if (argc > i + 1) {
+				replay_prefix = argv[i + 1];
+			}
+			else {
+				printf("%s\n",commandline_usage);
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// Pace of the replay: N times the recorded one, max = no pacing
+		if (strcmp(argv[i], "-replay_speed") == 0) {
+			if (argc > i + 1 && strcmp(argv[i + 1], "max") == 0) {
+				replay_speed = 0;
+			}
+			else if (argc > i + 1 && atof(argv[i + 1]) > 0) {
+				replay_speed = atof(argv[i + 1]);
+			}
+			else {
+				printf("%s\n",commandline_usage);
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// Decisions of the router during the replay
+		if (strcmp(argv[i], "-replay_log") == 0) {
+			if (argc > i + 1) {
+				replay_log = argv[i + 1];
+			}
+			else {
+				printf("%s\n",commandline_usage);
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// State of the model at each step, written in background
+		if (strcmp(argv[i], "-ground_truth") == 0) {
+			if (argc > i + 1) {
+				gt_file = argv[i + 1];
+			}
+			else {
+				printf("%s\n",commandline_usage);
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// Chunks of the ground truth compressed with zlib
+		if (strcmp(argv[i], "-gt_compress") == 0) {
+			gt_compress = true;
+		}
+
+		// Query socket of the live metrics
+		if (strcmp(argv[i], "-metrics_socket") == 0) {
+			if (argc > i + 1) {
+				metrics_socket = argv[i + 1];
+			}
+			else {
+				printf("%s\n",commandline_usage);
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// QGroundControl mission uploaded to the board by the router
+		if (strcmp(argv[i], "-mission") == 0) {
+			if (argc > i + 1) {
+				mission_file = argv[i + 1];
+			}
+			else {
+				printf("%s\n",commandline_usage);
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// Parameter requests of the GS answered by the router
+		if (strcmp(argv[i], "-param_cache") == 0) {
+			param_cache_on = true;
+		}
+
 	}
 	// end: for each input argument
 
@@ -768,9 +1324,21 @@ void parse_commandline(int argc, char **argv, char *&uart_name, int &baudrate, c
 // ----------------------------------------------------------------------
 //   Quit Signal Handler
 // ----------------------------------------------------------------------
-// this function is called when you press Ctrl-C
+// this function is called when you press Ctrl-C: only async-signal-safe
+// stores, the main thread does the rest
 	void
 quit_handler( int sig )
+{
+	quit_signal = sig;
+	time_to_exit = 1;
+}
+
+// ----------------------------------------------------------------------
+//   Quit
+// ----------------------------------------------------------------------
+// Called by the main thread once time_to_exit is set
+	void
+quit_router( int sig )
 {
 	printf("\n");
 	printf("TERMINATING AT USER REQUEST\n");
@@ -788,23 +1356,43 @@ quit_handler( int sig )
 			//autopilot_interface_quit->stop_hil();
 		}
 
-		//Close the Serial Port
-		autopilot_interface_quit->uart_port.handle_quit(sig);
-
-		/*
-		   tspec wcet, acet;
-		   int instances;
-		   printf("Now printing the stats\n");
-		   wcet = ptask_get_wcet(inflowT_id);
-		   acet = ptask_get_avg(inflowT_id);
-		   instances = ptask_get_numinstances(inflowT_id); 
-		   printf("TASK INFLOW: NINST = %d  WCET = %ld\t ACET = %ld\t \n",instances,tspec_to(&wcet, MICRO), tspec_to(&acet, MICRO));
-
-		   wcet = ptask_get_wcet(simulatorT_id);
-		   acet = ptask_get_avg(simulatorT_id);
-		   instances = ptask_get_numinstances(simulatorT_id); 
-		   printf("TASK SIMULATOR: NINST = %d WCET = %ld\t ACET = %ld\t \n",instances,tspec_to(&wcet, MICRO),tspec_to(&acet, MICRO));
-		   */ 
+		//Stop the TX engine and close the Serial Port
+		autopilot_interface_quit->tx_engine_stop();
+		autopilot_interface_quit->tx_report(stdout);
+		autopilot_interface_quit->link_usage.report(stdout);
+		mav_link_report(&autopilot_interface_quit->mav_link, stdout);
+		mav_link_report(&gs_interface_quit->mav_link, stdout);
+		autopilot_interface_quit->link_quality.report(stdout);
+		gs_interface_quit->link_quality.report(stdout);
+
+		// Frames still in the rings of the recorder
+		flight_recorder.stop();
+		flight_recorder.report(stdout);
+		ground_truth.stop();
+		ground_truth.report(stdout);
+		mission_upload.report(stdout);
+		param_cache.report(stdout);
+		printf("Raw passthrough to GS: %lu frames, %lu dropped\n",
+				(unsigned long)gs_interface_quit->raw_frames,
+				(unsigned long)gs_interface_quit->raw_drops);
+		autopilot_interface_quit->port.handle_quit(sig);
+
+		// Before the task statistics, read by the query socket
+		metrics_close();
+
+		// Timing statistics of the tasks
+		printf("Task statistics:\n");
+		task_stats_dump(stdout);
+		task_stats_close();
+
+		// Closed-loop latency
+		loop_latency.report(stdout);
+
+		// Age of the actuator commands applied to the model
+		printf("Control age: steps = %lu stale = %lu avg = %.1f us max = %.1f us\n",
+				(unsigned long)ctr_steps, (unsigned long)ctr_stale_steps,
+				ctr_steps ? ctr_age_sum_ns / 1000.0 / ctr_steps : 0.0,
+				ctr_age_max_ns / 1000.0);
 
 
 		printf("Closing Files...\n\n");
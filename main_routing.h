@@ -28,11 +28,24 @@
 
 using namespace std;
 
+#include "mav_crc.h"
 #include <common/mavlink.h>
 
 #include "sim_interface.h"
 #include "gs_interface.h"
 #include "autopilot_interface.h"
+#include "rt_setup.h"
+#include "task_stats.h"
+#include "actuator_mailbox.h"
+#include "loop_latency.h"
+#include "hil_encode.h"
+#include "mav_msgset.h"
+#include "flight_recorder.h"
+#include "frec_reader.h"
+#include "ground_truth.h"
+#include "metrics.h"
+#include "mission_upload.h"
+#include "param_cache.h"
 
 extern "C" {
 #include <ptask.h>
@@ -59,9 +72,16 @@ int top(int argc, char **argv);
 void commands(Autopilot_Interface &autopilot_interface);
 void parse_commandline(int argc, char **argv, char *&uart_name, int &baudrate, 
         char *&sim_ip, unsigned int &r_port, unsigned int &w_port,
-        char *&gs_ip, unsigned int &gs_r_port, unsigned int &gs_w_port); 
+        char *&gs_ip, unsigned int &gs_r_port, unsigned int &gs_w_port,
+        RT_Config &rt_cfg, int &mav_version, char *&record_prefix,
+        char *&replay_prefix, double &replay_speed, char *&replay_log,
+        char *&gt_file, bool &gt_compress, char *&metrics_socket,
+        char *&mission_file, bool &param_cache_on); 
 
 void routing_messages(mavlink_message_t *msg, struct Interfaces* p);
+int forward_raw(void* arg, const mavlink_message_t* msg, const uint8_t* frame, unsigned len);
+int replay_traffic(const char* prefix, double speed, const char* log_name,
+        struct Interfaces* p);
 
 // Threads Bodies
 //
@@ -77,6 +97,14 @@ int outflowT_id;
 int simulatorT_id;
 int gsT_id;
 
+// Timing Statistics Indexes
+int inflowS_id = -1;
+int simulatorS_id = -1;
+int gsS_id = -1;
+
+// Metrics Indexes
+int simstepM_id = -1;
+
 // Struct with the pointes to the interfaces
 struct Interfaces 
 {
@@ -92,7 +120,33 @@ uint8_t UAV_base_mode; // Mode of the UAV
 pthread_mutex_t mut_first_heartbeat;
 pthread_cond_t cond_first_heartbeat;
 
-float hil_ctr[4];
+// Latest actuator command from the board (HIL_CONTROLS)
+Actuator_Mailbox hil_ctr_mailbox;
+
+// Age of the actuator command applied at each simulation step
+uint64_t ctr_age_ns = 0;
+uint64_t ctr_age_max_ns = 0;
+uint64_t ctr_age_sum_ns = 0;
+uint64_t ctr_steps = 0;
+uint64_t ctr_stale_steps = 0;
+
+// Closed-loop latency HIL_SENSOR -> HIL_CONTROLS
+Loop_Latency loop_latency;
+
+// Real-time settings of the tasks
+RT_Config rt_cfg;
+
+// Recorder of the MAVLink traffic (-record)
+Flight_Recorder flight_recorder;
+
+// State of the model at each step (-ground_truth)
+Ground_Truth ground_truth;
+
+// Mission sent to the board by the router (-mission)
+Mission_Upload mission_upload;
+
+// Parameters of the board served to the GS by the router (-param_cache)
+Param_Cache param_cache;
 
 
 // Flags
@@ -124,6 +178,7 @@ GS_Interface* gs_interface_quit;
 Autopilot_Interface *autopilot_interface_quit;
 Serial_Port *serial_port_quit;
 void quit_handler( int sig );
+void quit_router( int sig );
 
 
 
@@ -0,0 +1,103 @@
+/**
+ * @file mav_crc.h
+ *
+ * @brief Table driven X.25 (CRC-16/MCRF4XX) checksum of the MAVLink frames
+ *
+ * Replaces the shift and xor implementation of checksum.h for the parser
+ * and the packers of the MAVLink library:
+ *
+ *  - crc_accumulate() (one byte, used by the parser) looks up one table
+ *  - crc_calculate() and crc_accumulate_buffer() (used by the packers on
+ *    the header and the payload) process 8 bytes per step with 8 tables
+ *    (slicing-by-8), byte by byte for the remainder
+ *
+ * Must be included before <common/mavlink.h>: the library is compiled
+ * with HAVE_CRC_ACCUMULATE and the buffer functions are redirected here.
+ * Including it afterwards is a compilation error (crc_accumulate defined
+ * twice).
+ *
+ */
+
+#ifndef MAV_CRC_H_
+#define MAV_CRC_H_
+
+// ------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------
+
+#include <stdint.h>
+
+// ------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------
+
+#define MAV_CRC_SLICES  8
+
+// Reflected polynomial of CRC-16/MCRF4XX (0x1021)
+#define MAV_CRC_POLY    0x8408
+
+// Tables of the slicing-by-8 (mav_crc_table[0] is the byte table)
+extern const uint16_t mav_crc_table[MAV_CRC_SLICES][256];
+
+
+// ------------------------------------------------------------------------
+//   Functions
+// ------------------------------------------------------------------------
+
+//
+// crc_accumulate
+//
+// Accumulate one byte into the CRC
+//
+#define HAVE_CRC_ACCUMULATE
+static inline void crc_accumulate(uint8_t data, uint16_t* crcAccum)
+{
+    *crcAccum = (*crcAccum >> 8) ^ mav_crc_table[0][(*crcAccum ^ data) & 0xff];
+}
+
+#include "checksum.h"
+
+//
+// mav_crc_accumulate_buffer
+//
+// Accumulate a byte array into the CRC, 8 bytes at a time
+//
+static inline void mav_crc_accumulate_buffer(uint16_t* crcAccum, const char* pBuffer,
+        uint16_t length)
+{
+    const uint8_t* p = (const uint8_t*)pBuffer;
+    uint16_t crc = *crcAccum;
+
+    while (length >= 8)
+    {
+        crc ^= p[0] | (p[1] << 8);
+        crc = mav_crc_table[7][crc & 0xff] ^ mav_crc_table[6][crc >> 8] ^
+              mav_crc_table[5][p[2]] ^ mav_crc_table[4][p[3]] ^
+              mav_crc_table[3][p[4]] ^ mav_crc_table[2][p[5]] ^
+              mav_crc_table[1][p[6]] ^ mav_crc_table[0][p[7]];
+        p += 8;
+        length -= 8;
+    }
+
+    while (length--)
+        crc = (crc >> 8) ^ mav_crc_table[0][(crc ^ *p++) & 0xff];
+
+    *crcAccum = crc;
+}
+
+//
+// mav_crc_calculate
+//
+static inline uint16_t mav_crc_calculate(const uint8_t* pBuffer, uint16_t length)
+{
+    uint16_t crc = X25_INIT_CRC;
+    mav_crc_accumulate_buffer(&crc, (const char*)pBuffer, length);
+    return crc;
+}
+
+// Used by mavlink_helpers.h
+#define crc_calculate           mav_crc_calculate
+#define crc_accumulate_buffer   mav_crc_accumulate_buffer
+
+
+#endif // MAV_CRC_H_
@@ -0,0 +1,38 @@
+/**
+ * @file mav_msgset.cpp
+ *
+ * @brief Messages of the dialect used by the router, resolved at compile time
+ *
+ */
+
+#include "mav_msgset.h"
+
+
+// ------------------------------------------------------------------------
+//   Message Table
+// ------------------------------------------------------------------------
+
+//
+// mav_msg_table_entry
+//
+// The table is sorted by msgid (the lookup of the library can read past
+// the end for ids larger than the last one).
+//
+const mavlink_msg_entry_t* mav_msg_table_entry(uint32_t msgid)
+{
+    static const mavlink_msg_entry_t table[] = MAVLINK_MESSAGE_CRCS;
+
+    int low = 0;
+    int high = sizeof(table) / sizeof(table[0]) - 1;
+    while (low <= high)
+    {
+        int mid = (low + high) / 2;
+        if (msgid < table[mid].msgid)
+            high = mid - 1;
+        else if (msgid > table[mid].msgid)
+            low = mid + 1;
+        else
+            return &table[mid];
+    }
+    return NULL;
+}
@@ -0,0 +1,240 @@
+/**
+ * @file mav_msgset.h
+ *
+ * @brief Messages of the dialect used by the router, resolved at compile time
+ *
+ * The router decodes only HEARTBEAT, HIL_CONTROLS, the answers of the
+ * mission protocol and the messages of the parameter protocol, and packs
+ * only HIL_SENSOR, HIL_GPS, SET_MODE, COMMAND_LONG, MISSION_COUNT,
+ * MISSION_ITEM_INT and PARAM_VALUE: every other message is forwarded as
+ * it is. For the messages of the set, Mav_Msg<MSGID> gives
+ * length, CRC extra and type as compile time constants, and MAV_GET /
+ * MAV_PUT access the fields of the payload at constant offsets. The
+ * offsets are those of the packed structs of the library, which are laid
+ * out in wire order (checked with a static_assert on their size).
+ *
+ * mav_msg_entry() answers the messages of the set with a switch on
+ * constants and bisects the table of the dialect only for the others.
+ *
+ * Adding a message to the set is one line in MAV_ROUTER_DECODED or
+ * MAV_ROUTER_PACKED.
+ *
+ */
+
+#ifndef MAV_MSGSET_H_
+#define MAV_MSGSET_H_
+
+// ------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mav_crc.h"
+#include <common/mavlink.h>
+
+#if MAVLINK_NEED_BYTE_SWAP
+#error "mav_msgset.h: the payload is accessed in host byte order"
+#endif
+
+// ------------------------------------------------------------------------
+//   Message Set
+// ------------------------------------------------------------------------
+
+// Messages received and decoded by the router (X(NAME, name))
+#define MAV_ROUTER_DECODED(X) \
+    X(HEARTBEAT, heartbeat) \
+    X(HIL_CONTROLS, hil_controls) \
+    X(MISSION_REQUEST, mission_request) \
+    X(MISSION_REQUEST_INT, mission_request_int) \
+    X(MISSION_ACK, mission_ack) \
+    X(PARAM_VALUE, param_value) \
+    X(PARAM_REQUEST_LIST, param_request_list) \
+    X(PARAM_REQUEST_READ, param_request_read) \
+    X(PARAM_SET, param_set)
+
+// Messages built by the router
+#define MAV_ROUTER_PACKED(X) \
+    X(HIL_SENSOR, hil_sensor) \
+    X(HIL_GPS, hil_gps) \
+    X(SET_MODE, set_mode) \
+    X(COMMAND_LONG, command_long) \
+    X(MISSION_COUNT, mission_count) \
+    X(MISSION_ITEM_INT, mission_item_int)
+
+#define MAV_ROUTER_MESSAGES(X) MAV_ROUTER_DECODED(X) MAV_ROUTER_PACKED(X)
+
+
+// ------------------------------------------------------------------------
+//   Message Traits
+// ------------------------------------------------------------------------
+
+// Payload offset of target_system / target_component, 0 if the message
+// has none (as in the table of the dialect)
+template <typename T>
+constexpr uint8_t mav_target_system_ofs(decltype(((T*)0)->target_system)*)
+{
+    return offsetof(T, target_system);
+}
+template <typename T>
+constexpr uint8_t mav_target_system_ofs(...)
+{
+    return 0;
+}
+template <typename T>
+constexpr uint8_t mav_target_component_ofs(decltype(((T*)0)->target_component)*)
+{
+    return offsetof(T, target_component);
+}
+template <typename T>
+constexpr uint8_t mav_target_component_ofs(...)
+{
+    return 0;
+}
+
+// Presence of the fields: the offset may be 0 (MISSION_ACK,
+// PARAM_REQUEST_LIST, ...)
+template <typename T>
+constexpr bool mav_has_target_system(decltype(((T*)0)->target_system)*)
+{
+    return true;
+}
+template <typename T>
+constexpr bool mav_has_target_system(...)
+{
+    return false;
+}
+template <typename T>
+constexpr bool mav_has_target_component(decltype(((T*)0)->target_component)*)
+{
+    return true;
+}
+template <typename T>
+constexpr bool mav_has_target_component(...)
+{
+    return false;
+}
+
+template <uint32_t MSGID> struct Mav_Msg;
+
+#define MAV_MSG_TRAITS(NAME, name) \
+    template <> struct Mav_Msg<MAVLINK_MSG_ID_##NAME> { \
+        typedef mavlink_##name##_t type; \
+        static constexpr uint32_t id = MAVLINK_MSG_ID_##NAME; \
+        static constexpr uint8_t len = MAVLINK_MSG_ID_##NAME##_LEN; \
+        static constexpr uint8_t crc_extra = MAVLINK_MSG_ID_##NAME##_CRC; \
+        static constexpr uint8_t target_system_ofs = mav_target_system_ofs<type>(0); \
+        static constexpr uint8_t target_component_ofs = mav_target_component_ofs<type>(0); \
+        static constexpr uint8_t flags = \
+                (mav_has_target_system<type>(0) ? MAV_MSG_ENTRY_FLAG_HAVE_TARGET_SYSTEM : 0) | \
+                (mav_has_target_component<type>(0) ? MAV_MSG_ENTRY_FLAG_HAVE_TARGET_COMPONENT : 0); \
+        static constexpr uint16_t v1_frame_len = \
+                len + MAVLINK_CORE_HEADER_MAVLINK1_LEN + 1 + MAVLINK_NUM_CHECKSUM_BYTES; \
+        static constexpr uint16_t frame_max = len + MAVLINK_NUM_NON_PAYLOAD_BYTES; \
+    }; \
+    static_assert(sizeof(mavlink_##name##_t) == MAVLINK_MSG_ID_##NAME##_LEN, \
+            "mavlink_" #name "_t is not the wire payload");
+
+MAV_ROUTER_MESSAGES(MAV_MSG_TRAITS)
+
+#undef MAV_MSG_TRAITS
+
+
+// ------------------------------------------------------------------------
+//   Field Access
+// ------------------------------------------------------------------------
+
+// Payload offset and type of a field of a message of the set
+#define MAV_OFS(NAME, field) offsetof(Mav_Msg<MAVLINK_MSG_ID_##NAME>::type, field)
+#define MAV_FIELD_TYPE(NAME, field) decltype(((Mav_Msg<MAVLINK_MSG_ID_##NAME>::type*)0)->field)
+
+// Field of a received message (truncated MAVLink 2 payloads are zero
+// filled by the parser, as for the getters of the library)
+#define MAV_GET(msg, NAME, field) \
+    mav_get<MAV_FIELD_TYPE(NAME, field)>(_MAV_PAYLOAD(msg), MAV_OFS(NAME, field))
+
+// Field of a payload being encoded
+#define MAV_PUT(payload, NAME, field, value) \
+    mav_put<MAV_FIELD_TYPE(NAME, field)>(payload, MAV_OFS(NAME, field), value)
+
+// Unaligned access to a field of the payload: one load/store, expanded
+// in place even without optimization (like the _mav_put_* macros of the
+// library, a memcpy would be a call at -O0)
+template <typename T>
+struct Mav_Unaligned {
+    typedef T type __attribute__((may_alias, aligned(1)));
+};
+
+template <typename T>
+inline __attribute__((always_inline)) T mav_get(const char* payload, size_t ofs)
+{
+    return *(const typename Mav_Unaligned<T>::type*)(payload + ofs);
+}
+
+template <typename T>
+inline __attribute__((always_inline)) void mav_put(char* payload, size_t ofs, T v)
+{
+    *(typename Mav_Unaligned<T>::type*)(payload + ofs) = v;
+}
+
+
+// ------------------------------------------------------------------------
+//   Lookup
+// ------------------------------------------------------------------------
+
+// Bisection of the table of the dialect (NULL for unknown ids)
+const mavlink_msg_entry_t* mav_msg_table_entry(uint32_t msgid);
+
+//
+// mav_msg_entry
+//
+// CRC extra and length of a message: constants for the messages of the
+// set, the table of the dialect for the others
+//
+inline const mavlink_msg_entry_t* mav_msg_entry(uint32_t msgid)
+{
+#define MAV_MSG_ENTRY_CASE(NAME, name) \
+    case MAVLINK_MSG_ID_##NAME: \
+        { \
+            typedef Mav_Msg<MAVLINK_MSG_ID_##NAME> M; \
+            static const mavlink_msg_entry_t e = {M::id, M::crc_extra, M::len, M::flags, \
+                    M::target_system_ofs, M::target_component_ofs}; \
+            return &e; \
+        }
+
+    switch (msgid)
+    {
+        MAV_ROUTER_MESSAGES(MAV_MSG_ENTRY_CASE)
+
+        default:
+            return mav_msg_table_entry(msgid);
+    }
+
+#undef MAV_MSG_ENTRY_CASE
+}
+
+//
+// mav_router_decodes
+//
+// The router looks into the message: the others are passed through
+//
+inline bool mav_router_decodes(uint32_t msgid)
+{
+#define MAV_MSG_ID_CASE(NAME, name) case MAVLINK_MSG_ID_##NAME:
+
+    switch (msgid)
+    {
+        MAV_ROUTER_DECODED(MAV_MSG_ID_CASE)
+            return true;
+
+        default:
+            return false;
+    }
+
+#undef MAV_MSG_ID_CASE
+}
+
+
+#endif // MAV_MSGSET_H_
@@ -0,0 +1,90 @@
+/**
+ * @file mav_parser.cpp
+ *
+ * @brief MAVLink parser owning its state
+ *
+ */
+
+#include "mav_parser.h"
+
+#include <string.h>
+
+
+// ------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------
+Mavlink_Parser::Mavlink_Parser()
+{
+    reset();
+}
+
+// ------------------------------------------------------------------------
+//  FUNCTIONS
+// ------------------------------------------------------------------------
+
+//
+// reset
+//
+void Mavlink_Parser::reset()
+{
+    memset(&msg, 0, sizeof(msg));
+    memset(&rxmsg, 0, sizeof(rxmsg));
+    memset(&status, 0, sizeof(status));
+    memset(&r_status, 0, sizeof(r_status));
+    status.parse_state = MAVLINK_PARSE_STATE_IDLE;
+
+    bad_frame = false;
+    frames = 0;
+    bad_crc = 0;
+    parse_errors = 0;
+    resync_bytes = 0;
+}
+
+//
+// parse
+//
+// Same as mavlink_parse_char() on the state of this parser
+//
+int Mavlink_Parser::parse(uint8_t c)
+{
+    bad_frame = false;
+    if (!in_progress() && c != MAVLINK_STX && c != MAVLINK_STX_MAVLINK1)
+        resync_bytes++;
+
+    uint8_t ret = mavlink_frame_char_buffer(&rxmsg, &status, c, &msg, &r_status);
+
+    // Errors of this byte (reset by the framing at each call)
+    parse_errors += r_status.packet_rx_drop_count;
+
+    if (ret == MAVLINK_FRAMING_OK)
+    {
+        frames++;
+        return 1;
+    }
+
+    if (ret == MAVLINK_FRAMING_BAD_CRC || ret == MAVLINK_FRAMING_BAD_SIGNATURE)
+    {
+        // Treat as a parse failure and resynchronize on this byte
+        bad_crc++;
+        parse_errors++;
+        bad_frame = true;
+        status.msg_received = MAVLINK_FRAMING_INCOMPLETE;
+        status.parse_state = MAVLINK_PARSE_STATE_IDLE;
+        if (c == MAVLINK_STX)
+        {
+            status.parse_state = MAVLINK_PARSE_STATE_GOT_STX;
+            rxmsg.len = 0;
+            mavlink_start_checksum(&rxmsg);
+        }
+    }
+    return 0;
+}
+
+//
+// in_progress
+//
+bool Mavlink_Parser::in_progress()
+{
+    return status.parse_state != MAVLINK_PARSE_STATE_IDLE &&
+            status.parse_state != MAVLINK_PARSE_STATE_UNINIT;
+}
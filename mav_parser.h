@@ -0,0 +1,80 @@
+/**
+ * @file mav_parser.h
+ *
+ * @brief MAVLink parser owning its state
+ *
+ * mavlink_parse_char() keeps the state of each link in static arrays of
+ * the library, indexed by a channel number: the links are limited to
+ * MAVLINK_COMM_NUM_BUFFERS and the states of different links share
+ * cache lines. A Mavlink_Parser holds the state of one link and runs
+ * the framing of the library (mavlink_frame_char_buffer) on it, so any
+ * number of links can be parsed by different threads.
+ *
+ * The object is aligned to a cache line and its size is a multiple of
+ * it: two parsers never share a line. The alignment is honoured for
+ * static, automatic and member objects (not by new before C++17).
+ *
+ */
+
+#ifndef MAV_PARSER_H_
+#define MAV_PARSER_H_
+
+// ------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------
+
+#include <stdint.h>
+
+#include "mav_crc.h"
+#include <common/mavlink.h>
+
+// ------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------
+
+#define MAV_PARSER_CACHE_LINE   64
+
+
+// ---------------------------------------------------------------------
+//   Mavlink Parser Class
+// ---------------------------------------------------------------------
+class Mavlink_Parser
+{
+
+    public:
+
+        Mavlink_Parser();
+
+        void reset();
+
+        // Returns 1 when c completes a valid frame, available in msg
+        // until the next call
+        int parse(uint8_t c);
+
+        // A frame has been started and is not complete
+        bool in_progress();
+
+        // Last frame parsed
+        mavlink_message_t msg;
+
+        // The last byte ended a frame with a bad CRC/signature (header
+        // in msg)
+        bool bad_frame;
+
+        // Statistics
+        uint64_t frames;
+        uint64_t bad_crc;           // CRC or signature errors
+        uint64_t parse_errors;      // Bad CRC and invalid lengths/flags
+        uint64_t resync_bytes;      // Skipped searching for a start of frame
+
+    private:
+
+        // Frame being parsed and state of the framing
+        mavlink_message_t rxmsg;
+        mavlink_status_t status;
+        mavlink_status_t r_status;
+
+} __attribute__((aligned(MAV_PARSER_CACHE_LINE)));
+
+
+#endif // MAV_PARSER_H_
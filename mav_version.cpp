@@ -0,0 +1,195 @@
+/**
+ * @file mav_version.cpp
+ *
+ * @brief MAVLink 1 / MAVLink 2 handling of a link
+ *
+ */
+
+#include "mav_version.h"
+#include "mav_msgset.h"
+
+#include <string.h>
+
+
+// ------------------------------------------------------------------------
+//   Frames
+// ------------------------------------------------------------------------
+
+//
+// mav_frame_len
+//
+uint16_t mav_frame_len(const mavlink_message_t* msg)
+{
+    if (msg->magic == MAVLINK_STX_MAVLINK1)
+        return msg->len + MAVLINK_CORE_HEADER_MAVLINK1_LEN + 1 + MAVLINK_NUM_CHECKSUM_BYTES;
+
+    uint16_t len = msg->len + MAVLINK_NUM_NON_PAYLOAD_BYTES;
+    if (msg->incompat_flags & MAVLINK_IFLAG_SIGNED)
+        len += MAVLINK_SIGNATURE_BLOCK_LEN;
+    return len;
+}
+
+//
+// mav_v1_frame_len
+//
+// Size the message would have as a MAVLink 1 frame (full payload)
+//
+uint16_t mav_v1_frame_len(const mavlink_message_t* msg)
+{
+    const mavlink_msg_entry_t* e = mav_msg_entry(msg->msgid);
+    if (e == NULL || msg->msgid > 255)
+        return mav_frame_len(msg);
+
+    return e->msg_len + MAVLINK_CORE_HEADER_MAVLINK1_LEN + 1 + MAVLINK_NUM_CHECKSUM_BYTES;
+}
+
+//
+// mav_convert
+//
+// Same as mavlink_finalize_message_chan() but the sequence number and
+// the ids of the sender are kept. A signature is dropped.
+//
+int mav_convert(mavlink_message_t* msg, int version)
+{
+    const mavlink_msg_entry_t* e = mav_msg_entry(msg->msgid);
+    if (e == NULL)
+        return -1;
+
+    uint8_t* payload = (uint8_t*)_MAV_PAYLOAD_NON_CONST(msg);
+    uint8_t buf[MAVLINK_CORE_HEADER_LEN];
+    uint8_t header_len;
+
+    if (version == MAV_VERSION_1)
+    {
+        if (msg->msgid > 255)
+            return -1;
+
+        // MAVLink 1 carries the whole payload
+        if (msg->len < e->msg_len)
+            memset(payload + msg->len, 0, e->msg_len - msg->len);
+
+        msg->magic = MAVLINK_STX_MAVLINK1;
+        msg->len = e->msg_len;
+
+        buf[0] = msg->len;
+        buf[1] = msg->seq;
+        buf[2] = msg->sysid;
+        buf[3] = msg->compid;
+        buf[4] = msg->msgid & 0xFF;
+        header_len = MAVLINK_CORE_HEADER_MAVLINK1_LEN;
+    }
+    else
+    {
+        msg->magic = MAVLINK_STX;
+        msg->len = _mav_trim_payload((const char*)payload, msg->len);
+
+        buf[0] = msg->len;
+        buf[1] = 0;
+        buf[2] = 0;
+        buf[3] = msg->seq;
+        buf[4] = msg->sysid;
+        buf[5] = msg->compid;
+        buf[6] = msg->msgid & 0xFF;
+        buf[7] = (msg->msgid >> 8) & 0xFF;
+        buf[8] = (msg->msgid >> 16) & 0xFF;
+        header_len = MAVLINK_CORE_HEADER_LEN;
+    }
+    msg->incompat_flags = 0;
+    msg->compat_flags = 0;
+
+    msg->checksum = crc_calculate(buf, header_len);
+    crc_accumulate_buffer(&msg->checksum, (const char*)payload, msg->len);
+    crc_accumulate(e->crc_extra, &msg->checksum);
+    mavlink_ck_a(msg) = (uint8_t)(msg->checksum & 0xFF);
+    mavlink_ck_b(msg) = (uint8_t)(msg->checksum >> 8);
+
+    return 0;
+}
+
+
+// ------------------------------------------------------------------------
+//   Links
+// ------------------------------------------------------------------------
+
+void mav_link_init(Mav_Link_Version* link, const char* name, int mode)
+{
+    memset(link, 0, sizeof(*link));
+    link->name = name;
+    link->mode = mode;
+    link->out = (mode == MAV_VERSION_1) ? MAV_VERSION_1 : MAV_VERSION_2;
+}
+
+//
+// mav_parse_version
+//
+// "auto", "1" or "2" (-1 if not valid)
+//
+int mav_parse_version(const char* str)
+{
+    if (strcmp(str, "auto") == 0)
+        return MAV_VERSION_AUTO;
+    if (strcmp(str, "1") == 0)
+        return MAV_VERSION_1;
+    if (strcmp(str, "2") == 0)
+        return MAV_VERSION_2;
+    return -1;
+}
+
+//
+// mav_link_rx
+//
+void mav_link_rx(Mav_Link_Version* link, const mavlink_message_t* msg, uint64_t now_ns)
+{
+    if (msg->magic != MAVLINK_STX_MAVLINK1)
+    {
+        link->rx_v2++;
+        link->v1_since_ns = 0;
+        if (link->mode == MAV_VERSION_AUTO)
+            link->out = MAV_VERSION_2;
+        return;
+    }
+
+    link->rx_v1++;
+    if (link->mode != MAV_VERSION_AUTO || link->out == MAV_VERSION_1)
+        return;
+
+    // The peer does not switch to MAVLink 2
+    if (link->v1_since_ns == 0)
+        link->v1_since_ns = now_ns;
+    else if (now_ns - link->v1_since_ns >= MAV_V1_FALLBACK_NS)
+        link->out = MAV_VERSION_1;
+}
+
+//
+// mav_link_tx
+//
+const mavlink_message_t* mav_link_tx(Mav_Link_Version* link,
+        const mavlink_message_t* msg, mavlink_message_t* tmp)
+{
+    int version = (msg->magic == MAVLINK_STX_MAVLINK1) ? MAV_VERSION_1 : MAV_VERSION_2;
+    if (version == link->out)
+        return msg;
+
+    *tmp = *msg;
+    if (mav_convert(tmp, link->out) < 0)
+    {
+        link->not_convertible++;
+        return msg;
+    }
+
+    link->converted++;
+    return tmp;
+}
+
+//
+// mav_link_report
+//
+void mav_link_report(const Mav_Link_Version* link, FILE* f)
+{
+    const char* modes[3] = {"auto", "1", "2"};
+
+    fprintf(f, "MAVLink %s: mode %s, sending v%d | received v1 %lu v2 %lu | "
+            "converted %lu (not convertible %lu)\n", link->name, modes[link->mode],
+            link->out, (unsigned long)link->rx_v1, (unsigned long)link->rx_v2,
+            (unsigned long)link->converted, (unsigned long)link->not_convertible);
+}
@@ -0,0 +1,88 @@
+/**
+ * @file mav_version.h
+ *
+ * @brief MAVLink 1 / MAVLink 2 handling of a link
+ *
+ * The version of the peer is detected from the magic of the frames it
+ * sends. In automatic mode a link speaks MAVLink 2, which truncates the
+ * trailing zeros of the payload, and falls back to MAVLink 1 when the
+ * peer keeps sending MAVLink 1 frames (it does not understand 2: PX4
+ * upgrades as soon as it receives a MAVLink 2 frame).
+ *
+ * Messages received on a link with a different version are converted
+ * before being forwarded, keeping the sequence number and the ids of
+ * the original sender.
+ *
+ */
+
+#ifndef MAV_VERSION_H_
+#define MAV_VERSION_H_
+
+// ------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdint.h>
+#include "mav_crc.h"
+#include <common/mavlink.h>
+
+// ------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------
+
+#define MAV_VERSION_AUTO    0
+#define MAV_VERSION_1       1
+#define MAV_VERSION_2       2
+
+// MAVLink 1 frames from the peer before falling back to MAVLink 1 (ns)
+#define MAV_V1_FALLBACK_NS  2000000000ULL
+
+
+// ------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------
+// Protocol version of a link
+struct Mav_Link_Version {
+
+    const char* name;
+
+    int mode;               // MAV_VERSION_AUTO, MAV_VERSION_1, MAV_VERSION_2
+    int out;                // Version of the frames sent on the link
+
+    // Detection (receiver side)
+    uint64_t v1_since_ns;   // First MAVLink 1 frame since the last 2 (0 = none)
+    uint64_t rx_v1;
+    uint64_t rx_v2;
+
+    // Conversions (sender side)
+    uint64_t converted;
+    uint64_t not_convertible;
+};
+
+
+// ------------------------------------------------------------------------
+//   Prototypes
+// ------------------------------------------------------------------------
+
+void mav_link_init(Mav_Link_Version* link, const char* name, int mode);
+int mav_parse_version(const char* str);
+
+// Receiver: a message has been parsed on the link
+void mav_link_rx(Mav_Link_Version* link, const mavlink_message_t* msg, uint64_t now_ns);
+
+// Sender: the message in the version of the link (msg itself or tmp)
+const mavlink_message_t* mav_link_tx(Mav_Link_Version* link,
+        const mavlink_message_t* msg, mavlink_message_t* tmp);
+
+void mav_link_report(const Mav_Link_Version* link, FILE* f);
+
+// Re-finalize the message in the given version (0 = ok, -1 = unknown id)
+int mav_convert(mavlink_message_t* msg, int version);
+
+// Bytes on the wire of the message, as it is and as a MAVLink 1 frame
+uint16_t mav_frame_len(const mavlink_message_t* msg);
+uint16_t mav_v1_frame_len(const mavlink_message_t* msg);
+
+
+#endif // MAV_VERSION_H_
@@ -0,0 +1,409 @@
+/**
+ * @file metrics.cpp
+ *
+ * @brief Live counters and gauges of the router
+ *
+ */
+
+
+// ------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------
+
+#include "metrics.h"
+#include "task_stats.h"
+#include "time_utils.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+
+// Shared page with the counters
+static Metrics_Page* page = NULL;
+static bool page_shared = false;
+
+// Query socket
+static int server_fd = -1;
+static char server_path[108];
+static pthread_t server_thread;
+static volatile bool server_stop = false;
+
+// Wait for a command (ms)
+#define METRICS_POLL_MS         200
+#define METRICS_CLIENT_MS       1000
+
+
+// ------------------------------------------------------------------------
+//   Segment Management
+// ------------------------------------------------------------------------
+
+//
+// metrics_open
+//
+int metrics_open()
+{
+    if (page != NULL)
+        return 0;
+
+    int fd = shm_open(METRICS_SHM, O_CREAT | O_RDWR, 0644);
+    if (fd >= 0 && ftruncate(fd, sizeof(Metrics_Page)) == 0)
+    {
+        void* addr = mmap(NULL, sizeof(Metrics_Page), PROT_READ | PROT_WRITE,
+                MAP_SHARED, fd, 0);
+        if (addr != MAP_FAILED)
+        {
+            page = (Metrics_Page*)addr;
+            page_shared = true;
+        }
+    }
+    if (fd >= 0)
+        close(fd);
+
+    // The counters are kept anyway, only the live view is lost
+    if (page == NULL)
+    {
+        fprintf(stderr, "WARNING: metrics not shared (%s)\n", METRICS_SHM);
+        void* addr = NULL;
+        if (posix_memalign(&addr, METRICS_CACHE_LINE, sizeof(Metrics_Page)) != 0)
+            return -1;
+        page = (Metrics_Page*)addr;
+    }
+
+    memset(page, 0, sizeof(Metrics_Page));
+    page->pid = getpid();
+    page->start_ns = time_monotonic_ns();
+    __atomic_store_n(&page->magic, METRICS_MAGIC, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+//
+// metrics_close
+//
+void metrics_close()
+{
+    metrics_serve_stop();
+
+    if (page == NULL)
+        return;
+
+    if (page_shared)
+    {
+        munmap(page, sizeof(Metrics_Page));
+        shm_unlink(METRICS_SHM);
+    }
+    else
+        free(page);
+
+    page = NULL;
+}
+
+//
+// metrics_register_link
+//
+int metrics_register_link(const char* name)
+{
+    if (page == NULL || page->nlinks >= METRICS_MAX_LINKS)
+        return -1;
+
+    int idx = page->nlinks;
+    strncpy(page->link[idx].name, name, METRICS_NAME_LEN - 1);
+
+    __atomic_store_n(&page->nlinks, idx + 1, __ATOMIC_RELEASE);
+    return idx;
+}
+
+//
+// metrics_register_gauge
+//
+int metrics_register_gauge(const char* name)
+{
+    if (page == NULL || page->ngauges >= METRICS_MAX_GAUGES)
+        return -1;
+
+    int idx = page->ngauges;
+    strncpy(page->gauge[idx].name, name, METRICS_NAME_LEN - 1);
+
+    __atomic_store_n(&page->ngauges, idx + 1, __ATOMIC_RELEASE);
+    return idx;
+}
+
+
+// ------------------------------------------------------------------------
+//   Writers
+// ------------------------------------------------------------------------
+
+//
+// metrics_frame
+//
+// Each direction has a single writer: the inflow task and the TX engine
+// for the autopilot link, the GS task for both directions of the GS
+// link (sendRaw() runs in sendMessage(), pushRaw() does not count).
+// Relaxed atomic additions: the readers copy the counters while they
+// are written.
+//
+void metrics_frame(int link, int dir, uint32_t msgid, uint32_t len)
+{
+    if (link < 0 || page == NULL)
+        return;
+
+    if (msgid >= METRICS_MSGIDS)
+        msgid = METRICS_MSGIDS - 1;
+
+    Metrics_Link* l = &page->link[link];
+    __atomic_fetch_add(&l->total[dir].frames, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&l->total[dir].bytes, len, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&l->msg[dir][msgid].frames, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&l->msg[dir][msgid].bytes, len, __ATOMIC_RELAXED);
+}
+
+//
+// metrics_gauge
+//
+// The caller serializes the updates of a gauge (owner task or lock of
+// the measured queue)
+//
+void metrics_gauge(int gauge, uint64_t value)
+{
+    if (gauge < 0 || page == NULL)
+        return;
+
+    Metrics_Gauge* g = &page->gauge[gauge];
+    __atomic_store_n(&g->value, value, __ATOMIC_RELAXED);
+    __atomic_store_n(&g->sum, g->sum + value, __ATOMIC_RELAXED);
+    __atomic_store_n(&g->samples, g->samples + 1, __ATOMIC_RELAXED);
+    if (value > g->max)
+        __atomic_store_n(&g->max, value, __ATOMIC_RELAXED);
+}
+
+
+// ------------------------------------------------------------------------
+//   Readers
+// ------------------------------------------------------------------------
+
+//
+// metrics_read
+//
+void metrics_read(const Metrics_Page* src, Metrics_Page* dst)
+{
+    const uint64_t* s = (const uint64_t*)src;
+    uint64_t* d = (uint64_t*)dst;
+
+    for (size_t i = 0; i < sizeof(Metrics_Page) / sizeof(uint64_t); i++)
+        d[i] = __atomic_load_n(&s[i], __ATOMIC_RELAXED);
+}
+
+//
+// reply_links
+//
+static void reply_links(FILE* f, const Metrics_Page* pg)
+{
+    for (uint32_t i = 0; i < pg->nlinks && i < METRICS_MAX_LINKS; i++)
+    {
+        const Metrics_Link* l = &pg->link[i];
+        for (int dir = 0; dir < 2; dir++)
+        {
+            fprintf(f, "link %s %s %lu %lu\n", l->name, dir == METRICS_DIR_RX ? "rx" : "tx",
+                    (unsigned long)l->total[dir].frames, (unsigned long)l->total[dir].bytes);
+        }
+    }
+}
+
+//
+// reply_msgids
+//
+// Only the msgids seen (256 stands for the larger ids)
+//
+static void reply_msgids(FILE* f, const Metrics_Page* pg, const char* name)
+{
+    for (uint32_t i = 0; i < pg->nlinks && i < METRICS_MAX_LINKS; i++)
+    {
+        const Metrics_Link* l = &pg->link[i];
+        if (name[0] != '\0' && strcmp(name, l->name) != 0)
+            continue;
+
+        for (int dir = 0; dir < 2; dir++)
+        {
+            for (int m = 0; m < METRICS_MSGIDS; m++)
+            {
+                if (l->msg[dir][m].frames == 0)
+                    continue;
+                fprintf(f, "msg %s %s %d %lu %lu\n", l->name,
+                        dir == METRICS_DIR_RX ? "rx" : "tx", m,
+                        (unsigned long)l->msg[dir][m].frames,
+                        (unsigned long)l->msg[dir][m].bytes);
+            }
+        }
+    }
+}
+
+//
+// reply_gauges
+//
+static void reply_gauges(FILE* f, const Metrics_Page* pg)
+{
+    for (uint32_t i = 0; i < pg->ngauges && i < METRICS_MAX_GAUGES; i++)
+    {
+        const Metrics_Gauge* g = &pg->gauge[i];
+        fprintf(f, "gauge %s %lu %lu %lu %lu\n", g->name, (unsigned long)g->value,
+                (unsigned long)(g->samples ? g->sum / g->samples : 0), (unsigned long)g->max,
+                (unsigned long)g->samples);
+    }
+}
+
+//
+// reply
+//
+// Answer of a command, built in memory and sent at once
+//
+static void reply(int fd, const char* cmd)
+{
+    char* buf = NULL;
+    size_t len = 0;
+    FILE* f = open_memstream(&buf, &len);
+    if (f == NULL)
+        return;
+
+    static Metrics_Page snapshot;
+    metrics_read(page, &snapshot);
+
+    char what[16] = "";
+    char arg[METRICS_NAME_LEN] = "";
+    sscanf(cmd, "%15s %23s", what, arg);
+
+    bool all = (strcmp(what, "all") == 0);
+    if (all || strcmp(what, "links") == 0)
+        reply_links(f, &snapshot);
+    if (all || strcmp(what, "msgids") == 0)
+        reply_msgids(f, &snapshot, all ? "" : arg);
+    if (all || strcmp(what, "gauges") == 0)
+        reply_gauges(f, &snapshot);
+    if (all || strcmp(what, "tasks") == 0)
+        task_stats_dump(f);
+    if (!all && strcmp(what, "links") != 0 && strcmp(what, "msgids") != 0 &&
+            strcmp(what, "gauges") != 0 && strcmp(what, "tasks") != 0)
+        fprintf(f, "error: commands are links, msgids [<link>], gauges, tasks, all\n");
+    fprintf(f, "end\n");
+    fclose(f);
+
+    // The client may be gone: no SIGPIPE
+    size_t sent = 0;
+    while (sent < len)
+    {
+        ssize_t n = send(fd, buf + sent, len - sent, MSG_NOSIGNAL);
+        if (n <= 0)
+            break;
+        sent += n;
+    }
+    free(buf);
+}
+
+//
+// serve
+//
+// One command per connection
+//
+static void* serve(void* arg)
+{
+    (void)arg;
+
+    while (!server_stop)
+    {
+        struct pollfd pfd;
+        pfd.fd = server_fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, METRICS_POLL_MS) <= 0)
+            continue;
+
+        int fd = accept(server_fd, NULL, NULL);
+        if (fd < 0)
+            continue;
+
+        char cmd[64];
+        size_t len = 0;
+        pfd.fd = fd;
+        while (len < sizeof(cmd) - 1 && poll(&pfd, 1, METRICS_CLIENT_MS) > 0)
+        {
+            ssize_t n = read(fd, cmd + len, sizeof(cmd) - 1 - len);
+            if (n <= 0)
+                break;
+            len += n;
+            if (memchr(cmd, '\n', len) != NULL)
+                break;
+        }
+        cmd[len] = '\0';
+
+        if (len > 0)
+            reply(fd, cmd);
+        close(fd);
+    }
+    return NULL;
+}
+
+//
+// metrics_serve
+//
+int metrics_serve(const char* path)
+{
+    if (page == NULL || server_fd >= 0)
+        return -1;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        printf("Metrics: socket path too long %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    strcpy(server_path, path);
+
+    // Left by a previous run
+    unlink(path);
+
+    server_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server_fd < 0 || bind(server_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+            listen(server_fd, 4) < 0)
+    {
+        printf("Metrics: could not listen on %s\n", path);
+        if (server_fd >= 0)
+            close(server_fd);
+        server_fd = -1;
+        return -1;
+    }
+
+    server_stop = false;
+    if (pthread_create(&server_thread, NULL, serve, NULL) != 0)
+    {
+        close(server_fd);
+        server_fd = -1;
+        unlink(path);
+        return -1;
+    }
+
+    printf("Metrics on %s\n", path);
+    return 0;
+}
+
+//
+// metrics_serve_stop
+//
+void metrics_serve_stop()
+{
+    if (server_fd < 0)
+        return;
+
+    server_stop = true;
+    pthread_join(server_thread, NULL);
+    close(server_fd);
+    unlink(server_path);
+    server_fd = -1;
+}
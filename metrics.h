@@ -0,0 +1,140 @@
+/**
+ * @file metrics.h
+ *
+ * @brief Live counters and gauges of the router
+ *
+ * The counters (frames and bytes per link, direction and msgid) and the
+ * gauges (queue depths, step time of the simulator, ...) live in a shared
+ * memory page, like the task statistics. The tasks update them with
+ * relaxed atomic operations, no locks, no system calls. The totals of
+ * each direction of a link, the msgid table of each direction and each
+ * gauge start on their own cache line: the counters written by the
+ * inflow task, the TX engine and the GS task do not share lines (the
+ * buckets of the msgid tables are packed, four per line). The readers
+ * (uav_top, the query socket) take copies of the page and compute the
+ * rates from two copies.
+ *
+ * Query socket (optional): a client connects to the Unix socket, sends
+ * one command line and reads the reply up to the line "end":
+ *
+ *   links              link <name> <rx|tx> <frames> <bytes>
+ *   msgids [<link>]    msg <link> <rx|tx> <msgid> <frames> <bytes>
+ *                      (msgid 256 stands for all the larger ids)
+ *   gauges             gauge <name> <value> <mean> <max> <samples>
+ *   tasks              statistics of the periodic tasks
+ *   all                links, msgids, gauges and tasks
+ *
+ */
+
+#ifndef METRICS_H_
+#define METRICS_H_
+
+// ------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdint.h>
+
+// ------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------
+
+#define METRICS_SHM             "/uav_fw_metrics"
+#define METRICS_MAGIC           0x4d545232  // "MTR2"
+
+#define METRICS_SOCKET          "/tmp/uav_fw_metrics.sock"
+
+#define METRICS_MAX_LINKS       4
+#define METRICS_MAX_GAUGES      16
+#define METRICS_NAME_LEN        24
+
+#define METRICS_DIR_RX          0
+#define METRICS_DIR_TX          1
+
+// One bucket per MAVLink 1 msgid, the last one for the larger ids
+#define METRICS_MSGIDS          257
+
+// Buckets of a direction, padded to whole cache lines
+#define METRICS_MSGID_ROW       260
+
+#define METRICS_CACHE_LINE      64
+
+
+// ------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------
+struct Metrics_Count {
+
+    uint64_t frames;
+    uint64_t bytes;
+};
+
+// Totals of a direction, alone on their cache line
+struct Metrics_Total {
+
+    uint64_t frames;
+    uint64_t bytes;
+} __attribute__((aligned(METRICS_CACHE_LINE)));
+
+// Traffic of a link
+struct Metrics_Link {
+
+    char name[METRICS_NAME_LEN];
+
+    Metrics_Total total[2];
+    Metrics_Count msg[2][METRICS_MSGID_ROW] __attribute__((aligned(METRICS_CACHE_LINE)));
+};
+
+// Sampled value (single writer at a time), one cache line
+struct Metrics_Gauge {
+
+    char name[METRICS_NAME_LEN];
+
+    uint64_t value;
+    uint64_t max;
+    uint64_t sum;
+    uint64_t samples;
+} __attribute__((aligned(METRICS_CACHE_LINE)));
+
+// Content of the shared memory segment (64 bit words and padding only,
+// so that it can be copied word by word)
+struct Metrics_Page {
+
+    uint32_t magic;
+    uint32_t pid;
+    uint32_t nlinks;
+    uint32_t ngauges;
+    uint64_t start_ns;          // CLOCK_MONOTONIC at metrics_open
+
+    Metrics_Link link[METRICS_MAX_LINKS];
+    Metrics_Gauge gauge[METRICS_MAX_GAUGES];
+};
+
+
+// ------------------------------------------------------------------------
+//   Prototypes
+// ------------------------------------------------------------------------
+
+// Create the shared memory segment (falls back to private memory)
+int metrics_open();
+void metrics_close();
+
+// Register a link or a gauge, returns its index (-1 if full)
+int metrics_register_link(const char* name);
+int metrics_register_gauge(const char* name);
+
+// Writers: never block
+void metrics_frame(int link, int dir, uint32_t msgid, uint32_t len);
+void metrics_gauge(int gauge, uint64_t value);
+
+// Copy of the page, each counter read atomically (safe from any
+// thread/process)
+void metrics_read(const Metrics_Page* src, Metrics_Page* dst);
+
+// Query socket
+int metrics_serve(const char* path);
+void metrics_serve_stop();
+
+
+#endif // METRICS_H_
@@ -0,0 +1,595 @@
+/**
+ * @file mission_upload.cpp
+ *
+ * @brief Upload of a QGroundControl mission straight to the board
+ *
+ */
+
+#include "mission_upload.h"
+#include "autopilot_interface.h"
+#include "mav_msgset.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+
+
+// ------------------------------------------------------------------------
+//   JSON Reader
+// ------------------------------------------------------------------------
+// Just what a .mission file needs: the whole document in memory
+
+#define JSON_NULL       0
+#define JSON_BOOL       1
+#define JSON_NUMBER     2
+#define JSON_STRING     3
+#define JSON_ARRAY      4
+#define JSON_OBJECT     5
+
+struct Json_Value {
+
+    int type;
+    double number;                      // Also the value of a bool
+    std::string str;
+    std::vector<Json_Value> items;      // Array elements, object values
+    std::vector<std::string> keys;      // Object keys
+
+    Json_Value() : type(JSON_NULL), number(0) {}
+
+    const Json_Value* get(const char* key) const
+    {
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            if (keys[i] == key)
+                return &items[i];
+        }
+        return NULL;
+    }
+
+    double num(const char* key, double def) const
+    {
+        const Json_Value* v = get(key);
+        return (v != NULL && (v->type == JSON_NUMBER || v->type == JSON_BOOL)) ? v->number : def;
+    }
+};
+
+class Json_Reader
+{
+
+    public:
+
+        Json_Reader(const char* text, size_t len) : p(text), end(text + len) {}
+
+        bool parse(Json_Value* v)
+        {
+            return value(v, 0) && (skip(), p == end);
+        }
+
+    private:
+
+        const char* p;
+        const char* end;
+
+        void skip()
+        {
+            while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+                p++;
+        }
+
+        bool literal(const char* word)
+        {
+            size_t n = strlen(word);
+            if ((size_t)(end - p) < n || strncmp(p, word, n) != 0)
+                return false;
+            p += n;
+            return true;
+        }
+
+        bool string(std::string* s)
+        {
+            if (p == end || *p != '"')
+                return false;
+            for (p++; p < end && *p != '"'; p++)
+            {
+                if (*p != '\\')
+                {
+                    s->push_back(*p);
+                    continue;
+                }
+                if (++p == end)
+                    return false;
+                switch (*p)
+                {
+                    case 'b': s->push_back('\b'); break;
+                    case 'f': s->push_back('\f'); break;
+                    case 'n': s->push_back('\n'); break;
+                    case 'r': s->push_back('\r'); break;
+                    case 't': s->push_back('\t'); break;
+                    case 'u':
+                        // Names and values of a mission are ASCII
+                        if (end - p < 5)
+                            return false;
+                        p += 4;
+                        s->push_back('?');
+                        break;
+                    default: s->push_back(*p); break;
+                }
+            }
+            if (p == end)
+                return false;
+            p++;
+            return true;
+        }
+
+        bool value(Json_Value* v, int depth)
+        {
+            skip();
+            if (p == end || depth > 32)
+                return false;
+
+            if (*p == '{' || *p == '[')
+            {
+                bool object = (*p == '{');
+                char close = object ? '}' : ']';
+                v->type = object ? JSON_OBJECT : JSON_ARRAY;
+                p++;
+                skip();
+                if (p < end && *p == close)
+                {
+                    p++;
+                    return true;
+                }
+                for (;;)
+                {
+                    if (object)
+                    {
+                        std::string key;
+                        skip();
+                        if (!string(&key))
+                            return false;
+                        skip();
+                        if (p == end || *p++ != ':')
+                            return false;
+                        v->keys.push_back(key);
+                    }
+                    v->items.push_back(Json_Value());
+                    if (!value(&v->items.back(), depth + 1))
+                        return false;
+                    skip();
+                    if (p < end && *p == ',')
+                    {
+                        p++;
+                        continue;
+                    }
+                    if (p < end && *p == close)
+                    {
+                        p++;
+                        return true;
+                    }
+                    return false;
+                }
+            }
+
+            if (*p == '"')
+            {
+                v->type = JSON_STRING;
+                return string(&v->str);
+            }
+            if (literal("true") || literal("false"))
+            {
+                v->type = JSON_BOOL;
+                v->number = (p[-1] == 'e' && p[-2] == 'u');    // "true"
+                return true;
+            }
+            if (literal("null"))
+            {
+                v->type = JSON_NULL;
+                return true;
+            }
+
+            char* num_end;
+            std::string text(p, (end - p < 64) ? end - p : 64);
+            v->number = strtod(text.c_str(), &num_end);
+            if (num_end == text.c_str())
+                return false;
+            v->type = JSON_NUMBER;
+            p += num_end - text.c_str();
+            return true;
+        }
+};
+
+
+// ------------------------------------------------------------------------
+//   Item Conversion
+// ------------------------------------------------------------------------
+
+//
+// is_global
+//
+static bool is_global(uint8_t frame)
+{
+    switch (frame)
+    {
+        case MAV_FRAME_GLOBAL:
+        case MAV_FRAME_GLOBAL_RELATIVE_ALT:
+        case MAV_FRAME_GLOBAL_INT:
+        case MAV_FRAME_GLOBAL_RELATIVE_ALT_INT:
+        case MAV_FRAME_GLOBAL_TERRAIN_ALT:
+        case MAV_FRAME_GLOBAL_TERRAIN_ALT_INT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+//
+// is_local
+//
+static bool is_local(uint8_t frame)
+{
+    switch (frame)
+    {
+        case MAV_FRAME_LOCAL_NED:
+        case MAV_FRAME_LOCAL_ENU:
+        case MAV_FRAME_LOCAL_OFFSET_NED:
+        case MAV_FRAME_BODY_NED:
+        case MAV_FRAME_BODY_OFFSET_NED:
+            return true;
+        default:
+            return false;
+    }
+}
+
+//
+// json_param
+//
+// Element of an array of numbers (null in the Plan format for the unused
+// parameters)
+//
+static double json_param(const Json_Value* a, size_t i, double def)
+{
+    if (a == NULL || i >= a->items.size() || a->items[i].type != JSON_NUMBER)
+        return def;
+    return a->items[i].number;
+}
+
+//
+// convert_item
+//
+// Simple item of the plain format (param1..4 + coordinate) or of the Plan
+// format (params[7]). Returns false for the items that are not simple.
+//
+static bool convert_item(const Json_Value& j, mavlink_mission_item_int_t* it)
+{
+    const Json_Value* type = j.get("type");
+    if (type != NULL && type->str != "missionItem" && type->str != "SimpleItem")
+        return false;
+
+    double param[7];
+    const Json_Value* params = j.get("params");
+    if (params != NULL && params->type == JSON_ARRAY)
+    {
+        for (int i = 0; i < 7; i++)
+            param[i] = json_param(params, i, (i < 4) ? NAN : 0);
+    }
+    else
+    {
+        const Json_Value* coord = j.get("coordinate");
+        param[0] = j.num("param1", 0);
+        param[1] = j.num("param2", 0);
+        param[2] = j.num("param3", 0);
+        param[3] = j.num("param4", 0);
+        for (int i = 0; i < 3; i++)
+            param[4 + i] = json_param(coord, i, 0);
+    }
+
+    memset(it, 0, sizeof(*it));
+    it->command = (uint16_t)j.num("command", 0);
+    it->frame = (uint8_t)j.num("frame", 0);
+    it->autocontinue = (j.num("autoContinue", 1) != 0);
+    it->param1 = param[0];
+    it->param2 = param[1];
+    it->param3 = param[2];
+    it->param4 = param[3];
+    it->z = param[6];
+
+    // Degrees * 1e7, meters * 1e4 or the parameter as it is
+    double scale = is_global(it->frame) ? 1e7 : (is_local(it->frame) ? 1e4 : 1);
+    it->x = (int32_t)lround(isnan(param[4]) ? 0 : param[4] * scale);
+    it->y = (int32_t)lround(isnan(param[5]) ? 0 : param[5] * scale);
+    return true;
+}
+
+//
+// convert_home
+//
+// plannedHomePosition: an item (plain format) or [lat, lon, alt] (Plan)
+//
+static void convert_home(const Json_Value& j, mavlink_mission_item_int_t* it)
+{
+    memset(it, 0, sizeof(*it));
+    if (j.type == JSON_OBJECT)
+    {
+        convert_item(j, it);
+    }
+    else
+    {
+        it->x = (int32_t)lround(json_param(&j, 0, 0) * 1e7);
+        it->y = (int32_t)lround(json_param(&j, 1, 0) * 1e7);
+        it->z = json_param(&j, 2, 0);
+    }
+    it->command = MAV_CMD_NAV_WAYPOINT;
+    it->frame = MAV_FRAME_GLOBAL;
+    it->autocontinue = 1;
+}
+
+
+// ------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------
+Mission_Upload::Mission_Upload()
+{
+    state = MISSION_IDLE;
+    items_sent = 0;
+    requests = 0;
+    rerequests = 0;
+    retries = 0;
+    start_ns = 0;
+    end_ns = 0;
+    result = MAV_MISSION_ACCEPTED;
+
+    path[0] = '\0';
+    aut = NULL;
+    target_system = 0;
+    target_component = 0;
+    last_sent = -1;
+    attempts = 0;
+    last_ns = 0;
+}
+
+// ------------------------------------------------------------------------
+//  FUNCTIONS
+// ------------------------------------------------------------------------
+
+//
+// load
+//
+int Mission_Upload::load(const char* path_)
+{
+    snprintf(path, sizeof(path), "%s", path_);
+
+    FILE* f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        printf("Mission: could not open %s\n", path);
+        return -1;
+    }
+    std::string text;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        text.append(buf, n);
+    fclose(f);
+
+    Json_Value doc;
+    Json_Reader reader(text.data(), text.size());
+    if (!reader.parse(&doc) || doc.type != JSON_OBJECT)
+    {
+        printf("Mission: %s is not a JSON document\n", path);
+        return -1;
+    }
+
+    // Plan format: the mission is one of the sections
+    const Json_Value* mission = doc.get("mission");
+    if (mission == NULL)
+        mission = &doc;
+
+    const Json_Value* list = mission->get("items");
+    if (list == NULL || list->type != JSON_ARRAY)
+    {
+        printf("Mission: no items in %s\n", path);
+        return -1;
+    }
+
+    // ArduPilot keeps the home position as item 0, PX4 does not
+    int autopilot = (int)mission->num("firmwareType", mission->num("MAV_AUTOPILOT",
+            MAV_AUTOPILOT_PX4));
+    const Json_Value* home = mission->get("plannedHomePosition");
+
+    items.clear();
+    mavlink_mission_item_int_t it;
+    if (autopilot == MAV_AUTOPILOT_ARDUPILOTMEGA && home != NULL)
+    {
+        convert_home(*home, &it);
+        items.push_back(it);
+    }
+
+    unsigned skipped = 0;
+    for (size_t i = 0; i < list->items.size(); i++)
+    {
+        if (convert_item(list->items[i], &it))
+            items.push_back(it);
+        else
+            skipped++;
+    }
+    if (mission->get("complexItems") != NULL)
+        skipped += mission->get("complexItems")->items.size();
+
+    for (size_t i = 0; i < items.size(); i++)
+    {
+        items[i].seq = i;
+        items[i].current = (i == 0);
+    }
+
+    printf("Mission %s: %lu items", path, (unsigned long)items.size());
+    if (skipped > 0)
+        printf(" (%u complex items not supported, skipped)", skipped);
+    printf("\n");
+
+    if (items.empty())
+        return -1;
+
+    state = MISSION_LOADED;
+    return 0;
+}
+
+//
+// send_count
+//
+void Mission_Upload::send_count()
+{
+    mavlink_message_t msg;
+    mavlink_msg_mission_count_pack_chan(MISSION_SYSID, MISSION_COMPID, MISSION_CHAN, &msg,
+            target_system, target_component, items.size());
+    aut->send_message(&msg);
+}
+
+//
+// send_item
+//
+void Mission_Upload::send_item(uint16_t seq)
+{
+    mavlink_message_t msg;
+    mavlink_mission_item_int_t* it = &items[seq];
+    it->target_system = target_system;
+    it->target_component = target_component;
+    mavlink_msg_mission_item_int_encode_chan(MISSION_SYSID, MISSION_COMPID, MISSION_CHAN, &msg,
+            it);
+    aut->send_message(&msg);
+    items_sent++;
+}
+
+//
+// start
+//
+void Mission_Upload::start(Autopilot_Interface* aut_, uint8_t target_system_,
+        uint8_t target_component_, uint64_t now_ns)
+{
+    if (state != MISSION_LOADED)
+        return;
+
+    aut = aut_;
+    target_system = target_system_;
+    target_component = target_component_;
+
+    printf("Mission: uploading %lu items to %u:%u\n", (unsigned long)items.size(),
+            target_system, target_component);
+
+    state = MISSION_SENDING;
+    start_ns = now_ns;
+    last_ns = now_ns;
+    last_sent = -1;
+    attempts = 1;
+    send_count();
+}
+
+//
+// finish
+//
+void Mission_Upload::finish(int new_state, uint64_t now_ns)
+{
+    state = new_state;
+    end_ns = now_ns;
+    report(stdout);
+}
+
+//
+// handle
+//
+bool Mission_Upload::handle(const mavlink_message_t* msg, uint64_t now_ns)
+{
+    if (state != MISSION_SENDING || msg->sysid != target_system)
+        return false;
+
+    uint8_t target;
+    uint16_t seq;
+    switch (msg->msgid)
+    {
+        case MAVLINK_MSG_ID_MISSION_REQUEST_INT:
+            target = MAV_GET(msg, MISSION_REQUEST_INT, target_system);
+            seq = MAV_GET(msg, MISSION_REQUEST_INT, seq);
+            break;
+
+        case MAVLINK_MSG_ID_MISSION_REQUEST:
+            target = MAV_GET(msg, MISSION_REQUEST, target_system);
+            seq = MAV_GET(msg, MISSION_REQUEST, seq);
+            break;
+
+        case MAVLINK_MSG_ID_MISSION_ACK:
+            if (MAV_GET(msg, MISSION_ACK, target_system) != MISSION_SYSID)
+                return false;
+            result = MAV_GET(msg, MISSION_ACK, type);
+            finish(result == MAV_MISSION_ACCEPTED ? MISSION_DONE : MISSION_FAILED, now_ns);
+            return true;
+
+        default:
+            return false;
+    }
+
+    if (target != MISSION_SYSID)
+        return false;
+
+    // Always answered with MISSION_ITEM_INT
+    requests++;
+    if (seq < items.size())
+    {
+        if ((int)seq <= last_sent)
+            rerequests++;
+        send_item(seq);
+        last_sent = seq;
+        attempts = 1;
+        last_ns = now_ns;
+    }
+    return true;
+}
+
+//
+// poll
+//
+void Mission_Upload::poll(uint64_t now_ns)
+{
+    if (state != MISSION_SENDING || now_ns - last_ns < MISSION_TIMEOUT_NS)
+        return;
+
+    if (attempts > MISSION_RETRIES)
+    {
+        printf("Mission: no answer from the board\n");
+        result = MAV_MISSION_ERROR;
+        finish(MISSION_FAILED, now_ns);
+        return;
+    }
+
+    // The count again before the first request, then the last item
+    // (whose answer may have been lost)
+    retries++;
+    attempts++;
+    last_ns = now_ns;
+    if (last_sent < 0)
+        send_count();
+    else
+        send_item(last_sent);
+}
+
+//
+// report
+//
+void Mission_Upload::report(FILE* f)
+{
+    if (state == MISSION_IDLE)
+        return;
+
+    if (state == MISSION_LOADED || state == MISSION_SENDING)
+    {
+        fprintf(f, "Mission %s: %lu items, %s\n", path, (unsigned long)items.size(),
+                state == MISSION_LOADED ? "not started" : "upload in progress");
+        return;
+    }
+
+    double ms = (end_ns - start_ns) / 1e6;
+    fprintf(f, "Mission %s: %lu items %s in %.1f ms (%.0f items/s), %lu requests "
+            "(%lu repeated), %lu retries, result %u\n", path, (unsigned long)items.size(),
+            state == MISSION_DONE ? "uploaded" : "NOT uploaded", ms,
+            ms > 0 ? items.size() * 1000.0 / ms : 0.0, (unsigned long)requests,
+            (unsigned long)rerequests, (unsigned long)retries, result);
+}
@@ -0,0 +1,120 @@
+/**
+ * @file mission_upload.h
+ *
+ * @brief Upload of a QGroundControl mission straight to the board
+ *
+ * The items of a .mission file (QGroundControl JSON, plain format or
+ * "Plan" format) are converted once into MISSION_ITEM_INT messages. The
+ * upload follows the MAVLink mission protocol:
+ *
+ *   router                              board
+ *   MISSION_COUNT(n)            --->
+ *                               <---    MISSION_REQUEST(_INT)(0)
+ *   MISSION_ITEM_INT(0)         --->
+ *   ...
+ *                               <---    MISSION_ACK
+ *
+ * The requests are answered by the inflow task as soon as they are read
+ * from the serial link, without going through the Ground Station. If
+ * nothing arrives within MISSION_TIMEOUT_NS the last message is sent
+ * again, at most MISSION_RETRIES times in a row.
+ *
+ */
+
+#ifndef MISSION_UPLOAD_H_
+#define MISSION_UPLOAD_H_
+
+// ------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+
+#include "mav_crc.h"
+#include <common/mavlink.h>
+
+class Autopilot_Interface;
+
+// ------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------
+
+// Identity of the router as mission sender
+#define MISSION_SYSID           255
+#define MISSION_COMPID          MAV_COMP_ID_MISSIONPLANNER
+
+// Channel of the messages of the upload (sequence of the sender above,
+// not shared with the packers of the other tasks)
+#define MISSION_CHAN            MAVLINK_COMM_3
+
+// Wait for the next request or the ack, and retransmissions
+#define MISSION_TIMEOUT_NS      50000000ULL
+#define MISSION_RETRIES         10
+
+// Mission_Upload.state
+#define MISSION_IDLE            0
+#define MISSION_LOADED          1   // Waiting for the board
+#define MISSION_SENDING         2
+#define MISSION_DONE            3
+#define MISSION_FAILED          4
+
+
+// ---------------------------------------------------------------------
+//   Mission Upload Class
+// ---------------------------------------------------------------------
+class Mission_Upload
+{
+
+    public:
+
+        Mission_Upload();
+
+        // Items of a .mission file (0 = ok)
+        int load(const char* path);
+
+        // MISSION_COUNT to the board
+        void start(Autopilot_Interface* aut, uint8_t target_system, uint8_t target_component,
+                uint64_t now_ns);
+
+        // Inflow task: messages of the board. Returns true if the message
+        // belongs to the upload (not to be forwarded)
+        bool handle(const mavlink_message_t* msg, uint64_t now_ns);
+
+        // Inflow task, each period: retransmissions
+        void poll(uint64_t now_ns);
+
+        void report(FILE* f);
+
+        int state;
+
+        // Statistics
+        uint64_t items_sent;
+        uint64_t requests;
+        uint64_t rerequests;        // Requests of an item already sent
+        uint64_t retries;           // Retransmissions after a timeout
+        uint64_t start_ns;
+        uint64_t end_ns;
+        uint8_t result;             // MAV_MISSION_RESULT of the ack
+
+    private:
+
+        std::vector<mavlink_mission_item_int_t> items;
+        char path[256];
+
+        Autopilot_Interface* aut;
+        uint8_t target_system;
+        uint8_t target_component;
+
+        int last_sent;              // Seq of the last item sent, -1 = count
+        unsigned attempts;          // Transmissions without an answer
+        uint64_t last_ns;
+
+        void send_count();
+        void send_item(uint16_t seq);
+        void finish(int new_state, uint64_t now_ns);
+};
+
+
+#endif // MISSION_UPLOAD_H_
@@ -0,0 +1,785 @@
+/*
+ * file: mock_autopilot.cpp
+ *
+ * Board side of the HIL link emulated on a pseudo-terminal, to run and
+ * benchmark main_routing without a Pixhawk.
+ *
+ * The mock behaves like PX4 in HIL:
+ *  - heartbeat at 1 Hz (and as an answer to SET_MODE, whose base and
+ *    custom mode are applied)
+ *  - COMMAND_LONG acknowledged
+ *  - HIL_SENSOR / HIL_GPS consumed, HIL_CONTROLS sent while in HIL mode,
+ *    either as an answer to each HIL_SENSOR after the compute delay
+ *    (echoing its time_usec) or at a fixed rate
+ *  - background telemetry at the default rates of a PX4 USB link
+ *  - MAVLink 1 until a MAVLink 2 frame is received
+ *  - mission upload: MISSION_COUNT answered with MISSION_REQUEST_INT for
+ *    each item, MISSION_ACK at the end. -mission_delay is the time to
+ *    store an item before requesting the next one, -mission_loss the
+ *    percentage of items lost (to exercise the retransmissions).
+ *  - parameters (-params <n>, none by default): PARAM_REQUEST_LIST
+ *    answered with one PARAM_VALUE every -param_interval us,
+ *    PARAM_REQUEST_READ and PARAM_SET answered at once
+ *
+ * usage: mock_autopilot [-link <path>] [-rate <Hz>] [-delay <us>]
+ *                       [-telemetry <scale>] [-sysid <id>] [-mavlink <1|2>]
+ *                       [-mission_delay <us>] [-mission_loss <%>]
+ *                       [-params <n>] [-param_interval <us>]
+ *
+ * The name of the slave pty (or the symlink given with -link) is the
+ * device to pass to main_routing -d.
+ *
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     // ppoll()
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "mav_crc.h"
+#include <common/mavlink.h>
+
+#include "time_utils.h"
+#include "mav_parser.h"
+
+
+// ------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------
+
+#define MOCK_COMPID         1
+
+// HIL_CONTROLS waiting for the compute delay (power of two)
+#define MOCK_PENDING        64
+
+// Output buffer flushed once per iteration
+#define MOCK_TX_BYTES       8192
+
+// Sending channel
+#define MOCK_TX_CHAN        MAVLINK_COMM_1
+
+
+// ------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------
+// Telemetry stream
+struct Mock_Stream {
+
+    uint32_t msgid;
+    float rate_hz;
+    uint64_t period_ns;
+    uint64_t next_ns;
+    uint64_t sent;
+};
+
+// HIL_CONTROLS to be sent
+struct Mock_Pending {
+
+    uint64_t due_ns;
+    uint64_t time_usec;
+};
+
+struct Mock_Stats {
+
+    uint64_t sensors;
+    uint64_t gps;
+    uint64_t controls;
+    uint64_t telemetry;
+    uint64_t other_rx;
+    uint64_t tx_bytes;
+    uint64_t tx_dropped;
+    uint64_t pending_overflow;
+    uint64_t late_controls;     // Sent more than 1 ms after their due time
+    uint64_t mission_items;
+    uint64_t mission_lost;
+    uint64_t mission_rerequests;
+    uint64_t missions;
+    uint64_t param_lists;
+    uint64_t param_reads;
+    uint64_t param_sets;
+    uint64_t param_values;      // PARAM_VALUE sent
+};
+
+// Mission being received
+struct Mock_Mission {
+
+    bool active;
+    uint16_t count;
+    uint16_t next;              // Seq requested
+    uint8_t sysid;              // Sender
+    uint8_t compid;
+    bool request_pending;       // Next request after the storage delay
+    uint64_t request_ns;
+    uint64_t start_ns;
+};
+
+
+// ------------------------------------------------------------------------
+//   Global State
+// ------------------------------------------------------------------------
+
+static volatile sig_atomic_t quit = 0;
+
+static int master_fd = -1;
+static const char* link_path = NULL;
+
+static uint8_t sysid = 1;
+static uint8_t base_mode = MAV_MODE_FLAG_CUSTOM_MODE_ENABLED;
+static uint32_t custom_mode = 0;
+static bool force_v1 = false;
+
+static uint8_t tx_buf[MOCK_TX_BYTES];
+static uint32_t tx_len = 0;
+
+static Mock_Pending pending[MOCK_PENDING];
+static uint32_t pending_head = 0;
+static uint32_t pending_tail = 0;
+
+// Last sensor data, used for the controls and the telemetry
+static mavlink_hil_sensor_t last_sensor;
+static mavlink_hil_gps_t last_gps;
+
+static Mock_Stats stats;
+
+static Mock_Mission mission;
+static uint64_t mission_delay_ns = 0;
+static int mission_loss = 0;
+
+// Parameters MOCK_P0000 ... and the list being sent
+static float* param_values = NULL;
+static int nparams = 0;
+static int param_next = -1;
+static uint64_t param_next_ns = 0;
+static uint64_t param_interval_ns = 1000000;
+
+// Default rates of the PX4 telemetry on a USB link (Hz)
+static Mock_Stream streams[] = {
+    {MAVLINK_MSG_ID_SYS_STATUS,          1.0f, 0, 0, 0},
+    {MAVLINK_MSG_ID_ATTITUDE,           50.0f, 0, 0, 0},
+    {MAVLINK_MSG_ID_ATTITUDE_QUATERNION,50.0f, 0, 0, 0},
+    {MAVLINK_MSG_ID_HIGHRES_IMU,        50.0f, 0, 0, 0},
+    {MAVLINK_MSG_ID_LOCAL_POSITION_NED, 30.0f, 0, 0, 0},
+    {MAVLINK_MSG_ID_GLOBAL_POSITION_INT,50.0f, 0, 0, 0},
+    {MAVLINK_MSG_ID_GPS_RAW_INT,         5.0f, 0, 0, 0},
+    {MAVLINK_MSG_ID_VFR_HUD,             4.0f, 0, 0, 0},
+    {MAVLINK_MSG_ID_SERVO_OUTPUT_RAW,   10.0f, 0, 0, 0},
+    {MAVLINK_MSG_ID_ALTITUDE,           10.0f, 0, 0, 0},
+    {MAVLINK_MSG_ID_BATTERY_STATUS,      0.5f, 0, 0, 0},
+};
+static const int nstreams = sizeof(streams) / sizeof(streams[0]);
+
+
+// ------------------------------------------------------------------------
+//   Output
+// ------------------------------------------------------------------------
+
+//
+// flush
+//
+// The slave side may not be read (router not started): data that does
+// not fit in the pty buffer is dropped
+//
+static void flush()
+{
+    if (tx_len == 0)
+        return;
+
+    int ret = write(master_fd, tx_buf, tx_len);
+    if (ret > 0)
+    {
+        stats.tx_bytes += ret;
+        stats.tx_dropped += tx_len - ret;
+    }
+    else
+        stats.tx_dropped += tx_len;
+
+    tx_len = 0;
+}
+
+static void send(const mavlink_message_t* msg)
+{
+    if (tx_len + MAVLINK_MAX_PACKET_LEN > MOCK_TX_BYTES)
+        flush();
+    tx_len += mavlink_msg_to_send_buffer(tx_buf + tx_len, msg);
+}
+
+static void send_heartbeat()
+{
+    mavlink_message_t msg;
+    mavlink_msg_heartbeat_pack_chan(sysid, MOCK_COMPID, MOCK_TX_CHAN, &msg,
+            MAV_TYPE_QUADROTOR, MAV_AUTOPILOT_PX4, base_mode, custom_mode,
+            MAV_STATE_STANDBY);
+    send(&msg);
+}
+
+//
+// send_controls
+//
+// A rate damper on the gyros around the hover throttle: enough to have
+// non trivial values flowing back to the model
+//
+static void send_controls(uint64_t time_usec)
+{
+    mavlink_message_t msg;
+    mavlink_msg_hil_controls_pack_chan(sysid, MOCK_COMPID, MOCK_TX_CHAN, &msg,
+            time_usec,
+            -0.1f * last_sensor.xgyro, -0.1f * last_sensor.ygyro,
+            -0.1f * last_sensor.zgyro, 0.5f,
+            0, 0, 0, 0, base_mode, 0);
+    send(&msg);
+    stats.controls++;
+}
+
+static void send_telemetry(uint32_t msgid, uint64_t now_ns)
+{
+    mavlink_message_t msg;
+    uint32_t boot_ms = (uint32_t)(now_ns / 1000000);
+    const mavlink_hil_sensor_t &s = last_sensor;
+    const mavlink_hil_gps_t &g = last_gps;
+
+    switch (msgid)
+    {
+        case MAVLINK_MSG_ID_SYS_STATUS:
+            mavlink_msg_sys_status_pack_chan(sysid, MOCK_COMPID, MOCK_TX_CHAN, &msg,
+                    0x3f, 0x3f, 0x3f, 250, 12150, -1, 95, 0, 0, 0, 0, 0, 0);
+            break;
+        case MAVLINK_MSG_ID_ATTITUDE:
+            mavlink_msg_attitude_pack_chan(sysid, MOCK_COMPID, MOCK_TX_CHAN, &msg,
+                    boot_ms, 0, 0, 0, s.xgyro, s.ygyro, s.zgyro);
+            break;
+        case MAVLINK_MSG_ID_ATTITUDE_QUATERNION:
+            mavlink_msg_attitude_quaternion_pack_chan(sysid, MOCK_COMPID, MOCK_TX_CHAN, &msg,
+                    boot_ms, 1, 0, 0, 0, s.xgyro, s.ygyro, s.zgyro);
+            break;
+        case MAVLINK_MSG_ID_HIGHRES_IMU:
+            mavlink_msg_highres_imu_pack_chan(sysid, MOCK_COMPID, MOCK_TX_CHAN, &msg,
+                    s.time_usec, s.xacc, s.yacc, s.zacc, s.xgyro, s.ygyro, s.zgyro,
+                    s.xmag, s.ymag, s.zmag, s.abs_pressure, s.diff_pressure,
+                    s.pressure_alt, s.temperature, 0x1fff);
+            break;
+        case MAVLINK_MSG_ID_LOCAL_POSITION_NED:
+            mavlink_msg_local_position_ned_pack_chan(sysid, MOCK_COMPID, MOCK_TX_CHAN, &msg,
+                    boot_ms, 0, 0, -s.pressure_alt, g.vn / 100.0f, g.ve / 100.0f,
+                    g.vd / 100.0f);
+            break;
+        case MAVLINK_MSG_ID_GLOBAL_POSITION_INT:
+            mavlink_msg_global_position_int_pack_chan(sysid, MOCK_COMPID, MOCK_TX_CHAN, &msg,
+                    boot_ms, g.lat, g.lon, g.alt, g.alt, g.vn, g.ve, g.vd, 0);
+            break;
+        case MAVLINK_MSG_ID_GPS_RAW_INT:
+            mavlink_msg_gps_raw_int_pack_chan(sysid, MOCK_COMPID, MOCK_TX_CHAN, &msg,
+                    g.time_usec, g.fix_type, g.lat, g.lon, g.alt, g.eph, g.epv, g.vel,
+                    g.cog, g.satellites_visible);
+            break;
+        case MAVLINK_MSG_ID_VFR_HUD:
+            mavlink_msg_vfr_hud_pack_chan(sysid, MOCK_COMPID, MOCK_TX_CHAN, &msg,
+                    g.vel / 100.0f, g.vel / 100.0f, 0, 50, s.pressure_alt, -g.vd / 100.0f);
+            break;
+        case MAVLINK_MSG_ID_SERVO_OUTPUT_RAW:
+            mavlink_msg_servo_output_raw_pack_chan(sysid, MOCK_COMPID, MOCK_TX_CHAN, &msg,
+                    (uint32_t)(now_ns / 1000), 0, 1500, 1500, 1500, 1500, 0, 0, 0, 0);
+            break;
+        case MAVLINK_MSG_ID_ALTITUDE:
+            mavlink_msg_altitude_pack_chan(sysid, MOCK_COMPID, MOCK_TX_CHAN, &msg,
+                    now_ns / 1000, s.pressure_alt, s.pressure_alt, s.pressure_alt,
+                    s.pressure_alt, s.pressure_alt, NAN);
+            break;
+        case MAVLINK_MSG_ID_BATTERY_STATUS:
+            {
+                uint16_t cells[10] = {4050, 4050, 4050, UINT16_MAX, UINT16_MAX,
+                    UINT16_MAX, UINT16_MAX, UINT16_MAX, UINT16_MAX, UINT16_MAX};
+                mavlink_msg_battery_status_pack_chan(sysid, MOCK_COMPID, MOCK_TX_CHAN, &msg,
+                        0, MAV_BATTERY_FUNCTION_ALL, MAV_BATTERY_TYPE_LIPO, 2500, cells,
+                        250, -1, -1, 95);
+            }
+            break;
+        default:
+            return;
+    }
+    send(&msg);
+    stats.telemetry++;
+}
+
+
+static void send_mission_request(uint16_t seq)
+{
+    mavlink_message_t msg;
+    mavlink_msg_mission_request_int_pack_chan(sysid, MOCK_COMPID, MOCK_TX_CHAN, &msg,
+            mission.sysid, mission.compid, seq);
+    send(&msg);
+}
+
+static void send_mission_ack(uint8_t type)
+{
+    mavlink_message_t msg;
+    mavlink_msg_mission_ack_pack_chan(sysid, MOCK_COMPID, MOCK_TX_CHAN, &msg,
+            mission.sysid, mission.compid, type);
+    send(&msg);
+}
+
+
+static void send_param_value(int index)
+{
+    char id[MAVLINK_MSG_PARAM_VALUE_FIELD_PARAM_ID_LEN + 1];
+    snprintf(id, sizeof(id), "MOCK_P%04d", index);
+
+    mavlink_message_t msg;
+    mavlink_msg_param_value_pack_chan(sysid, MOCK_COMPID, MOCK_TX_CHAN, &msg, id,
+            param_values[index], MAV_PARAM_TYPE_REAL32, nparams, index);
+    send(&msg);
+    stats.param_values++;
+}
+
+//
+// param_index
+//
+// Index of a parameter from its name (not null terminated if 16 chars)
+//
+static int param_index(const char* id)
+{
+    int index;
+    char name[MAVLINK_MSG_PARAM_VALUE_FIELD_PARAM_ID_LEN + 1];
+    memcpy(name, id, MAVLINK_MSG_PARAM_VALUE_FIELD_PARAM_ID_LEN);
+    name[MAVLINK_MSG_PARAM_VALUE_FIELD_PARAM_ID_LEN] = '\0';
+
+    if (sscanf(name, "MOCK_P%d", &index) != 1 || index < 0 || index >= nparams)
+        return -1;
+    return index;
+}
+
+
+// ------------------------------------------------------------------------
+//   Input
+// ------------------------------------------------------------------------
+
+//
+// handle_mission_item
+//
+// Items out of sequence (a retransmission) make the expected one to be
+// requested again
+//
+static void handle_mission_item(uint16_t seq, uint64_t now_ns)
+{
+    if (!mission.active)
+        return;
+
+    if (mission_loss > 0 && rand() % 100 < mission_loss)
+    {
+        stats.mission_lost++;
+        return;
+    }
+
+    if (seq != mission.next)
+    {
+        stats.mission_rerequests++;
+        send_mission_request(mission.next);
+        return;
+    }
+
+    stats.mission_items++;
+    mission.next++;
+    if (mission.next == mission.count)
+    {
+        mission.active = false;
+        mission.request_pending = false;
+        stats.missions++;
+        send_mission_ack(MAV_MISSION_ACCEPTED);
+        printf("Mission: %u items received in %.1f ms\n", mission.count,
+                (now_ns - mission.start_ns) / 1e6);
+        return;
+    }
+
+    mission.request_pending = true;
+    mission.request_ns = now_ns + mission_delay_ns;
+}
+
+static void handle_message(const mavlink_message_t* msg, uint64_t now_ns, uint64_t delay_ns,
+        bool answer_sensors)
+{
+    // PX4 switches to MAVLink 2 as soon as it receives a MAVLink 2 frame
+    if (!force_v1 && msg->magic == MAVLINK_STX)
+        mavlink_get_channel_status(MOCK_TX_CHAN)->flags &= ~MAVLINK_STATUS_FLAG_OUT_MAVLINK1;
+
+    switch (msg->msgid)
+    {
+        case MAVLINK_MSG_ID_HIL_SENSOR:
+            mavlink_msg_hil_sensor_decode(msg, &last_sensor);
+            stats.sensors++;
+
+            if (answer_sensors && (base_mode & MAV_MODE_FLAG_HIL_ENABLED))
+            {
+                if (pending_head - pending_tail >= MOCK_PENDING)
+                {
+                    stats.pending_overflow++;
+                    break;
+                }
+                Mock_Pending* p = &pending[pending_head & (MOCK_PENDING - 1)];
+                p->due_ns = now_ns + delay_ns;
+                p->time_usec = last_sensor.time_usec;
+                pending_head++;
+            }
+            break;
+
+        case MAVLINK_MSG_ID_HIL_GPS:
+            mavlink_msg_hil_gps_decode(msg, &last_gps);
+            stats.gps++;
+            break;
+
+        case MAVLINK_MSG_ID_SET_MODE:
+            base_mode = mavlink_msg_set_mode_get_base_mode(msg);
+            custom_mode = mavlink_msg_set_mode_get_custom_mode(msg);
+            printf("SET_MODE: base_mode %u custom_mode %u (HIL %s)\n", base_mode,
+                    custom_mode, (base_mode & MAV_MODE_FLAG_HIL_ENABLED) ? "on" : "off");
+
+            // The router waits for a heartbeat with the new mode
+            send_heartbeat();
+            break;
+
+        case MAVLINK_MSG_ID_MISSION_COUNT:
+            if (mavlink_msg_mission_count_get_target_system(msg) != sysid)
+                break;
+            mission.sysid = msg->sysid;
+            mission.compid = msg->compid;
+            mission.count = mavlink_msg_mission_count_get_count(msg);
+            mission.next = 0;
+            mission.start_ns = now_ns;
+            mission.request_pending = false;
+            mission.active = (mission.count > 0);
+            if (mission.active)
+                send_mission_request(0);
+            else
+                send_mission_ack(MAV_MISSION_ACCEPTED);
+            break;
+
+        case MAVLINK_MSG_ID_MISSION_ITEM_INT:
+            if (mavlink_msg_mission_item_int_get_target_system(msg) == sysid)
+                handle_mission_item(mavlink_msg_mission_item_int_get_seq(msg), now_ns);
+            break;
+
+        case MAVLINK_MSG_ID_MISSION_ITEM:
+            if (mavlink_msg_mission_item_get_target_system(msg) == sysid)
+                handle_mission_item(mavlink_msg_mission_item_get_seq(msg), now_ns);
+            break;
+
+        case MAVLINK_MSG_ID_PARAM_REQUEST_LIST:
+            if (mavlink_msg_param_request_list_get_target_system(msg) != sysid || nparams == 0)
+                break;
+            stats.param_lists++;
+            param_next = 0;
+            param_next_ns = now_ns;
+            break;
+
+        case MAVLINK_MSG_ID_PARAM_REQUEST_READ:
+        {
+            if (mavlink_msg_param_request_read_get_target_system(msg) != sysid)
+                break;
+            mavlink_param_request_read_t r;
+            mavlink_msg_param_request_read_decode(msg, &r);
+            int index = (r.param_index >= 0) ? r.param_index : param_index(r.param_id);
+            if (index >= 0 && index < nparams)
+            {
+                stats.param_reads++;
+                send_param_value(index);
+            }
+            break;
+        }
+
+        case MAVLINK_MSG_ID_PARAM_SET:
+        {
+            if (mavlink_msg_param_set_get_target_system(msg) != sysid)
+                break;
+            mavlink_param_set_t set;
+            mavlink_msg_param_set_decode(msg, &set);
+            int index = param_index(set.param_id);
+            if (index >= 0)
+            {
+                stats.param_sets++;
+                param_values[index] = set.param_value;
+                send_param_value(index);
+            }
+            break;
+        }
+
+        case MAVLINK_MSG_ID_COMMAND_LONG:
+            {
+                mavlink_message_t ack;
+                mavlink_msg_command_ack_pack_chan(sysid, MOCK_COMPID, MOCK_TX_CHAN, &ack,
+                        mavlink_msg_command_long_get_command(msg), MAV_RESULT_ACCEPTED);
+                send(&ack);
+            }
+            break;
+
+        default:
+            stats.other_rx++;
+            break;
+    }
+}
+
+
+// ------------------------------------------------------------------------
+//   Pseudo Terminal
+// ------------------------------------------------------------------------
+
+//
+// open_pty
+//
+// The slave is kept open in raw mode: the line discipline does not echo
+// the frames back and writes do not fail before the router opens it
+//
+static int open_pty(int* slave_fd)
+{
+    int fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (fd < 0 || grantpt(fd) < 0 || unlockpt(fd) < 0)
+        return -1;
+
+    const char* name = ptsname(fd);
+    *slave_fd = open(name, O_RDWR | O_NOCTTY);
+    if (*slave_fd < 0)
+        return -1;
+
+    struct termios config;
+    tcgetattr(*slave_fd, &config);
+    cfmakeraw(&config);
+    tcsetattr(*slave_fd, TCSANOW, &config);
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    printf("Mock autopilot on %s\n", name);
+    if (link_path != NULL)
+    {
+        unlink(link_path);
+        if (symlink(name, link_path) < 0)
+            fprintf(stderr, "WARNING: could not create %s (%s)\n", link_path, strerror(errno));
+        else
+            printf("Linked as %s\n", link_path);
+    }
+
+    return fd;
+}
+
+static void quit_handler(int sig)
+{
+    quit = 1;
+}
+
+
+// ------------------------------------------------------------------------
+//   Main
+// ------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    float rate_hz = 0;          // 0 = answer each HIL_SENSOR
+    long delay_us = 500;
+    float telemetry = 1.0f;
+
+    const char* usage = "usage: mock_autopilot [-link <path>] [-rate <Hz>] [-delay <us>] "
+            "[-telemetry <scale>] [-sysid <id>] [-mavlink <1|2>] [-mission_delay <us>] "
+            "[-mission_loss <%>] [-params <n>] [-param_interval <us>]";
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-link") == 0 && argc > i + 1)
+            link_path = argv[++i];
+        else if (strcmp(argv[i], "-rate") == 0 && argc > i + 1)
+            rate_hz = atof(argv[++i]);
+        else if (strcmp(argv[i], "-delay") == 0 && argc > i + 1)
+            delay_us = atol(argv[++i]);
+        else if (strcmp(argv[i], "-telemetry") == 0 && argc > i + 1)
+            telemetry = atof(argv[++i]);
+        else if (strcmp(argv[i], "-sysid") == 0 && argc > i + 1)
+            sysid = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-mavlink") == 0 && argc > i + 1)
+            force_v1 = (atoi(argv[++i]) == 1);
+        else if (strcmp(argv[i], "-mission_delay") == 0 && argc > i + 1)
+            mission_delay_ns = (uint64_t)atol(argv[++i]) * 1000;
+        else if (strcmp(argv[i], "-mission_loss") == 0 && argc > i + 1)
+            mission_loss = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-params") == 0 && argc > i + 1)
+            nparams = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-param_interval") == 0 && argc > i + 1)
+            param_interval_ns = (uint64_t)atol(argv[++i]) * 1000;
+        else
+        {
+            printf("%s\n", usage);
+            return EXIT_FAILURE;
+        }
+    }
+
+    int slave_fd;
+    master_fd = open_pty(&slave_fd);
+    if (master_fd < 0)
+    {
+        fprintf(stderr, "Could not open a pseudo terminal (%s)\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGINT, quit_handler);
+    signal(SIGTERM, quit_handler);
+
+    // Like PX4, start with MAVLink 1
+    mavlink_get_channel_status(MOCK_TX_CHAN)->flags |= MAVLINK_STATUS_FLAG_OUT_MAVLINK1;
+
+    memset(&stats, 0, sizeof(stats));
+    memset(&mission, 0, sizeof(mission));
+
+    if (nparams > 0)
+    {
+        param_values = (float*)malloc(nparams * sizeof(float));
+        for (int i = 0; i < nparams; i++)
+            param_values[i] = i * 0.5f;
+    }
+    memset(&last_sensor, 0, sizeof(last_sensor));
+    memset(&last_gps, 0, sizeof(last_gps));
+
+    uint64_t now = time_monotonic_ns();
+    uint64_t delay_ns = (uint64_t)delay_us * 1000;
+    uint64_t next_heartbeat = now;
+    uint64_t controls_period = (rate_hz > 0) ? (uint64_t)(1e9 / rate_hz) : 0;
+    uint64_t next_controls = now + controls_period;
+
+    for (int i = 0; i < nstreams; i++)
+    {
+        float rate = streams[i].rate_hz * telemetry;
+        streams[i].period_ns = (rate > 0) ? (uint64_t)(1e9 / rate) : 0;
+        streams[i].next_ns = now + streams[i].period_ns;
+    }
+
+    struct pollfd fds[1];
+    fds[0].fd = master_fd;
+    fds[0].events = POLLIN;
+
+    uint8_t rbuf[1024];
+    Mavlink_Parser parser;
+
+    while (!quit)
+    {
+        // Sleep until the next event or the next byte
+        now = time_monotonic_ns();
+        uint64_t next = next_heartbeat;
+        if (pending_head != pending_tail && pending[pending_tail & (MOCK_PENDING - 1)].due_ns < next)
+            next = pending[pending_tail & (MOCK_PENDING - 1)].due_ns;
+        if (controls_period > 0 && next_controls < next)
+            next = next_controls;
+        if (mission.request_pending && mission.request_ns < next)
+            next = mission.request_ns;
+        if (param_next >= 0 && param_next_ns < next)
+            next = param_next_ns;
+        for (int i = 0; i < nstreams; i++)
+        {
+            if (streams[i].period_ns > 0 && streams[i].next_ns < next)
+                next = streams[i].next_ns;
+        }
+
+        struct timespec timeout;
+        uint64_t wait_ns = (next > now) ? next - now : 0;
+        timeout.tv_sec = wait_ns / 1000000000ULL;
+        timeout.tv_nsec = wait_ns % 1000000000ULL;
+        if (ppoll(fds, 1, &timeout, NULL) > 0)
+        {
+            int n = read(master_fd, rbuf, sizeof(rbuf));
+            now = time_monotonic_ns();
+            for (int i = 0; i < n; i++)
+            {
+                if (parser.parse(rbuf[i]))
+                    handle_message(&parser.msg, now, delay_ns, controls_period == 0);
+            }
+        }
+
+        now = time_monotonic_ns();
+
+        // Controls whose compute time is over
+        while (pending_head != pending_tail &&
+                pending[pending_tail & (MOCK_PENDING - 1)].due_ns <= now)
+        {
+            Mock_Pending* p = &pending[pending_tail & (MOCK_PENDING - 1)];
+            if (now - p->due_ns > 1000000)
+                stats.late_controls++;
+            send_controls(p->time_usec);
+            pending_tail++;
+        }
+
+        // Controls at fixed rate
+        if (controls_period > 0 && now >= next_controls)
+        {
+            if (base_mode & MAV_MODE_FLAG_HIL_ENABLED)
+                send_controls(now / 1000);
+            next_controls += controls_period;
+            if (next_controls < now)
+                next_controls = now + controls_period;
+        }
+
+        // Next item of the mission, once the previous one is stored
+        if (mission.request_pending && now >= mission.request_ns)
+        {
+            mission.request_pending = false;
+            send_mission_request(mission.next);
+        }
+
+        // Parameter list, one value per interval
+        while (param_next >= 0 && now >= param_next_ns)
+        {
+            send_param_value(param_next++);
+            param_next_ns += param_interval_ns;
+            if (param_next >= nparams)
+                param_next = -1;
+        }
+
+        if (now >= next_heartbeat)
+        {
+            send_heartbeat();
+            next_heartbeat += 1000000000ULL;
+        }
+
+        for (int i = 0; i < nstreams; i++)
+        {
+            Mock_Stream* s = &streams[i];
+            if (s->period_ns == 0 || now < s->next_ns)
+                continue;
+
+            send_telemetry(s->msgid, now);
+            s->sent++;
+            s->next_ns += s->period_ns;
+            if (s->next_ns < now)
+                s->next_ns = now + s->period_ns;
+        }
+
+        flush();
+    }
+
+    printf("\nMock autopilot statistics\n");
+    printf("  HIL_SENSOR received   %lu\n", (unsigned long)stats.sensors);
+    printf("  HIL_GPS received      %lu\n", (unsigned long)stats.gps);
+    printf("  other received        %lu\n", (unsigned long)stats.other_rx);
+    printf("  HIL_CONTROLS sent     %lu (late %lu, overflow %lu)\n",
+            (unsigned long)stats.controls, (unsigned long)stats.late_controls,
+            (unsigned long)stats.pending_overflow);
+    printf("  telemetry sent        %lu\n", (unsigned long)stats.telemetry);
+    printf("  missions received     %lu (%lu items, %lu lost, %lu requested again)\n",
+            (unsigned long)stats.missions, (unsigned long)stats.mission_items,
+            (unsigned long)stats.mission_lost, (unsigned long)stats.mission_rerequests);
+    printf("  parameter lists       %lu (reads %lu, sets %lu, PARAM_VALUE sent %lu)\n",
+            (unsigned long)stats.param_lists, (unsigned long)stats.param_reads,
+            (unsigned long)stats.param_sets, (unsigned long)stats.param_values);
+    printf("  bytes sent            %lu (dropped %lu)\n", (unsigned long)stats.tx_bytes,
+            (unsigned long)stats.tx_dropped);
+    printf("  parse errors          %lu (bad CRC %lu)\n", (unsigned long)parser.parse_errors,
+            (unsigned long)parser.bad_crc);
+
+    if (link_path != NULL)
+        unlink(link_path);
+    close(slave_fd);
+    close(master_fd);
+    free(param_values);
+
+    return 0;
+}
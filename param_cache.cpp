@@ -0,0 +1,338 @@
+/**
+ * @file param_cache.cpp
+ *
+ * @brief Parameters of the board kept by the router for the Ground Station
+ *
+ */
+
+#include "param_cache.h"
+#include "gs_interface.h"
+#include "mav_msgset.h"
+
+#include <string.h>
+
+
+// ------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------
+Param_Cache::Param_Cache()
+{
+    enabled = false;
+
+    values_rx = 0;
+    values_served = 0;
+    lists_served = 0;
+    lists_forwarded = 0;
+    reads_served = 0;
+    reads_forwarded = 0;
+    sets = 0;
+    flushes = 0;
+
+    nvalid = 0;
+    owner_known = false;
+    sysid = 0;
+    compid = 0;
+    others = false;
+    list_next = -1;
+
+    pthread_mutex_init(&mut, NULL);
+}
+
+Param_Cache::~Param_Cache()
+{
+    pthread_mutex_destroy(&mut);
+}
+
+
+// ------------------------------------------------------------------------
+//   Table
+// ------------------------------------------------------------------------
+
+//
+// flush
+//
+void Param_Cache::flush(uint16_t count)
+{
+    Param_Entry empty;
+    memset(&empty, 0, sizeof(empty));
+
+    if (nvalid > 0)
+        flushes++;
+
+    entries.assign(count, empty);
+    names.clear();
+    nvalid = 0;
+    list_next = -1;
+}
+
+//
+// find
+//
+// Index of a parameter by name, -1 if unknown
+//
+int Param_Cache::find(const char* id)
+{
+    std::map<std::string, uint16_t>::iterator it = names.find(id);
+    return (it == names.end()) ? -1 : it->second;
+}
+
+//
+// addressed
+//
+// Request for the cached component
+//
+bool Param_Cache::addressed(uint8_t target_system, uint8_t target_component)
+{
+    if (!owner_known || target_system != sysid)
+        return false;
+
+    return target_component == compid || (target_component == MAV_COMP_ID_ALL && !others);
+}
+
+//
+// value_message
+//
+// PARAM_VALUE of an entry, as sent by the board
+//
+bool Param_Cache::value_message(uint16_t index, mavlink_message_t* msg)
+{
+    const Param_Entry* e = &entries[index];
+    if (!e->valid)
+        return false;
+
+    mavlink_msg_param_value_pack_chan(sysid, compid, PARAM_CACHE_CHAN, msg, e->id, e->value,
+            e->type, entries.size(), index);
+    return true;
+}
+
+//
+// set_owner
+//
+// The first autopilot heartbeat names the component whose parameters
+// are cached
+//
+void Param_Cache::set_owner(const mavlink_message_t* heartbeat)
+{
+    if (!enabled || MAV_GET(heartbeat, HEARTBEAT, autopilot) == MAV_AUTOPILOT_INVALID)
+        return;
+
+    pthread_mutex_lock(&mut);
+    if (!owner_known)
+    {
+        owner_known = true;
+        sysid = heartbeat->sysid;
+        compid = heartbeat->compid;
+    }
+    pthread_mutex_unlock(&mut);
+}
+
+//
+// update
+//
+// The answers to a PARAM_SET may have param_index 65535 (ArduPilot): the
+// entry is found by name. The values before the heartbeat of the
+// autopilot are ignored (they are forwarded to the GS all the same).
+//
+void Param_Cache::update(const mavlink_message_t* msg)
+{
+    if (!enabled)
+        return;
+
+    mavlink_param_value_t v;
+    mavlink_msg_param_value_decode(msg, &v);
+
+    char id[MAVLINK_MSG_PARAM_VALUE_FIELD_PARAM_ID_LEN + 1];
+    memcpy(id, v.param_id, MAVLINK_MSG_PARAM_VALUE_FIELD_PARAM_ID_LEN);
+    id[MAVLINK_MSG_PARAM_VALUE_FIELD_PARAM_ID_LEN] = '\0';
+
+    pthread_mutex_lock(&mut);
+
+    if (!owner_known)
+    {
+        pthread_mutex_unlock(&mut);
+        return;
+    }
+    if (msg->sysid != sysid || msg->compid != compid)
+    {
+        if (msg->sysid == sysid)
+            others = true;
+        pthread_mutex_unlock(&mut);
+        return;
+    }
+
+    values_rx++;
+    if (v.param_count == 0 || v.param_count > PARAM_CACHE_MAX)
+    {
+        pthread_mutex_unlock(&mut);
+        return;
+    }
+
+    if (v.param_count != entries.size())
+        flush(v.param_count);
+
+    int index = (v.param_index < entries.size()) ? v.param_index : find(id);
+    if (index < 0)
+    {
+        pthread_mutex_unlock(&mut);
+        return;
+    }
+
+    Param_Entry* e = &entries[index];
+    if (e->id[0] != '\0' && strcmp(e->id, id) != 0)
+        names.erase(e->id);
+    if (!e->valid)
+        nvalid++;
+
+    e->valid = true;
+    memcpy(e->id, id, sizeof(e->id));
+    e->value = v.param_value;
+    e->type = v.param_type;
+    names[e->id] = index;
+
+    pthread_mutex_unlock(&mut);
+}
+
+
+// ------------------------------------------------------------------------
+//   Requests of the Ground Station
+// ------------------------------------------------------------------------
+
+//
+// request
+//
+bool Param_Cache::request(const mavlink_message_t* msg, GS_Interface* gs)
+{
+    if (!enabled)
+        return false;
+
+    bool served = false;
+    mavlink_message_t answer;
+    char id[MAVLINK_MSG_PARAM_VALUE_FIELD_PARAM_ID_LEN + 1];
+    id[MAVLINK_MSG_PARAM_VALUE_FIELD_PARAM_ID_LEN] = '\0';
+
+    switch (msg->msgid)
+    {
+        case MAVLINK_MSG_ID_PARAM_REQUEST_LIST:
+            // Incomplete: the board sends the whole list again
+            pthread_mutex_lock(&mut);
+            if (addressed(MAV_GET(msg, PARAM_REQUEST_LIST, target_system),
+                    MAV_GET(msg, PARAM_REQUEST_LIST, target_component)) &&
+                    nvalid > 0 && nvalid == entries.size())
+            {
+                list_next = 0;
+                lists_served++;
+                served = true;
+            }
+            else
+                lists_forwarded++;
+            pthread_mutex_unlock(&mut);
+            return served;
+
+        case MAVLINK_MSG_ID_PARAM_REQUEST_READ:
+        {
+            mavlink_msg_param_request_read_get_param_id(msg, id);
+            int16_t index = MAV_GET(msg, PARAM_REQUEST_READ, param_index);
+
+            pthread_mutex_lock(&mut);
+            if (addressed(MAV_GET(msg, PARAM_REQUEST_READ, target_system),
+                    MAV_GET(msg, PARAM_REQUEST_READ, target_component)))
+            {
+                int i = (index >= 0) ? index : find(id);
+                served = (i >= 0 && i < (int)entries.size() && value_message(i, &answer));
+            }
+            if (served)
+                reads_served++;
+            else
+                reads_forwarded++;
+            pthread_mutex_unlock(&mut);
+            break;
+        }
+
+        case MAVLINK_MSG_ID_PARAM_SET:
+        {
+            mavlink_msg_param_set_get_param_id(msg, id);
+
+            // Read from the board until it confirms the new value
+            pthread_mutex_lock(&mut);
+            if (addressed(MAV_GET(msg, PARAM_SET, target_system),
+                    MAV_GET(msg, PARAM_SET, target_component)))
+            {
+                sets++;
+                int i = find(id);
+                if (i >= 0 && entries[i].valid)
+                {
+                    entries[i].valid = false;
+                    nvalid--;
+                }
+            }
+            pthread_mutex_unlock(&mut);
+            return false;
+        }
+
+        default:
+            return false;
+    }
+
+    if (served)
+    {
+        values_served++;
+        gs->pushMessage(&answer);
+    }
+    return served;
+}
+
+//
+// poll
+//
+// Values of the list being served. The entries made invalid by a
+// PARAM_SET in the meantime are skipped: the GS reads them by index
+//
+void Param_Cache::poll(GS_Interface* gs)
+{
+    if (!enabled)
+        return;
+
+    mavlink_message_t msg[PARAM_CACHE_BURST];
+    int n = 0;
+
+    pthread_mutex_lock(&mut);
+    if (list_next < 0)
+    {
+        pthread_mutex_unlock(&mut);
+        return;
+    }
+    while (list_next >= 0 && n < PARAM_CACHE_BURST)
+    {
+        if (list_next >= (int)entries.size())
+        {
+            list_next = -1;
+            break;
+        }
+        if (value_message(list_next++, &msg[n]))
+            n++;
+    }
+    values_served += n;
+    pthread_mutex_unlock(&mut);
+
+    for (int i = 0; i < n; i++)
+        gs->pushMessage(&msg[i]);
+}
+
+//
+// report
+//
+void Param_Cache::report(FILE* f)
+{
+    if (!enabled)
+        return;
+
+    pthread_mutex_lock(&mut);
+    fprintf(f, "Param cache: %u/%lu values of %u:%u, %lu PARAM_VALUE from the board, "
+            "%lu served\n", nvalid, (unsigned long)entries.size(), sysid, compid,
+            (unsigned long)values_rx, (unsigned long)values_served);
+    fprintf(f, "  lists %lu served %lu forwarded | reads %lu served %lu forwarded | "
+            "sets %lu | flushes %lu\n", (unsigned long)lists_served,
+            (unsigned long)lists_forwarded, (unsigned long)reads_served,
+            (unsigned long)reads_forwarded, (unsigned long)sets, (unsigned long)flushes);
+    pthread_mutex_unlock(&mut);
+}
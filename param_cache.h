@@ -0,0 +1,151 @@
+/**
+ * @file param_cache.h
+ *
+ * @brief Parameters of the board kept by the router for the Ground Station
+ *
+ * The PARAM_VALUE messages of the autopilot fill a table by index and
+ * by name. The autopilot is the sender of the first HEARTBEAT with an
+ * autopilot other than MAV_AUTOPILOT_INVALID (set_owner()): a camera or
+ * a gimbal answering first is not taken for it. Once the table is
+ * complete:
+ *
+ *   PARAM_REQUEST_LIST   the values are sent from the table to the GS,
+ *                        PARAM_CACHE_BURST per period of the GS task
+ *   PARAM_REQUEST_READ   answered from the table (by index or by name)
+ *   PARAM_SET            forwarded to the board, the entry is invalid
+ *                        until the PARAM_VALUE of the board comes back
+ *
+ * Until then, and for the parameters missing from the table, the
+ * requests go to the board and its answers fill the table. Requests to
+ * all the components (target_component 0) are served only as long as
+ * no other component of the board has sent parameters. A new
+ * param_count (other firmware, parameters added by a reboot) empties
+ * the table.
+ *
+ * Sequence numbers: the PARAM_VALUE built by the router carry the
+ * sysid/compid of the autopilot (the GS must take them for its answers)
+ * and the sequence of PARAM_CACHE_CHAN. They cannot follow the sequence
+ * of the board: the frames of the board go on with their own numbers,
+ * forwarded raw, and a number taken by the router would come back as a
+ * duplicate. A GS computing the loss of the autopilot from the sequence
+ * numbers sees a gap at each switch between the two streams while a
+ * list is served (up to one per value). This is the price of not
+ * reading the list from the board.
+ *
+ * set_owner() and update() are called by the inflow task, request() and
+ * poll() by the GS task: the table is protected by a mutex, the
+ * messages are pushed to the GS outside of it.
+ *
+ */
+
+#ifndef PARAM_CACHE_H_
+#define PARAM_CACHE_H_
+
+// ------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <vector>
+#include <map>
+#include <string>
+
+#include "mav_crc.h"
+#include <common/mavlink.h>
+
+class GS_Interface;
+
+// ------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------
+
+// Channel of the PARAM_VALUE built by the router: they carry their own
+// sequence numbers, not those of the board
+#define PARAM_CACHE_CHAN        MAVLINK_COMM_2
+
+// PARAM_VALUE sent to the GS per period of the GS task while serving a
+// list (one datagram each)
+#define PARAM_CACHE_BURST       32
+
+// Larger param_count are not cached
+#define PARAM_CACHE_MAX         4096
+
+
+// ------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------
+struct Param_Entry {
+
+    bool valid;
+    char id[MAVLINK_MSG_PARAM_VALUE_FIELD_PARAM_ID_LEN + 1];
+    float value;
+    uint8_t type;
+};
+
+
+// ---------------------------------------------------------------------
+//   Parameter Cache Class
+// ---------------------------------------------------------------------
+class Param_Cache
+{
+
+    public:
+
+        Param_Cache();
+        ~Param_Cache();
+
+        // Inflow task: HEARTBEAT of the board
+        void set_owner(const mavlink_message_t* heartbeat);
+
+        // Inflow task: PARAM_VALUE of the board
+        void update(const mavlink_message_t* msg);
+
+        // GS task: parameter requests of the GS. Returns true if the
+        // request is answered by the cache (not to be forwarded)
+        bool request(const mavlink_message_t* msg, GS_Interface* gs);
+
+        // GS task, each period: values of a list being served
+        void poll(GS_Interface* gs);
+
+        void report(FILE* f);
+
+        // Off by default (-param_cache)
+        bool enabled;
+
+        // Statistics
+        uint64_t values_rx;         // PARAM_VALUE of the board
+        uint64_t values_served;     // PARAM_VALUE sent by the router
+        uint64_t lists_served;
+        uint64_t lists_forwarded;
+        uint64_t reads_served;
+        uint64_t reads_forwarded;
+        uint64_t sets;
+        uint64_t flushes;           // Table emptied by a new param_count
+
+    private:
+
+        pthread_mutex_t mut;
+
+        std::vector<Param_Entry> entries;
+        std::map<std::string, uint16_t> names;
+        unsigned nvalid;
+
+        // Component whose parameters are cached
+        bool owner_known;
+        uint8_t sysid;
+        uint8_t compid;
+        bool others;                // Parameters from other components
+
+        // Next index of the list being served, -1 if none
+        int list_next;
+
+        bool addressed(uint8_t target_system, uint8_t target_component);
+        int find(const char* id);
+        void flush(uint16_t count);
+        bool value_message(uint16_t index, mavlink_message_t* msg);
+};
+
+
+#endif // PARAM_CACHE_H_
@@ -0,0 +1,439 @@
+/**
+ * @file rt_setup.cpp
+ *
+ * @brief Real-time configuration of the routing tasks
+ *
+ * The settings are applied by each task on itself at the beginning of
+ * its body, so that tasks with different policies can coexist in the
+ * same ptask environment.
+ *
+ */
+
+
+// ------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------
+
+#include "rt_setup.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+
+// Structure used by the sched_setattr/sched_getattr system calls
+// (not exported by the C library)
+struct rt_sched_attr {
+    uint32_t size;
+    uint32_t sched_policy;
+    uint64_t sched_flags;
+    int32_t  sched_nice;
+    uint32_t sched_priority;
+    uint64_t sched_runtime;
+    uint64_t sched_deadline;
+    uint64_t sched_period;
+};
+
+// Priority inheritance flag used by rt_mutex_init()
+static bool rt_pi_enabled = false;
+
+// Memory locking result, reported by each task
+static bool rt_mem_locked = false;
+
+
+// ------------------------------------------------------------------------
+//   Configuration
+// ------------------------------------------------------------------------
+
+//
+// rt_config_defaults
+//
+// Default settings: time sharing scheduler, no pinning, no locking.
+// This is the behaviour of the application before the configuration
+// was introduced.
+//
+void rt_config_defaults(RT_Config &cfg)
+{
+    Task_RT_Config* tasks[4] = {&cfg.inflow, &cfg.simulator, &cfg.gs, &cfg.outflow};
+    const char* names[4] = {"inflow", "simulator", "gs", "outflow"};
+    const int prio[4] = {90, 90, 80, 95};
+
+    for (int i = 0; i < 4; i++)
+    {
+        tasks[i]->name = names[i];
+        tasks[i]->processor = -1;
+        tasks[i]->policy = SCHED_OTHER;
+        tasks[i]->priority = prio[i];
+        tasks[i]->runtime_us = 0;
+        tasks[i]->period_us = 4000;
+    }
+
+    cfg.mem_lock = false;
+    cfg.prefault_kb = 0;
+    cfg.pi_mutex = false;
+}
+
+//
+// rt_parse_policy
+//
+static int rt_parse_policy(const char* str)
+{
+    if (strcmp(str, "other") == 0)
+        return SCHED_OTHER;
+    if (strcmp(str, "fifo") == 0)
+        return SCHED_FIFO;
+    if (strcmp(str, "rr") == 0)
+        return SCHED_RR;
+    if (strcmp(str, "deadline") == 0)
+        return SCHED_DEADLINE;
+    return -1;
+}
+
+//
+// rt_parse_long
+//
+// Whole string as a decimal number in [min, max]
+//
+static bool rt_parse_long(const char* str, long min, long max, long &val)
+{
+    char* end;
+    errno = 0;
+    val = strtol(str, &end, 10);
+    return errno == 0 && end != str && *end == '\0' && val >= min && val <= max;
+}
+
+//
+// rt_parse_task
+//
+// Parse a task specification in the form "cpu:policy:prio[:runtime_us]"
+// where cpu = -1 leaves the task free to migrate and runtime_us is the
+// budget of a SCHED_DEADLINE reservation. The priority is checked
+// against the range of the policy (it is not used by SCHED_OTHER and
+// SCHED_DEADLINE), the budget against the period of the task.
+//
+bool rt_parse_task(const char* spec, Task_RT_Config &task)
+{
+    char buff[64];
+    strncpy(buff, spec, sizeof(buff) - 1);
+    buff[sizeof(buff) - 1] = 0;
+
+    char* save;
+    char* cpu = strtok_r(buff, ":", &save);
+    char* pol = strtok_r(NULL, ":", &save);
+    char* prio = strtok_r(NULL, ":", &save);
+    char* runtime = strtok_r(NULL, ":", &save);
+
+    if (cpu == NULL || pol == NULL || strtok_r(NULL, ":", &save) != NULL)
+    {
+        printf("%s: cpu:policy:prio[:runtime_us]\n", spec);
+        return false;
+    }
+
+    int policy = rt_parse_policy(pol);
+    if (policy < 0)
+    {
+        printf("%s: policy other, fifo, rr or deadline\n", spec);
+        return false;
+    }
+
+    long ncpu = sysconf(_SC_NPROCESSORS_CONF);
+    long val;
+    if (!rt_parse_long(cpu, -1, ncpu - 1, val))
+    {
+        printf("%s: cpu -1 (any) to %ld\n", spec, ncpu - 1);
+        return false;
+    }
+    task.processor = val;
+    task.policy = policy;
+
+    if (prio != NULL)
+    {
+        long min = 0;
+        long max = 99;
+        if (policy == SCHED_FIFO || policy == SCHED_RR)
+        {
+            min = sched_get_priority_min(policy);
+            max = sched_get_priority_max(policy);
+        }
+        if (!rt_parse_long(prio, min, max, val))
+        {
+            printf("%s: priority %ld to %ld for SCHED_%s\n", spec, min, max,
+                    rt_policy_name(policy));
+            return false;
+        }
+        task.priority = val;
+    }
+
+    if (runtime != NULL)
+    {
+        if (!rt_parse_long(runtime, 1, task.period_us, val))
+        {
+            printf("%s: runtime 1 to %ld us (period of the task)\n", spec,
+                    task.period_us);
+            return false;
+        }
+        task.runtime_us = val;
+    }
+
+    // A deadline reservation needs a budget
+    if (policy == SCHED_DEADLINE && task.runtime_us <= 0)
+        task.runtime_us = task.period_us / 2;
+
+    return true;
+}
+
+//
+// rt_parse_prefault
+//
+// Stack prefaulted by each task, in KB
+//
+bool rt_parse_prefault(const char* str, unsigned int &kb)
+{
+    char* end;
+    errno = 0;
+    long val = strtol(str, &end, 10);
+    if (errno != 0 || end == str || *end != '\0' || val < 0 || val > RT_PREFAULT_MAX_KB)
+    {
+        printf("-prefault: 0 to %d KB\n", RT_PREFAULT_MAX_KB);
+        return false;
+    }
+
+    kb = (unsigned int)val;
+    return true;
+}
+
+const char* rt_policy_name(int policy)
+{
+    switch (policy)
+    {
+        case SCHED_OTHER:
+            return "OTHER";
+        case SCHED_FIFO:
+            return "FIFO";
+        case SCHED_RR:
+            return "RR";
+        case SCHED_DEADLINE:
+            return "DEADLINE";
+        default:
+            return "UNKNOWN";
+    }
+}
+
+
+// ------------------------------------------------------------------------
+//   Process Settings
+// ------------------------------------------------------------------------
+
+//
+// rt_lock_memory
+//
+// Lock the current and future pages of the process in RAM, so that the
+// periodic tasks never page fault on the routing path.
+//
+int rt_lock_memory(const RT_Config &cfg)
+{
+    if (!cfg.mem_lock)
+        return 0;
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+    {
+        fprintf(stderr, "WARNING: mlockall failed (%s)\n", strerror(errno));
+        return -1;
+    }
+
+    rt_mem_locked = true;
+    return 0;
+}
+
+void rt_set_pi_mutex(bool enable)
+{
+    rt_pi_enabled = enable;
+}
+
+//
+// rt_mutex_init
+//
+// Initialize a mutex shared among tasks. When enabled, the mutex uses
+// the priority inheritance protocol.
+//
+void rt_mutex_init(pthread_mutex_t* mux)
+{
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    if (rt_pi_enabled)
+        pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+
+    pthread_mutex_init(mux, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+
+// ------------------------------------------------------------------------
+//   Task Settings
+// ------------------------------------------------------------------------
+
+//
+// rt_stack_room
+//
+// Bytes of stack between the caller and the end of the stack of the
+// thread (0 if unknown)
+//
+static size_t rt_stack_room()
+{
+    pthread_attr_t attr;
+    void* addr;
+    size_t size;
+
+    if (pthread_getattr_np(pthread_self(), &attr) != 0)
+        return 0;
+    int ret = pthread_attr_getstack(&attr, &addr, &size);
+    pthread_attr_destroy(&attr);
+    if (ret != 0)
+        return 0;
+
+    char here;
+    return (size_t)(&here - (char*)addr);
+}
+
+//
+// rt_prefault_stack
+//
+// Touch the next kb KB of the stack, one byte per page, so that the pages
+// are mapped (and locked, if requested) before the first periodic
+// activation. The writes go through a volatile pointer: they are not
+// removed by the optimizer. At most the room of the stack minus
+// RT_PREFAULT_MARGIN_KB is touched.
+//
+void rt_prefault_stack(unsigned int kb)
+{
+    if (kb == 0)
+        return;
+
+    size_t bytes = (size_t)kb * 1024;
+    size_t room = rt_stack_room();
+    size_t margin = RT_PREFAULT_MARGIN_KB * 1024;
+    if (room <= margin)
+        return;
+    if (bytes > room - margin)
+    {
+        bytes = room - margin;
+        printf("[RT] stack prefault limited to %lu KB\n", (unsigned long)(bytes / 1024));
+    }
+
+    long page = sysconf(_SC_PAGESIZE);
+    if (page <= 0)
+        page = 4096;
+
+    unsigned char stack[bytes];
+    volatile unsigned char* p = stack;
+    for (size_t i = 0; i < bytes; i += page)
+        p[i] = 0;
+    p[bytes - 1] = 0;
+}
+
+//
+// rt_apply_task
+//
+// Apply affinity and scheduling policy to the calling thread
+//
+int rt_apply_task(const Task_RT_Config &task)
+{
+    int ret = 0;
+
+    // CPU Affinity
+    if (task.processor >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(task.processor, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+        {
+            fprintf(stderr, "WARNING: %s task could not be pinned on CPU %d\n",
+                    task.name, task.processor);
+            ret = -1;
+        }
+    }
+
+    // Scheduling Policy
+    if (task.policy == SCHED_DEADLINE)
+    {
+        struct rt_sched_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.sched_policy = SCHED_DEADLINE;
+        attr.sched_runtime = (uint64_t)task.runtime_us * 1000;
+        attr.sched_deadline = (uint64_t)task.period_us * 1000;
+        attr.sched_period = (uint64_t)task.period_us * 1000;
+
+        if (syscall(SYS_sched_setattr, 0, &attr, 0) < 0)
+        {
+            fprintf(stderr, "WARNING: %s task could not set SCHED_DEADLINE (%s)\n",
+                    task.name, strerror(errno));
+            ret = -1;
+        }
+    }
+    else if (task.policy != SCHED_OTHER)
+    {
+        struct sched_param param;
+        param.sched_priority = task.priority;
+        int err = pthread_setschedparam(pthread_self(), task.policy, &param);
+        if (err != 0)
+        {
+            fprintf(stderr, "WARNING: %s task could not set SCHED_%s prio %d (%s)\n",
+                    task.name, rt_policy_name(task.policy), task.priority, strerror(err));
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+//
+// rt_report_task
+//
+// Print the settings effectively in place for the calling thread
+//
+void rt_report_task(const Task_RT_Config &task)
+{
+    char cpus[128];
+    int len = 0;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    pthread_getaffinity_np(pthread_self(), sizeof(set), &set);
+    cpus[0] = 0;
+    for (int i = 0; i < CPU_SETSIZE && len < (int)sizeof(cpus) - 8; i++)
+    {
+        if (CPU_ISSET(i, &set))
+            len += snprintf(cpus + len, sizeof(cpus) - len, "%s%d", len ? "," : "", i);
+    }
+
+    struct rt_sched_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    if (syscall(SYS_sched_getattr, 0, &attr, sizeof(attr), 0) < 0)
+    {
+        int policy;
+        struct sched_param param;
+        pthread_getschedparam(pthread_self(), &policy, &param);
+        attr.sched_policy = policy;
+        attr.sched_priority = param.sched_priority;
+    }
+
+    printf("[RT] %-9s : cpu %s | SCHED_%s", task.name, cpus,
+            rt_policy_name(attr.sched_policy));
+    if (attr.sched_policy == SCHED_DEADLINE)
+        printf(" runtime %lu us period %lu us",
+                (unsigned long)(attr.sched_runtime / 1000),
+                (unsigned long)(attr.sched_period / 1000));
+    else
+        printf(" prio %u", attr.sched_priority);
+    printf(" | mlock %s | pi %s\n", rt_mem_locked ? "yes" : "no",
+            rt_pi_enabled ? "yes" : "no");
+}
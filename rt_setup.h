@@ -0,0 +1,96 @@
+/**
+ * @file rt_setup.h
+ *
+ * @brief Real-time configuration of the routing tasks
+ *
+ * Per-task CPU affinity, scheduling policy and priority, plus the
+ * process wide settings (memory locking, stack prefaulting and
+ * priority inheritance mutexes).
+ *
+ */
+
+#ifndef RT_SETUP_H_
+#define RT_SETUP_H_
+
+// ------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+
+// ------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------
+
+// Older C libraries do not export the deadline policy
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE 6
+#endif
+
+// Largest -prefault (KB), well below the default stack of a thread. The
+// stack left to the task is also checked at run time.
+#define RT_PREFAULT_MAX_KB      1024
+
+// Stack left to the frames of the task after the prefault (KB)
+#define RT_PREFAULT_MARGIN_KB   64
+
+
+// ------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------
+// Real-time settings of a single task
+struct Task_RT_Config {
+
+    const char* name;
+
+    int processor;      // CPU the task is pinned to (-1 = any)
+    int policy;         // SCHED_OTHER, SCHED_FIFO, SCHED_RR or SCHED_DEADLINE
+    int priority;       // Static priority (SCHED_FIFO / SCHED_RR)
+
+    // SCHED_DEADLINE reservation (microseconds)
+    long runtime_us;
+    long period_us;
+};
+
+// Real-time settings of the whole application
+struct RT_Config {
+
+    Task_RT_Config inflow;
+    Task_RT_Config simulator;
+    Task_RT_Config gs;
+    Task_RT_Config outflow;
+
+    bool mem_lock;              // mlockall() before starting the tasks
+    unsigned int prefault_kb;   // Stack prefaulted by each task (0 = off)
+    bool pi_mutex;              // Priority inheritance on shared mutexes
+};
+
+
+// ------------------------------------------------------------------------
+//   Prototypes
+// ------------------------------------------------------------------------
+
+void rt_config_defaults(RT_Config &cfg);
+
+// Parse a task specification "cpu:policy:prio[:runtime_us]"
+bool rt_parse_task(const char* spec, Task_RT_Config &task);
+
+// "<KB>", 0 to RT_PREFAULT_MAX_KB
+bool rt_parse_prefault(const char* str, unsigned int &kb);
+
+// Process wide settings
+int rt_lock_memory(const RT_Config &cfg);
+void rt_set_pi_mutex(bool enable);
+void rt_mutex_init(pthread_mutex_t* mux);
+
+// Settings applied by each task on itself
+void rt_prefault_stack(unsigned int kb);
+int rt_apply_task(const Task_RT_Config &task);
+void rt_report_task(const Task_RT_Config &task);
+
+const char* rt_policy_name(int policy);
+
+
+#endif // RT_SETUP_H_
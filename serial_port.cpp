@@ -58,8 +58,10 @@
 #include <pthread.h> // This uses POSIX Threads
 #include <signal.h>
 #include <time.h> 
+#include <errno.h>
 
 #include "time_utils.h"
+#include "serial_tuning.h"
 
 
 // ------------------------------------------------------------------------
@@ -78,9 +80,9 @@ Serial_Port::Serial_Port(char *&uart_name_ , int &baudrate_)
     open_serial();
 
     fdsR[0].fd = fd;
-    fdsR[0].revents = POLLIN;
+    fdsR[0].events = POLLIN;
     fdsW[0].fd = fd;
-    fdsW[0].revents = POLLOUT;
+    fdsW[0].events = POLLOUT;
 }
 
 Serial_Port::Serial_Port()
@@ -89,9 +91,9 @@ Serial_Port::Serial_Port()
     open_serial();
     
     fdsR[0].fd = fd;
-    fdsR[0].revents = POLLIN;
+    fdsR[0].events = POLLIN;
     fdsW[0].fd = fd;
-    fdsW[0].revents = POLLOUT;
+    fdsW[0].events = POLLOUT;
 }
 
 Serial_Port::~Serial_Port()
@@ -185,6 +187,7 @@ void Serial_Port::open_serial()
     //   CONNECTED!
     // --------------------------------------------------------------------------
     printf("Connected to %s with %d baud, 8 data bits, no parity, 1 stop bit (8N1)\n", uart_name, baudrate);
+    report_settings();
 
     status = true;
 
@@ -195,6 +198,32 @@ void Serial_Port::open_serial()
 }
 
 
+// ------------------------------------------------------------------------------
+//   Report Serial Port Settings
+// ------------------------------------------------------------------------------
+// Settings effectively applied by the driver
+void Serial_Port::report_settings()
+{
+    int ispeed = -1;
+    int ospeed = -1;
+    serial_get_baudrate(fd, &ispeed, &ospeed);
+
+    int low_latency = serial_get_low_latency(fd);
+    int latency_timer = serial_get_latency_timer(uart_name);
+
+    printf("Serial settings: baud in %d out %d | low latency %s | latency timer ",
+            ispeed, ospeed, (low_latency < 0) ? "n/a" : (low_latency ? "on" : "off"));
+    if (latency_timer < 0)
+        printf("n/a\n");
+    else
+        printf("%d ms%s\n", latency_timer,
+                (latency_timer > SERIAL_LATENCY_TIMER_MS) ? " (not permitted to lower it)" : "");
+
+    if (ospeed != baudrate)
+        fprintf(stderr, "WARNING: the driver applied %d baud instead of %d\n", ospeed, baudrate);
+}
+
+
 // ------------------------------------------------------------------------------
 //   Close Serial Port
 // ------------------------------------------------------------------------------
@@ -288,6 +317,8 @@ _setup_port(int baud, int data_bits, int stop_bits, bool parity, bool hardware_c
         return false;
     }
 
+    bool custom_baud = false;
+
     // Read file descritor configuration
     struct termios  config;
     if(tcgetattr(fd, &config) < 0)
@@ -409,9 +440,9 @@ _setup_port(int baud, int data_bits, int stop_bits, bool parity, bool hardware_c
             }
             break;
         default:
-            fprintf(stderr, "ERROR: Desired baud rate %d could not be set, aborting.\n", baud);
-            return false;
-
+            // Any other rate (1.5M, 2M, 3M, ...) is set with termios2
+            // once the rest of the configuration has been applied
+            custom_baud = true;
             break;
     }
 
@@ -422,6 +453,18 @@ _setup_port(int baud, int data_bits, int stop_bits, bool parity, bool hardware_c
         return false;
     }
 
+    if (custom_baud && serial_set_baudrate(fd, baud) < 0)
+    {
+        fprintf(stderr, "ERROR: Desired baud rate %d could not be set, aborting.\n", baud);
+        return false;
+    }
+
+    // Low latency: received bytes are pushed to the tty layer at once and
+    // the USB-serial adapters flush their buffer every millisecond.
+    // Both need privileges on most systems: failures are only reported.
+    serial_set_low_latency(fd);
+    serial_set_latency_timer(uart_name, SERIAL_LATENCY_TIMER_MS);
+
     // Done!
     return true;
 }
@@ -439,7 +482,7 @@ int Serial_Port::_read_port(uint8_t &cp)
     int result = read(fd, &cp, 1);
     if ( result == -1 )
     {
-        printf("%s, %s : _read_port  : Failed to read on the serial\n",__FILE__,__LINE__);
+        printf("%s, %d : _read_port  : Failed to read on the serial\n",__FILE__,__LINE__);
     }
     return result;
 }
@@ -450,14 +493,27 @@ int Serial_Port::_read_port(uint8_t &cp)
 // ------------------------------------------------------------------------------
 int Serial_Port::_write_port(char *buf, unsigned &len)
 {
+    unsigned writtenB = 0;
 
-    // Write packet via serial link
-    int writtenB = write(fd, buf, len);
-
-    if ( writtenB == -1 )
+    // Write packet via serial link. The driver may accept only part of
+    // the buffer: keep writing the rest until the whole frame is out.
+    while (writtenB < len)
     {
-        printf("%s, %s : _write_port  : Failed to write on the serial\n",__FILE__,__LINE__);
-        return writtenB;
+        int ret = write(fd, buf + writtenB, len - writtenB);
+
+        if ( ret == -1 )
+        {
+            if (errno == EINTR)
+                continue;
+
+            // Output buffer full: wait until the driver drains it
+            if (errno == EAGAIN && poll(fdsW, 1, SERIAL_WRITE_TIMEOUT_MS) > 0)
+                continue;
+
+            printf("%s, %d : _write_port  : Failed to write on the serial\n",__FILE__,__LINE__);
+            return -1;
+        }
+        writtenB += ret;
     }
     // Wait until all data has been written
     //tcdrain(fd);
@@ -75,6 +75,10 @@
 #endif
 
 
+// Maximum wait for room in the output buffer (ms)
+#define SERIAL_WRITE_TIMEOUT_MS 100
+
+
 // Status flags
 #define SERIAL_PORT_OPEN   1;
 #define SERIAL_PORT_CLOSED 0;
@@ -124,6 +128,9 @@ class Serial_Port
 
         void handle_quit( int sig );
 
+        // Baudrate, low latency mode and latency timer in use
+        void report_settings();
+
         int  fd;
     private:
 
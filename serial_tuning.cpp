@@ -0,0 +1,173 @@
+/**
+ * @file serial_tuning.cpp
+ *
+ * @brief Linux specific settings of the serial port
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "serial_tuning.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/ioctl.h>
+#include <asm/termbits.h>   // termios2, not compatible with <termios.h>
+#include <linux/serial.h>
+
+
+// ------------------------------------------------------------------------------
+//   Baudrate
+// ------------------------------------------------------------------------------
+
+//
+// serial_set_baudrate
+//
+// The rest of the configuration (8N1, raw mode) must have been applied
+// with tcsetattr() before: only the speed fields are changed.
+//
+int serial_set_baudrate(int fd, int baud)
+{
+    struct termios2 tio;
+
+    if (ioctl(fd, TCGETS2, &tio) < 0)
+        return -1;
+
+    tio.c_cflag &= ~CBAUD;
+    tio.c_cflag |= BOTHER;
+    tio.c_ispeed = baud;
+    tio.c_ospeed = baud;
+
+    // The input speed follows the output one
+    tio.c_cflag &= ~(CBAUD << IBSHIFT);
+    tio.c_cflag |= BOTHER << IBSHIFT;
+
+    if (ioctl(fd, TCSETS2, &tio) < 0)
+        return -1;
+
+    return 0;
+}
+
+//
+// serial_get_baudrate
+//
+int serial_get_baudrate(int fd, int* ispeed, int* ospeed)
+{
+    struct termios2 tio;
+
+    if (ioctl(fd, TCGETS2, &tio) < 0)
+        return -1;
+
+    *ispeed = tio.c_ispeed;
+    *ospeed = tio.c_ospeed;
+
+    return 0;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Low Latency Mode
+// ------------------------------------------------------------------------------
+
+//
+// serial_set_low_latency
+//
+// Ask the driver to push the received bytes to the tty layer at once
+// instead of deferring them to a work queue
+//
+int serial_set_low_latency(int fd)
+{
+    struct serial_struct ser;
+
+    if (ioctl(fd, TIOCGSERIAL, &ser) < 0)
+        return -1;
+
+    ser.flags |= ASYNC_LOW_LATENCY;
+
+    if (ioctl(fd, TIOCSSERIAL, &ser) < 0)
+        return -1;
+
+    return 0;
+}
+
+int serial_get_low_latency(int fd)
+{
+    struct serial_struct ser;
+
+    if (ioctl(fd, TIOCGSERIAL, &ser) < 0)
+        return -1;
+
+    return (ser.flags & ASYNC_LOW_LATENCY) ? 1 : 0;
+}
+
+
+// ------------------------------------------------------------------------------
+//   USB-Serial Latency Timer
+// ------------------------------------------------------------------------------
+
+//
+// serial_latency_timer_path
+//
+// /sys/bus/usb-serial/devices/<tty>/latency_timer of the device (the
+// port may be a symlink such as /dev/serial/by-id/...)
+//
+static int serial_latency_timer_path(const char* port, char* path, size_t size)
+{
+    char real[PATH_MAX];
+
+    if (realpath(port, real) == NULL)
+        return -1;
+
+    const char* tty = strrchr(real, '/');
+    tty = (tty != NULL) ? tty + 1 : real;
+
+    snprintf(path, size, "/sys/bus/usb-serial/devices/%s/latency_timer", tty);
+    return 0;
+}
+
+//
+// serial_set_latency_timer
+//
+// Writing the attribute needs root (or a udev rule): the failure is
+// not fatal, the effective value is reported anyway
+//
+int serial_set_latency_timer(const char* port, int ms)
+{
+    char path[PATH_MAX];
+
+    if (serial_latency_timer_path(port, path, sizeof(path)) < 0)
+        return -1;
+
+    FILE* f = fopen(path, "w");
+    if (f == NULL)
+        return -1;
+
+    int ret = (fprintf(f, "%d", ms) > 0) ? 0 : -1;
+    if (fclose(f) != 0)
+        ret = -1;
+
+    return ret;
+}
+
+int serial_get_latency_timer(const char* port)
+{
+    char path[PATH_MAX];
+    int ms = -1;
+
+    if (serial_latency_timer_path(port, path, sizeof(path)) < 0)
+        return -1;
+
+    FILE* f = fopen(path, "r");
+    if (f == NULL)
+        return -1;
+
+    if (fscanf(f, "%d", &ms) != 1)
+        ms = -1;
+    fclose(f);
+
+    return ms;
+}
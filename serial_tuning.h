@@ -0,0 +1,46 @@
+/**
+ * @file serial_tuning.h
+ *
+ * @brief Linux specific settings of the serial port
+ *
+ * Arbitrary baudrates (termios2 / BOTHER), ASYNC_LOW_LATENCY and the
+ * latency timer of the USB-serial adapters (FTDI & co.), which buffer
+ * the received bytes for up to 16 ms by default.
+ *
+ * termios2 lives in <asm/termbits.h>, which cannot be included together
+ * with <termios.h>: these functions are kept in their own translation
+ * unit and only take plain types.
+ *
+ */
+
+#ifndef SERIAL_TUNING_H_
+#define SERIAL_TUNING_H_
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// Latency timer requested to the USB-serial adapters (ms)
+#define SERIAL_LATENCY_TIMER_MS 1
+
+
+// ------------------------------------------------------------------------------
+//   Prototypes
+// ------------------------------------------------------------------------------
+
+// Set the same input and output baudrate, any value the UART supports
+int serial_set_baudrate(int fd, int baud);
+
+// Baudrates effectively applied by the driver
+int serial_get_baudrate(int fd, int* ispeed, int* ospeed);
+
+// Enable/read the ASYNC_LOW_LATENCY flag (1 = set, 0 = clear, -1 = n/a)
+int serial_set_low_latency(int fd);
+int serial_get_low_latency(int fd);
+
+// Latency timer of a USB-serial adapter (ms, -1 = not available)
+int serial_set_latency_timer(const char* port, int ms);
+int serial_get_latency_timer(const char* port);
+
+
+#endif // SERIAL_TUNING_H_
@@ -26,8 +26,8 @@ Sim_Interface::Sim_Interface():
     fdsW[0].events = POLLOUT;
 
     // Initialize Mutexes
-    pthread_mutex_init(&mut_act_controls,0);
-    pthread_mutex_init(&mut_sensors,0);
+    rt_mutex_init(&mut_act_controls);
+    rt_mutex_init(&mut_sensors);
 
     pthread_cond_init(&sim_contr_cond,0);
     ActUpdated = 0;
@@ -60,8 +60,8 @@ Sim_Interface::Sim_Interface(char* &ip, unsigned int r_port, unsigned int w_port
     fdsW[0].events = POLLOUT;
 
     // Initialize Mutexes
-    pthread_mutex_init(&mut_act_controls,0);
-    pthread_mutex_init(&mut_sensors,0);
+    rt_mutex_init(&mut_act_controls);
+    rt_mutex_init(&mut_sensors);
 
     ActUpdated = 0;
 
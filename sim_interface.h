@@ -9,6 +9,7 @@
  */
 
 #include "udp_port.h"
+#include "rt_setup.h"
 #include <time.h>
 #include <poll.h>
 
@@ -0,0 +1,74 @@
+/*
+ * file: task_monitor.cpp
+ *
+ * Live view of the timing statistics published by main_routing.
+ *
+ * usage: task_monitor [-p <period_ms>] [-n <iterations>]
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "task_stats.h"
+
+
+int main(int argc, char **argv)
+{
+    int period_ms = 1000;
+    int iterations = -1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-p") == 0 && argc > i + 1)
+            period_ms = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-n") == 0 && argc > i + 1)
+            iterations = atoi(argv[++i]);
+        else
+        {
+            printf("usage: task_monitor [-p <period_ms>] [-n <iterations>]\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    int fd = shm_open(TASK_STATS_SHM, O_RDONLY, 0);
+    if (fd < 0)
+    {
+        fprintf(stderr, "No statistics published (is main_routing running?)\n");
+        return EXIT_FAILURE;
+    }
+
+    void* addr = mmap(NULL, sizeof(Task_Stats_Page), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+    {
+        fprintf(stderr, "Could not map %s\n", TASK_STATS_SHM);
+        return EXIT_FAILURE;
+    }
+
+    const Task_Stats_Page* page = (const Task_Stats_Page*)addr;
+    if (page->magic != TASK_STATS_MAGIC)
+    {
+        fprintf(stderr, "Unknown format of %s\n", TASK_STATS_SHM);
+        return EXIT_FAILURE;
+    }
+
+    while (iterations != 0)
+    {
+        // Clear the terminal and print the current values
+        printf("\033[2J\033[H");
+        task_stats_dump_page(stdout, page);
+        fflush(stdout);
+
+        if (iterations > 0)
+            iterations--;
+        usleep(period_ms * 1000);
+    }
+
+    munmap(addr, sizeof(Task_Stats_Page));
+    return 0;
+}
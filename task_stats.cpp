@@ -0,0 +1,269 @@
+/**
+ * @file task_stats.cpp
+ *
+ * @brief Live timing statistics of the periodic tasks
+ *
+ * The nominal release of job k is t0 + k * period, where t0 is the
+ * start of the first job: this is the activation pattern followed by
+ * ptask_wait_for_period().
+ *
+ */
+
+
+// ------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------
+
+#include "task_stats.h"
+#include "time_utils.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+
+// Shared page with the records
+static Task_Stats_Page* page = NULL;
+static bool page_shared = false;
+
+// Private state of each task (not exported)
+struct Task_Timeline {
+    uint64_t t0;
+    uint64_t job_start;
+};
+static Task_Timeline timeline[TASK_STATS_MAX_TASKS];
+
+
+// ------------------------------------------------------------------------
+//   Segment Management
+// ------------------------------------------------------------------------
+
+//
+// task_stats_open
+//
+int task_stats_open()
+{
+    if (page != NULL)
+        return 0;
+
+    int fd = shm_open(TASK_STATS_SHM, O_CREAT | O_RDWR, 0644);
+    if (fd >= 0 && ftruncate(fd, sizeof(Task_Stats_Page)) == 0)
+    {
+        void* addr = mmap(NULL, sizeof(Task_Stats_Page), PROT_READ | PROT_WRITE,
+                MAP_SHARED, fd, 0);
+        if (addr != MAP_FAILED)
+        {
+            page = (Task_Stats_Page*)addr;
+            page_shared = true;
+        }
+    }
+    if (fd >= 0)
+        close(fd);
+
+    // The statistics are kept anyway, only the live view is lost
+    if (page == NULL)
+    {
+        fprintf(stderr, "WARNING: task statistics not shared (%s)\n", TASK_STATS_SHM);
+        page = (Task_Stats_Page*)malloc(sizeof(Task_Stats_Page));
+        if (page == NULL)
+            return -1;
+    }
+
+    memset(page, 0, sizeof(Task_Stats_Page));
+    memset(timeline, 0, sizeof(timeline));
+    page->magic = TASK_STATS_MAGIC;
+
+    return 0;
+}
+
+//
+// task_stats_close
+//
+void task_stats_close()
+{
+    if (page == NULL)
+        return;
+
+    if (page_shared)
+    {
+        munmap(page, sizeof(Task_Stats_Page));
+        shm_unlink(TASK_STATS_SHM);
+    }
+    else
+        free(page);
+
+    page = NULL;
+}
+
+//
+// task_stats_register
+//
+int task_stats_register(const char* name, long period_us, long deadline_us)
+{
+    if (page == NULL || page->ntasks >= TASK_STATS_MAX_TASKS)
+        return -1;
+
+    int idx = page->ntasks;
+    Task_Stats* ts = &page->task[idx];
+
+    strncpy(ts->name, name, TASK_STATS_NAME_LEN - 1);
+    ts->period_ns = (uint64_t)period_us * 1000;
+    ts->deadline_ns = (uint64_t)deadline_us * 1000;
+
+    __atomic_store_n(&page->ntasks, idx + 1, __ATOMIC_RELEASE);
+    return idx;
+}
+
+
+// ------------------------------------------------------------------------
+//   Job Boundaries
+// ------------------------------------------------------------------------
+
+//
+// task_stats_job_start
+//
+void task_stats_job_start(int idx)
+{
+    if (idx < 0 || page == NULL)
+        return;
+
+    timeline[idx].job_start = time_monotonic_ns();
+}
+
+//
+// task_stats_job_end
+//
+// Update the record of the task. The record is protected by a sequence
+// counter, so readers never block the task.
+//
+void task_stats_job_end(int idx)
+{
+    if (idx < 0 || page == NULL)
+        return;
+
+    uint64_t end = time_monotonic_ns();
+    Task_Timeline* tl = &timeline[idx];
+    Task_Stats* ts = &page->task[idx];
+
+    uint32_t seq = ts->seq;
+    __atomic_store_n(&ts->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    if (ts->jobs == 0)
+        tl->t0 = tl->job_start;
+
+    uint64_t release = tl->t0 + ts->jobs * ts->period_ns;
+    uint64_t jitter = (tl->job_start > release) ? tl->job_start - release : 0;
+    uint64_t exec = end - tl->job_start;
+    uint64_t resp = (end > release) ? end - release : 0;
+
+    ts->jobs++;
+
+    ts->last_exec_ns = exec;
+    ts->sum_exec_ns += exec;
+    if (exec > ts->wcet_ns)
+        ts->wcet_ns = exec;
+
+    ts->last_resp_ns = resp;
+    ts->sum_resp_ns += resp;
+    if (resp > ts->max_resp_ns)
+        ts->max_resp_ns = resp;
+
+    if (jitter > ts->max_jitter_ns)
+        ts->max_jitter_ns = jitter;
+    uint64_t bin = jitter / TASK_STATS_JITTER_BIN_NS;
+    if (bin >= TASK_STATS_JITTER_BINS)
+        bin = TASK_STATS_JITTER_BINS - 1;
+    ts->jitter_hist[bin]++;
+
+    if (resp > ts->deadline_ns)
+    {
+        ts->deadline_miss++;
+        ts->overrun_streak++;
+        if (ts->overrun_streak > ts->max_overrun_streak)
+            ts->max_overrun_streak = ts->overrun_streak;
+    }
+    else
+        ts->overrun_streak = 0;
+
+    __atomic_store_n(&ts->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+
+// ------------------------------------------------------------------------
+//   Readers
+// ------------------------------------------------------------------------
+
+//
+// task_stats_read
+//
+void task_stats_read(const Task_Stats* src, Task_Stats* dst)
+{
+    uint32_t s1, s2;
+    do
+    {
+        s1 = __atomic_load_n(&src->seq, __ATOMIC_ACQUIRE);
+        memcpy(dst, src, sizeof(Task_Stats));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        s2 = __atomic_load_n(&src->seq, __ATOMIC_RELAXED);
+    } while ((s1 & 1) || s1 != s2);
+}
+
+//
+// task_stats_dump_page
+//
+void task_stats_dump_page(FILE* f, const Task_Stats_Page* pg)
+{
+    uint32_t n = __atomic_load_n(&pg->ntasks, __ATOMIC_ACQUIRE);
+
+    fprintf(f, "%-10s %10s %8s %7s %9s %9s %9s %9s %9s\n", "TASK", "JOBS", "MISS",
+            "STREAK", "ACET[us]", "WCET[us]", "AVGR[us]", "MAXR[us]", "MAXJ[us]");
+
+    for (uint32_t i = 0; i < n && i < TASK_STATS_MAX_TASKS; i++)
+    {
+        Task_Stats ts;
+        task_stats_read(&pg->task[i], &ts);
+        uint64_t jobs = ts.jobs ? ts.jobs : 1;
+
+        fprintf(f, "%-10s %10lu %8lu %7u %9.1f %9.1f %9.1f %9.1f %9.1f\n", ts.name,
+                (unsigned long)ts.jobs, (unsigned long)ts.deadline_miss,
+                ts.max_overrun_streak,
+                ts.sum_exec_ns / 1000.0 / jobs, ts.wcet_ns / 1000.0,
+                ts.sum_resp_ns / 1000.0 / jobs, ts.max_resp_ns / 1000.0,
+                ts.max_jitter_ns / 1000.0);
+    }
+
+    // Jitter histograms (only the non empty bins)
+    for (uint32_t i = 0; i < n && i < TASK_STATS_MAX_TASKS; i++)
+    {
+        Task_Stats ts;
+        task_stats_read(&pg->task[i], &ts);
+
+        fprintf(f, "%s jitter:", ts.name);
+        for (int b = 0; b < TASK_STATS_JITTER_BINS; b++)
+        {
+            if (ts.jitter_hist[b] == 0)
+                continue;
+            if (b == TASK_STATS_JITTER_BINS - 1)
+                fprintf(f, " >=%dus:%lu", b * TASK_STATS_JITTER_BIN_NS / 1000,
+                        (unsigned long)ts.jitter_hist[b]);
+            else
+                fprintf(f, " <%dus:%lu", (b + 1) * TASK_STATS_JITTER_BIN_NS / 1000,
+                        (unsigned long)ts.jitter_hist[b]);
+        }
+        fprintf(f, "\n");
+    }
+}
+
+//
+// task_stats_dump
+//
+void task_stats_dump(FILE* f)
+{
+    if (page == NULL)
+        return;
+
+    task_stats_dump_page(f, page);
+}
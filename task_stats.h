@@ -0,0 +1,107 @@
+/**
+ * @file task_stats.h
+ *
+ * @brief Live timing statistics of the periodic tasks
+ *
+ * Each task updates its own record at the end of every job (single
+ * writer, no locks). The records live in a shared memory segment, so
+ * that an external monitor can follow the schedulability of the tasks
+ * during a HIL run.
+ *
+ */
+
+#ifndef TASK_STATS_H_
+#define TASK_STATS_H_
+
+// ------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdint.h>
+
+// ------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------
+
+#define TASK_STATS_SHM          "/uav_fw_task_stats"
+#define TASK_STATS_MAGIC        0x54535431  // "TST1"
+
+#define TASK_STATS_MAX_TASKS    8
+#define TASK_STATS_NAME_LEN     16
+
+// Activation jitter histogram: 10 us bins, the last bin collects
+// everything above (TASK_STATS_JITTER_BINS - 1) * 10 us
+#define TASK_STATS_JITTER_BINS  32
+#define TASK_STATS_JITTER_BIN_NS 10000
+
+
+// ------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------
+// Statistics of a single task
+struct Task_Stats {
+
+    char name[TASK_STATS_NAME_LEN];
+
+    // Sequence counter (odd while the record is being updated)
+    uint32_t seq;
+
+    uint64_t period_ns;
+    uint64_t deadline_ns;
+
+    // Jobs and deadline misses
+    uint64_t jobs;
+    uint64_t deadline_miss;
+    uint32_t overrun_streak;
+    uint32_t max_overrun_streak;
+
+    // Execution time (start of the job -> end of the job)
+    uint64_t last_exec_ns;
+    uint64_t wcet_ns;
+    uint64_t sum_exec_ns;
+
+    // Response time (nominal release -> end of the job)
+    uint64_t last_resp_ns;
+    uint64_t max_resp_ns;
+    uint64_t sum_resp_ns;
+
+    // Activation jitter (nominal release -> start of the job)
+    uint64_t max_jitter_ns;
+    uint64_t jitter_hist[TASK_STATS_JITTER_BINS];
+};
+
+// Content of the shared memory segment
+struct Task_Stats_Page {
+
+    uint32_t magic;
+    uint32_t ntasks;
+
+    Task_Stats task[TASK_STATS_MAX_TASKS];
+};
+
+
+// ------------------------------------------------------------------------
+//   Prototypes
+// ------------------------------------------------------------------------
+
+// Create the shared memory segment (falls back to private memory)
+int task_stats_open();
+void task_stats_close();
+
+// Register a periodic task, returns the index of its record
+int task_stats_register(const char* name, long period_us, long deadline_us);
+
+// Job boundaries, called by the task itself
+void task_stats_job_start(int idx);
+void task_stats_job_end(int idx);
+
+// Consistent copy of a record (safe from any thread/process)
+void task_stats_read(const Task_Stats* src, Task_Stats* dst);
+
+// Print the statistics of all the tasks
+void task_stats_dump(FILE* f);
+void task_stats_dump_page(FILE* f, const Task_Stats_Page* page);
+
+
+#endif // TASK_STATS_H_
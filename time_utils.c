@@ -46,3 +46,21 @@ int timespec_sub(struct timespec *d, struct timespec *a, struct timespec *b)
     }
     return 1;
 }
+
+static uint64_t virtual_ns = 0;
+
+void time_set_virtual_ns(uint64_t ns)
+{
+    __atomic_store_n(&virtual_ns, ns, __ATOMIC_RELEASE);
+}
+
+uint64_t time_monotonic_ns(void)
+{
+    uint64_t v = __atomic_load_n(&virtual_ns, __ATOMIC_ACQUIRE);
+    if (v != 0)
+        return v;
+
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000ULL + (uint64_t)t.tv_nsec;
+}
@@ -2,10 +2,15 @@
 #define __TIMEUTILS_H__
 
 #include <time.h>
+#include <stdint.h>
 
 void timespec_add(struct timespec *ta, struct timespec *tb);
 void timespec_add_us(struct timespec *t, long us);
 int timespec_cmp(struct timespec *a, struct timespec *b);
 int timespec_sub(struct timespec *d, struct timespec *a, struct timespec *b);
+uint64_t time_monotonic_ns(void);
+
+// Replay: time_monotonic_ns() returns ns from now on (0 = real clock)
+void time_set_virtual_ns(uint64_t ns);
 
 #endif 
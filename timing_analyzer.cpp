@@ -0,0 +1,529 @@
+/*
+ * file: timing_analyzer.cpp
+ *
+ * Statistics of the periods of the timing logs written by main_routing
+ * (Times_*.txt: one time in us per line) and of the frames of the
+ * recordings of the flight recorder, in a single pass and with bounded
+ * memory.
+ *
+ * usage: timing_analyzer [-period <us>] [-deadline <us>] [-bin <us>]
+ *                        [-threads <n>] [-msgid <id>] [-hist <prefix>]
+ *                        <file.txt | rec:<prefix>> ...
+ *
+ *   -period      nominal period (default 4000 us, the period of the tasks)
+ *   -deadline    a period longer than this is a deadline violation
+ *                (default 1.5 periods: an activation has been missed)
+ *   -bin         width of the bins of the histograms (default 10 us)
+ *   -threads     worker threads (default: online CPUs)
+ *   -msgid       recordings: only the frames of this msgid
+ *   -hist        histograms saved as <prefix>_<stream>.csv
+ *
+ * A recording gives one stream per link, direction and msgid. Large text
+ * logs are split in chunks analyzed in parallel; the statistics of the
+ * chunks are merged in order.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "frec_reader.h"
+#include "time_utils.h"
+
+
+// Bins of a histogram, the last one takes everything above
+#define TA_BINS         4096
+
+// Bytes of text analyzed by a work item
+#define TA_CHUNK_BYTES  (16UL << 20)
+
+
+// ------------------------------------------------------------------------
+//   Statistics of a stream
+// ------------------------------------------------------------------------
+struct Timing_Stats {
+
+    uint64_t n;
+    double mean;
+    double m2;                  // Sum of the squared deviations (Welford)
+    double min;
+    double max;
+    uint64_t misses;
+    uint64_t hist[TA_BINS + 1];
+};
+
+// Settings, read only for the workers
+static double period_us = 4000;
+static double deadline_us = 0;
+static double bin_us = 10;
+static int64_t msgid = -1;
+
+static void stats_init(Timing_Stats* s)
+{
+    memset(s, 0, sizeof(*s));
+}
+
+static inline void stats_add(Timing_Stats* s, double dt)
+{
+    s->n++;
+    double d = dt - s->mean;
+    s->mean += d / s->n;
+    s->m2 += d * (dt - s->mean);
+
+    if (s->n == 1 || dt < s->min)
+        s->min = dt;
+    if (s->n == 1 || dt > s->max)
+        s->max = dt;
+    if (dt > deadline_us)
+        s->misses++;
+
+    long b = (dt > 0) ? (long)(dt / bin_us) : 0;
+    s->hist[(b < TA_BINS) ? b : TA_BINS]++;
+}
+
+//
+// stats_merge
+//
+// Chan et al. combination of the mean and of the squared deviations
+//
+static void stats_merge(Timing_Stats* a, const Timing_Stats* b)
+{
+    if (b->n == 0)
+        return;
+    if (a->n == 0)
+    {
+        *a = *b;
+        return;
+    }
+
+    uint64_t n = a->n + b->n;
+    double d = b->mean - a->mean;
+    a->m2 += b->m2 + d * d * a->n * b->n / n;
+    a->mean += d * b->n / n;
+    a->n = n;
+    if (b->min < a->min)
+        a->min = b->min;
+    if (b->max > a->max)
+        a->max = b->max;
+    a->misses += b->misses;
+    for (int i = 0; i <= TA_BINS; i++)
+        a->hist[i] += b->hist[i];
+}
+
+//
+// stats_percentile
+//
+// Upper edge of the bin holding the percentile (the maximum for the last
+// bin)
+//
+static double stats_percentile(const Timing_Stats* s, double p)
+{
+    uint64_t rank = (uint64_t)ceil(p / 100.0 * s->n);
+    uint64_t seen = 0;
+    for (int i = 0; i < TA_BINS; i++)
+    {
+        seen += s->hist[i];
+        if (seen >= rank && seen > 0)
+            return ((i + 1) * bin_us < s->max) ? (i + 1) * bin_us : s->max;
+    }
+    return s->max;
+}
+
+
+// ------------------------------------------------------------------------
+//   Work items
+// ------------------------------------------------------------------------
+// Chunk of a text log: statistics of the periods inside it, plus its
+// first and last times to join it to the neighbours
+struct Text_Chunk {
+
+    const char* data;
+    size_t begin;
+    size_t end;
+    size_t size;
+
+    Timing_Stats* stats;
+    bool any;
+    double first;
+    double last;
+};
+
+struct Stream {
+
+    std::string name;
+    Timing_Stats* stats;
+};
+
+// Input: a text log (chunks) or a recording (streams)
+struct Input {
+
+    const char* name;
+    bool recording;
+
+    const char* data;
+    size_t size;
+    std::vector<Text_Chunk> chunks;
+
+    std::vector<Stream> streams;
+    int failed;
+};
+
+struct Work {
+
+    Input* input;
+    int chunk;                  // -1 = the whole recording
+};
+
+static std::vector<Work> work;
+static int next_work = 0;
+
+
+//
+// parse_chunk
+//
+// Lines starting in [begin, end): the line cut by begin belongs to the
+// previous chunk
+//
+static void parse_chunk(Text_Chunk* c)
+{
+    const char* p = c->data + c->begin;
+    const char* end = c->data + c->end;
+    const char* limit = c->data + c->size;
+
+    if (c->begin > 0 && p[-1] != '\n')
+    {
+        while (p < end && *p != '\n')
+            p++;
+        p++;
+    }
+
+    c->any = false;
+    while (p < end)
+    {
+        // One unsigned integer per line, anything else is skipped
+        while (p < limit && (*p == ' ' || *p == '\t'))
+            p++;
+        bool digits = false;
+        double v = 0;
+        while (p < limit && *p >= '0' && *p <= '9')
+        {
+            v = v * 10 + (*p - '0');
+            digits = true;
+            p++;
+        }
+        while (p < limit && *p != '\n')
+            p++;
+        p++;
+
+        if (!digits)
+            continue;
+        if (c->any)
+            stats_add(c->stats, v - c->last);
+        else
+            c->first = v;
+        c->any = true;
+        c->last = v;
+    }
+}
+
+//
+// analyze_recording
+//
+static void analyze_recording(Input* in)
+{
+    Frec_Reader reader;
+    if (reader.open(in->name) < 0)
+    {
+        in->failed = 1;
+        return;
+    }
+    if (msgid >= 0)
+        reader.select_msgid(msgid);
+
+    // Last time of each stream, by link, direction and msgid
+    std::map<uint64_t, std::pair<size_t, uint64_t> > last;
+
+    Frec_Frame f;
+    while (reader.next(&f))
+    {
+        uint64_t key = ((uint64_t)f.link << 33) | ((uint64_t)f.dir << 32) | f.msgid;
+        std::map<uint64_t, std::pair<size_t, uint64_t> >::iterator it = last.find(key);
+        if (it == last.end())
+        {
+            char name[64];
+            snprintf(name, sizeof(name), "%s_%s_%u", f.link == FREC_LINK_AUTOPILOT ? "ap" : "gs",
+                    f.dir == FREC_DIR_RX ? "rx" : "tx", f.msgid);
+            Stream s;
+            s.name = name;
+            s.stats = new Timing_Stats;
+            stats_init(s.stats);
+            in->streams.push_back(s);
+            last[key] = std::make_pair(in->streams.size() - 1, f.mono_ns);
+            continue;
+        }
+
+        stats_add(in->streams[it->second.first].stats,
+                ((int64_t)f.mono_ns - (int64_t)it->second.second) / 1000.0);
+        it->second.second = f.mono_ns;
+    }
+}
+
+static void* worker(void* arg)
+{
+    for (;;)
+    {
+        int i = __atomic_fetch_add(&next_work, 1, __ATOMIC_RELAXED);
+        if (i >= (int)work.size())
+            return NULL;
+
+        if (work[i].chunk < 0)
+            analyze_recording(work[i].input);
+        else
+            parse_chunk(&work[i].input->chunks[work[i].chunk]);
+    }
+}
+
+
+// ------------------------------------------------------------------------
+//   Inputs
+// ------------------------------------------------------------------------
+static int open_text(Input* in)
+{
+    int fd = open(in->name, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Could not open %s\n", in->name);
+        return -1;
+    }
+
+    struct stat st;
+    fstat(fd, &st);
+    in->size = st.st_size;
+    in->data = NULL;
+    if (in->size > 0)
+    {
+        void* p = mmap(NULL, in->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED)
+        {
+            fprintf(stderr, "Could not map %s\n", in->name);
+            close(fd);
+            return -1;
+        }
+        madvise(p, in->size, MADV_SEQUENTIAL);
+        in->data = (const char*)p;
+    }
+    close(fd);
+
+    for (size_t b = 0; b < in->size; b += TA_CHUNK_BYTES)
+    {
+        Text_Chunk c;
+        c.data = in->data;
+        c.begin = b;
+        c.end = (b + TA_CHUNK_BYTES < in->size) ? b + TA_CHUNK_BYTES : in->size;
+        c.size = in->size;
+        c.stats = new Timing_Stats;
+        stats_init(c.stats);
+        in->chunks.push_back(c);
+    }
+    return 0;
+}
+
+//
+// join_chunks
+//
+// Statistics of the whole log: the chunks in order, with the periods
+// across their boundaries
+//
+static void join_chunks(Input* in)
+{
+    Stream s;
+    const char* base = strrchr(in->name, '/');
+    s.name = base ? base + 1 : in->name;
+    size_t dot = s.name.rfind('.');
+    if (dot != std::string::npos && dot > 0)
+        s.name.erase(dot);
+    s.stats = new Timing_Stats;
+    stats_init(s.stats);
+
+    bool any = false;
+    double last = 0;
+    for (size_t i = 0; i < in->chunks.size(); i++)
+    {
+        Text_Chunk* c = &in->chunks[i];
+        if (!c->any)
+            continue;
+        if (any)
+            stats_add(s.stats, c->first - last);
+        stats_merge(s.stats, c->stats);
+        any = true;
+        last = c->last;
+        delete c->stats;
+    }
+    in->streams.push_back(s);
+
+    if (in->data != NULL)
+        munmap((void*)in->data, in->size);
+}
+
+
+// ------------------------------------------------------------------------
+//   Output
+// ------------------------------------------------------------------------
+static void report(const Stream* s)
+{
+    const Timing_Stats* t = s->stats;
+    if (t->n == 0)
+    {
+        printf("%-24s %9s\n", s->name.c_str(), "0");
+        return;
+    }
+
+    printf("%-24s %9lu %9.1f %8.1f %8.1f %9.1f %8.1f %8.1f %8.1f %8.1f %8lu\n", s->name.c_str(),
+            (unsigned long)t->n, t->mean, t->n > 1 ? sqrt(t->m2 / (t->n - 1)) : 0.0, t->min,
+            t->max, stats_percentile(t, 50), stats_percentile(t, 90), stats_percentile(t, 99),
+            stats_percentile(t, 99.9), (unsigned long)t->misses);
+}
+
+static void save_histogram(const char* prefix, const Stream* s)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s_%s.csv", prefix, s->name.c_str());
+    FILE* f = fopen(path, "w");
+    if (f == NULL)
+    {
+        fprintf(stderr, "Could not create %s\n", path);
+        return;
+    }
+
+    fprintf(f, "bin_us,count\n");
+    for (int i = 0; i < TA_BINS; i++)
+    {
+        if (s->stats->hist[i] > 0)
+            fprintf(f, "%g,%lu\n", i * bin_us, (unsigned long)s->stats->hist[i]);
+    }
+    if (s->stats->hist[TA_BINS] > 0)
+        fprintf(f, "%g,%lu\n", TA_BINS * bin_us, (unsigned long)s->stats->hist[TA_BINS]);
+    fclose(f);
+}
+
+
+int main(int argc, char **argv)
+{
+    const char* usage = "usage: timing_analyzer [-period <us>] [-deadline <us>] [-bin <us>] "
+            "[-threads <n>] [-msgid <id>] [-hist <prefix>] <file.txt | rec:<prefix>> ...";
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    const char* hist_prefix = NULL;
+    std::vector<Input> inputs;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-period") == 0 && argc > i + 1)
+            period_us = atof(argv[++i]);
+        else if (strcmp(argv[i], "-deadline") == 0 && argc > i + 1)
+            deadline_us = atof(argv[++i]);
+        else if (strcmp(argv[i], "-bin") == 0 && argc > i + 1)
+            bin_us = atof(argv[++i]);
+        else if (strcmp(argv[i], "-threads") == 0 && argc > i + 1)
+            threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-msgid") == 0 && argc > i + 1)
+            msgid = atol(argv[++i]);
+        else if (strcmp(argv[i], "-hist") == 0 && argc > i + 1)
+            hist_prefix = argv[++i];
+        else if (argv[i][0] != '-')
+        {
+            Input in;
+            in.recording = strncmp(argv[i], "rec:", 4) == 0;
+            in.name = in.recording ? argv[i] + 4 : argv[i];
+            in.data = NULL;
+            in.size = 0;
+            in.failed = 0;
+            inputs.push_back(in);
+        }
+        else
+        {
+            printf("%s\n", usage);
+            return EXIT_FAILURE;
+        }
+    }
+    if (inputs.empty() || bin_us <= 0 || period_us <= 0)
+    {
+        printf("%s\n", usage);
+        return EXIT_FAILURE;
+    }
+    if (deadline_us <= 0)
+        deadline_us = 1.5 * period_us;
+    if (threads < 1)
+        threads = 1;
+
+    uint64_t t0 = time_monotonic_ns();
+
+    for (size_t i = 0; i < inputs.size(); i++)
+    {
+        Work w;
+        w.input = &inputs[i];
+        if (inputs[i].recording)
+        {
+            w.chunk = -1;
+            work.push_back(w);
+            continue;
+        }
+        if (open_text(&inputs[i]) < 0)
+        {
+            inputs[i].failed = 1;
+            continue;
+        }
+        for (size_t c = 0; c < inputs[i].chunks.size(); c++)
+        {
+            w.chunk = c;
+            work.push_back(w);
+        }
+    }
+
+    if (threads > (int)work.size())
+        threads = work.size();
+    std::vector<pthread_t> tid(threads);
+    for (int i = 1; i < threads; i++)
+        pthread_create(&tid[i], NULL, worker, NULL);
+    worker(NULL);
+    for (int i = 1; i < threads; i++)
+        pthread_join(tid[i], NULL);
+
+    printf("Periods in us (deadline %.1f us)\n", deadline_us);
+    printf("%-24s %9s %9s %8s %8s %9s %8s %8s %8s %8s %8s\n", "STREAM", "N", "MEAN", "STD",
+            "MIN", "MAX", "P50", "P90", "P99", "P99.9", "MISSES");
+
+    int failed = 0;
+    for (size_t i = 0; i < inputs.size(); i++)
+    {
+        Input* in = &inputs[i];
+        if (in->failed)
+        {
+            failed++;
+            continue;
+        }
+        if (!in->recording)
+            join_chunks(in);
+
+        for (size_t j = 0; j < in->streams.size(); j++)
+        {
+            report(&in->streams[j]);
+            if (hist_prefix != NULL)
+                save_histogram(hist_prefix, &in->streams[j]);
+            delete in->streams[j].stats;
+        }
+    }
+
+    fprintf(stderr, "%lu inputs analyzed in %.3f s with %d threads\n",
+            (unsigned long)(inputs.size() - failed), (time_monotonic_ns() - t0) / 1e9, threads);
+    return failed ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,235 @@
+/*
+ * file: uav_top.cpp
+ *
+ * Live view of the metrics published by main_routing: messages/s and
+ * bytes/s per link and msgid, depth of the queues, step time of the
+ * simulator and timing of the tasks (deadline misses).
+ *
+ * usage: uav_top [-p <period_ms>] [-n <iterations>] [-top <msgids>]
+ *        uav_top -q <command> [-s <socket>]
+ *
+ *   -q   one command sent to the query socket of the router
+ *        (-metrics_socket), reply printed as it is
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <vector>
+#include <algorithm>
+
+#include "metrics.h"
+#include "task_stats.h"
+#include "time_utils.h"
+
+
+static const char* usage = "usage: uav_top [-p <period_ms>] [-n <iterations>] [-top <msgids>]\n"
+        "       uav_top -q <command> [-s <socket>]";
+
+// Rate of a msgid between two copies of the page
+struct Msg_Rate {
+
+    const char* link;
+    int dir;
+    int msgid;
+    double frames;
+    double bytes;
+
+    bool operator<(const Msg_Rate& o) const { return frames > o.frames; }
+};
+
+static Metrics_Page prev;
+static Metrics_Page cur;
+
+//
+// query
+//
+// Command to the query socket, reply on stdout
+//
+static int query(const char* path, const char* cmd)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+    {
+        fprintf(stderr, "Could not connect to %s (is main_routing running with "
+                "-metrics_socket?)\n", path);
+        return EXIT_FAILURE;
+    }
+
+    char line[128];
+    int len = snprintf(line, sizeof(line), "%s\n", cmd);
+    if (write(fd, line, len) != len)
+    {
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        fwrite(buf, 1, n, stdout);
+    close(fd);
+    return 0;
+}
+
+//
+// show
+//
+static void show(const Task_Stats_Page* tasks, double dt_s, unsigned top)
+{
+    printf("uav_top - main_routing pid %u, up %.0f s\n\n", cur.pid,
+            (time_monotonic_ns() - cur.start_ns) / 1e9);
+
+    printf("%-6s %3s %10s %12s %14s %16s\n", "LINK", "DIR", "MSG/S", "BYTES/S", "FRAMES",
+            "BYTES");
+    std::vector<Msg_Rate> rates;
+    for (uint32_t i = 0; i < cur.nlinks && i < METRICS_MAX_LINKS; i++)
+    {
+        const Metrics_Link* c = &cur.link[i];
+        const Metrics_Link* p = &prev.link[i];
+        for (int dir = 0; dir < 2; dir++)
+        {
+            printf("%-6s %3s %10.1f %12.1f %14lu %16lu\n", c->name,
+                    dir == METRICS_DIR_RX ? "rx" : "tx",
+                    (c->total[dir].frames - p->total[dir].frames) / dt_s,
+                    (c->total[dir].bytes - p->total[dir].bytes) / dt_s,
+                    (unsigned long)c->total[dir].frames, (unsigned long)c->total[dir].bytes);
+
+            for (int m = 0; m < METRICS_MSGIDS; m++)
+            {
+                uint64_t frames = c->msg[dir][m].frames - p->msg[dir][m].frames;
+                if (frames == 0)
+                    continue;
+                Msg_Rate r;
+                r.link = c->name;
+                r.dir = dir;
+                r.msgid = m;
+                r.frames = frames / dt_s;
+                r.bytes = (c->msg[dir][m].bytes - p->msg[dir][m].bytes) / dt_s;
+                rates.push_back(r);
+            }
+        }
+    }
+
+    std::sort(rates.begin(), rates.end());
+    printf("\n%-6s %3s %6s %10s %12s\n", "LINK", "DIR", "MSGID", "MSG/S", "BYTES/S");
+    for (size_t i = 0; i < rates.size() && i < top; i++)
+    {
+        printf("%-6s %3s %6d %10.1f %12.1f\n", rates[i].link,
+                rates[i].dir == METRICS_DIR_RX ? "rx" : "tx", rates[i].msgid,
+                rates[i].frames, rates[i].bytes);
+    }
+
+    printf("\n%-24s %12s %12s %12s\n", "GAUGE", "VALUE", "MEAN", "MAX");
+    for (uint32_t i = 0; i < cur.ngauges && i < METRICS_MAX_GAUGES; i++)
+    {
+        const Metrics_Gauge* g = &cur.gauge[i];
+        printf("%-24s %12lu %12.1f %12lu\n", g->name, (unsigned long)g->value,
+                g->samples ? (double)g->sum / g->samples : 0.0, (unsigned long)g->max);
+    }
+
+    if (tasks != NULL && tasks->magic == TASK_STATS_MAGIC)
+    {
+        printf("\n");
+        task_stats_dump_page(stdout, tasks);
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    int period_ms = 1000;
+    int iterations = -1;
+    unsigned top = 10;
+    const char* cmd = NULL;
+    const char* path = METRICS_SOCKET;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-p") == 0 && argc > i + 1 && atoi(argv[i + 1]) > 0)
+            period_ms = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-n") == 0 && argc > i + 1)
+            iterations = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-top") == 0 && argc > i + 1)
+            top = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-q") == 0 && argc > i + 1)
+            cmd = argv[++i];
+        else if (strcmp(argv[i], "-s") == 0 && argc > i + 1)
+            path = argv[++i];
+        else
+        {
+            printf("%s\n", usage);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (cmd != NULL)
+        return query(path, cmd);
+
+    int fd = shm_open(METRICS_SHM, O_RDONLY, 0);
+    if (fd < 0)
+    {
+        fprintf(stderr, "No metrics published (is main_routing running?)\n");
+        return EXIT_FAILURE;
+    }
+
+    void* addr = mmap(NULL, sizeof(Metrics_Page), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+    {
+        fprintf(stderr, "Could not map %s\n", METRICS_SHM);
+        return EXIT_FAILURE;
+    }
+
+    const Metrics_Page* page = (const Metrics_Page*)addr;
+    if (page->magic != METRICS_MAGIC)
+    {
+        fprintf(stderr, "Unknown format of %s\n", METRICS_SHM);
+        return EXIT_FAILURE;
+    }
+
+    // Timing of the tasks, if published
+    const Task_Stats_Page* tasks = NULL;
+    fd = shm_open(TASK_STATS_SHM, O_RDONLY, 0);
+    if (fd >= 0)
+    {
+        addr = mmap(NULL, sizeof(Task_Stats_Page), PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (addr != MAP_FAILED)
+            tasks = (const Task_Stats_Page*)addr;
+    }
+
+    metrics_read(page, &prev);
+    uint64_t prev_ns = time_monotonic_ns();
+
+    while (iterations != 0)
+    {
+        usleep(period_ms * 1000);
+
+        metrics_read(page, &cur);
+        uint64_t now_ns = time_monotonic_ns();
+
+        // Clear the terminal and print the current values
+        printf("\033[2J\033[H");
+        show(tasks, (now_ns - prev_ns) / 1e9, top);
+        fflush(stdout);
+
+        prev = cur;
+        prev_ns = now_ns;
+        if (iterations > 0)
+            iterations--;
+    }
+
+    return 0;
+}
@@ -26,6 +26,7 @@
 #include <time.h>
 #include <sys/time.h>
 
+#include "mav_crc.h"
 #include <common/mavlink.h>
 
 